@@ -0,0 +1,481 @@
+// Hot-path SQLite operations against temporary database files:
+// saveMessage (autocommit vs. the writer's batched transactions, with and
+// without the search index; a connection opened per message, as handlers
+// did before the server kept one), getMessages pages at several table sizes,
+// searchMessages, userExists hits/misses, and the v5 -> v6 schema migration
+// (time and on-disk size per row, search index backfill).
+#include "../include/Database.h"
+#include <benchmark/benchmark.h>
+#include <sqlite3.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace {
+
+constexpr int kConversations = 64;
+constexpr int kPopulateBatch = 1000;
+// PersistenceQueue::Options::searchIndexBatch
+constexpr int kSearchIndexBatch = 2000;
+
+// A database file under the system temp directory, removed with its WAL files.
+class TempDatabase {
+public:
+    // open = false: only the path, for a file built by other means first
+    explicit TempDatabase(bool open = true) {
+        static std::atomic<int> counter{0};
+        m_path = (std::filesystem::temp_directory_path() /
+                  ("connect_bench_" + std::to_string(counter++) + ".db")).string();
+        remove();
+        if (open) {
+            this->open();
+        }
+    }
+
+    ~TempDatabase() {
+        m_db.reset();
+        remove();
+    }
+
+    TempDatabase(const TempDatabase&) = delete;
+    TempDatabase& operator=(const TempDatabase&) = delete;
+
+    Database& db() { return *m_db; }
+    const std::string& path() const { return m_path; }
+
+    Database& open() {
+        m_db = std::make_unique<Database>(m_path);
+        m_db->initialize();
+        return *m_db;
+    }
+
+private:
+    void remove() {
+        std::error_code ec;
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::filesystem::remove(m_path + suffix, ec);
+        }
+    }
+
+    std::string m_path;
+    std::unique_ptr<Database> m_db;
+};
+
+std::string userName(int i) {
+    return "user" + std::to_string(i);
+}
+
+// Messages spread over kConversations conversations of user0 with user1..N,
+// inserted in batches like the persistence writer does.
+void populateMessages(Database& db, int rows) {
+    for (int i = 0; i < rows; i += kPopulateBatch) {
+        db.beginTransaction();
+        for (int j = i; j < std::min(rows, i + kPopulateBatch); ++j) {
+            db.saveMessage(userName(0), userName(1 + j % kConversations),
+                           "Message " + std::to_string(j) + ": are we still meeting later today?");
+        }
+        db.commitTransaction();
+    }
+}
+
+void populateUsers(Database& db, int users) {
+    db.beginTransaction();
+    for (int i = 0; i < users; ++i) {
+        db.ensureUser(userName(i));
+    }
+    db.commitTransaction();
+}
+
+// Populating 100k rows takes seconds; fixtures are built once per size and
+// shared by every run of that size.
+TempDatabase& messagesFixture(int rows) {
+    static std::map<int, std::unique_ptr<TempDatabase>> fixtures;
+    auto& fixture = fixtures[rows];
+    if (!fixture) {
+        fixture = std::make_unique<TempDatabase>();
+        populateMessages(fixture->db(), rows);
+        while (fixture->db().indexMessages(kSearchIndexBatch) > 0) {
+        }
+    }
+    return *fixture;
+}
+
+TempDatabase& usersFixture(int users) {
+    static std::map<int, std::unique_ptr<TempDatabase>> fixtures;
+    auto& fixture = fixtures[users];
+    if (!fixture) {
+        fixture = std::make_unique<TempDatabase>();
+        populateUsers(fixture->db(), users);
+    }
+    return *fixture;
+}
+
+// Schema v5 as the previous release left it: names in every row, text
+// timestamps. Filled directly in SQL, since Database only creates v6.
+const char* kV5Schema = R"(
+    PRAGMA journal_mode = WAL;
+    CREATE TABLE users (
+        id INTEGER PRIMARY KEY AUTOINCREMENT,
+        username TEXT UNIQUE NOT NULL,
+        created_at DATETIME DEFAULT CURRENT_TIMESTAMP
+    );
+    CREATE TABLE conversations (
+        id INTEGER PRIMARY KEY,
+        user_a TEXT NOT NULL,
+        user_b TEXT NOT NULL,
+        last_seq INTEGER NOT NULL DEFAULT 1,
+        UNIQUE (user_a, user_b)
+    );
+    CREATE INDEX idx_conversations_user_b ON conversations (user_b, user_a);
+    CREATE TABLE messages (
+        conversation_id INTEGER NOT NULL,
+        seq INTEGER NOT NULL,
+        id INTEGER NOT NULL UNIQUE,
+        sender TEXT NOT NULL,
+        receiver TEXT NOT NULL,
+        text TEXT NOT NULL,
+        message_type TEXT DEFAULT 'text',
+        media_path TEXT,
+        timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,
+        delivered INTEGER NOT NULL DEFAULT 1,
+        PRIMARY KEY (conversation_id, seq)
+    ) WITHOUT ROWID;
+    CREATE INDEX idx_messages_undelivered ON messages (receiver, id) WHERE delivered = 0;
+    CREATE TABLE chat_groups (
+        id INTEGER PRIMARY KEY,
+        name TEXT NOT NULL UNIQUE,
+        last_seq INTEGER NOT NULL DEFAULT 0,
+        created_at DATETIME DEFAULT CURRENT_TIMESTAMP
+    );
+    CREATE TABLE group_members (
+        group_id INTEGER NOT NULL,
+        username TEXT NOT NULL,
+        joined_at DATETIME DEFAULT CURRENT_TIMESTAMP,
+        PRIMARY KEY (group_id, username)
+    ) WITHOUT ROWID;
+    CREATE TABLE group_messages (
+        group_id INTEGER NOT NULL,
+        seq INTEGER NOT NULL,
+        id INTEGER NOT NULL UNIQUE,
+        sender TEXT NOT NULL,
+        text TEXT NOT NULL,
+        message_type TEXT DEFAULT 'text',
+        media_path TEXT,
+        timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,
+        PRIMARY KEY (group_id, seq)
+    ) WITHOUT ROWID;
+    CREATE TABLE media (
+        id INTEGER PRIMARY KEY AUTOINCREMENT,
+        sender TEXT NOT NULL,
+        receiver TEXT NOT NULL,
+        path TEXT NOT NULL,
+        type TEXT NOT NULL,
+        timestamp DATETIME DEFAULT CURRENT_TIMESTAMP
+    );
+    PRAGMA user_version = 5;
+)";
+
+// 10k users; conversations of 100 messages each between distinct pairs.
+// Ids interleave conversations as live traffic does; one message in 1000
+// is still undelivered.
+const char* kV5Populate = R"(
+    BEGIN;
+    WITH RECURSIVE u(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM u WHERE i + 1 < 10000)
+    INSERT INTO users (username) SELECT printf('user%05d', i) FROM u;
+
+    WITH RECURSIVE k(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM k WHERE i + 1 < :conversations),
+    pairs(i, a, b) AS (
+        SELECT i, printf('user%05d', i % 10000), printf('user%05d', (i % 10000 + 1 + i / 10000) % 10000)
+        FROM k)
+    INSERT INTO conversations (id, user_a, user_b, last_seq)
+    SELECT i + 1, MIN(a, b), MAX(a, b), 100 FROM pairs;
+
+    WITH RECURSIVE r(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM r WHERE i + 1 < :rows)
+    INSERT INTO messages (conversation_id, seq, id, sender, receiver, text, message_type, media_path,
+                          timestamp, delivered)
+    SELECT c.id, i % 100 + 1, (i % 100) * :conversations + c.id,
+           CASE WHEN i % 2 = 0 THEN c.user_a ELSE c.user_b END,
+           CASE WHEN i % 2 = 0 THEN c.user_b ELSE c.user_a END,
+           printf('Message %d: are we still meeting later today?', i), 'text', '',
+           datetime(1700000000 + (i % 100) * :conversations + c.id, 'unixepoch'), i % 1000 != 0
+    FROM r JOIN conversations c ON c.id = i / 100 + 1;
+    COMMIT;
+)";
+
+void createV5Database(const std::string& path, int rows) {
+    sqlite3* db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    sqlite3_exec(db, kV5Schema, nullptr, nullptr, nullptr);
+
+    // sqlite3_exec cannot bind; the statements are run one by one.
+    const char* sql = kV5Populate;
+    while (*sql) {
+        sqlite3_stmt* stmt = nullptr;
+        const char* tail = nullptr;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, &tail) != SQLITE_OK) {
+            break;
+        }
+        if (stmt) {
+            const int conversations = sqlite3_bind_parameter_index(stmt, ":conversations");
+            const int count = sqlite3_bind_parameter_index(stmt, ":rows");
+            if (conversations) {
+                sqlite3_bind_int(stmt, conversations, std::max(1, rows / 100));
+            }
+            if (count) {
+                sqlite3_bind_int(stmt, count, rows);
+            }
+            sqlite3_step(stmt);
+            sqlite3_finalize(stmt);
+        }
+        sql = tail;
+    }
+    sqlite3_close(db);
+}
+
+// Pages holding data (freed pages of dropped tables excluded), WAL included.
+double usedBytes(const std::string& path) {
+    sqlite3* db = nullptr;
+    sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr);
+    auto pragma = [db](const char* sql) {
+        sqlite3_stmt* stmt = nullptr;
+        double value = 0;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+            value = sqlite3_column_double(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        return value;
+    };
+    const double bytes = pragma("PRAGMA page_size;") *
+                         (pragma("PRAGMA page_count;") - pragma("PRAGMA freelist_count;"));
+    sqlite3_close(db);
+    return bytes;
+}
+
+// Removes the search index and its triggers, leaving messages as they are
+// on a v6 file; a Database opened afterwards writes without indexing.
+void dropSearchIndex(const std::string& path) {
+    sqlite3* db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    sqlite3_exec(db, R"(
+        DROP TRIGGER messages_fts_delete;
+        DROP TRIGGER messages_fts_update;
+        DROP TABLE messages_fts;
+        DROP TABLE messages_fts_state;
+        DROP VIEW messages_search;
+    )", nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+}
+
+// Texts vary, as chat does: each message brings a few words the index has
+// not seen yet besides the common ones.
+std::string messageText(int i) {
+    return "Message " + std::to_string(i) + " of a typical length, ref" + std::to_string(i * 7919 % 100003) +
+           " for a chat conversation";
+}
+
+// batch = 1: one transaction per message (autocommit path);
+// batch > 1: group commit, as PersistenceQueue does.
+// index = 0: without the search index; index = 1: indexing included, done
+// the way the writer does under sustained load (every kSearchIndexBatch
+// messages, in its own transaction).
+void BM_Database_SaveMessage(benchmark::State& state) {
+    const int batch = static_cast<int>(state.range(0));
+    const bool indexed = state.range(1) != 0;
+    TempDatabase temp;
+    if (!indexed) {
+        dropSearchIndex(temp.path());
+        temp.open();
+    }
+    Database& db = temp.db();
+
+    int i = 0;
+    for (auto _ : state) {
+        if (batch > 1 && i % batch == 0) {
+            db.beginTransaction();
+        }
+        benchmark::DoNotOptimize(db.saveMessage(userName(0), userName(1 + i % kConversations), messageText(i)));
+        if (++i % batch == 0 && batch > 1) {
+            db.commitTransaction();
+        }
+        if (indexed && i % kSearchIndexBatch == 0) {
+            db.indexMessages(kSearchIndexBatch);
+        }
+    }
+    if (batch > 1 && i % batch != 0) {
+        db.commitTransaction();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// The message handler's database work, userExists + saveMessage in
+// autocommit. reopen = 1: the path before one Database lived for the
+// server lifetime, where each handler opened, initialized and closed its
+// own, so every statement was prepared per call and the last close
+// checkpointed the WAL. reopen = 0: one Database with cached statements.
+void BM_Database_SaveMessagePerCall(benchmark::State& state) {
+    const bool reopen = state.range(0) != 0;
+    TempDatabase temp(false);
+    {
+        Database schema(temp.path());
+        schema.initialize();
+        schema.ensureUser(userName(1));
+    }
+    if (!reopen) {
+        temp.open();
+    }
+
+    int i = 0;
+    for (auto _ : state) {
+        std::unique_ptr<Database> local;
+        if (reopen) {
+            local = std::make_unique<Database>(temp.path());
+            local->initialize();
+        }
+        Database& db = reopen ? *local : temp.db();
+        benchmark::DoNotOptimize(db.userExists(userName(1)));
+        benchmark::DoNotOptimize(db.saveMessage(userName(0), userName(1 + i % kConversations), messageText(i)));
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Newest page of one conversation; the table holds `rows` messages overall.
+void BM_Database_GetMessages(benchmark::State& state) {
+    const int rows = static_cast<int>(state.range(0));
+    const int limit = static_cast<int>(state.range(1));
+    Database& db = messagesFixture(rows).db();
+
+    std::size_t returned = 0;
+    for (auto _ : state) {
+        const std::vector<Message> page = db.getMessages(userName(0), userName(1), limit);
+        returned += page.size();
+        benchmark::DoNotOptimize(page.data());
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(returned));
+}
+
+// A deep keyset page: should cost the same as the newest one.
+void BM_Database_GetMessagesBefore(benchmark::State& state) {
+    const int rows = static_cast<int>(state.range(0));
+    Database& db = messagesFixture(rows).db();
+    const std::vector<Message> all = db.getMessages(userName(0), userName(1), rows);
+    const long long cursor = all.empty() ? 0 : all[all.size() / 2].id;
+
+    for (auto _ : state) {
+        const std::vector<Message> page = db.getMessagesBefore(userName(0), userName(1), cursor, 100);
+        benchmark::DoNotOptimize(page.data());
+    }
+}
+
+// One page (20) of a one-word search over user0's conversations, which
+// hold all `rows` messages: common = 1 matches every row (all of them are
+// ranked), common = 0 a single one (by the number in its text).
+void BM_Database_SearchMessages(benchmark::State& state) {
+    const int rows = static_cast<int>(state.range(0));
+    Database& db = messagesFixture(rows).db();
+    const std::string query = state.range(1) != 0 ? "meeting" : std::to_string(rows / 2);
+
+    std::size_t returned = 0;
+    for (auto _ : state) {
+        const std::vector<Message> page = db.searchMessages(userName(0), query, "", 0, 20);
+        returned += page.size();
+        benchmark::DoNotOptimize(page.data());
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(returned));
+}
+
+void BM_Database_UserExists(benchmark::State& state) {
+    const int users = static_cast<int>(state.range(0));
+    const bool hit = state.range(1) != 0;
+    Database& db = usersFixture(users).db();
+
+    int i = 0;
+    for (auto _ : state) {
+        const std::string name = hit ? userName(i++ % users) : "missing" + std::to_string(i++);
+        benchmark::DoNotOptimize(db.userExists(name));
+    }
+}
+
+// Startup migration of a v5 file of `rows` messages: items/s is rows copied
+// per second; bytes_per_row before and after (users and indexes included).
+// The search index the writer then fills in the background is timed and
+// sized separately.
+void BM_Database_MigrateV6(benchmark::State& state) {
+    const int rows = static_cast<int>(state.range(0));
+    double before = 0;
+    double after = 0;
+    double index = 0;
+    double indexSeconds = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        {
+            TempDatabase temp(false);
+            createV5Database(temp.path(), rows);
+            before = usedBytes(temp.path());
+
+            state.ResumeTiming();
+            Database& db = temp.open();
+            state.PauseTiming();
+
+            const auto start = std::chrono::steady_clock::now();
+            while (db.indexMessages(kSearchIndexBatch) > 0) {
+            }
+            indexSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            index = usedBytes(temp.path());
+            dropSearchIndex(temp.path());
+            after = usedBytes(temp.path());
+            index -= after;
+        }
+        state.ResumeTiming();
+    }
+    state.counters["v5_bytes_per_row"] = before / rows;
+    state.counters["v6_bytes_per_row"] = after / rows;
+    state.counters["v6_size_ratio"] = after / before;
+    state.counters["index_bytes_per_row"] = index / rows;
+    state.counters["index_rows_per_second"] = rows / indexSeconds;
+    state.SetItemsProcessed(state.iterations() * rows);
+}
+
+} // namespace
+
+BENCHMARK(BM_Database_SaveMessage)
+    ->ArgNames({"batch", "index"})
+    ->ArgsProduct({{1, 100}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(BM_Database_SaveMessagePerCall)
+    ->ArgName("reopen")
+    ->Arg(1)->Arg(0)
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(BM_Database_GetMessages)
+    ->ArgNames({"rows", "limit"})
+    ->ArgsProduct({{1000, 10000, 100000}, {20, 100}})
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(BM_Database_GetMessagesBefore)
+    ->ArgName("rows")
+    ->Arg(1000)->Arg(10000)->Arg(100000)
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(BM_Database_SearchMessages)
+    ->ArgNames({"rows", "common"})
+    ->ArgsProduct({{1000, 10000, 100000}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(BM_Database_UserExists)
+    ->ArgNames({"users", "hit"})
+    ->ArgsProduct({{1000, 100000}, {0, 1}});
+
+BENCHMARK(BM_Database_MigrateV6)
+    ->ArgName("rows")
+    ->Arg(1000000)->Arg(10000000)
+    ->Iterations(1)
+    ->UseRealTime()
+    ->Unit(benchmark::kSecond);
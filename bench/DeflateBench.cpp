@@ -0,0 +1,93 @@
+// Bandwidth and CPU cost of permessage-deflate on outbound frames:
+// history pages (large, repetitive) and acks (below the default threshold),
+// per window size, context takeover and wire protocol.
+#include "../include/Deflate.h"
+#include "../include/FrameWriter.h"
+#include <benchmark/benchmark.h>
+#include <QString>
+#include <QVector>
+#include <cstdint>
+
+namespace {
+
+constexpr int kPages = 64;
+constexpr int kPageSize = 100;
+
+QByteArray payload(const Frame& frame) {
+    return frame.protocol == WireProtocol::Binary ? frame.binary : frame.text.toUtf8();
+}
+
+// Consecutive history pages of one conversation, as the reader pool encodes them.
+QVector<QByteArray> makeHistoryPages(WireProtocol protocol) {
+    QVector<QByteArray> pages;
+    Frame frame;
+    for (int page = 0; page < kPages; ++page) {
+        FrameWriter writer(frame, protocol);
+        writer.field(Wire::Key::Type, Wire::Type::History)
+            .field(Wire::Key::With, QStringLiteral("bob"))
+            .field(Wire::Key::HasMore, true)
+            .field(Wire::Key::NextCursor, static_cast<qint64>(page * kPageSize + 1));
+        writer.beginArray(Wire::Key::Messages);
+        for (int i = kPageSize; i > 0; --i) {
+            const qint64 id = static_cast<qint64>(page) * kPageSize + i;
+            writer.beginObject()
+                .field(Wire::Key::Id, id)
+                .field(Wire::Key::Seq, id)
+                .field(Wire::Key::Sender, i % 2 ? QStringLiteral("alice") : QStringLiteral("bob"))
+                .field(Wire::Key::Text, QStringLiteral("Message %1: are we still meeting at %2?").arg(id).arg(i % 24))
+                .field(Wire::Key::Timestamp, QStringLiteral("2024-01-01 12:%1:00").arg(i % 60, 2, 10, QLatin1Char('0')))
+                .endObject();
+        }
+        writer.endArray().finish();
+        pages.append(payload(frame));
+    }
+    return pages;
+}
+
+void run(benchmark::State& state, const QVector<QByteArray>& frames) {
+    DeflateOptions options;
+    options.windowBits = static_cast<int>(state.range(0));
+    options.contextTakeover = state.range(1) != 0;
+    MessageDeflater deflater(options);
+
+    QByteArray out;
+    std::int64_t rawBytes = 0;
+    std::int64_t wireBytes = 0;
+    int i = 0;
+    for (auto _ : state) {
+        const QByteArray& frame = frames[i++ % frames.size()];
+        deflater.compress(frame.constData(), frame.size(), out);
+        benchmark::DoNotOptimize(out.constData());
+        rawBytes += frame.size();
+        wireBytes += out.size();
+    }
+
+    // bytes_per_second is compression throughput, i.e. CPU per raw byte.
+    state.SetBytesProcessed(rawBytes);
+    state.counters["raw_bytes"] = benchmark::Counter(static_cast<double>(rawBytes), benchmark::Counter::kAvgIterations);
+    state.counters["wire_bytes"] = benchmark::Counter(static_cast<double>(wireBytes), benchmark::Counter::kAvgIterations);
+    state.counters["ratio"] = rawBytes ? static_cast<double>(wireBytes) / static_cast<double>(rawBytes) : 0.0;
+}
+
+void BM_Deflate_History(benchmark::State& state) {
+    const WireProtocol protocol = state.range(2) ? WireProtocol::Binary : WireProtocol::Json;
+    static const QVector<QByteArray> json = makeHistoryPages(WireProtocol::Json);
+    static const QVector<QByteArray> cbor = makeHistoryPages(WireProtocol::Binary);
+    run(state, protocol == WireProtocol::Binary ? cbor : json);
+}
+
+// Why the threshold exists: acks barely shrink, and cost a deflate call each.
+void BM_Deflate_Ack(benchmark::State& state) {
+    static const QVector<QByteArray> acks = {payload(Frames::messageAck(WireProtocol::Json))};
+    run(state, acks);
+}
+
+} // namespace
+
+BENCHMARK(BM_Deflate_History)
+    ->ArgNames({"window_bits", "takeover", "cbor"})
+    ->ArgsProduct({{9, 12, 15}, {0, 1}, {0, 1}});
+
+BENCHMARK(BM_Deflate_Ack)
+    ->ArgNames({"window_bits", "takeover"})
+    ->ArgsProduct({{15}, {0, 1}});
@@ -0,0 +1,50 @@
+// libsodium wrappers: crypto_box encrypt/decrypt per payload size and the
+// Argon2id password hash (deliberately slow: INTERACTIVE limits).
+#include "../include/Encryption.h"
+#include <benchmark/benchmark.h>
+#include <string>
+
+namespace {
+
+struct KeyPair {
+    KeyPair() { encryption.generateKeyPair(); }
+    Encryption encryption;
+};
+
+void BM_Encryption_Encrypt(benchmark::State& state) {
+    KeyPair alice;
+    KeyPair bob;
+    const std::string message(static_cast<std::size_t>(state.range(0)), 'm');
+    const std::string bobKey = bob.encryption.getPublicKey();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(alice.encryption.encryptMessage(message, bobKey));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+void BM_Encryption_Decrypt(benchmark::State& state) {
+    KeyPair alice;
+    KeyPair bob;
+    const std::string message(static_cast<std::size_t>(state.range(0)), 'm');
+    const std::string sealed = alice.encryption.encryptMessage(message, bob.encryption.getPublicKey());
+    const std::string aliceKey = alice.encryption.getPublicKey();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(bob.encryption.decryptMessage(sealed, aliceKey));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+void BM_Encryption_HashPassword(benchmark::State& state) {
+    const std::string password = "correct horse battery staple";
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Encryption::hashPassword(password));
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_Encryption_Encrypt)->ArgName("bytes")->RangeMultiplier(8)->Range(64, 256 << 10);
+BENCHMARK(BM_Encryption_Decrypt)->ArgName("bytes")->RangeMultiplier(8)->Range(64, 256 << 10);
+BENCHMARK(BM_Encryption_HashPassword)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,206 @@
+// Per-frame protocol cost on the event loop: decoding an inbound "message"
+// request and encoding the delivery frame for the recipient. The QJsonDocument
+// variant is the original handleMessage/sendJsonMessage path; the others are
+// decodeRequest + FrameWriter in each wire protocol. Also group fan-out.
+#include "../include/FrameWriter.h"
+#include <benchmark/benchmark.h>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QString>
+#include <vector>
+
+namespace {
+
+enum Codec { QJson, Json, Cbor };
+
+constexpr qint64 kTimestamp = 1700000000;
+
+QString messageText(int length) {
+    return QString(length, QLatin1Char('m'));
+}
+
+// The inbound frame as a client sends it.
+QString jsonRequest(const QString& text) {
+    QJsonObject request;
+    request["type"] = "message";
+    request["to"] = "bob";
+    request["text"] = text;
+    return QString::fromUtf8(QJsonDocument(request).toJson(QJsonDocument::Compact));
+}
+
+QByteArray cborRequest(const QString& text) {
+    Frame frame;
+    FrameWriter(frame, WireProtocol::Binary)
+        .field(Wire::Key::Type, Wire::Type::Message)
+        .field(Wire::Key::To, QStringLiteral("bob"))
+        .field(Wire::Key::Text, text)
+        .finish();
+    return frame.binary;
+}
+
+void BM_Protocol_MessageRoundTrip(benchmark::State& state) {
+    const Codec codec = static_cast<Codec>(state.range(0));
+    const QString text = messageText(static_cast<int>(state.range(1)));
+    const QString json = jsonRequest(text);
+    const QByteArray cbor = cborRequest(text);
+    const QString sender = QStringLiteral("alice");
+
+    Frame frame;
+    for (auto _ : state) {
+        if (codec == QJson) {
+            const QJsonObject request = QJsonDocument::fromJson(json.toUtf8()).object();
+            QJsonObject delivery;
+            delivery["type"] = "message";
+            delivery["from"] = sender;
+            delivery["text"] = request["text"].toString();
+            delivery["timestamp"] = kTimestamp;
+            const QString out = QString::fromUtf8(QJsonDocument(delivery).toJson(QJsonDocument::Compact));
+            benchmark::DoNotOptimize(out.constData());
+            continue;
+        }
+
+        Request request;
+        const bool ok = codec == Json ? decodeRequest(json, request) : decodeRequest(cbor, request);
+        benchmark::DoNotOptimize(ok);
+        const Frame& out = FrameWriter(frame, codec == Json ? WireProtocol::Json : WireProtocol::Binary)
+            .field(Wire::Key::Type, Wire::Type::Message)
+            .field(Wire::Key::From, sender)
+            .field(Wire::Key::Text, request.text)
+            .field(Wire::Key::Timestamp, kTimestamp)
+            .finish();
+        benchmark::DoNotOptimize(out.text.constData());
+        benchmark::DoNotOptimize(out.binary.constData());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Decode only, for each codec: the share of the round trip spent parsing.
+void BM_Protocol_DecodeRequest(benchmark::State& state) {
+    const Codec codec = static_cast<Codec>(state.range(0));
+    const QString text = messageText(64);
+    const QString json = jsonRequest(text);
+    const QByteArray cbor = cborRequest(text);
+
+    for (auto _ : state) {
+        if (codec == QJson) {
+            const QJsonObject request = QJsonDocument::fromJson(json.toUtf8()).object();
+            benchmark::DoNotOptimize(request["text"].toString().constData());
+        } else if (codec == Json) {
+            Request request;
+            benchmark::DoNotOptimize(decodeRequest(json, request));
+        } else {
+            Request request;
+            benchmark::DoNotOptimize(decodeRequest(cbor, request));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// A full history page (100 messages), built per request on a reader thread.
+void BM_Protocol_EncodeHistoryPage(benchmark::State& state) {
+    const Codec codec = static_cast<Codec>(state.range(0));
+    constexpr int kPageSize = 100;
+    const QString text = QStringLiteral("Are we still meeting later today?");
+
+    Frame frame;
+    for (auto _ : state) {
+        if (codec == QJson) {
+            QJsonArray messages;
+            for (int i = 0; i < kPageSize; ++i) {
+                QJsonObject msg;
+                msg["id"] = i;
+                msg["seq"] = i;
+                msg["sender"] = i % 2 ? "alice" : "bob";
+                msg["text"] = text;
+                msg["timestamp"] = "2024-01-01 12:00:00";
+                messages.append(msg);
+            }
+            QJsonObject page;
+            page["type"] = "history";
+            page["with"] = "bob";
+            page["has_more"] = true;
+            page["next_cursor"] = 1;
+            page["messages"] = messages;
+            const QString out = QString::fromUtf8(QJsonDocument(page).toJson(QJsonDocument::Compact));
+            benchmark::DoNotOptimize(out.constData());
+            continue;
+        }
+
+        FrameWriter writer(frame, codec == Json ? WireProtocol::Json : WireProtocol::Binary);
+        writer.field(Wire::Key::Type, Wire::Type::History)
+            .field(Wire::Key::With, QStringLiteral("bob"))
+            .field(Wire::Key::HasMore, true)
+            .field(Wire::Key::NextCursor, static_cast<qint64>(1));
+        writer.beginArray(Wire::Key::Messages);
+        for (int i = 0; i < kPageSize; ++i) {
+            writer.beginObject()
+                .field(Wire::Key::Id, static_cast<qint64>(i))
+                .field(Wire::Key::Seq, static_cast<qint64>(i))
+                .field(Wire::Key::Sender, i % 2 ? QLatin1String("alice") : QLatin1String("bob"))
+                .field(Wire::Key::Text, text)
+                .field(Wire::Key::Timestamp, QLatin1String("2024-01-01 12:00:00"))
+                .endObject();
+        }
+        const Frame& out = writer.endArray().finish();
+        benchmark::DoNotOptimize(out.text.constData());
+        benchmark::DoNotOptimize(out.binary.constData());
+    }
+    state.SetItemsProcessed(state.iterations() * kPageSize);
+}
+
+// A group_message to `members` online recipients: encoded per recipient, or
+// once with every recipient sharing the buffer (ConnectionShard::fanOut).
+void BM_Protocol_GroupFanout(benchmark::State& state) {
+    const bool once = state.range(0) != 0;
+    const int members = static_cast<int>(state.range(1));
+    const QString group = QStringLiteral("team");
+    const QString sender = QStringLiteral("alice");
+    const QString text = QStringLiteral("Standup moved to 10:30, same room");
+
+    // Stands in for the recipients' sockets.
+    std::vector<Frame> outbox(static_cast<std::size_t>(members));
+    Frame shared;
+    for (auto _ : state) {
+        if (once) {
+            FrameWriter(shared, WireProtocol::Json)
+                .field(Wire::Key::Type, Wire::Type::GroupMessage)
+                .field(Wire::Key::Group, group)
+                .field(Wire::Key::From, sender)
+                .field(Wire::Key::Text, text)
+                .field(Wire::Key::Timestamp, kTimestamp)
+                .finish();
+            for (Frame& out : outbox) {
+                out = shared;
+            }
+        } else {
+            for (Frame& out : outbox) {
+                FrameWriter(out, WireProtocol::Json)
+                    .field(Wire::Key::Type, Wire::Type::GroupMessage)
+                    .field(Wire::Key::Group, group)
+                    .field(Wire::Key::From, sender)
+                    .field(Wire::Key::Text, text)
+                    .field(Wire::Key::Timestamp, kTimestamp)
+                    .finish();
+            }
+        }
+        benchmark::DoNotOptimize(outbox.data());
+    }
+    state.SetItemsProcessed(state.iterations() * members);
+}
+
+} // namespace
+
+// codec: 0 = QJsonDocument, 1 = decodeRequest + FrameWriter (JSON), 2 = same in CBOR
+BENCHMARK(BM_Protocol_MessageRoundTrip)
+    ->ArgNames({"codec", "text_bytes"})
+    ->ArgsProduct({{QJson, Json, Cbor}, {16, 256, 4096}});
+
+BENCHMARK(BM_Protocol_DecodeRequest)->ArgName("codec")->DenseRange(QJson, Cbor);
+
+BENCHMARK(BM_Protocol_EncodeHistoryPage)->ArgName("codec")->DenseRange(QJson, Cbor);
+
+// once: 0 = encode per recipient, 1 = encode once and share
+BENCHMARK(BM_Protocol_GroupFanout)
+    ->ArgNames({"once", "members"})
+    ->ArgsProduct({{0, 1}, {100, 10000}});
@@ -0,0 +1,80 @@
+// Per-frame routing cost vs. number of online users on a shard:
+// the old QMap::key() sender scan against the Session index used by ConnectionShard.
+#include "../include/Session.h"
+#include <benchmark/benchmark.h>
+#include <QHash>
+#include <QMap>
+#include <QString>
+#include <QVector>
+#include <memory>
+#include <unordered_map>
+
+namespace {
+
+// Only pointer identity matters for the lookups, so sockets are never created.
+QWebSocket* fakeSocket(int i) {
+    return reinterpret_cast<QWebSocket*>(static_cast<quintptr>(i + 1) * 64);
+}
+
+QVector<QString> makeUsernames(int count) {
+    QVector<QString> names;
+    names.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        names.append(QStringLiteral("user%1").arg(i));
+    }
+    return names;
+}
+
+// Before: sender via QMap::key (linear scan), recipient via contains + operator[].
+void BM_Routing_QMapKey(benchmark::State& state) {
+    const int users = static_cast<int>(state.range(0));
+    const QVector<QString> names = makeUsernames(users);
+    QMap<QString, QWebSocket*> onlineUsers;
+    for (int i = 0; i < users; ++i) {
+        onlineUsers.insert(names[i], fakeSocket(i));
+    }
+
+    int i = 0;
+    for (auto _ : state) {
+        QString sender = onlineUsers.key(fakeSocket(i));
+        const QString& to = names[(i + 1) % users];
+        QWebSocket* recipient = onlineUsers.contains(to) ? onlineUsers[to] : nullptr;
+        benchmark::DoNotOptimize(sender);
+        benchmark::DoNotOptimize(recipient);
+        i = (i + 7919) % users;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// After: sender comes from the session captured by the socket's handler,
+// recipient from the username -> Session hash.
+void BM_Routing_SessionIndex(benchmark::State& state) {
+    const int users = static_cast<int>(state.range(0));
+    const QVector<QString> names = makeUsernames(users);
+    std::unordered_map<QWebSocket*, std::unique_ptr<Session>> sessions;
+    QVector<Session*> captured;
+    QHash<QString, Session*> usersByName;
+    for (int i = 0; i < users; ++i) {
+        auto session = std::make_unique<Session>();
+        session->socket = fakeSocket(i);
+        session->username = names[i];
+        captured.append(session.get());
+        usersByName.insert(names[i], session.get());
+        sessions.emplace(session->socket, std::move(session));
+    }
+
+    int i = 0;
+    for (auto _ : state) {
+        const QString& sender = captured[i]->username;
+        Session* recipient = usersByName.value(names[(i + 1) % users], nullptr);
+        benchmark::DoNotOptimize(sender);
+        benchmark::DoNotOptimize(recipient);
+        i = (i + 7919) % users;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_Routing_QMapKey)->RangeMultiplier(10)->Range(100, 100000);
+BENCHMARK(BM_Routing_SessionIndex)->RangeMultiplier(10)->Range(100, 100000);
@@ -0,0 +1,82 @@
+// Cost of the shard's heartbeat wheel vs. number of connections: one tick
+// with every connection armed (most ticks fire nothing), and a steady state
+// where each connection's check fires and is re-armed once per interval,
+// as ConnectionShard does for idle sockets.
+#include "../include/TimingWheel.h"
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// 30 s interval at the shard's 250 ms tick.
+constexpr std::uint64_t kInterval = 120;
+
+std::unique_ptr<TimingWheel::Node[]> armAll(TimingWheel& wheel, int connections) {
+    auto nodes = std::make_unique<TimingWheel::Node[]>(connections);
+    for (int i = 0; i < connections; ++i) {
+        // Connections spread over the interval, as they would be by arrival time.
+        wheel.schedule(nodes[i], 1 + static_cast<std::uint64_t>(i) % kInterval);
+    }
+    return nodes;
+}
+
+// Every tick: the due slice fires and is re-armed one interval later.
+void BM_TimingWheel_SteadyTick(benchmark::State& state) {
+    const int connections = static_cast<int>(state.range(0));
+    TimingWheel wheel;
+    auto nodes = armAll(wheel, connections);
+
+    std::uint64_t tick = 0;
+    std::uint64_t fired = 0;
+    for (auto _ : state) {
+        TimingWheel::List due;
+        wheel.advance(++tick, due);
+        while (TimingWheel::Node* node = due.popFront()) {
+            wheel.schedule(*node, tick + kInterval);
+            ++fired;
+        }
+    }
+    state.counters["fired_per_tick"] = benchmark::Counter(static_cast<double>(fired) / static_cast<double>(tick));
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Ticks where nothing is due: what 100k idle-but-armed sockets cost per tick.
+void BM_TimingWheel_EmptyTick(benchmark::State& state) {
+    const int connections = static_cast<int>(state.range(0));
+    TimingWheel wheel;
+    auto nodes = std::make_unique<TimingWheel::Node[]>(connections);
+    for (int i = 0; i < connections; ++i) {
+        wheel.schedule(nodes[i], 1'000'000'000);
+    }
+
+    std::uint64_t tick = 0;
+    for (auto _ : state) {
+        TimingWheel::List due;
+        wheel.advance(++tick, due);
+        benchmark::DoNotOptimize(due.empty());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Re-arming on activity (the shard avoids it by stamping a tick instead).
+void BM_TimingWheel_Reschedule(benchmark::State& state) {
+    const int connections = static_cast<int>(state.range(0));
+    TimingWheel wheel;
+    auto nodes = armAll(wheel, connections);
+
+    int i = 0;
+    std::uint64_t offset = 0;
+    for (auto _ : state) {
+        wheel.schedule(nodes[i], kInterval + (offset++ % kInterval));
+        i = (i + 7919) % connections;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_TimingWheel_SteadyTick)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK(BM_TimingWheel_EmptyTick)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK(BM_TimingWheel_Reschedule)->RangeMultiplier(10)->Range(1000, 1000000);
@@ -0,0 +1,253 @@
+#include "ClusterBroker.h"
+#include <QHostAddress>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <iostream>
+
+ClusterBroker::ClusterBroker(QObject* parent)
+    : QObject(parent)
+{
+}
+
+ClusterBroker::~ClusterBroker() {
+    for (auto& [socket, node] : m_nodes) {
+        socket->disconnect(this);
+    }
+}
+
+bool ClusterBroker::listen(const ClusterBus::Address& address) {
+    if (!address.valid) {
+        m_error = QStringLiteral("invalid address");
+        return false;
+    }
+
+    if (address.local) {
+        // A broker that crashed leaves its socket file behind.
+        QLocalServer::removeServer(address.name);
+        m_localServer = new QLocalServer(this);
+        if (!m_localServer->listen(address.name)) {
+            m_error = m_localServer->errorString();
+            return false;
+        }
+        connect(m_localServer, &QLocalServer::newConnection, this, [this]() {
+            while (QLocalSocket* socket = m_localServer->nextPendingConnection()) {
+                addNode(socket);
+            }
+        });
+        return true;
+    }
+
+    QHostAddress host(address.host);
+    if (address.host == QLatin1String("localhost")) {
+        host = QHostAddress::LocalHost;
+    } else if (address.host == QLatin1String("*")) {
+        host = QHostAddress::Any;
+    }
+    if (host.isNull()) {
+        m_error = QStringLiteral("invalid host %1").arg(address.host);
+        return false;
+    }
+    m_tcpServer = new QTcpServer(this);
+    if (!m_tcpServer->listen(host, address.port)) {
+        m_error = m_tcpServer->errorString();
+        return false;
+    }
+    connect(m_tcpServer, &QTcpServer::newConnection, this, [this]() {
+        while (QTcpSocket* socket = m_tcpServer->nextPendingConnection()) {
+            socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+            addNode(socket);
+        }
+    });
+    return true;
+}
+
+void ClusterBroker::addNode(QIODevice* socket) {
+    auto owned = std::make_unique<Node>();
+    Node* node = owned.get();
+    node->socket = socket;
+    m_nodes.emplace(socket, std::move(owned));
+
+    connect(socket, &QIODevice::readyRead, this, [this, node]() { onReadyRead(node); });
+    auto onDisconnected = [this, node]() {
+        removeNode(node);
+        flush();
+    };
+    if (auto* local = qobject_cast<QLocalSocket*>(socket)) {
+        connect(local, &QLocalSocket::disconnected, this, onDisconnected);
+    } else if (auto* tcp = qobject_cast<QTcpSocket*>(socket)) {
+        connect(tcp, &QTcpSocket::disconnected, this, onDisconnected);
+    }
+}
+
+void ClusterBroker::removeNode(Node* node) {
+    QIODevice* socket = node->socket;
+    socket->disconnect(this);
+    socket->deleteLater();
+
+    // Everyone the node held goes offline for the rest of the cluster.
+    if (!node->id.isEmpty() && m_nodesById.value(node->id) == node) {
+        m_nodesById.remove(node->id);
+        for (const QString& username : node->users) {
+            m_presence.remove(username);
+            ClusterBus::Record record;
+            record.kind = ClusterBus::Kind::Presence;
+            record.username = username;
+            record.node = node->id;
+            record.online = false;
+            QByteArray encoded;
+            ClusterBus::appendRecord(encoded, record);
+            broadcast(node, encoded);
+        }
+        std::cout << "Node " << node->id.toStdString() << " left (" << node->users.size() << " users)" << std::endl;
+    }
+
+    m_dirty.removeAll(node);
+    m_nodes.erase(socket);
+}
+
+void ClusterBroker::onReadyRead(Node* node) {
+    node->inbox += node->socket->readAll();
+
+    qsizetype offset = 0;
+    ClusterBus::Record record;
+    for (;;) {
+        const qsizetype start = offset;
+        const ClusterBus::ReadStatus status = ClusterBus::readRecord(node->inbox, offset, record);
+        if (status == ClusterBus::ReadStatus::Incomplete) {
+            break;
+        }
+        if (status == ClusterBus::ReadStatus::Error
+            || !handleRecord(*node, record, node->inbox.constData() + start, offset - start)) {
+            std::cerr << "Dropping node " << node->id.toStdString() << ": protocol error" << std::endl;
+            removeNode(node);
+            flush();
+            return;
+        }
+    }
+    node->inbox.remove(0, offset);
+
+    // One write per destination for everything this read produced.
+    flush();
+}
+
+bool ClusterBroker::handleRecord(Node& node, const ClusterBus::Record& record, const char* raw, qsizetype size) {
+    if (record.kind == ClusterBus::Kind::Hello) {
+        if (!node.id.isEmpty() || record.node.isEmpty()) {
+            return false;
+        }
+        handleHello(node, record.node);
+        return true;
+    }
+    if (node.id.isEmpty()) {
+        return false;
+    }
+
+    switch (record.kind) {
+    case ClusterBus::Kind::Presence:
+        setPresence(node, record.username, record.online, record.protocol);
+        return true;
+    case ClusterBus::Kind::Forward: {
+        // Relayed byte for byte: the broker never re-encodes a frame. A target
+        // that just left never gets it; a direct message then stays
+        // undelivered in the shared database and is pushed after next auth.
+        Node* target = m_nodesById.value(record.node, nullptr);
+        if (target && target != &node) {
+            send(*target, raw, size);
+        }
+        return true;
+    }
+    case ClusterBus::Kind::GroupMembership:
+        broadcast(&node, QByteArray::fromRawData(raw, static_cast<int>(size)));
+        return true;
+    default:
+        return false;
+    }
+}
+
+void ClusterBroker::handleHello(Node& node, const QString& id) {
+    // A restarted node may reconnect before its old connection times out.
+    if (Node* previous = m_nodesById.value(id, nullptr)) {
+        std::cout << "Node " << id.toStdString() << " reconnected, dropping the old connection" << std::endl;
+        QIODevice* socket = previous->socket;
+        removeNode(previous);
+        if (auto* local = qobject_cast<QLocalSocket*>(socket)) {
+            local->abort();
+        } else if (auto* tcp = qobject_cast<QTcpSocket*>(socket)) {
+            tcp->abort();
+        }
+    }
+
+    node.id = id;
+    m_nodesById.insert(id, &node);
+
+    // Registry snapshot: the new node learns who is online elsewhere.
+    for (auto it = m_presence.cbegin(); it != m_presence.cend(); ++it) {
+        ClusterBus::Record record;
+        record.kind = ClusterBus::Kind::Presence;
+        record.username = it.key();
+        record.node = it.value().node;
+        record.online = true;
+        record.protocol = it.value().protocol;
+        QByteArray encoded;
+        ClusterBus::appendRecord(encoded, record);
+        send(node, encoded.constData(), encoded.size());
+    }
+    std::cout << "Node " << id.toStdString() << " joined (" << m_nodesById.size() << " nodes, "
+              << m_presence.size() << " users online)" << std::endl;
+}
+
+void ClusterBroker::setPresence(Node& node, const QString& username, bool online, WireProtocol protocol) {
+    auto it = m_presence.find(username);
+    if (online) {
+        // The user connected to this node while another still holds an old session.
+        if (it != m_presence.end() && it.value().node != node.id) {
+            if (Node* previous = m_nodesById.value(it.value().node, nullptr)) {
+                previous->users.remove(username);
+            }
+        }
+        m_presence.insert(username, Presence{node.id, protocol});
+        node.users.insert(username);
+    } else {
+        // Only the node the user is registered on may take them offline.
+        if (it == m_presence.end() || it.value().node != node.id) {
+            return;
+        }
+        m_presence.erase(it);
+        node.users.remove(username);
+    }
+
+    ClusterBus::Record record;
+    record.kind = ClusterBus::Kind::Presence;
+    record.username = username;
+    record.node = node.id;
+    record.online = online;
+    record.protocol = protocol;
+    QByteArray encoded;
+    ClusterBus::appendRecord(encoded, record);
+    broadcast(&node, encoded);
+}
+
+void ClusterBroker::send(Node& node, const char* data, qsizetype size) {
+    if (node.outbox.isEmpty()) {
+        m_dirty.append(&node);
+    }
+    node.outbox.append(data, static_cast<int>(size));
+}
+
+void ClusterBroker::broadcast(const Node* except, const QByteArray& record) {
+    for (auto it = m_nodesById.cbegin(); it != m_nodesById.cend(); ++it) {
+        if (it.value() != except) {
+            send(*it.value(), record.constData(), record.size());
+        }
+    }
+}
+
+void ClusterBroker::flush() {
+    for (Node* node : m_dirty) {
+        node->socket->write(node->outbox);
+        node->outbox.clear();
+    }
+    m_dirty.clear();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QVector>
+#include <memory>
+#include <unordered_map>
+#include "ClusterBus.h"
+
+class QIODevice;
+class QLocalServer;
+class QTcpServer;
+
+// Брокер кластера: реестр присутствия "пользователь -> узел" и ретранслятор
+// записей между узлами (ConnectServer). Один поток; всё, что пришло узлу за
+// одно чтение, копится в его исходящем буфере и уходит одним write().
+class ClusterBroker : public QObject {
+    Q_OBJECT
+
+public:
+    explicit ClusterBroker(QObject* parent = nullptr);
+    ~ClusterBroker() override;
+
+    bool listen(const ClusterBus::Address& address);
+    QString errorString() const { return m_error; }
+
+private:
+    struct Node {
+        QIODevice* socket = nullptr;
+        QString id;             // пусто до Hello
+        QSet<QString> users;    // кого узел держит сейчас (по реестру)
+        QByteArray inbox;
+        QByteArray outbox;
+    };
+
+    struct Presence {
+        QString node;
+        WireProtocol protocol = WireProtocol::Json;
+    };
+
+    void addNode(QIODevice* socket);
+    void onReadyRead(Node* node);
+    void removeNode(Node* node);
+    // false — узел нарушил протокол и отключается
+    bool handleRecord(Node& node, const ClusterBus::Record& record, const char* raw, qsizetype size);
+    void handleHello(Node& node, const QString& id);
+    void setPresence(Node& node, const QString& username, bool online, WireProtocol protocol);
+    void send(Node& node, const char* data, qsizetype size);
+    void broadcast(const Node* except, const QByteArray& record);
+    void flush();
+
+    QTcpServer* m_tcpServer = nullptr;
+    QLocalServer* m_localServer = nullptr;
+    QString m_error;
+
+    std::unordered_map<QIODevice*, std::unique_ptr<Node>> m_nodes;
+    QHash<QString, Node*> m_nodesById;
+    QHash<QString, Presence> m_presence;
+    QVector<Node*> m_dirty; // узлы с непустым outbox
+};
@@ -0,0 +1,48 @@
+// Cluster broker: keeps the presence registry (which node holds which user)
+// and relays forwarded frames between ConnectServer processes.
+#include "ClusterBroker.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+void signalHandler(int) {
+    QCoreApplication::quit();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("ConnectBroker");
+
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+
+    // Same address syntax as the servers' CONNECT_CLUSTER_BROKER, which is also the default.
+    const char* env_broker = std::getenv("CONNECT_CLUSTER_BROKER");
+    const QString defaultAddress = env_broker ? QString::fromLocal8Bit(env_broker)
+                                              : QStringLiteral("127.0.0.1:%1").arg(ClusterBus::kDefaultPort);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Presence registry and message bus for Connect Messenger cluster nodes");
+    parser.addHelpOption();
+    const QCommandLineOption listenOption("listen", "host:port, port or local:<socket name>.", "address",
+                                          defaultAddress);
+    parser.addOption(listenOption);
+    parser.process(app);
+
+    const ClusterBus::Address address = ClusterBus::Address::parse(parser.value(listenOption));
+    ClusterBroker broker;
+    if (!broker.listen(address)) {
+        std::cerr << "Failed to listen on " << parser.value(listenOption).toStdString() << ": "
+                  << broker.errorString().toStdString() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Cluster broker listening on " << address.toString().toStdString() << std::endl;
+    return app.exec();
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "WireProtocol.h"
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+// Шина между узлами кластера (ConnectServer <-> ConnectBroker). Поток
+// записей [u32 длина, big-endian][тело QDataStream] поверх TCP или
+// Unix-domain сокета; несколько записей уходят одним write().
+namespace ClusterBus {
+
+constexpr quint16 kDefaultPort = 9100;
+constexpr quint32 kMaxRecordBytes = 16u << 20; // больше — поток испорчен, соединение рвётся
+
+// "local:<имя>" — QLocalServer/QLocalSocket (Unix-domain сокет),
+// "host:port" или "port" — TCP
+struct Address {
+    bool local = false;
+    QString name; // local
+    QString host = QStringLiteral("127.0.0.1");
+    quint16 port = kDefaultPort;
+    bool valid = false;
+
+    static Address parse(const QString& text);
+    QString toString() const;
+};
+
+enum class Kind : quint8 {
+    Hello = 1,       // узел -> брокер: node
+    Presence,        // узел -> брокер: username, online, protocol; брокер -> узлы: + node
+    Forward,         // узел -> брокер -> узел node: кадр для usernames
+    GroupMembership  // узел -> брокер -> остальные узлы: group, username, online (= вступил)
+};
+
+struct Record {
+    Kind kind = Kind::Hello;
+    QString node;      // Hello — отправитель, Presence — узел пользователя, Forward — получатель
+    QString username;
+    QString group;
+    bool online = false;
+    WireProtocol protocol = WireProtocol::Json;
+
+    // Forward: один кадр на всех usernames, закодированный в нужные им протоколы
+    QStringList usernames;
+    bool hasText = false;
+    QString text;
+    bool hasBinary = false;
+    QByteArray binary;
+    // Forward личного сообщения (один получатель): узел получателя после
+    // записи в сокет помечает строку доставленной. Пишутся в конец записи —
+    // узлы без этих полей их пропускают
+    QString sender;
+    qint64 timestamp = 0;
+};
+
+// Дописывает запись в конец out (буфер пачки)
+void appendRecord(QByteArray& out, const Record& record);
+
+enum class ReadStatus { Record, Incomplete, Error };
+// Разбирает запись с позиции offset и сдвигает его; Incomplete — ждать данных
+ReadStatus readRecord(const QByteArray& buffer, qsizetype& offset, Record& record);
+
+} // namespace ClusterBus
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <chrono>
+#include <functional>
+#include <utility>
+#include <vector>
+#include "ClusterBus.h"
+#include "FrameWriter.h"
+#include "GroupDirectory.h"
+#include "RoutingTable.h"
+
+class QIODevice;
+class QTimer;
+
+// Связь узла кластера с брокером (ConnectBroker), свой QThread. Анонсирует
+// пользователей из RoutingTable, держит реплику присутствия остальных узлов
+// (маршрутизация решается локально, без запроса к брокеру) и пересылает
+// кадры пользователям других узлов. Записи от всех шардов копятся в одной
+// очереди и уходят одним write() за итерацию event loop связи.
+class ClusterLink : public QObject {
+    Q_OBJECT
+
+public:
+    struct Options {
+        ClusterBus::Address broker; // невалидный адрес — режим кластера выключен
+        QString nodeId;             // уникален в кластере
+        std::chrono::milliseconds reconnectInterval{1000};
+    };
+
+    // Пользователь другого узла и протокол его соединения
+    struct RemoteRoute {
+        QString node;
+        WireProtocol protocol = WireProtocol::Json;
+    };
+
+    ClusterLink(const Options& options, RoutingTable& routing, GroupDirectory& groups, QObject* parent = nullptr);
+    ~ClusterLink() override;
+
+    const QString& nodeId() const { return m_options.nodeId; }
+
+    // Пользователь другого узла вошёл или вышел (поток связи); задаётся до start()
+    using PresenceListener = std::function<void(const QString& username)>;
+    void setPresenceListener(PresenceListener listener) { m_presenceListener = std::move(listener); }
+
+    // Потокобезопасные, вызываются из шардов
+    bool remoteRoute(const QString& username, RemoteRoute& route) const;
+    // Пользователи из users, которые в сети на других узлах — одна блокировка
+    std::vector<std::pair<QString, RemoteRoute>> remoteRoutes(const QSet<QString>& users) const;
+    // frame закодирован в протокол получателя; узел получателя помечает
+    // сообщение sender с временем timestamp доставленным после записи в сокет
+    void forward(const QString& node, const QString& username, const Frame& frame, const QString& sender,
+                 qint64 timestamp);
+    void forward(const QString& node, const QStringList& usernames, const FanoutFrame& frame);
+    void announcePresence(const QString& username, bool online, WireProtocol protocol);
+    void announceMembership(const QString& group, const QString& username, bool joined);
+
+    // Вызываются только в потоке связи
+    void start();
+    void stop();
+
+private:
+    void connectToBroker();
+    void onConnected();
+    void onDisconnected();
+    void onReadyRead();
+    void handleRecord(const ClusterBus::Record& record);
+    void deliverLocal(const ClusterBus::Record& record);
+    void forwardFrame(const QString& node, const QStringList& usernames, const FanoutFrame& frame,
+                      const QString& sender, qint64 timestamp);
+    // false — нет связи с брокером, запись выброшена
+    bool enqueue(const ClusterBus::Record& record);
+    void flush();
+
+    Options m_options;
+    RoutingTable& m_routing;
+    GroupDirectory& m_groups;
+
+    PresenceListener m_presenceListener;
+
+    mutable QReadWriteLock m_remoteLock;
+    QHash<QString, RemoteRoute> m_remote;
+
+    // Очередь записей для брокера, пополняется из любого потока
+    QMutex m_outboxMutex;
+    QByteArray m_outbox;
+    int m_outboxRecords = 0;
+    bool m_flushScheduled = false;
+    bool m_connected = false;
+
+    QIODevice* m_socket = nullptr; // QTcpSocket или QLocalSocket
+    QByteArray m_inbox;
+    QTimer* m_reconnectTimer = nullptr;
+};
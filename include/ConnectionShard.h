@@ -0,0 +1,188 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QWebSocketServer>
+#include <QWebSocket>
+#include <QHash>
+#include <QPointer>
+#include <QString>
+#include <QStringList>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include "Deflate.h"
+#include "FrameWriter.h"
+#include "GroupDirectory.h"
+#include "HttpRequestParser.h"
+#include "MediaStore.h"
+#include "Metrics.h"
+#include "PresenceHub.h"
+#include "RateLimiter.h"
+#include "TimingWheel.h"
+#include "RoutingTable.h"
+#include "Session.h"
+#include "StaticAssetCache.h"
+#include "UserRateLimiter.h"
+
+class ClusterLink;
+class Database;
+class PersistenceQueue;
+class ReaderPool;
+class QTcpSocket;
+class QTimer;
+
+// Один event loop (свой QThread) со своей долей соединений: HTTP/WebSocket
+// мультиплексор, handshake, разбор JSON и маршрутизация для своих сокетов.
+// Сообщение пользователю с другого шарда доставляется через RoutingTable
+// и queued-вызов deliver() в потоке шарда-получателя, пользователю другого
+// узла кластера — через ClusterLink.
+class ConnectionShard : public QObject {
+    Q_OBJECT
+
+public:
+    struct Options {
+        DeflateOptions deflate;
+
+        // HTTP на общем порту
+        int maxHeaderBytes = 8192;
+        std::chrono::milliseconds headerTimeout{10000};    // все заголовки запроса (slowloris)
+        std::chrono::milliseconds keepAliveTimeout{30000}; // простой между запросами
+
+        // Исходящая очередь соединения: байты, отданные сокету, но ещё не
+        // ушедшие в сеть, плюс отложенные кадры истории
+        qint64 outboundHighWatermark = 1 << 20;  // выше — соединение перегружено
+        qint64 outboundLowWatermark = 256 << 10; // ниже — снова нормальное
+        qint64 outboundHardLimit = 16 << 20;     // выше — отключение сразу
+        std::chrono::milliseconds slowConsumerGrace{30000}; // перегружено дольше — отключение; 0 = не отключать
+        bool pauseHistoryWhenCongested = true;   // кадры history ждут нижнего порога
+        bool dropEphemeralWhenCongested = true;  // pong и rate_limited не отправляются
+
+        // Лимиты входящих запросов (ведра токенов)
+        RateLimits rateLimits;
+
+        // Живость WebSocket: молчащему дольше interval уходит ping, не
+        // ответившему за timeout — обрыв (полуоткрытые TCP-соединения);
+        // interval 0 — не проверять
+        std::chrono::milliseconds heartbeatInterval{30000};
+        std::chrono::milliseconds heartbeatTimeout{10000};
+    };
+
+    // cluster == nullptr — одиночный сервер
+    ConnectionShard(int index, PersistenceQueue& persistence, ReaderPool& readers, MediaStore& media,
+                    RoutingTable& routing, GroupDirectory& groups, UserRateLimiter& userRates,
+                    ClusterLink* cluster, PresenceHub& presence, const StaticAssetCache& assets,
+                    const Options& options, QObject* parent = nullptr);
+    ~ConnectionShard() override;
+
+    int index() const { return m_index; }
+
+    // Вызываются только в потоке шарда (через QMetaObject::invokeMethod)
+    void start(); // после запуска потока: таймеры шарда
+    void addConnection(qintptr socketDescriptor);
+    // frame — уже закодированный кадр; кодируется один раз на стороне отправителя.
+    // Записанный в сокет кадр помечает сообщение sender с временем timestamp
+    // доставленным (сохраняется недоставленным)
+    void deliver(const QString& username, const Frame& frame, const QString& sender, qint64 timestamp);
+    // Рассылка в группу: участники, чьи сокеты у этого шарда
+    void deliverGroup(const QStringList& usernames, const FanoutFrame& frame);
+    // Пачка изменений присутствия от PresenceHub: подписчикам шарда — разница
+    void applyPresence(const PresenceHub::Changes& changes);
+    void shutdown();
+
+private slots:
+    void onNewConnection();
+    void onLagProbe();
+    void onHeartbeatTick();
+
+private:
+    // Что делать с кадром, когда соединение перегружено
+    enum class Delivery {
+        Reliable,  // сообщения, ack, ошибки: всегда в сокет
+        Bulk,      // страницы истории и presence: ждут нижнего порога
+        Ephemeral  // pong, rate_limited: выбрасываются
+    };
+
+    void onHttpData(QTcpSocket* socket, HttpRequestParser& parser, QTimer* timer);
+    QByteArray httpResponse(const HttpRequestParser& request, bool keepAlive) const;
+    void onDisconnected(Session* session);
+    void onTextFrame(Session& session, const QString& message);
+    void onBinaryFrame(Session& session, const QByteArray& message);
+    void handleMessage(Session& session, const Request& request);
+    void handleGroupMembership(Session& session, const Request& request);
+    // Поиск по беседам пользователя: запрос и кодирование — в ReaderPool
+    void handleSearch(Session& session, const Request& request);
+    // Загрузка медиа: upload_begin и бинарные чанки уходят в MediaStore,
+    // его ответ возвращается в поток шарда в onUploadResult
+    void handleUploadBegin(Session& session, const Request& request);
+    void handleUploadChunk(Session& session, const QByteArray& frame);
+    void onUploadResult(Session& session, const MediaStore::Result& result);
+    // message_ack после фиксации (AckMode::AfterCommit), иначе nullptr
+    std::function<void(bool)> ackOnCommit(QWebSocket* client, WireProtocol protocol);
+    // Кодирует group_message по разу на протокол и раздаёт по шардам участников;
+    // timestamp — время сохранённой строки (микросекунды)
+    void fanOut(const QString& group, const QString& sender, const QString& text, long long timestamp,
+                const GroupDirectory::Members& members);
+    // Поток читателя: офлайн-очередь пользователя -> кадры pending_messages,
+    // затем отправка в потоке шарда и пометка доставленными
+    void loadPendingMessages(Database& db, QPointer<QWebSocket> client, WireProtocol protocol,
+                             const QString& username);
+    // Поток читателя: собеседники пользователя -> подписка и снимок presence
+    void loadContacts(Database& db, QPointer<QWebSocket> client, const QString& username);
+    // Подписывает сессию на присутствие contacts и шлёт их состояние
+    // (snapshot — полный список после auth)
+    void watchContacts(Session& session, const QStringList& contacts, bool snapshot);
+    void unwatchContacts(Session& session);
+    void sendPresence(Session& session, const QStringList& online, const QStringList& offline, bool snapshot);
+    // Лимиты запросов: кадр до разбора, затем запрос по типу;
+    // false — клиенту уже ушла ошибка rate_limited
+    bool admitFrame(Session& session);
+    bool admitRequest(Session& session, Wire::Type type);
+    void sendRateLimited(Session& session, quint32 retryAfterMs);
+    // Входящий кадр или pong: соединение живо
+    void touch(Session& session);
+    void checkHeartbeat(Session& session);
+    Session* findSession(QWebSocket* client) const;
+    // true — кадр записан в сокет (не отложен, не выброшен)
+    bool sendFrame(Session& session, const Frame& frame, Delivery delivery = Delivery::Reliable);
+    bool writeFrame(Session& session, const Frame& frame);
+    void onBytesWritten(Session& session, qint64 bytes);
+    void disconnectSlowConsumer(Session& session);
+    // Доставка на шард получателя; frame закодирован в target.protocol
+    void route(const RoutingTable::Route& target, const QString& username, const Frame& frame,
+               const QString& sender, qint64 timestamp);
+
+    int m_index;
+    PersistenceQueue& m_persistence;
+    ReaderPool& m_readers;
+    MediaStore& m_media;
+    RoutingTable& m_routing;
+    GroupDirectory& m_groups;
+    UserRateLimiter& m_userRates; // общие вёдра пользователей
+    ClusterLink* m_cluster;
+    PresenceHub& m_presence;
+    const StaticAssetCache& m_assets;
+    Options m_options;
+
+    QWebSocketServer* m_wsServer;
+    // Все соединения шарда и индекс авторизованных пользователей (только этого шарда)
+    std::unordered_map<QWebSocket*, std::unique_ptr<Session>> m_sessions;
+    QHash<QString, Session*> m_usersByName;
+    // Контакт -> сессии шарда, подписанные на его присутствие
+    QHash<QString, QSet<Session*>> m_watchers;
+    QElapsedTimer m_clock; // время для ведер токенов и колеса таймеров
+    // Проверки живости всех соединений шарда: один таймер на шард вместо
+    // QTimer на сокет
+    TimingWheel m_heartbeats;
+    QTimer* m_heartbeatTimer = nullptr;
+    // Переиспользуемый буфер для кадров переменного содержания (FrameWriter)
+    Frame m_frameBuffer;
+    // Переиспользуемый буфер сжатого кадра
+    QByteArray m_deflateBuffer;
+
+    ShardMetrics m_metrics;
+    // Проба задержки event loop: насколько позже срока сработал таймер
+    QTimer* m_lagProbe = nullptr;
+    std::chrono::steady_clock::time_point m_lagProbeDue;
+};
@@ -3,41 +3,117 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <unordered_map>
 
 // Forward declaration
 struct sqlite3;
+struct sqlite3_stmt;
 
 struct Message {
-    int id;
+    long long id = 0;
+    long long conversationId = 0; // беседа = упорядоченная пара id (user_a < user_b)
+    long long seq = 0;            // порядковый номер внутри беседы
     std::string sender;
-    std::string receiver;
+    std::string receiver;         // для сообщения группы — имя группы
     std::string text;
-    std::string timestamp;
+    long long timestamp = 0;      // эпоха, микросекунды; 0 при записи — текущее время
     std::string messageType; // "text", "image", "video", "voice"
     std::string mediaPath;  
+    bool delivered = true;   // false — получатель был офлайн, ждёт доставки после auth
 };
 
 struct Media {
-    int id;
+    int id = 0;
     std::string sender;
     std::string receiver;
     std::string path;
     std::string type; // "photo", "video", "voice"
-    std::string timestamp;
+    long long timestamp = 0; // эпоха, микросекунды
 };
 
+// Один экземпляр живёт всё время работы сервера: соединение открывается
+// один раз в initialize(), а подготовленные запросы кэшируются и
+// переиспользуются через sqlite3_reset вместо prepare/finalize на каждый вызов.
+// Файл работает в режиме WAL: одно соединение ReadWrite (поток записи
+// PersistenceQueue) и несколько ReadOnly (ReaderPool) читают параллельно.
+// Экземпляр не потокобезопасен — каждым соединением владеет один поток.
+//
+// Строки сообщений и медиа ссылаются на users.id, а не повторяют имена;
+// имя <-> id разрешается через кэш экземпляра (имена неизменны, id не
+// переиспользуются, поэтому кэш не устаревает). Время — целые микросекунды
+// эпохи.
 class Database {
 public:
-    Database(const std::string& dbPath = "data/messenger.db");
+    enum class OpenMode {
+        ReadWrite, // создаёт схему и включает WAL
+        ReadOnly   // только SELECT-запросы
+    };
+
+    Database(const std::string& dbPath = "data/messenger.db", OpenMode mode = OpenMode::ReadWrite);
     ~Database();
 
+    Database(const Database&) = delete;
+    Database& operator=(const Database&) = delete;
+
     bool initialize();
+
+    // Текущее время в формате столбцов created_at (микросекунды эпохи)
+    static long long currentTimestamp();
+
+    // Транзакции (group commit в PersistenceQueue)
+    bool beginTransaction();
+    bool commitTransaction();
+    void rollbackTransaction();
+    // Точка сохранения внутри транзакции: одна запись пачки, которую можно
+    // отменить, не теряя остальных
+    bool savepoint();
+    bool releaseSavepoint();
+    void rollbackToSavepoint();
     
     // Сообщения
     bool saveMessage(const std::string& sender, const std::string& receiver, 
                     const std::string& text, const std::string& messageType = "text",
-                    const std::string& mediaPath = "");
+                    const std::string& mediaPath = "", bool delivered = true, long long timestamp = 0);
     std::vector<Message> getMessages(const std::string& user1, const std::string& user2, int limit = 100);
+    // Постраничная история по ключу (keyset): сообщения строго до/после
+    // сообщения с указанным id, всегда от новых к старым
+    std::vector<Message> getMessagesBefore(const std::string& user1, const std::string& user2,
+                                           long long beforeId, int limit);
+    std::vector<Message> getMessagesAfter(const std::string& user1, const std::string& user2,
+                                          long long afterId, int limit);
+    // Недоставленные сообщения пользователю, от старых к новым, с id > afterId
+    // (частичный индекс: в нём только недоставленные строки)
+    std::vector<Message> getUndelivered(const std::string& receiver, long long afterId, int limit);
+    // Помечает доставленными все сообщения receiver с id <= upToId — одним UPDATE.
+    // Новые сообщения получают больший id, поэтому не задеваются.
+    bool markDelivered(const std::string& receiver, long long upToId);
+    // Помечает доставленным одно сообщение, отправленное получателю в сети:
+    // его id шарду неизвестен, поэтому ищется по отправителю и времени
+    // среди недоставленных receiver
+    bool markMessageDelivered(const std::string& receiver, const std::string& sender, long long timestamp);
+    // Полнотекстовый поиск (FTS5) по беседам username — всем или только с
+    // with. Слова запроса — через пробел, все обязательны, "слово*" — префикс.
+    // От самых релевантных среди 1000 самых новых совпадений (дальше страниц
+    // нет); в text — фрагмент с совпадениями между \x02 и \x03.
+    std::vector<Message> searchMessages(const std::string& username, const std::string& query,
+                                        const std::string& with, int offset, int limit);
+    // Добавляет в индекс поиска до limit ещё не проиндексированных сообщений
+    // (по порядку id) отдельной транзакцией. Сообщения попадают в поиск только
+    // после этого: поток записи вызывает его вслед за пачками и в простое.
+    // Возвращает число добавленных, -1 — ошибка.
+    int indexMessages(int limit);
+
+    // Группы. Сообщение группы хранится один раз, а не по копии на участника;
+    // группа создаётся при первом вступлении.
+    bool saveGroupMessage(const std::string& group, const std::string& sender, const std::string& text,
+                          const std::string& messageType = "text", const std::string& mediaPath = "",
+                          long long timestamp = 0);
+    bool addGroupMember(const std::string& group, const std::string& username);
+    bool removeGroupMember(const std::string& group, const std::string& username);
+    // Страница истории группы от новых к старым; beforeId == 0 — самая новая
+    std::vector<Message> getGroupMessages(const std::string& group, long long beforeId, int limit);
+    // Все пары (группа, участник) — для загрузки состава групп при старте
+    std::vector<std::pair<std::string, std::string>> getGroupMembers();
     
     // Медиафайлы
     bool saveMedia(const std::string& sender, const std::string& receiver,
@@ -46,11 +122,42 @@ public:
     
     // Пользователи
     bool userExists(const std::string& username);
+    // Собеседники: все, с кем есть беседа (для присутствия)
+    std::vector<std::string> getContacts(const std::string& username, int limit);
     bool createUser(const std::string& username);
+    // Создаёт пользователя, если его ещё нет (без предварительного SELECT)
+    bool ensureUser(const std::string& username);
 
 private:
     std::string m_dbPath;
+    OpenMode m_mode;
     sqlite3* m_db;
+    // SQL-текст (статическая строка) -> подготовленный запрос
+    std::unordered_map<const char*, sqlite3_stmt*> m_statements;
+    // Кэш пользователей; сбрасывается при откате (id из отменённой вставки
+    // может достаться другому имени)
+    std::unordered_map<std::string, long long> m_userIds;
+    std::unordered_map<long long, std::string> m_usernames;
+    bool m_searchIndex = false; // есть messages_fts (SQLite собран с FTS5)
     
     void createTables();
+    void createSchema();
+    void migrateSchema();
+    bool migrateToV5(int version);
+    bool migrateToV6();
+    void finishMigrationV6();
+    bool migrateToV7();
+    int schemaVersion();
+    bool tableExists(const char* table);
+    bool insertMessage(const std::string& sender, const std::string& receiver,
+                       const std::string& text, const std::string& messageType,
+                       const std::string& mediaPath, bool delivered, long long timestamp);
+    // 0 — нет такого пользователя (create: создаёт; только соединение ReadWrite)
+    long long userId(const std::string& username, bool create = false);
+    const std::string& usernameOf(long long id);
+    void cacheUser(const std::string& username, long long id);
+    std::vector<Message> readMessages(sqlite3_stmt* stmt);
+    sqlite3_stmt* statement(const char* sql);
+    bool execute(const char* sql);
+    void finalizeStatements();
 }; 
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <QByteArray>
+#include <memory>
+
+struct z_stream_s;
+
+// Сжатие кадров сервер -> клиент по схеме permessage-deflate (RFC 7692):
+// raw DEFLATE, Z_SYNC_FLUSH, хвост 00 00 FF FF отрезается. Сжатый кадр
+// уходит бинарным WebSocket-кадром с первым байтом kCompressedFrameMarker
+// (ни JSON, ни CBOR-карта с него не начинаются).
+struct DeflateOptions {
+    bool enabled = true;
+    int windowBits = 15;         // 9..15; память сжатия ~ 2^(windowBits+2) на соединение
+    bool contextTakeover = true; // словарь переживает кадр (лучше сжатие, больше памяти)
+    int threshold = 256;         // кадры короче уходят как есть (pong, ack)
+    int level = 6;
+    int memLevel = 8;
+};
+
+inline constexpr char kCompressedFrameMarker = '\0';
+
+// Одно соединение, один поток; создаётся при первом кадре выше порога
+class MessageDeflater {
+public:
+    explicit MessageDeflater(const DeflateOptions& options);
+    ~MessageDeflater();
+
+    MessageDeflater(const MessageDeflater&) = delete;
+    MessageDeflater& operator=(const MessageDeflater&) = delete;
+
+    // out = маркер + сжатые данные; false при ошибке zlib
+    bool compress(const char* data, int size, QByteArray& out);
+
+private:
+    std::unique_ptr<z_stream_s> m_stream;
+    bool m_valid = false;
+    bool m_contextTakeover;
+};
+
+// Клиентская сторона: принимает кадр без маркера
+class MessageInflater {
+public:
+    MessageInflater();
+    ~MessageInflater();
+
+    MessageInflater(const MessageInflater&) = delete;
+    MessageInflater& operator=(const MessageInflater&) = delete;
+
+    bool decompress(const char* data, int size, QByteArray& out);
+
+private:
+    std::unique_ptr<z_stream_s> m_stream;
+    bool m_valid = false;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "WireProtocol.h"
+#include <QCborStreamWriter>
+#include <QLatin1String>
+#include <QString>
+#include <cstddef>
+#include <optional>
+
+// Пишет кадр прямо в переиспользуемый буфер шарда, без построения
+// QJsonObject: компактный JSON (ключи — имена Wire::Key, строки
+// экранируются) или CBOR-карту с числовыми ключами.
+class FrameWriter {
+public:
+    // Очищает буфер нужного протокола, сохраняя выделенную память
+    FrameWriter(Frame& frame, WireProtocol protocol);
+
+    FrameWriter& field(Wire::Key key, Wire::Type value);
+    FrameWriter& field(Wire::Key key, QLatin1String value);
+    FrameWriter& field(Wire::Key key, const QString& value);
+    FrameWriter& field(Wire::Key key, qint64 value);
+    FrameWriter& field(Wire::Key key, bool value);
+    FrameWriter& field(Wire::Key key, std::nullptr_t);
+
+    // Массив объектов: beginArray(key), затем beginObject()/endObject() на элемент;
+    // массив строк: element() на элемент
+    FrameWriter& beginArray(Wire::Key key);
+    FrameWriter& endArray();
+    FrameWriter& element(const QString& value);
+    FrameWriter& beginObject();
+    FrameWriter& endObject();
+
+    // Закрывает кадр и возвращает его
+    const Frame& finish();
+
+private:
+    void key(Wire::Key key);
+    void separator();
+    void appendEscaped(const QString& value);
+
+    Frame& m_frame;
+    std::optional<QCborStreamWriter> m_cbor; // только для Binary
+    bool m_first = true;
+};
+
+// Кадр рассылки, закодированный один раз на каждый нужный получателям
+// протокол; один экземпляр на всех получателей, шарды и узлы кластера
+struct FanoutFrame {
+    Frame frames[2]; // индекс — WireProtocol
+    bool encoded[2] = {false, false};
+
+    const Frame* get(WireProtocol protocol) const {
+        const int i = static_cast<int>(protocol);
+        return encoded[i] ? &frames[i] : nullptr;
+    }
+};
+
+// Заранее закодированные постоянные ответы (кодируются один раз на процесс
+// для каждого протокола)
+namespace Frames {
+
+const Frame& authSuccess(WireProtocol protocol);
+const Frame& messageAck(WireProtocol protocol);
+
+const Frame& errorInvalidFrame(WireProtocol protocol);
+const Frame& errorNotAuthenticated(WireProtocol protocol);
+const Frame& errorUnknownType(WireProtocol protocol);
+const Frame& errorStoreFailed(WireProtocol protocol);
+const Frame& errorGroupRequired(WireProtocol protocol);
+const Frame& errorNotGroupMember(WireProtocol protocol);
+const Frame& errorSearchQueryRequired(WireProtocol protocol);
+const Frame& errorInvalidUpload(WireProtocol protocol);
+const Frame& errorUploadTooLarge(WireProtocol protocol);
+
+} // namespace Frames
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QString>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Состав групп в памяти, общий для всех шардов: рассылка в группу не
+// обращается к базе. Состав — неизменяемый снимок: вступление и выход
+// (редкие) подменяют его копией, а рассылка обходит полученный снимок
+// без блокировки. В базу изменения пишет PersistenceQueue.
+class GroupDirectory {
+public:
+    using Members = QSet<QString>;
+
+    // Загрузка при старте: пары (группа, участник) из Database::getGroupMembers()
+    void load(const std::vector<std::pair<std::string, std::string>>& members);
+
+    // nullptr, если группы нет
+    std::shared_ptr<const Members> members(const QString& group) const;
+    bool isMember(const QString& group, const QString& username) const;
+
+    // false — уже участник / не был участником
+    bool join(const QString& group, const QString& username);
+    bool leave(const QString& group, const QString& username);
+
+private:
+    mutable QReadWriteLock m_lock;
+    QHash<QString, std::shared_ptr<const Members>> m_groups;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <QByteArray>
+#include <QPair>
+#include <QVector>
+
+// Инкрементальный разбор заголовков HTTP/1.x-запроса на общем порту.
+// Байты не забираются из сокета (peek): при WebSocket upgrade они ещё нужны
+// QWebSocketServer. Между вызовами запоминается, докуда уже искали конец
+// заголовков, так что запрос, пришедший по частям, не сканируется заново.
+class HttpRequestParser {
+public:
+    enum class Status {
+        NeedMore,  // конец заголовков ещё не пришёл
+        Complete,  // заголовки разобраны, см. headerLength()
+        TooLarge,  // заголовки длиннее maxHeaderBytes -> 431
+        Malformed  // -> 400
+    };
+
+    explicit HttpRequestParser(int maxHeaderBytes = 8192);
+
+    // buffered — все непрочитанные байты текущего запроса (с первого байта)
+    Status parse(const QByteArray& buffered);
+    // К следующему запросу на том же соединении (keep-alive)
+    void reset();
+
+    // Пришёл ли хоть один байт текущего запроса
+    bool started() const { return m_scanned > 0; }
+    int maxHeaderBytes() const { return m_maxHeaderBytes; }
+
+    // Доступны после Complete
+    const QByteArray& method() const { return m_method; }
+    const QByteArray& path() const { return m_path; } // без query string
+    // Имя — в нижнем регистре; пусто, если заголовка нет
+    QByteArray header(const QByteArray& lowerName) const;
+    int headerLength() const { return m_headerLength; }
+    qint64 contentLength() const { return m_contentLength; }
+    // Есть тело: Content-Length > 0 или любой Transfer-Encoding (длину
+    // chunked-тела заранее не узнать — соединение закрывается после ответа)
+    bool hasBody() const { return m_contentLength > 0 || m_chunked; }
+    bool keepAlive() const { return m_keepAlive; }
+    bool isWebSocketUpgrade() const { return m_upgrade; }
+
+private:
+    bool parseHeaders(const QByteArray& buffered);
+
+    int m_maxHeaderBytes;
+    int m_scanned = 0;
+    int m_headerLength = 0;
+
+    QByteArray m_method;
+    QByteArray m_path;
+    QVector<QPair<QByteArray, QByteArray>> m_headers;
+    qint64 m_contentLength = 0;
+    bool m_chunked = false; // есть Transfer-Encoding
+    bool m_keepAlive = false;
+    bool m_upgrade = false;
+};
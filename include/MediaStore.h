@@ -0,0 +1,117 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+class QCryptographicHash;
+class QFile;
+
+// Приём медиафайлов, загружаемых чанками (Wire::kUploadChunkMarker).
+// Файлы хранятся по содержимому: <root>/<первые 2 hex>/<sha256>, одинаковые
+// файлы — один раз. Рядом, в <sha256>.owners, — кто его загружал: без
+// передачи (по объявленному sha256) принимается только свой файл, иначе
+// по хешу можно было бы проверить, есть ли чужой файл, и взять его себе. Загрузка пишется прямо в <root>/partial/<upload_id>.part
+// и хешируется по мере поступления; в памяти — только текущий чанк, поэтому
+// расход памяти не зависит от размера файла. Загрузку можно продолжить с
+// принятого смещения после обрыва, перезапуска или с другого узла (partial
+// лежит рядом с файлами, описание — в <upload_id>.meta).
+//
+// Все операции с файлами — в одном своём потоке, не в event loop; результат
+// передаётся колбэком в этом потоке (шард пересылает его к себе, как
+// ReaderPool).
+class MediaStore {
+public:
+    struct Options {
+        QString root = QStringLiteral("media/uploads");
+        qint64 maxUploadBytes = 100 << 20;
+        int chunkBytes = 256 << 10;     // наибольший чанк
+        int window = 4;                 // чанков соединения в обработке одновременно
+        std::chrono::minutes idleClose{5};   // открытая загрузка без чанков — файл закрывается
+        std::chrono::hours partialTtl{24};   // недозагруженный файл удаляется
+    };
+
+    struct Begin {
+        QString owner;
+        QString receiver;
+        QString mediaType;
+        qint64 size = 0;
+        QByteArray sha256;   // 32 байта или пусто
+        QByteArray uploadId; // kUploadIdBytes байт — продолжить; пусто — новая
+    };
+
+    struct Result {
+        enum class Status {
+            Ready,    // begin: загрузка открыта, offset — откуда слать
+            Progress, // чанк принят (или смещение не то: offset — ожидаемое)
+            Complete, // файл принят: path, sha256
+            Error     // error — текст для клиента; загрузку нужно начать заново
+        };
+
+        Status status = Status::Error;
+        QByteArray uploadId;
+        qint64 offset = 0;
+        // Complete
+        QString owner;
+        QString receiver;
+        QString mediaType;
+        QString path;          // относительно root
+        QByteArray sha256;
+        bool deduplicated = false; // такой файл уже был, новый не записан (только для метрик)
+        bool reused = false;       // begin: свой файл владельца, данные не передавались
+        const char* error = nullptr;
+    };
+
+    using Callback = std::function<void(const Result&)>;
+
+    explicit MediaStore(const Options& options);
+    ~MediaStore();
+
+    MediaStore(const MediaStore&) = delete;
+    MediaStore& operator=(const MediaStore&) = delete;
+
+    bool start();
+    void stop();
+
+    const Options& options() const { return m_options; }
+
+    void begin(Begin request, Callback done);
+    // frame — кадр чанка целиком (данные после заголовка), без копирования
+    void write(QByteArray uploadId, QString owner, qint64 offset, QByteArray frame, Callback done);
+
+private:
+    struct Upload;
+    using Task = std::function<void()>;
+
+    void post(Task task);
+    void run();
+    void doBegin(const Begin& request, const Callback& done);
+    void doWrite(const QByteArray& uploadId, const QString& owner, qint64 offset,
+                 const QByteArray& frame, const Callback& done);
+    // Загрузка из памяти или с диска (после перезапуска / с другого узла)
+    Upload* find(const QByteArray& uploadId);
+    Result finish(const QByteArray& uploadId, Upload& upload);
+    void discard(const QByteArray& uploadId);
+    bool isOwner(const QByteArray& sha256, const QString& owner) const;
+    void addOwner(const QByteArray& sha256, const QString& owner);
+    static QByteArray newUploadId();
+    void sweep();
+    QString blobPath(const QByteArray& sha256) const;
+    QString partialPath(const QByteArray& uploadId, const char* suffix) const;
+
+    Options m_options;
+    std::unordered_map<std::string, std::unique_ptr<Upload>> m_uploads; // ключ — upload_id в hex
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::deque<Task> m_tasks;
+    bool m_stopping = false;
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Метрики в формате Prometheus (GET /metrics). Запись — relaxed-атомики без
+// блокировок и аллокаций, поэтому остаётся включённой в продакшене. Горячие
+// метрики соединений живут в ShardMetrics своего шарда (пишет один поток,
+// кэш-линии не делятся); при выдаче /metrics шарды суммируются.
+
+// Гистограмма с фиксированными верхними границами бакетов (в единицах
+// записи: наносекунды или байты) и бакетом +Inf.
+class Histogram {
+public:
+    explicit Histogram(std::vector<std::uint64_t> bounds);
+
+    void observe(std::uint64_t value);
+
+    // Неблокирующий снимок; к снимку можно прибавить другие гистограммы
+    struct Snapshot {
+        std::vector<std::uint64_t> buckets; // не накопительные, последний — +Inf
+        std::uint64_t count = 0;
+        std::uint64_t sum = 0;
+    };
+    void addTo(Snapshot& snapshot) const;
+
+    const std::vector<std::uint64_t>& bounds() const { return m_bounds; }
+
+    // Границы по умолчанию: задержки 10 мкс .. 2.5 с, размеры 64 Б .. 1 МБ,
+    // получатели рассылки 1 .. 10000
+    static std::vector<std::uint64_t> latencyBounds();
+    static std::vector<std::uint64_t> sizeBounds();
+    static std::vector<std::uint64_t> fanoutBounds();
+
+private:
+    std::vector<std::uint64_t> m_bounds;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> m_buckets;
+    std::atomic<std::uint64_t> m_count{0};
+    std::atomic<std::uint64_t> m_sum{0};
+};
+
+// Записывает время жизни объекта (в наносекундах) в гистограмму
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& histogram)
+        : m_histogram(histogram), m_start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        m_histogram.observe(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count()));
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Histogram& m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Метрики одного шарда (event loop): пишутся только его потоком
+struct ShardMetrics {
+    // Порядок совпадает с kRequestTypeNames
+    enum RequestType { Auth, Message, History, Search, Ping, Group, Other, RequestTypeCount };
+
+    ShardMetrics();
+
+    Histogram requests[RequestTypeCount];   // время handleMessage, нс
+    Histogram outboundFrameBytes;           // размер кадра до сжатия
+    std::atomic<std::uint64_t> outboundWireBytes{0}; // после сжатия
+    std::atomic<std::uint64_t> invalidFrames{0};
+    std::atomic<std::uint64_t> connectionsAccepted{0};
+    std::atomic<std::int64_t> tcpConnections{0};
+    std::atomic<std::int64_t> webSocketConnections{0};
+    std::atomic<std::int64_t> authenticatedUsers{0};
+    std::atomic<std::int64_t> outboundQueuedBytes{0};   // ещё не ушло в сеть, по всем соединениям
+    std::atomic<std::int64_t> congestedConnections{0};  // выше верхнего порога очереди
+    std::atomic<std::uint64_t> droppedFrames{0};        // pong, не отправленные перегруженным
+    std::atomic<std::uint64_t> slowConsumerDisconnects{0};
+    Histogram eventLoopLag;                 // опоздание таймера-пробы, нс
+    Histogram groupFanoutRecipients;        // онлайн-участники на одно group_message
+    std::atomic<std::uint64_t> presenceFrames{0}; // кадры presence (снимки и изменения)
+    std::atomic<std::uint64_t> rateLimitedConnection{0}; // отклонено лимитом соединения
+    std::atomic<std::uint64_t> rateLimitedUser{0};       // отклонено лимитом пользователя
+    std::atomic<std::uint64_t> heartbeatPings{0};        // ping сервера молчащим соединениям
+    std::atomic<std::uint64_t> idleDisconnects{0};       // не ответили на ping
+    std::atomic<std::uint64_t> uploadBytes{0};           // данные чанков загрузки, переданные на запись
+    std::atomic<std::uint64_t> uploadsStored{0};         // загрузки, записанные новым файлом
+    std::atomic<std::uint64_t> uploadsDeduplicated{0};   // загрузки уже хранившегося файла
+};
+
+class Metrics {
+public:
+    static Metrics& instance();
+
+    // Пишут поток записи (saveMessage) и пул чтения (getMessages, userExists,
+    // searchMessages)
+    Histogram dbSaveMessage;
+    Histogram dbGetMessages;
+    Histogram dbUserExists;
+    Histogram dbSearchMessages;
+
+    // Пишет PresenceHub: пользователей в одной пачке изменений
+    Histogram presenceBatchChanges;
+
+    // Пишет поток связи с брокером (режим кластера)
+    Histogram clusterBatchRecords;                        // записей в одном write() на шину
+    std::atomic<std::uint64_t> clusterForwarded{0};       // записи Forward на другие узлы
+    std::atomic<std::uint64_t> clusterReceived{0};        // записи Forward с других узлов
+    std::atomic<std::uint64_t> clusterDropped{0};         // не отправлено: нет связи с брокером
+    std::atomic<std::int64_t> clusterRemoteUsers{0};      // пользователи на других узлах
+    std::atomic<std::int64_t> clusterBrokerConnected{0};
+
+    void attach(const ShardMetrics* shard);
+    void detach(const ShardMetrics* shard);
+
+    // Текстовый формат Prometheus 0.0.4
+    std::string render() const;
+
+private:
+    Metrics();
+
+    mutable std::mutex m_mutex; // только список шардов
+    std::vector<const ShardMetrics*> m_shards;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Database.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Асинхронная запись сообщений (write-behind): обработчики только ставят
+// сообщение в очередь, а отдельный поток пишет их пачками в одной
+// транзакции — по размеру пачки или по истечении maxBatchDelay.
+// Ошибка одной записи не отменяет остальные: пачка переписывается с точкой
+// сохранения на каждую запись, и false получает только она. Транзакция,
+// которую не удалось начать или зафиксировать (база занята другим узлом),
+// повторяется с паузой до maxAttempts раз.
+// Это единственное пишущее соединение с базой: все INSERT идут через него.
+// Индекс поиска он же дополняет вслед за записью (Database::indexMessages):
+// в простое, а под нагрузкой — как только отставание дойдёт до
+// searchIndexBatch сообщений.
+class PersistenceQueue {
+public:
+    // Когда отправлять message_ack клиенту
+    enum class AckMode {
+        AfterEnqueue, // сразу после постановки в очередь
+        AfterCommit   // после фиксации транзакции на диске
+    };
+
+    struct Options {
+        std::size_t maxBatchSize = 512;
+        std::chrono::milliseconds maxBatchDelay{5};
+        AckMode ackMode = AckMode::AfterCommit;
+        int searchIndexBatch = 2000; // сообщений в одной транзакции индексации
+        int maxAttempts = 5;                      // попыток транзакции пачки
+        std::chrono::milliseconds retryBackoff{50}; // пауза перед второй, дальше вдвое больше
+    };
+
+    // Вызывается в потоке записи после фиксации (или ошибки) пачки
+    using CommitCallback = std::function<void(bool committed)>;
+
+    PersistenceQueue(const std::string& dbPath, const Options& options);
+    ~PersistenceQueue();
+
+    PersistenceQueue(const PersistenceQueue&) = delete;
+    PersistenceQueue& operator=(const PersistenceQueue&) = delete;
+
+    bool start();
+    // Дописывает всё, что осталось в очереди, и останавливает поток
+    void stop();
+
+    void enqueue(Message message, CommitCallback onCommitted = nullptr);
+    // Регистрация пользователя при auth (INSERT OR IGNORE). onCommitted
+    // вызывается, когда зафиксировано и всё, что было в очереди раньше, —
+    // после него офлайн-сообщения пользователю уже видны читателям.
+    void enqueueUser(std::string username, CommitCallback onCommitted = nullptr);
+    // Офлайн-сообщения отправлены: Database::markDelivered(receiver, upToId)
+    void enqueueMarkDelivered(std::string receiver, long long upToId);
+    // Сообщение ушло в сокет получателя в сети: Database::markMessageDelivered.
+    // Запись идёт после сохранения сообщения — очередь сохраняет порядок.
+    void enqueueMarkMessageDelivered(std::string receiver, std::string sender, long long timestamp);
+    // Сообщение группы (message.receiver — имя группы), одна строка на сообщение
+    void enqueueGroupMessage(Message message, CommitCallback onCommitted = nullptr);
+    void enqueueGroupMembership(std::string group, std::string username, bool join);
+    // Принятый медиафайл: строка media (Database::saveMedia)
+    void enqueueMedia(Media media, CommitCallback onCommitted = nullptr);
+
+    AckMode ackMode() const { return m_options.ackMode; }
+
+private:
+    struct Entry {
+        enum class Kind { SaveMessage, EnsureUser, MarkDelivered, MarkMessageDelivered, SaveGroupMessage,
+                          JoinGroup, LeaveGroup, SaveMedia };
+
+        Kind kind;
+        Message message;      // SaveMessage, SaveGroupMessage, MarkMessageDelivered
+        std::string username; // EnsureUser, MarkDelivered, JoinGroup, LeaveGroup
+        std::string group;    // JoinGroup, LeaveGroup
+        Media media;          // SaveMedia
+        long long upToId = 0; // MarkDelivered
+        CommitCallback onCommitted;
+    };
+
+    void push(Entry entry);
+    void run();
+    void flush(std::vector<Entry>& batch);
+    enum class Outcome { Committed, EntryFailed, TransactionFailed };
+    // Одна попытка транзакции с записями, у которых ok == true. isolated —
+    // каждая в своей точке сохранения; иначе первая ошибка отменяет всё
+    Outcome write(const std::vector<Entry>& batch, std::vector<char>& ok, bool isolated);
+    bool apply(const Entry& entry);
+    void indexMessages();
+
+    Options m_options;
+    std::unique_ptr<Database> m_database;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::vector<Entry> m_pending;
+    bool m_stopping = false;
+
+    // Только поток записи
+    bool m_indexBacklog = true;  // возможно, не всё проиндексировано (после старта — миграция)
+    int m_unindexed = 0;         // сохранено сообщений после последней индексации
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QVector>
+#include <chrono>
+#include "RoutingTable.h"
+
+class ClusterLink;
+class ConnectionShard;
+
+// Сводит изменения присутствия за окно (window) в одну пачку на все шарды:
+// кто вошёл и вышел за окно, с итоговым состоянием на момент рассылки.
+// Шарды сами находят своих подписчиков и шлют им разницу с тем, что клиент
+// уже видел, поэтому шторм переподключений даёт не больше одного кадра
+// presence на подписчика за окно, а не по кадру на каждое событие.
+// Живёт в главном потоке.
+class PresenceHub : public QObject {
+    Q_OBJECT
+
+public:
+    using Changes = QHash<QString, bool>; // пользователь -> в сети
+
+    PresenceHub(RoutingTable& routing, std::chrono::milliseconds window, QObject* parent = nullptr);
+
+    // До start(): пользователи других узлов тоже считаются в сети
+    void setCluster(ClusterLink* cluster) { m_cluster = cluster; }
+    void start(const QVector<ConnectionShard*>& shards);
+    void stop();
+
+    // Потокобезопасные
+    void markChanged(const QString& username);
+    // В сети на этом узле или (в кластере) на другом
+    bool isOnline(const QString& username) const;
+    // Те из users, кто в сети, — одной блокировкой на таблицу
+    QSet<QString> onlineAmong(const QSet<QString>& users) const;
+
+private:
+    void flush();
+
+    RoutingTable& m_routing;
+    ClusterLink* m_cluster = nullptr;
+    std::chrono::milliseconds m_window;
+    QVector<ConnectionShard*> m_shards;
+
+    QMutex m_mutex;
+    QSet<QString> m_dirty;
+    bool m_scheduled = false; // окно открыто, flush() уже запланирован
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <QtGlobal>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// Скорость и запас ведра токенов; perSecond <= 0 — без ограничения
+struct RateLimit {
+    double perSecond = 0;
+    double burst = 0;
+
+    bool enabled() const { return perSecond > 0; }
+
+    // "rate" или "rate/burst" (запас по умолчанию — секунда скорости); "0" — без ограничения
+    static bool parse(const char* text, RateLimit& limit) {
+        char* end = nullptr;
+        const double rate = std::strtod(text, &end);
+        if (end == text || rate < 0) {
+            return false;
+        }
+        double burst = rate;
+        if (*end == '/') {
+            const char* start = end + 1;
+            burst = std::strtod(start, &end);
+            if (end == start || burst < 1) {
+                return false;
+            }
+        }
+        if (*end != '\0') {
+            return false;
+        }
+        limit.perSecond = rate;
+        limit.burst = std::max(1.0, burst);
+        return true;
+    }
+};
+
+// Лимиты запросов, проверяемые шардом до разбора запроса (connection) и
+// после него, по типу: на соединение и на пользователя (все его сессии
+// на узле, см. UserRateLimiter)
+struct RateLimits {
+    RateLimit connection{100, 200}; // любые кадры соединения
+    RateLimit message{20, 50};      // message, group_message
+    RateLimit history{5, 20};
+    RateLimit control{2, 10};       // auth, group_join, group_leave
+    RateLimit userMessage{30, 60};
+    RateLimit userHistory{10, 30};
+};
+
+// 8 байт: запас токенов и время последнего пополнения в миллисекундах
+// часов владельца (шарда или UserRateLimiter). Пополняется лениво при проверке — без таймеров и аллокаций.
+class TokenBucket {
+public:
+    // false — токена нет; retryAfterMs — через сколько он появится
+    bool take(const RateLimit& limit, quint32 nowMs, quint32& retryAfterMs) {
+        if (!limit.enabled()) {
+            return true;
+        }
+        const float burst = static_cast<float>(limit.burst);
+        if (m_tokens < 0) {
+            m_tokens = burst; // первый запрос: полный запас
+        } else {
+            const quint32 elapsed = nowMs - m_updated; // переполнение часов безопасно
+            m_tokens = std::min(burst, m_tokens + static_cast<float>(elapsed * limit.perSecond / 1000.0));
+        }
+        m_updated = nowMs;
+        if (m_tokens >= 1.0f) {
+            m_tokens -= 1.0f;
+            return true;
+        }
+        retryAfterMs = static_cast<quint32>(std::ceil((1.0f - m_tokens) * 1000.0 / limit.perSecond));
+        return false;
+    }
+
+    // Запас к моменту nowMs полный: ведро можно выбросить, ничего не потеряв
+    bool full(const RateLimit& limit, quint32 nowMs) const {
+        if (m_tokens < 0 || !limit.enabled()) {
+            return true;
+        }
+        const quint32 elapsed = nowMs - m_updated;
+        return m_tokens + elapsed * limit.perSecond / 1000.0 >= limit.burst;
+    }
+
+private:
+    float m_tokens = -1.0f; // < 0 — ещё не использовалось
+    quint32 m_updated = 0;
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Database.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Пул потоков с read-only соединениями (WAL) для запросов истории и медиа,
+// чтобы долгий SELECT не останавливал event loop. Задача получает
+// соединение своего потока; результат задача сама отправляет обратно
+// в поток сокета (QMetaObject::invokeMethod).
+class ReaderPool {
+public:
+    using Task = std::function<void(Database&)>;
+
+    ReaderPool(const std::string& dbPath, std::size_t size);
+    ~ReaderPool();
+
+    ReaderPool(const ReaderPool&) = delete;
+    ReaderPool& operator=(const ReaderPool&) = delete;
+
+    bool start();
+    void stop();
+
+    void submit(Task task);
+
+private:
+    void run(Database& db);
+
+    std::string m_dbPath;
+    std::size_t m_size;
+    std::vector<std::unique_ptr<Database>> m_connections;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::deque<Task> m_tasks;
+    bool m_stopping = false;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QString>
+#include <functional>
+#include <utility>
+#include <vector>
+#include "WireProtocol.h"
+
+class ConnectionShard;
+
+// Общая для всех шардов таблица "пользователь -> шард, который держит его
+// сокет". Чтение (маршрутизация каждого сообщения) идёт под read-lock,
+// запись — только при auth и отключении.
+class RoutingTable {
+public:
+    // Шард пользователя и протокол его соединения: отправитель кодирует
+    // кадр сразу в формате получателя
+    struct Route {
+        ConnectionShard* shard = nullptr;
+        WireProtocol protocol = WireProtocol::Json;
+    };
+
+    // Наблюдатель изменений (режим кластера: анонс присутствия брокеру).
+    // Вызывается под write-lock, поэтому видит изменения в порядке таблицы;
+    // должен только поставить запись в очередь. Задаётся до запуска шардов.
+    using Listener = std::function<void(const QString& username, bool online, WireProtocol protocol)>;
+    void setListener(Listener listener);
+
+    void registerUser(const QString& username, ConnectionShard* shard, WireProtocol protocol);
+    // Удаляет запись, только если пользователь всё ещё закреплён за этим шардом
+    // (он мог переподключиться на другой шард)
+    void unregisterUser(const QString& username, ConnectionShard* shard);
+
+    // shard == nullptr, если пользователь не в сети
+    Route routeFor(const QString& username) const;
+    // Онлайн-пользователи из users с маршрутами — одна блокировка на всю
+    // рассылку в группу, а не по одной на участника
+    std::vector<std::pair<QString, Route>> onlineRoutes(const QSet<QString>& users) const;
+    int size() const;
+    // Обход под read-lock: изменения (и их анонсы) не вклиниваются в обход
+    void forEach(const std::function<void(const QString&, const Route&)>& visit) const;
+
+private:
+    mutable QReadWriteLock m_lock;
+    QHash<QString, Route> m_users;
+    Listener m_listener;
+};
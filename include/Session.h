@@ -0,0 +1,55 @@
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <deque>
+#include <memory>
+#include "Deflate.h"
+#include "RateLimiter.h"
+#include "TimingWheel.h"
+#include "WireProtocol.h"
+
+class QTimer;
+class QWebSocket;
+
+// Состояние одного WebSocket-соединения. Создаётся шардом при подключении,
+// указатель захватывается в обработчиках сигналов сокета, поэтому поиск
+// отправителя не требует обхода списка онлайн-пользователей.
+struct Session {
+    QWebSocket* socket = nullptr;
+    QString username; // пусто до успешного auth
+    WireProtocol protocol = WireProtocol::Json;
+    bool deflateRequested = false;             // клиент прислал "compression": "deflate"
+    std::unique_ptr<MessageDeflater> deflater; // создаётся при первом крупном кадре
+
+    // Исходящая очередь (пороги — в ConnectionShard::Options)
+    qint64 bufferedBytes = 0;    // отдано QWebSocket, ещё не ушло в сеть
+    std::deque<Frame> deferred;  // кадры истории, ждущие нижнего порога
+    qint64 deferredBytes = 0;
+    bool congested = false;      // выше верхнего порога и ещё не опустились до нижнего
+    bool closing = false;        // отключается как медленный клиент, кадры больше не пишутся
+    QTimer* graceTimer = nullptr; // создаётся при первом переполнении, дочерний сокету
+
+    // Контакты (собеседники) -> состояние "в сети", последнее отправленное
+    // клиенту: рассылка присутствия шлёт только разницу с ним
+    QHash<QString, bool> contacts;
+
+    // Проверка живости (ConnectionShard::Options::heartbeat*): узел в колесе
+    // таймеров шарда, тик последнего входящего кадра и отправлен ли ping
+    TimingWheel::Node heartbeat;
+    std::uint64_t lastActivity = 0;
+    bool pingSent = false;
+
+    // Лимиты запросов соединения (ConnectionShard::Options::rateLimits)
+    TokenBucket frameBucket;   // любые кадры, до разбора
+    TokenBucket messageBucket;
+    TokenBucket historyBucket;
+    TokenBucket controlBucket;
+
+    // Данные чанков загрузки, отданные MediaStore и ещё без ответа
+    // (не больше MediaStore::Options::window чанков)
+    qint64 uploadBytesInFlight = 0;
+
+    bool isAuthenticated() const { return !username.isEmpty(); }
+    qint64 queuedBytes() const { return bufferedBytes + deferredBytes; }
+}; 
\ No newline at end of file
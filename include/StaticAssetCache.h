@@ -0,0 +1,62 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QObject>
+#include <QReadWriteLock>
+#include <QString>
+#include <QStringList>
+#include <memory>
+
+// Статические файлы (web_client.html), загруженные в память один раз, с
+// заранее сжатыми gzip/brotli-вариантами и ETag. Файл перечитывается при
+// изменении на диске (QFileSystemWatcher в потоке владельца); find()
+// потокобезопасен и вызывается из шардов.
+class StaticAssetCache : public QObject {
+    Q_OBJECT
+
+public:
+    enum class Encoding { Identity, Gzip, Brotli };
+
+    struct Variant {
+        QByteArray body;  // пусто, если вариант не собран (или не меньше исходного)
+        QByteArray etag;  // в кавычках, свой для каждой кодировки
+    };
+
+    struct Asset {
+        QByteArray contentType;
+        Variant variants[3]; // индекс — Encoding
+
+        const Variant& variant(Encoding encoding) const {
+            return variants[static_cast<int>(encoding)];
+        }
+        // Лучшая кодировка из заголовка Accept-Encoding
+        Encoding negotiate(const QByteArray& acceptEncoding) const;
+        // If-None-Match совпадает с одним из вариантов (или "*")
+        bool matches(const QByteArray& ifNoneMatch) const;
+    };
+
+    explicit StaticAssetCache(QObject* parent = nullptr);
+
+    // Регистрирует файл под одним или несколькими URL и сразу загружает его
+    void addFile(const QString& filePath, const QStringList& urlPaths, const QByteArray& contentType);
+
+    // nullptr — URL не зарегистрирован или файл не найден
+    std::shared_ptr<const Asset> find(const QString& urlPath) const;
+
+private slots:
+    void onFileChanged(const QString& path);
+    void onDirectoryChanged(const QString& path);
+
+private:
+    void load(const QString& filePath);
+
+    QFileSystemWatcher m_watcher;
+    QHash<QString, QByteArray> m_contentTypes; // абсолютный путь -> Content-Type
+    QHash<QString, qint64> m_modified;         // абсолютный путь -> mtime последней загрузки
+
+    mutable QReadWriteLock m_lock;
+    QHash<QString, QString> m_filesByUrl;      // URL -> абсолютный путь
+    QHash<QString, std::shared_ptr<const Asset>> m_assets;
+};
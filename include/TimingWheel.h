@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+
+// Иерархическое колесо таймеров (Varghese & Lauck): 4 уровня по 64 слота,
+// единица времени — тик владельца. Постановка, снятие и тик — O(1), не
+// считая сработавших узлов и переноса слота старшего уровня раз в 64^k тиков;
+// от числа запланированных узлов цена тика не зависит. Узлы встроены в
+// объекты владельца (интрусивный список), аллокаций нет.
+// Не потокобезопасно: колесом владеет один поток.
+class TimingWheel {
+public:
+    struct Node {
+        Node() = default;
+        ~Node() { unlink(); }
+        Node(const Node&) = delete;
+        Node& operator=(const Node&) = delete;
+
+        bool scheduled() const { return next != nullptr; }
+        void unlink();
+
+        void* owner = nullptr;    // объект, в который встроен узел
+        std::uint64_t expires = 0; // тик срабатывания
+        Node* prev = nullptr;
+        Node* next = nullptr;
+    };
+
+    // Сработавшие узлы; узел можно снять или переставить, пока он в списке
+    class List {
+    public:
+        List();
+        ~List();
+        List(const List&) = delete;
+        List& operator=(const List&) = delete;
+
+        bool empty() const { return m_head.next == &m_head; }
+        Node* popFront();
+        void append(Node& node);
+        void splice(List& other); // переносит все узлы other в конец
+
+    private:
+        Node m_head; // кольцо с ограничителем
+    };
+
+    explicit TimingWheel(std::uint64_t now = 0);
+
+    // Тик, который обработает следующий advance(); время для постановки
+    // без обращения к часам
+    std::uint64_t now() const { return m_next; }
+
+    // Ставит (или переставляет) узел на тик expires; прошедший тик — на ближайший
+    void schedule(Node& node, std::uint64_t expires);
+    void cancel(Node& node) { node.unlink(); }
+
+    // Обрабатывает тики до now включительно; сработавшие узлы — в expired
+    void advance(std::uint64_t now, List& expired);
+
+private:
+    static constexpr int kLevels = 4;
+    static constexpr int kBits = 6;
+    static constexpr int kSlots = 1 << kBits;
+    static constexpr std::uint64_t kMask = kSlots - 1;
+
+    void insert(Node& node);
+    void cascade(int level, std::uint64_t index);
+
+    std::uint64_t m_next;
+    List m_slots[kLevels][kSlots];
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <array>
+#include "RateLimiter.h"
+
+// Вёдра пользователей (userMessage, userHistory), общие для всех шардов
+// узла: соединения одного пользователя на разных шардах тратят один лимит.
+// Запись не удаляется при отключении — иначе переподключение давало бы
+// полное ведро; её выбрасывает редкая чистка, когда ведро уже пополнилось.
+// Таблица разбита на полосы со своей блокировкой, чтобы шарды не ждали
+// друг друга на каждом запросе.
+class UserRateLimiter {
+public:
+    explicit UserRateLimiter(const RateLimits& limits);
+
+    // Потокобезопасный; false — токена нет, retryAfterMs — через сколько он появится
+    bool take(const QString& username, bool history, quint32& retryAfterMs);
+
+private:
+    struct Buckets {
+        TokenBucket message;
+        TokenBucket history;
+    };
+    struct Stripe {
+        QMutex mutex;
+        QHash<QString, Buckets> users;
+        int sweepAt = 0; // размер, при котором чистить полные вёдра
+    };
+
+    void sweep(Stripe& stripe, quint32 nowMs);
+
+    const RateLimit m_message;
+    const RateLimit m_history;
+    QElapsedTimer m_clock;
+    std::array<Stripe, 16> m_stripes;
+};
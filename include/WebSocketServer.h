@@ -1,37 +1,67 @@
 #pragma once
 
 #include <QObject>
-#include <QWebSocketServer>
-#include <QWebSocket>
-#include <QMap>
 #include <QString>
 #include <QTcpServer>
+#include <QThread>
+#include <QVector>
+#include <chrono>
 #include <memory>
+#include "ClusterLink.h"
+#include "ConnectionShard.h"
+#include "GroupDirectory.h"
+#include "MediaStore.h"
+#include "PersistenceQueue.h"
+#include "PresenceHub.h"
+#include "ReaderPool.h"
+#include "RoutingTable.h"
+#include "StaticAssetCache.h"
+#include "UserRateLimiter.h"
 
+struct ServerConfig {
+    QString dbPath = QStringLiteral("data/messenger.db");
+    QString webClientPath = QStringLiteral("web_client.html");
+    PersistenceQueue::Options persistence;
+    int readerThreads = 2;
+    MediaStore::Options media;
+    int eventLoopThreads = 0; // 0 = QThread::idealThreadCount()
+    ConnectionShard::Options connections;
+    ClusterLink::Options cluster; // broker не задан — одиночный сервер
+    // Окно, за которое изменения присутствия сводятся в один кадр подписчику
+    std::chrono::milliseconds presenceWindow{250};
+};
+
+// Принимает TCP-соединения на общем порту и раздаёт их по кругу шардам
+// (ConnectionShard), каждый из которых крутит свой event loop в своём потоке.
+// В режиме кластера узел связан с брокером через ClusterLink (свой поток).
 class WebSocketServer : public QObject {
     Q_OBJECT
 
 public:
-    WebSocketServer(QObject* parent = nullptr);
+    explicit WebSocketServer(const ServerConfig& config = ServerConfig(), QObject* parent = nullptr);
     ~WebSocketServer();
 
     bool start(int port = 9001);
     void stop();
     bool isRunning() const;
 
-private slots:
-    void onNewConnection();
-    void onTextMessageReceived(const QString& message);
-    void onDisconnected();
-    void onTcpConnection();
-
 private:
-    void handleMessage(QWebSocket* client, const QString& message);
-    void sendJsonMessage(QWebSocket* client, const QJsonObject& message);
-    void handleHttpRequest(QTcpSocket* socket, const QByteArray& request);
+    void dispatchConnection(qintptr socketDescriptor);
 
-    std::unique_ptr<QWebSocketServer> m_server;
+    ServerConfig m_config;
     std::unique_ptr<QTcpServer> m_httpServer;
-    QMap<QString, QWebSocket*> m_onlineUsers;
+    std::unique_ptr<PersistenceQueue> m_persistence;
+    std::unique_ptr<ReaderPool> m_readers;
+    std::unique_ptr<MediaStore> m_media;
+    RoutingTable m_routing;
+    PresenceHub m_presence;
+    GroupDirectory m_groups;
+    UserRateLimiter m_userRates;
+    StaticAssetCache m_assets;
+    QVector<QThread*> m_threads;
+    QVector<ConnectionShard*> m_shards;
+    ClusterLink* m_cluster = nullptr; // живёт в m_clusterThread
+    QThread* m_clusterThread = nullptr;
+    int m_nextShard = 0;
     bool m_running = false;
 }; 
\ No newline at end of file
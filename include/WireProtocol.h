@@ -0,0 +1,178 @@
+#pragma once
+
+#include <QLatin1String>
+#include <QString>
+#include <QByteArray>
+#include <QtGlobal>
+#include <iterator>
+
+// Формат кадров на соединении. JSON (текстовые кадры) — по умолчанию,
+// его использует web_client.html. Binary — CBOR-карта с целочисленными
+// ключами из Wire::Key в бинарных кадрах; выбирается клиентом через
+// WebSocket subprotocol kBinarySubprotocol.
+enum class WireProtocol : quint8 {
+    Json,
+    Binary
+};
+
+namespace Wire {
+
+inline constexpr char kBinarySubprotocol[] = "connect.cbor.v1";
+
+// Чанк загрузки медиа — бинарный кадр в обоих протоколах, не запрос:
+// маркер, 16 байт upload_id, смещение (uint64 big-endian), затем данные.
+// Маркер не начинает ни CBOR-карту, ни сжатый кадр сервера.
+inline constexpr char kUploadChunkMarker = '\x01';
+inline constexpr int kUploadIdBytes = 16;
+inline constexpr int kUploadChunkHeaderBytes = 1 + kUploadIdBytes + 8;
+
+// Ключи полей. Значение — ключ в бинарной карте, имя — ключ в JSON.
+// Номера не переиспользуются: новые поля только добавляются в конец.
+enum class Key : quint8 {
+    Type,
+    Username,
+    To,
+    Text,
+    With,
+    BeforeId,
+    AfterId,
+    Limit,
+    From,
+    Timestamp,
+    Status,
+    Message,
+    Messages,
+    HasMore,
+    NextCursor,
+    Id,
+    Seq,
+    Sender,
+    Compression,
+    Group,
+    Online,
+    Offline,
+    Snapshot,
+    RetryAfterMs,
+    Offset,
+    Snippet,
+    UploadId,
+    Size,
+    Sha256,
+    MediaType,
+    Path,
+    ChunkSize,
+    Window
+};
+
+inline constexpr const char* kKeyNames[] = {
+    "type", "username", "to", "text", "with", "before_id", "after_id", "limit",
+    "from", "timestamp", "status", "message", "messages", "has_more", "next_cursor",
+    "id", "seq", "sender", "compression", "group", "online", "offline", "snapshot",
+    "retry_after_ms", "offset", "snippet", "upload_id", "size", "sha256", "media_type", "path",
+    "chunk_size", "window"
+};
+
+// Значение поля "type". В бинарном формате передаётся числом.
+enum class Type : quint8 {
+    Unknown,
+    Auth,
+    AuthResponse,
+    Message,
+    MessageAck,
+    History,
+    Ping,
+    Pong,
+    Error,
+    PendingMessages, // сообщения, пришедшие, пока пользователь был офлайн (после auth)
+    GroupMessage,    // сообщение в группу: запрос и доставка участникам
+    GroupJoin,       // вступить (группа создаётся при первом вступлении); ответ того же типа
+    GroupLeave,
+    Presence,        // кто из контактов в сети: снимок после auth, затем изменения
+    Search,          // поиск по своим беседам: запрос и ответ одного типа
+    UploadBegin,     // начать или продолжить загрузку медиа; ответ того же типа со смещением
+    UploadProgress,  // сервер: сколько байт загрузки принято (ответ на чанк)
+    UploadComplete   // сервер: файл принят и записан в media
+};
+
+inline constexpr const char* kTypeNames[] = {
+    "", "auth", "auth_response", "message", "message_ack", "history", "ping", "pong", "error",
+    "pending_messages", "group_message", "group_join", "group_leave", "presence", "search",
+    "upload_begin", "upload_progress", "upload_complete"
+};
+
+static_assert(std::size(kKeyNames) == static_cast<std::size_t>(Key::Window) + 1,
+              "every Wire::Key needs a JSON name");
+static_assert(std::size(kTypeNames) == static_cast<std::size_t>(Type::UploadComplete) + 1,
+              "every Wire::Type needs a JSON name");
+
+inline QLatin1String keyName(Key key) {
+    return QLatin1String(kKeyNames[static_cast<int>(key)]);
+}
+
+inline QLatin1String typeName(Type type) {
+    return QLatin1String(kTypeNames[static_cast<int>(type)]);
+}
+
+inline bool keyFromCode(quint64 code, Key& key) {
+    if (code >= std::size(kKeyNames)) {
+        return false;
+    }
+    key = static_cast<Key>(code);
+    return true;
+}
+
+inline bool keyFromName(const QString& name, Key& key) {
+    for (std::size_t i = 0; i < std::size(kKeyNames); ++i) {
+        if (name == QLatin1String(kKeyNames[i])) {
+            key = static_cast<Key>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline Type typeFromCode(quint64 code) {
+    return code < std::size(kTypeNames) ? static_cast<Type>(code) : Type::Unknown;
+}
+
+inline Type typeFromName(const QString& name) {
+    for (std::size_t i = 1; i < std::size(kTypeNames); ++i) {
+        if (name == QLatin1String(kTypeNames[i])) {
+            return static_cast<Type>(i);
+        }
+    }
+    return Type::Unknown;
+}
+
+} // namespace Wire
+
+// Закодированный кадр одного протокола: text для Json, binary для Binary
+struct Frame {
+    WireProtocol protocol = WireProtocol::Json;
+    QString text;
+    QByteArray binary;
+};
+
+// Разобранный запрос клиента, общий для обоих протоколов
+struct Request {
+    Wire::Type type = Wire::Type::Unknown;
+    QString username; // auth
+    QString to;       // message, upload_begin (получатель медиа)
+    QString text;     // message; search — строка запроса
+    QString with;     // history; search — только эта беседа
+    QString group;    // group_message, group_join, group_leave, history группы
+    qint64 beforeId = 0;
+    qint64 afterId = 0;
+    int limit = 0;    // 0 — размер страницы по умолчанию
+    int offset = 0;   // search: сколько результатов пропустить
+    // upload_begin
+    QString uploadId;  // hex; продолжить начатую загрузку
+    QString sha256;    // hex; необязательно, известный сервером файл не передаётся
+    QString mediaType; // photo, video, voice, file
+    qint64 size = 0;
+    bool deflate = false; // auth: "compression": "deflate"
+};
+
+// false — кадр не разбирается (не JSON-объект / не CBOR-карта)
+bool decodeRequest(const QString& json, Request& request);
+bool decodeRequest(const QByteArray& cbor, Request& request);
@@ -0,0 +1,284 @@
+#include "LoadWorker.h"
+#include "FrameWriter.h"
+#include <QCborMap>
+#include <QCborValue>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTimer>
+#include <QWebSocket>
+#include <algorithm>
+
+namespace {
+
+// Scheduler resolution: requests due within one tick go out together.
+constexpr std::chrono::milliseconds kTickInterval{1};
+constexpr std::chrono::milliseconds kConnectInterval{10};
+
+enum Operation { SendMessage, RequestHistory, SendPing };
+
+std::int64_t toNs(std::chrono::steady_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+// Only the fields the generator reads: type and text.
+Wire::Type decodeJson(const QString& message, QString& text) {
+    const QJsonObject object = QJsonDocument::fromJson(message.toUtf8()).object();
+    text = object.value(Wire::keyName(Wire::Key::Text)).toString();
+    return Wire::typeFromName(object.value(Wire::keyName(Wire::Key::Type)).toString());
+}
+
+Wire::Type decodeCbor(const QByteArray& message, QString& text) {
+    const QCborMap map = QCborValue::fromCbor(message).toMap();
+    text = map.value(static_cast<qint64>(Wire::Key::Text)).toString();
+    return Wire::typeFromCode(static_cast<quint64>(map.value(static_cast<qint64>(Wire::Key::Type)).toInteger()));
+}
+
+} // namespace
+
+LoadWorker::LoadWorker(const LoadOptions& options, int firstUser, int userCount, double connectRate,
+                       QObject* parent)
+    : QObject(parent)
+    , m_options(options)
+    , m_firstUser(firstUser)
+    , m_connectRate(connectRate)
+    , m_random(static_cast<std::mt19937::result_type>(firstUser + 1))
+    , m_mix({static_cast<double>(options.messageWeight), static_cast<double>(options.historyWeight),
+             static_cast<double>(options.pingWeight)})
+{
+    m_connections.resize(userCount);
+    for (int i = 0; i < userCount; ++i) {
+        m_connections[i].username = options.userPrefix + QString::number(firstUser + i);
+    }
+    // "<scheduled ns>|" takes ~20 characters of the payload.
+    m_padding = QString(std::max(0, options.payloadBytes - 20), QLatin1Char('x'));
+    m_ready.reserve(userCount);
+}
+
+void LoadWorker::connectAll() {
+    m_connectStart = std::chrono::steady_clock::now();
+    m_connectTimer = new QTimer(this);
+    connect(m_connectTimer, &QTimer::timeout, this, &LoadWorker::openBatch);
+    m_connectTimer->start(kConnectInterval);
+    openBatch();
+}
+
+void LoadWorker::openBatch() {
+    // Paced so the server's accept backlog does not overflow.
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_connectStart).count();
+    const int allowed = std::min(static_cast<int>(m_connections.size()), 1 + static_cast<int>(elapsed * m_connectRate));
+
+    for (; m_opened < allowed; ++m_opened) {
+        const int index = m_opened;
+        QWebSocket* socket = new QWebSocket(QString(), QWebSocketProtocol::VersionLatest, this);
+        m_connections[index].socket = socket;
+
+        connect(socket, &QWebSocket::connected, this, [this, index]() {
+            Connection& connection = m_connections[index];
+            sendFrame(connection, FrameWriter(m_frame, m_options.protocol)
+                .field(Wire::Key::Type, Wire::Type::Auth)
+                .field(Wire::Key::Username, connection.username)
+                .finish());
+        });
+        connect(socket, &QWebSocket::textMessageReceived, this, [this, index](const QString& message) {
+            QString text;
+            const Wire::Type type = decodeJson(message, text);
+            onFrame(index, type, text);
+        });
+        connect(socket, &QWebSocket::binaryMessageReceived, this, [this, index](const QByteArray& message) {
+            QString text;
+            const Wire::Type type = decodeCbor(message, text);
+            onFrame(index, type, text);
+        });
+        connect(socket, &QWebSocket::disconnected, this, [this, index]() { onClosed(index); });
+#if QT_VERSION >= QT_VERSION_CHECK(6, 5, 0)
+        connect(socket, &QWebSocket::errorOccurred, this, [this, index]() { onClosed(index); });
+#else
+        connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QWebSocket::error), this,
+                [this, index](QAbstractSocket::SocketError) { onClosed(index); });
+#endif
+
+        socket->open(m_options.urls[(m_firstUser + index) % m_options.urls.size()]);
+    }
+
+    if (m_opened == static_cast<int>(m_connections.size())) {
+        m_connectTimer->stop();
+    }
+}
+
+void LoadWorker::startLoad(std::chrono::steady_clock::time_point start, double rate) {
+    m_start = start;
+    m_rate = rate;
+    m_issued = 0;
+    m_sending = rate > 0.0;
+    if (!m_sending) {
+        return;
+    }
+
+    m_tickTimer = new QTimer(this);
+    m_tickTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_tickTimer, &QTimer::timeout, this, &LoadWorker::onTick);
+    m_tickTimer->start(kTickInterval);
+}
+
+void LoadWorker::beginMeasurement(std::chrono::steady_clock::time_point measureFrom) {
+    m_result = WorkerResult();
+    m_measureFromNs = toNs(measureFrom);
+    m_measuring = true;
+}
+
+void LoadWorker::stopLoad(std::chrono::steady_clock::time_point measureUntil) {
+    m_sending = false;
+    m_measureUntilNs = toNs(measureUntil);
+    if (m_tickTimer) {
+        m_tickTimer->stop();
+    }
+}
+
+WorkerResult LoadWorker::takeResult() {
+    m_measuring = false;
+    return std::move(m_result);
+}
+
+void LoadWorker::onTick() {
+    if (!m_sending || m_ready.isEmpty()) {
+        return;
+    }
+
+    // Everything scheduled up to now goes out, even if the generator fell
+    // behind; each request keeps its scheduled time (open loop).
+    const auto now = std::chrono::steady_clock::now();
+    const std::int64_t nowNs = toNs(now);
+    const std::int64_t startNs = toNs(m_start);
+    const auto due = static_cast<std::uint64_t>(std::chrono::duration<double>(now - m_start).count() * m_rate);
+
+    for (; m_issued < due; ++m_issued) {
+        const std::int64_t scheduledNs = startNs + static_cast<std::int64_t>(static_cast<double>(m_issued) * 1e9 / m_rate);
+        if (scheduledNs >= m_measureUntilNs) {
+            m_sending = false;
+            return;
+        }
+
+        m_nextSender = (m_nextSender + 1) % m_ready.size();
+        const int index = m_ready[m_nextSender];
+        if (m_measuring && scheduledNs >= m_measureFromNs) {
+            m_result.maxScheduleLagNs = std::max(m_result.maxScheduleLagNs, nowNs - scheduledNs);
+        }
+        send(m_connections[index], m_firstUser + index, scheduledNs);
+    }
+}
+
+void LoadWorker::send(Connection& connection, int user, std::int64_t scheduledNs) {
+    const bool counted = m_measuring && scheduledNs >= m_measureFromNs;
+
+    switch (m_mix(m_random)) {
+    case SendMessage: {
+        // The recipient reads the scheduled send time back out of the text.
+        const QString text = QString::number(scheduledNs) + QLatin1Char('|') + m_padding;
+        sendFrame(connection, FrameWriter(m_frame, m_options.protocol)
+            .field(Wire::Key::Type, Wire::Type::Message)
+            .field(Wire::Key::To, randomPeer(user))
+            .field(Wire::Key::Text, text)
+            .finish());
+        if (counted) {
+            ++m_result.messagesSent;
+        }
+        break;
+    }
+    case RequestHistory:
+        sendFrame(connection, FrameWriter(m_frame, m_options.protocol)
+            .field(Wire::Key::Type, Wire::Type::History)
+            .field(Wire::Key::With, randomPeer(user))
+            .field(Wire::Key::Limit, static_cast<qint64>(m_options.historyLimit))
+            .finish());
+        if (counted) {
+            ++m_result.historySent;
+        }
+        break;
+    case SendPing:
+        sendFrame(connection, FrameWriter(m_frame, m_options.protocol)
+            .field(Wire::Key::Type, Wire::Type::Ping)
+            .finish());
+        if (counted) {
+            ++m_result.pingsSent;
+        }
+        break;
+    }
+}
+
+void LoadWorker::sendFrame(Connection& connection, const Frame& frame) {
+    if (frame.protocol == WireProtocol::Binary) {
+        connection.socket->sendBinaryMessage(frame.binary);
+    } else {
+        connection.socket->sendTextMessage(frame.text);
+    }
+}
+
+QString LoadWorker::randomPeer(int self) {
+    // Any generator user, usually served by another worker (and another server shard).
+    std::uniform_int_distribution<int> pick(0, m_options.connections - 2);
+    int peer = pick(m_random);
+    if (peer >= self) {
+        ++peer;
+    }
+    return m_options.userPrefix + QString::number(peer);
+}
+
+void LoadWorker::onFrame(int index, Wire::Type type, const QString& text) {
+    Connection& connection = m_connections[index];
+
+    switch (type) {
+    case Wire::Type::AuthResponse:
+        if (!connection.authenticated) {
+            connection.authenticated = true;
+            m_ready.append(index);
+            m_authenticated.fetch_add(1, std::memory_order_relaxed);
+        }
+        break;
+    case Wire::Type::Message: {
+        const std::int64_t nowNs = toNs(std::chrono::steady_clock::now());
+        const int separator = text.indexOf(QLatin1Char('|'));
+        bool ok = false;
+        const std::int64_t sentNs = separator > 0 ? text.left(separator).toLongLong(&ok) : 0;
+        // Only messages scheduled inside the window count, including late
+        // deliveries that arrive while the run drains.
+        if (ok && m_measuring && sentNs >= m_measureFromNs && sentNs < m_measureUntilNs) {
+            ++m_result.messagesDelivered;
+            const std::int64_t latencyUs = std::max<std::int64_t>(0, (nowNs - sentNs) / 1000);
+            m_result.latenciesUs.push_back(static_cast<std::uint32_t>(
+                std::min<std::int64_t>(latencyUs, std::numeric_limits<std::uint32_t>::max())));
+        }
+        break;
+    }
+    case Wire::Type::MessageAck:
+        m_result.acks += m_measuring ? 1 : 0;
+        break;
+    case Wire::Type::History:
+        m_result.historyPages += m_measuring ? 1 : 0;
+        break;
+    case Wire::Type::Pong:
+        m_result.pongs += m_measuring ? 1 : 0;
+        break;
+    case Wire::Type::Error:
+        m_result.errors += m_measuring ? 1 : 0;
+        break;
+    default:
+        break;
+    }
+}
+
+void LoadWorker::onClosed(int index) {
+    Connection& connection = m_connections[index];
+    if (connection.closed) {
+        return;
+    }
+    connection.closed = true;
+
+    if (connection.authenticated) {
+        connection.authenticated = false;
+        m_ready.removeOne(index);
+        m_authenticated.fetch_sub(1, std::memory_order_relaxed);
+        ++m_result.disconnects;
+    } else {
+        m_failed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
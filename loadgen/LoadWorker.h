@@ -0,0 +1,122 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QUrl>
+#include <QVector>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+#include "WireProtocol.h"
+
+class QTimer;
+class QWebSocket;
+
+// Параметры прогона, общие для всех воркеров
+struct LoadOptions {
+    // Пользователь i подключается к urls[i % size]: при нескольких узлах
+    // кластера сообщения идут и между узлами
+    QList<QUrl> urls = {QUrl(QStringLiteral("ws://127.0.0.1:9001"))};
+    int connections = 1000;
+    double rate = 1000.0;         // запросов/с на весь генератор (все типы)
+    int connectRate = 500;        // новых соединений/с на весь генератор
+    // Доли типов запросов (веса, не обязательно в сумме 100)
+    int messageWeight = 80;
+    int historyWeight = 10;
+    int pingWeight = 10;
+    int payloadBytes = 64;        // длина поля text у message
+    int historyLimit = 50;
+    WireProtocol protocol = WireProtocol::Json;
+    QString userPrefix = QStringLiteral("loadgen");
+};
+
+// Итог воркера за окно измерения
+struct WorkerResult {
+    std::uint64_t messagesSent = 0;
+    std::uint64_t historySent = 0;
+    std::uint64_t pingsSent = 0;
+    std::uint64_t messagesDelivered = 0;
+    std::uint64_t acks = 0;
+    std::uint64_t historyPages = 0;
+    std::uint64_t pongs = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t disconnects = 0;
+    std::int64_t maxScheduleLagNs = 0;        // насколько генератор отставал от расписания
+    std::vector<std::uint32_t> latenciesUs;   // доставка отправитель -> получатель
+};
+
+// Доля соединений генератора в своём потоке (свой event loop). Нагрузка
+// открытая (open loop): запросы идут по расписанию, не дожидаясь ответов,
+// а задержка доставки отсчитывается от запланированного момента отправки,
+// так что отставание самого генератора не прячет задержки сервера.
+class LoadWorker : public QObject {
+    Q_OBJECT
+
+public:
+    // Пользователи [firstUser, firstUser + userCount) из options.connections
+    LoadWorker(const LoadOptions& options, int firstUser, int userCount, double connectRate,
+               QObject* parent = nullptr);
+
+    // Вызываются в потоке воркера (QMetaObject::invokeMethod)
+    void connectAll();
+    // Запросы с момента start со своей долей rate
+    void startLoad(std::chrono::steady_clock::time_point start, double rate);
+    // Сбрасывает счётчики: всё до measureFrom считается прогревом
+    void beginMeasurement(std::chrono::steady_clock::time_point measureFrom);
+    // Прекращает отправку; доставки уже отправленного ещё учитываются
+    void stopLoad(std::chrono::steady_clock::time_point measureUntil);
+    WorkerResult takeResult();
+
+    // Читаются координатором из главного потока
+    int authenticated() const { return m_authenticated.load(std::memory_order_relaxed); }
+    int failed() const { return m_failed.load(std::memory_order_relaxed); }
+
+private slots:
+    void openBatch();
+    void onTick();
+
+private:
+    struct Connection {
+        QWebSocket* socket = nullptr;
+        QString username;
+        bool authenticated = false;
+        bool closed = false;
+    };
+
+    void onFrame(int index, Wire::Type type, const QString& text);
+    void onClosed(int index);
+    void send(Connection& connection, int user, std::int64_t scheduledNs);
+    void sendFrame(Connection& connection, const Frame& frame);
+    QString randomPeer(int self);
+
+    LoadOptions m_options;
+    int m_firstUser;
+    QVector<Connection> m_connections;
+    int m_opened = 0;
+    double m_connectRate;
+    std::chrono::steady_clock::time_point m_connectStart;
+    QTimer* m_connectTimer = nullptr;
+    QTimer* m_tickTimer = nullptr;
+
+    std::atomic<int> m_authenticated{0};
+    std::atomic<int> m_failed{0};
+    QVector<int> m_ready; // индексы авторизованных соединений
+
+    std::chrono::steady_clock::time_point m_start;
+    double m_rate = 0.0;
+    std::uint64_t m_issued = 0;
+    int m_nextSender = 0;
+    std::int64_t m_measureFromNs = 0;
+    std::int64_t m_measureUntilNs = std::numeric_limits<std::int64_t>::max();
+    bool m_sending = false;
+    bool m_measuring = false;
+
+    std::mt19937 m_random;
+    std::discrete_distribution<int> m_mix;
+    QString m_padding;
+    Frame m_frame;
+    WorkerResult m_result;
+};
@@ -0,0 +1,244 @@
+// Headless load generator: opens many WebSocket connections to a running
+// server, authenticates them, then drives a message/history/ping mix at a
+// fixed rate and reports throughput and sender -> recipient latency.
+#include "LoadWorker.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Open sockets need one descriptor each; the default soft limit is often 1024.
+void raiseFileLimit(int connections) {
+#ifdef Q_OS_UNIX
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return;
+    }
+    const rlim_t wanted = static_cast<rlim_t>(connections) + 64;
+    if (limit.rlim_cur < wanted) {
+        limit.rlim_cur = std::min(wanted, limit.rlim_max);
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (limit.rlim_cur < wanted) {
+        std::cerr << "Warning: open file limit " << limit.rlim_cur << " is below " << wanted
+                  << "; raise it with ulimit -n" << std::endl;
+    }
+#else
+    Q_UNUSED(connections)
+#endif
+}
+
+double percentile(const std::vector<std::uint32_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    const auto rank = static_cast<std::size_t>(std::ceil(p * static_cast<double>(sorted.size())));
+    return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1] / 1000.0;
+}
+
+void printReport(const LoadOptions& options, QVector<WorkerResult>& results, double seconds) {
+    WorkerResult total;
+    for (WorkerResult& result : results) {
+        total.messagesSent += result.messagesSent;
+        total.historySent += result.historySent;
+        total.pingsSent += result.pingsSent;
+        total.messagesDelivered += result.messagesDelivered;
+        total.acks += result.acks;
+        total.historyPages += result.historyPages;
+        total.pongs += result.pongs;
+        total.errors += result.errors;
+        total.disconnects += result.disconnects;
+        total.maxScheduleLagNs = std::max(total.maxScheduleLagNs, result.maxScheduleLagNs);
+        total.latenciesUs.insert(total.latenciesUs.end(), result.latenciesUs.begin(), result.latenciesUs.end());
+    }
+    std::sort(total.latenciesUs.begin(), total.latenciesUs.end());
+
+    const std::uint64_t requests = total.messagesSent + total.historySent + total.pingsSent;
+    std::printf("\n=== Results (%.1f s measured, %s) ===\n", seconds,
+                options.protocol == WireProtocol::Binary ? "cbor" : "json");
+    std::printf("requests:   %llu sent, %.0f/s (target %.0f/s)\n",
+                static_cast<unsigned long long>(requests), requests / seconds, options.rate);
+    std::printf("  message:  %llu sent, %llu acked, %llu delivered (%.0f/s)\n",
+                static_cast<unsigned long long>(total.messagesSent), static_cast<unsigned long long>(total.acks),
+                static_cast<unsigned long long>(total.messagesDelivered), total.messagesDelivered / seconds);
+    std::printf("  history:  %llu sent, %llu pages\n",
+                static_cast<unsigned long long>(total.historySent), static_cast<unsigned long long>(total.historyPages));
+    std::printf("  ping:     %llu sent, %llu pongs\n",
+                static_cast<unsigned long long>(total.pingsSent), static_cast<unsigned long long>(total.pongs));
+    std::printf("errors:     %llu, disconnects: %llu\n",
+                static_cast<unsigned long long>(total.errors), static_cast<unsigned long long>(total.disconnects));
+    std::printf("delivery latency (ms): p50 %.3f  p99 %.3f  p999 %.3f  max %.3f\n",
+                percentile(total.latenciesUs, 0.50), percentile(total.latenciesUs, 0.99),
+                percentile(total.latenciesUs, 0.999), percentile(total.latenciesUs, 1.0));
+    std::printf("generator max schedule lag: %.3f ms%s\n", total.maxScheduleLagNs / 1e6,
+                total.maxScheduleLagNs > 10'000'000 ? " (generator saturated: add --threads or lower --rate)" : "");
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("ConnectLoadGen");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Load generator for the Connect Messenger WebSocket protocol");
+    parser.addHelpOption();
+    const QCommandLineOption urlOption("url", "Server URL; comma-separated for several cluster nodes.", "url",
+                                       "ws://127.0.0.1:9001");
+    const QCommandLineOption connectionsOption({"c", "connections"}, "Concurrent connections.", "n", "1000");
+    const QCommandLineOption rateOption({"r", "rate"}, "Target requests per second (all types).", "n", "1000");
+    const QCommandLineOption mixOption("mix", "message:history:ping weights.", "m:h:p", "80:10:10");
+    const QCommandLineOption durationOption({"d", "duration"}, "Measured seconds.", "s", "30");
+    const QCommandLineOption warmupOption("warmup", "Unmeasured seconds before the window.", "s", "5");
+    const QCommandLineOption drainOption("drain", "Seconds to wait for in-flight deliveries.", "s", "2");
+    const QCommandLineOption payloadOption("payload", "Message text length in characters.", "n", "64");
+    const QCommandLineOption historyLimitOption("history-limit", "History page size.", "n", "50");
+    const QCommandLineOption threadsOption("threads", "Worker event loops.", "n",
+                                           QString::number(std::max(1, QThread::idealThreadCount() / 2)));
+    const QCommandLineOption connectRateOption("connect-rate", "New connections per second.", "n", "500");
+    const QCommandLineOption prefixOption("prefix", "Username prefix.", "name", "loadgen");
+    const QCommandLineOption binaryOption("binary", "Use CBOR frames instead of JSON.");
+    parser.addOptions({urlOption, connectionsOption, rateOption, mixOption, durationOption, warmupOption,
+                       drainOption, payloadOption, historyLimitOption, threadsOption, connectRateOption,
+                       prefixOption, binaryOption});
+    parser.process(app);
+
+    LoadOptions options;
+    options.urls.clear();
+    for (const QString& url : parser.value(urlOption).split(QLatin1Char(','), Qt::SkipEmptyParts)) {
+        options.urls.append(QUrl(url.trimmed()));
+    }
+    if (options.urls.isEmpty()) {
+        std::cerr << "--url needs at least one server" << std::endl;
+        return 1;
+    }
+    options.connections = std::max(2, parser.value(connectionsOption).toInt());
+    options.rate = std::max(0.0, parser.value(rateOption).toDouble());
+    options.connectRate = std::max(1, parser.value(connectRateOption).toInt());
+    options.payloadBytes = std::max(0, parser.value(payloadOption).toInt());
+    options.historyLimit = std::max(1, parser.value(historyLimitOption).toInt());
+    options.userPrefix = parser.value(prefixOption);
+    options.protocol = parser.isSet(binaryOption) ? WireProtocol::Binary : WireProtocol::Json;
+
+    const QStringList mix = parser.value(mixOption).split(QLatin1Char(':'));
+    if (mix.size() != 3) {
+        std::cerr << "--mix expects three weights, e.g. 80:10:10" << std::endl;
+        return 1;
+    }
+    options.messageWeight = std::max(0, mix[0].toInt());
+    options.historyWeight = std::max(0, mix[1].toInt());
+    options.pingWeight = std::max(0, mix[2].toInt());
+    if (options.messageWeight + options.historyWeight + options.pingWeight == 0) {
+        std::cerr << "--mix needs at least one non-zero weight" << std::endl;
+        return 1;
+    }
+
+    const double duration = std::max(1.0, parser.value(durationOption).toDouble());
+    const double warmup = std::max(0.0, parser.value(warmupOption).toDouble());
+    const double drain = std::max(0.0, parser.value(drainOption).toDouble());
+    const int threadCount = std::clamp(parser.value(threadsOption).toInt(), 1, options.connections);
+
+    raiseFileLimit(options.connections);
+
+    // Users are split evenly; each worker runs its share on its own thread.
+    QVector<QThread*> threads;
+    QVector<LoadWorker*> workers;
+    for (int i = 0; i < threadCount; ++i) {
+        const int first = options.connections * i / threadCount;
+        const int count = options.connections * (i + 1) / threadCount - first;
+        QThread* thread = new QThread(&app);
+        LoadWorker* worker = new LoadWorker(options, first, count, double(options.connectRate) / threadCount);
+        worker->moveToThread(thread);
+        QObject::connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        thread->start();
+        QMetaObject::invokeMethod(worker, [worker]() { worker->connectAll(); }, Qt::QueuedConnection);
+        threads.append(thread);
+        workers.append(worker);
+    }
+
+    std::cout << "Connecting " << options.connections << " clients to " << parser.value(urlOption).toStdString()
+              << " with " << threadCount << " threads..." << std::endl;
+
+    // Connect phase: wait until every client is authenticated or has failed,
+    // with a deadline proportional to the connect rate.
+    const Clock::time_point connectStart = Clock::now();
+    const auto connectDeadline = connectStart + std::chrono::seconds(10 + options.connections / options.connectRate);
+    QTimer progress;
+    QObject::connect(&progress, &QTimer::timeout, &app, [&]() {
+        int authenticated = 0;
+        int failed = 0;
+        for (const LoadWorker* worker : workers) {
+            authenticated += worker->authenticated();
+            failed += worker->failed();
+        }
+        if (authenticated + failed < options.connections && Clock::now() < connectDeadline) {
+            return;
+        }
+        progress.stop();
+
+        std::cout << authenticated << " authenticated, " << failed << " failed in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - connectStart).count()
+                  << " ms" << std::endl;
+        if (authenticated < 2) {
+            std::cerr << "Not enough connections to generate load" << std::endl;
+            app.exit(1);
+            return;
+        }
+
+        // Every worker shares one schedule origin and measurement window.
+        const Clock::time_point start = Clock::now() + std::chrono::milliseconds(100);
+        const Clock::time_point measureFrom = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(warmup));
+        const Clock::time_point measureUntil = measureFrom + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(duration));
+        for (LoadWorker* worker : workers) {
+            const double share = options.rate / workers.size();
+            QMetaObject::invokeMethod(worker, [worker, start, share, measureFrom]() {
+                worker->startLoad(start, share);
+                worker->beginMeasurement(measureFrom);
+            }, Qt::QueuedConnection);
+        }
+        std::cout << "Running " << options.rate << " req/s: " << warmup << " s warmup, "
+                  << duration << " s measured" << std::endl;
+
+        const auto untilEnd = std::chrono::duration_cast<std::chrono::milliseconds>(measureUntil - Clock::now());
+        QTimer::singleShot(untilEnd, &app, [&, measureUntil]() {
+            for (LoadWorker* worker : workers) {
+                QMetaObject::invokeMethod(worker, [worker, measureUntil]() { worker->stopLoad(measureUntil); },
+                                          Qt::QueuedConnection);
+            }
+
+            QTimer::singleShot(std::chrono::milliseconds(static_cast<int>(drain * 1000)), &app, [&]() {
+                QVector<WorkerResult> results;
+                for (LoadWorker* worker : workers) {
+                    WorkerResult result;
+                    QMetaObject::invokeMethod(worker, [worker, &result]() { result = worker->takeResult(); },
+                                              Qt::BlockingQueuedConnection);
+                    results.append(std::move(result));
+                }
+                printReport(options, results, duration);
+                app.quit();
+            });
+        });
+    });
+    progress.start(200);
+
+    const int code = app.exec();
+
+    for (QThread* thread : threads) {
+        thread->quit();
+        thread->wait();
+    }
+    return code;
+}
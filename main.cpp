@@ -7,6 +7,8 @@
 #include <csignal>
 #include <memory>
 #include <cstdlib>
+#include <algorithm>
+#include <string>
 
 std::unique_ptr<WebSocketServer> g_server;
 
@@ -28,16 +30,174 @@ int main(int argc, char* argv[]) {
     std::cout << "=== Connect Messenger Server ===" << std::endl;
     std::cout << "Starting server..." << std::endl;
     
-    // Initialize database
-    Database db;
-    if (!db.initialize()) {
-        std::cerr << "Failed to initialize database" << std::endl;
-        return 1;
+    ServerConfig config;
+    
+    // Database path (the server opens it once in start() and keeps it for its lifetime)
+    const char* env_db_path = std::getenv("CONNECT_DB_PATH");
+    if (env_db_path) {
+        config.dbPath = QString::fromLocal8Bit(env_db_path);
+        std::cout << "Using CONNECT_DB_PATH from environment: " << env_db_path << std::endl;
+    }
+    
+    // Write-behind persistence: "commit" acks after the batch is on disk, "enqueue" acks immediately
+    const char* env_ack_mode = std::getenv("CONNECT_ACK_MODE");
+    if (env_ack_mode && std::string(env_ack_mode) == "enqueue") {
+        config.persistence.ackMode = PersistenceQueue::AckMode::AfterEnqueue;
+    }
+    const char* env_batch_size = std::getenv("CONNECT_DB_BATCH_SIZE");
+    if (env_batch_size) {
+        config.persistence.maxBatchSize = std::max(1, std::atoi(env_batch_size));
+    }
+    const char* env_batch_delay = std::getenv("CONNECT_DB_BATCH_DELAY_MS");
+    if (env_batch_delay) {
+        config.persistence.maxBatchDelay = std::chrono::milliseconds(std::max(0, std::atoi(env_batch_delay)));
+    }
+    // Search index catch-up: messages per indexing transaction, and the backlog that forces one under load
+    const char* env_search_batch = std::getenv("CONNECT_SEARCH_INDEX_BATCH");
+    if (env_search_batch) {
+        config.persistence.searchIndexBatch = std::max(1, std::atoi(env_search_batch));
+    }
+    const char* env_event_loops = std::getenv("CONNECT_EVENT_LOOPS");
+    if (env_event_loops) {
+        config.eventLoopThreads = std::max(0, std::atoi(env_event_loops));
+    }
+    const char* env_readers = std::getenv("CONNECT_DB_READERS");
+    if (env_readers) {
+        config.readerThreads = std::max(1, std::atoi(env_readers));
+    }
+    // Media uploads: content-addressed files under CONNECT_MEDIA_DIR, streamed in chunks
+    const char* env_media_dir = std::getenv("CONNECT_MEDIA_DIR");
+    if (env_media_dir) {
+        config.media.root = QString::fromLocal8Bit(env_media_dir);
+    }
+    const char* env_upload_max = std::getenv("CONNECT_UPLOAD_MAX_BYTES");
+    if (env_upload_max) {
+        config.media.maxUploadBytes = std::max<long long>(1, std::atoll(env_upload_max));
+    }
+    const char* env_upload_chunk = std::getenv("CONNECT_UPLOAD_CHUNK_BYTES");
+    if (env_upload_chunk) {
+        config.media.chunkBytes = std::clamp(std::atoi(env_upload_chunk), 4096, 16 << 20);
+    }
+    const char* env_upload_window = std::getenv("CONNECT_UPLOAD_WINDOW");
+    if (env_upload_window) {
+        config.media.window = std::max(1, std::atoi(env_upload_window));
+    }
+    // permessage-deflate style compression of large outbound frames (clients opt in at auth)
+    DeflateOptions& deflate = config.connections.deflate;
+    const char* env_deflate = std::getenv("CONNECT_DEFLATE");
+    if (env_deflate) {
+        deflate.enabled = std::atoi(env_deflate) != 0;
+    }
+    const char* env_window_bits = std::getenv("CONNECT_DEFLATE_WINDOW_BITS");
+    if (env_window_bits) {
+        deflate.windowBits = std::clamp(std::atoi(env_window_bits), 9, 15);
+    }
+    const char* env_takeover = std::getenv("CONNECT_DEFLATE_CONTEXT_TAKEOVER");
+    if (env_takeover) {
+        deflate.contextTakeover = std::atoi(env_takeover) != 0;
+    }
+    const char* env_threshold = std::getenv("CONNECT_DEFLATE_THRESHOLD");
+    if (env_threshold) {
+        deflate.threshold = std::max(0, std::atoi(env_threshold));
+    }
+    // HTTP limits on the shared port (slowloris protection, keep-alive)
+    const char* env_max_header = std::getenv("CONNECT_HTTP_MAX_HEADER_BYTES");
+    if (env_max_header) {
+        config.connections.maxHeaderBytes = std::max(1024, std::atoi(env_max_header));
+    }
+    const char* env_header_timeout = std::getenv("CONNECT_HTTP_HEADER_TIMEOUT_MS");
+    if (env_header_timeout) {
+        config.connections.headerTimeout = std::chrono::milliseconds(std::max(100, std::atoi(env_header_timeout)));
+    }
+    const char* env_keepalive = std::getenv("CONNECT_HTTP_KEEPALIVE_MS");
+    if (env_keepalive) {
+        config.connections.keepAliveTimeout = std::chrono::milliseconds(std::max(0, std::atoi(env_keepalive)));
+    }
+    // Per-connection outbound queue: watermarks in bytes, then what a congested connection loses
+    const char* env_high_watermark = std::getenv("CONNECT_OUTBOUND_HIGH_WATERMARK");
+    if (env_high_watermark) {
+        config.connections.outboundHighWatermark = std::max<qint64>(4096, std::atoll(env_high_watermark));
+    }
+    const char* env_low_watermark = std::getenv("CONNECT_OUTBOUND_LOW_WATERMARK");
+    if (env_low_watermark) {
+        config.connections.outboundLowWatermark = std::max<qint64>(0, std::atoll(env_low_watermark));
+    }
+    const char* env_hard_limit = std::getenv("CONNECT_OUTBOUND_HARD_LIMIT");
+    if (env_hard_limit) {
+        config.connections.outboundHardLimit = std::max<qint64>(4096, std::atoll(env_hard_limit));
+    }
+    config.connections.outboundLowWatermark = std::min(config.connections.outboundLowWatermark,
+                                                       config.connections.outboundHighWatermark);
+    config.connections.outboundHardLimit = std::max(config.connections.outboundHardLimit,
+                                                    config.connections.outboundHighWatermark);
+    const char* env_grace = std::getenv("CONNECT_SLOW_CONSUMER_GRACE_MS");
+    if (env_grace) {
+        config.connections.slowConsumerGrace = std::chrono::milliseconds(std::max(0, std::atoi(env_grace)));
+    }
+    const char* env_pause_history = std::getenv("CONNECT_CONGESTION_PAUSE_HISTORY");
+    if (env_pause_history) {
+        config.connections.pauseHistoryWhenCongested = std::atoi(env_pause_history) != 0;
+    }
+    const char* env_drop_ephemeral = std::getenv("CONNECT_CONGESTION_DROP_EPHEMERAL");
+    if (env_drop_ephemeral) {
+        config.connections.dropEphemeralWhenCongested = std::atoi(env_drop_ephemeral) != 0;
+    }
+    // Server-side heartbeat: WebSocket ping after this much silence, close if unanswered
+    const char* env_heartbeat = std::getenv("CONNECT_HEARTBEAT_INTERVAL_MS");
+    if (env_heartbeat) {
+        config.connections.heartbeatInterval = std::chrono::milliseconds(std::max(0, std::atoi(env_heartbeat)));
+    }
+    const char* env_heartbeat_timeout = std::getenv("CONNECT_HEARTBEAT_TIMEOUT_MS");
+    if (env_heartbeat_timeout) {
+        config.connections.heartbeatTimeout = std::chrono::milliseconds(std::max(1000, std::atoi(env_heartbeat_timeout)));
+    }
+    // Token-bucket request limits, "rate" or "rate/burst" per second; "0" disables one
+    const std::pair<const char*, RateLimit*> rateLimits[] = {
+        {"CONNECT_RATE_CONNECTION", &config.connections.rateLimits.connection},
+        {"CONNECT_RATE_MESSAGE", &config.connections.rateLimits.message},
+        {"CONNECT_RATE_HISTORY", &config.connections.rateLimits.history},
+        {"CONNECT_RATE_CONTROL", &config.connections.rateLimits.control},
+        {"CONNECT_RATE_USER_MESSAGE", &config.connections.rateLimits.userMessage},
+        {"CONNECT_RATE_USER_HISTORY", &config.connections.rateLimits.userHistory},
+    };
+    for (const auto& [name, limit] : rateLimits) {
+        const char* value = std::getenv(name);
+        if (value && !RateLimit::parse(value, *limit)) {
+            std::cerr << "Invalid " << name << ": " << value << std::endl;
+            return 1;
+        }
+    }
+    // Presence pushes: changes within the window go to each watcher as one frame
+    const char* env_presence_window = std::getenv("CONNECT_PRESENCE_WINDOW_MS");
+    if (env_presence_window) {
+        config.presenceWindow = std::chrono::milliseconds(std::max(0, std::atoi(env_presence_window)));
+    }
+    // Cluster mode: several servers behind a load balancer, joined by a ConnectBroker
+    // ("host:port" or "local:<socket name>"); node ids default to hostname:port
+    const char* env_cluster_broker = std::getenv("CONNECT_CLUSTER_BROKER");
+    if (env_cluster_broker && *env_cluster_broker) {
+        config.cluster.broker = ClusterBus::Address::parse(QString::fromLocal8Bit(env_cluster_broker));
+        if (!config.cluster.broker.valid) {
+            std::cerr << "Invalid CONNECT_CLUSTER_BROKER: " << env_cluster_broker << std::endl;
+            return 1;
+        }
+    }
+    const char* env_node_id = std::getenv("CONNECT_CLUSTER_NODE_ID");
+    if (env_node_id) {
+        config.cluster.nodeId = QString::fromLocal8Bit(env_node_id);
+    }
+    std::cout << "Persistence: ack after "
+              << (config.persistence.ackMode == PersistenceQueue::AckMode::AfterCommit ? "commit" : "enqueue")
+              << ", batch " << config.persistence.maxBatchSize
+              << " / " << config.persistence.maxBatchDelay.count() << " ms" << std::endl;
+    if (deflate.enabled) {
+        std::cout << "Compression: deflate, window " << deflate.windowBits
+                  << " bits, context takeover " << (deflate.contextTakeover ? "on" : "off")
+                  << ", threshold " << deflate.threshold << " bytes" << std::endl;
     }
-    std::cout << "Database initialized successfully" << std::endl;
     
     // Create and start WebSocket server
-    g_server = std::make_unique<WebSocketServer>();
+    g_server = std::make_unique<WebSocketServer>(config);
     
     // Get port from environment variable or command line
     int port = 9001;
@@ -0,0 +1,132 @@
+#include "../include/ClusterBus.h"
+#include <QDataStream>
+#include <QtEndian>
+
+namespace ClusterBus {
+
+namespace {
+
+// Pinned so nodes built against different Qt versions can share a broker.
+constexpr QDataStream::Version kStreamVersion = QDataStream::Qt_5_15;
+
+} // namespace
+
+Address Address::parse(const QString& text) {
+    Address address;
+    const QString value = text.trimmed();
+    if (value.startsWith(QLatin1String("local:"))) {
+        address.local = true;
+        address.name = value.mid(6);
+        address.valid = !address.name.isEmpty();
+        return address;
+    }
+
+    QString port = value;
+    const int colon = value.lastIndexOf(QLatin1Char(':'));
+    if (colon >= 0) {
+        address.host = value.left(colon);
+        port = value.mid(colon + 1);
+    }
+    bool ok = false;
+    const uint number = port.toUInt(&ok);
+    address.port = static_cast<quint16>(number);
+    address.valid = ok && number > 0 && number <= 0xFFFF && !address.host.isEmpty();
+    return address;
+}
+
+QString Address::toString() const {
+    return local ? QStringLiteral("local:") + name : QStringLiteral("%1:%2").arg(host).arg(port);
+}
+
+void appendRecord(QByteArray& out, const Record& record) {
+    const qsizetype start = out.size();
+    out.append(4, '\0');
+    {
+        QDataStream stream(&out, QIODevice::WriteOnly | QIODevice::Append);
+        stream.setVersion(kStreamVersion);
+        stream << static_cast<quint8>(record.kind);
+        switch (record.kind) {
+        case Kind::Hello:
+            stream << record.node;
+            break;
+        case Kind::Presence:
+            stream << record.username << record.node << record.online << static_cast<quint8>(record.protocol);
+            break;
+        case Kind::Forward:
+            stream << record.node << record.usernames << record.hasText;
+            if (record.hasText) {
+                stream << record.text;
+            }
+            stream << record.hasBinary;
+            if (record.hasBinary) {
+                stream << record.binary;
+            }
+            if (!record.sender.isEmpty()) {
+                stream << record.sender << record.timestamp;
+            }
+            break;
+        case Kind::GroupMembership:
+            stream << record.group << record.username << record.online;
+            break;
+        }
+    }
+    qToBigEndian(static_cast<quint32>(out.size() - start - 4), out.data() + start);
+}
+
+ReadStatus readRecord(const QByteArray& buffer, qsizetype& offset, Record& record) {
+    if (buffer.size() - offset < 4) {
+        return ReadStatus::Incomplete;
+    }
+    const quint32 size = qFromBigEndian<quint32>(buffer.constData() + offset);
+    if (size == 0 || size > kMaxRecordBytes) {
+        return ReadStatus::Error;
+    }
+    if (buffer.size() - offset - 4 < static_cast<qsizetype>(size)) {
+        return ReadStatus::Incomplete;
+    }
+
+    const QByteArray body = QByteArray::fromRawData(buffer.constData() + offset + 4, static_cast<int>(size));
+    QDataStream stream(body);
+    stream.setVersion(kStreamVersion);
+
+    quint8 kind = 0;
+    stream >> kind;
+    record = Record();
+    record.kind = static_cast<Kind>(kind);
+    switch (record.kind) {
+    case Kind::Hello:
+        stream >> record.node;
+        break;
+    case Kind::Presence: {
+        quint8 protocol = 0;
+        stream >> record.username >> record.node >> record.online >> protocol;
+        record.protocol = protocol == static_cast<quint8>(WireProtocol::Binary) ? WireProtocol::Binary
+                                                                                 : WireProtocol::Json;
+        break;
+    }
+    case Kind::Forward:
+        stream >> record.node >> record.usernames >> record.hasText;
+        if (record.hasText) {
+            stream >> record.text;
+        }
+        stream >> record.hasBinary;
+        if (record.hasBinary) {
+            stream >> record.binary;
+        }
+        // Optional tail: a direct message to be marked delivered.
+        if (!stream.atEnd()) {
+            stream >> record.sender >> record.timestamp;
+        }
+        break;
+    case Kind::GroupMembership:
+        stream >> record.group >> record.username >> record.online;
+        break;
+    default:
+        return ReadStatus::Error;
+    }
+
+    offset += 4 + size;
+    return stream.status() == QDataStream::Ok ? ReadStatus::Record : ReadStatus::Error;
+}
+
+} // namespace ClusterBus
@@ -0,0 +1,368 @@
+#include "../include/ClusterLink.h"
+#include "../include/ConnectionShard.h"
+#include "../include/Metrics.h"
+#include <QLocalSocket>
+#include <QMutexLocker>
+#include <QReadLocker>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QWriteLocker>
+#include <iostream>
+#include <memory>
+
+ClusterLink::ClusterLink(const Options& options, RoutingTable& routing, GroupDirectory& groups, QObject* parent)
+    : QObject(parent)
+    , m_options(options)
+    , m_routing(routing)
+    , m_groups(groups)
+{
+}
+
+ClusterLink::~ClusterLink() = default;
+
+void ClusterLink::start() {
+    // Retries until the broker is up; a node serves its own users meanwhile.
+    m_reconnectTimer = new QTimer(this);
+    connect(m_reconnectTimer, &QTimer::timeout, this, [this]() {
+        bool connected;
+        {
+            QMutexLocker locker(&m_outboxMutex);
+            connected = m_connected;
+        }
+        if (!connected) {
+            connectToBroker();
+        }
+    });
+    m_reconnectTimer->start(m_options.reconnectInterval);
+    connectToBroker();
+}
+
+void ClusterLink::stop() {
+    if (m_reconnectTimer) {
+        m_reconnectTimer->stop();
+    }
+    // Whatever the shards announced while shutting down goes out first; the
+    // broker drops this node's users when the connection closes anyway.
+    flush();
+    if (m_socket) {
+        m_socket->disconnect(this);
+        m_socket->close();
+        m_socket->deleteLater();
+        m_socket = nullptr;
+    }
+    onDisconnected();
+}
+
+void ClusterLink::connectToBroker() {
+    if (m_socket) {
+        m_socket->disconnect(this);
+        m_socket->deleteLater();
+        m_socket = nullptr;
+    }
+    m_inbox.clear();
+
+    if (m_options.broker.local) {
+        auto* socket = new QLocalSocket(this);
+        m_socket = socket;
+        connect(socket, &QLocalSocket::connected, this, &ClusterLink::onConnected);
+        connect(socket, &QLocalSocket::disconnected, this, &ClusterLink::onDisconnected);
+        connect(socket, &QIODevice::readyRead, this, &ClusterLink::onReadyRead);
+        socket->connectToServer(m_options.broker.name);
+    } else {
+        auto* socket = new QTcpSocket(this);
+        m_socket = socket;
+        // Records are already coalesced per event-loop turn; Nagle would only add delay.
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        connect(socket, &QTcpSocket::connected, this, &ClusterLink::onConnected);
+        connect(socket, &QTcpSocket::disconnected, this, &ClusterLink::onDisconnected);
+        connect(socket, &QIODevice::readyRead, this, &ClusterLink::onReadyRead);
+        socket->connectToHost(m_options.broker.host, m_options.broker.port);
+    }
+}
+
+void ClusterLink::onConnected() {
+    ClusterBus::Record hello;
+    hello.kind = ClusterBus::Kind::Hello;
+    hello.node = m_options.nodeId;
+    {
+        QMutexLocker locker(&m_outboxMutex);
+        m_connected = true;
+        m_outbox.clear();
+        m_outboxRecords = 0;
+        ClusterBus::appendRecord(m_outbox, hello);
+        ++m_outboxRecords;
+    }
+
+    // Every local user, under the routing table's read lock: a concurrent
+    // register/unregister announces itself either before or after the whole
+    // snapshot, never in the middle, so the broker ends up with the current state.
+    m_routing.forEach([this](const QString& username, const RoutingTable::Route& route) {
+        announcePresence(username, true, route.protocol);
+    });
+    flush();
+
+    Metrics::instance().clusterBrokerConnected.store(1, std::memory_order_relaxed);
+    std::cout << "Cluster: node " << m_options.nodeId.toStdString() << " connected to broker "
+              << m_options.broker.toString().toStdString() << std::endl;
+}
+
+void ClusterLink::onDisconnected() {
+    bool wasConnected;
+    {
+        QMutexLocker locker(&m_outboxMutex);
+        wasConnected = m_connected;
+        m_connected = false;
+        m_outbox.clear();
+        m_outboxRecords = 0;
+    }
+    // Without the broker nothing about other nodes is known: their users
+    // count as offline (messages go to the offline queue) until it is back.
+    QHash<QString, RemoteRoute> lost;
+    {
+        QWriteLocker locker(&m_remoteLock);
+        lost.swap(m_remote);
+    }
+    if (m_presenceListener) {
+        for (auto it = lost.cbegin(); it != lost.cend(); ++it) {
+            m_presenceListener(it.key());
+        }
+    }
+    Metrics::instance().clusterRemoteUsers.store(0, std::memory_order_relaxed);
+    Metrics::instance().clusterBrokerConnected.store(0, std::memory_order_relaxed);
+    if (wasConnected) {
+        std::cout << "Cluster: lost broker " << m_options.broker.toString().toStdString() << std::endl;
+    }
+}
+
+void ClusterLink::onReadyRead() {
+    m_inbox += m_socket->readAll();
+
+    qsizetype offset = 0;
+    ClusterBus::Record record;
+    for (;;) {
+        const ClusterBus::ReadStatus status = ClusterBus::readRecord(m_inbox, offset, record);
+        if (status == ClusterBus::ReadStatus::Incomplete) {
+            break;
+        }
+        if (status == ClusterBus::ReadStatus::Error) {
+            std::cerr << "Cluster: malformed record from broker, reconnecting" << std::endl;
+            m_inbox.clear();
+            onDisconnected();
+            connectToBroker();
+            return;
+        }
+        handleRecord(record);
+    }
+    m_inbox.remove(0, offset);
+}
+
+void ClusterLink::handleRecord(const ClusterBus::Record& record) {
+    switch (record.kind) {
+    case ClusterBus::Kind::Presence: {
+        if (record.node == m_options.nodeId) {
+            break;
+        }
+        bool changed = true;
+        {
+            QWriteLocker locker(&m_remoteLock);
+            if (record.online) {
+                m_remote.insert(record.username, RemoteRoute{record.node, record.protocol});
+            } else {
+                // Only the node the user was last seen on may take them offline.
+                auto it = m_remote.find(record.username);
+                changed = it != m_remote.end() && it.value().node == record.node;
+                if (changed) {
+                    m_remote.erase(it);
+                }
+            }
+            Metrics::instance().clusterRemoteUsers.store(m_remote.size(), std::memory_order_relaxed);
+        }
+        if (changed && m_presenceListener) {
+            m_presenceListener(record.username);
+        }
+        break;
+    }
+    case ClusterBus::Kind::Forward:
+        deliverLocal(record);
+        break;
+    case ClusterBus::Kind::GroupMembership:
+        // Stored by the node that accepted the request; the database file is shared.
+        if (record.online) {
+            m_groups.join(record.group, record.username);
+        } else {
+            m_groups.leave(record.group, record.username);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void ClusterLink::deliverLocal(const ClusterBus::Record& record) {
+    Metrics::instance().clusterReceived.fetch_add(1, std::memory_order_relaxed);
+
+    auto frame = std::make_shared<FanoutFrame>();
+    if (record.hasText) {
+        Frame& json = frame->frames[static_cast<int>(WireProtocol::Json)];
+        json.protocol = WireProtocol::Json;
+        json.text = record.text;
+        frame->encoded[static_cast<int>(WireProtocol::Json)] = true;
+    }
+    if (record.hasBinary) {
+        Frame& binary = frame->frames[static_cast<int>(WireProtocol::Binary)];
+        binary.protocol = WireProtocol::Binary;
+        binary.binary = record.binary;
+        frame->encoded[static_cast<int>(WireProtocol::Binary)] = true;
+    }
+
+    // A direct message takes the local direct path, which marks the row
+    // delivered once the frame is in the recipient's socket. Not found here
+    // (left meanwhile), it stays undelivered and is pushed after next auth.
+    if (!record.sender.isEmpty() && record.usernames.size() == 1) {
+        const QString& username = record.usernames.front();
+        const RoutingTable::Route route = m_routing.routeFor(username);
+        const Frame* encoded = route.shard ? frame->get(route.protocol) : nullptr;
+        if (encoded) {
+            ConnectionShard* shard = route.shard;
+            QMetaObject::invokeMethod(shard, [shard, username, frame = *encoded, sender = record.sender,
+                                              timestamp = record.timestamp]() {
+                shard->deliver(username, frame, sender, timestamp);
+            }, Qt::QueuedConnection);
+        }
+        return;
+    }
+
+    // Same path as a local group fan-out: one queued call per shard.
+    const QSet<QString> users(record.usernames.cbegin(), record.usernames.cend());
+    QHash<ConnectionShard*, QStringList> byShard;
+    for (const auto& [username, route] : m_routing.onlineRoutes(users)) {
+        byShard[route.shard].append(username);
+    }
+
+    std::shared_ptr<const FanoutFrame> shared = std::move(frame);
+    for (auto it = byShard.cbegin(); it != byShard.cend(); ++it) {
+        ConnectionShard* shard = it.key();
+        QMetaObject::invokeMethod(shard, [shard, usernames = it.value(), shared]() {
+            shard->deliverGroup(usernames, *shared);
+        }, Qt::QueuedConnection);
+    }
+}
+
+bool ClusterLink::remoteRoute(const QString& username, RemoteRoute& route) const {
+    QReadLocker locker(&m_remoteLock);
+    auto it = m_remote.constFind(username);
+    if (it == m_remote.cend()) {
+        return false;
+    }
+    route = it.value();
+    return true;
+}
+
+std::vector<std::pair<QString, ClusterLink::RemoteRoute>> ClusterLink::remoteRoutes(const QSet<QString>& users) const {
+    std::vector<std::pair<QString, RemoteRoute>> routes;
+    QReadLocker locker(&m_remoteLock);
+    if (users.size() <= m_remote.size()) {
+        for (const QString& username : users) {
+            auto it = m_remote.constFind(username);
+            if (it != m_remote.cend()) {
+                routes.emplace_back(username, it.value());
+            }
+        }
+    } else {
+        for (auto it = m_remote.cbegin(); it != m_remote.cend(); ++it) {
+            if (users.contains(it.key())) {
+                routes.emplace_back(it.key(), it.value());
+            }
+        }
+    }
+    return routes;
+}
+
+void ClusterLink::forward(const QString& node, const QString& username, const Frame& frame, const QString& sender,
+                          qint64 timestamp) {
+    FanoutFrame fanout;
+    fanout.frames[static_cast<int>(frame.protocol)] = frame;
+    fanout.encoded[static_cast<int>(frame.protocol)] = true;
+    forwardFrame(node, QStringList{username}, fanout, sender, timestamp);
+}
+
+void ClusterLink::forward(const QString& node, const QStringList& usernames, const FanoutFrame& frame) {
+    forwardFrame(node, usernames, frame, QString(), 0);
+}
+
+void ClusterLink::forwardFrame(const QString& node, const QStringList& usernames, const FanoutFrame& frame,
+                               const QString& sender, qint64 timestamp) {
+    ClusterBus::Record record;
+    record.kind = ClusterBus::Kind::Forward;
+    record.node = node;
+    record.usernames = usernames;
+    record.sender = sender;
+    record.timestamp = timestamp;
+    if (const Frame* json = frame.get(WireProtocol::Json)) {
+        record.hasText = true;
+        record.text = json->text;
+    }
+    if (const Frame* binary = frame.get(WireProtocol::Binary)) {
+        record.hasBinary = true;
+        record.binary = binary->binary;
+    }
+    if (enqueue(record)) {
+        Metrics::instance().clusterForwarded.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void ClusterLink::announcePresence(const QString& username, bool online, WireProtocol protocol) {
+    ClusterBus::Record record;
+    record.kind = ClusterBus::Kind::Presence;
+    record.username = username;
+    record.online = online;
+    record.protocol = protocol;
+    enqueue(record);
+}
+
+void ClusterLink::announceMembership(const QString& group, const QString& username, bool joined) {
+    ClusterBus::Record record;
+    record.kind = ClusterBus::Kind::GroupMembership;
+    record.group = group;
+    record.username = username;
+    record.online = joined;
+    enqueue(record);
+}
+
+bool ClusterLink::enqueue(const ClusterBus::Record& record) {
+    // Serialized outside the lock; shards only contend for the append.
+    QByteArray encoded;
+    ClusterBus::appendRecord(encoded, record);
+
+    QMutexLocker locker(&m_outboxMutex);
+    if (!m_connected) {
+        Metrics::instance().clusterDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    m_outbox += encoded;
+    ++m_outboxRecords;
+    // The first record of a batch schedules the write; everything queued
+    // before the link thread gets to it rides in the same write().
+    if (!m_flushScheduled) {
+        m_flushScheduled = true;
+        QMetaObject::invokeMethod(this, [this]() { flush(); }, Qt::QueuedConnection);
+    }
+    return true;
+}
+
+void ClusterLink::flush() {
+    QByteArray batch;
+    int records = 0;
+    {
+        QMutexLocker locker(&m_outboxMutex);
+        m_flushScheduled = false;
+        if (!m_connected || m_outbox.isEmpty()) {
+            return;
+        }
+        batch.swap(m_outbox);
+        records = m_outboxRecords;
+        m_outboxRecords = 0;
+    }
+    m_socket->write(batch);
+    Metrics::instance().clusterBatchRecords.observe(static_cast<std::uint64_t>(records));
+}
@@ -0,0 +1,1529 @@
+#include "../include/ConnectionShard.h"
+#include "../include/ClusterLink.h"
+#include "../include/FrameWriter.h"
+#include "../include/Database.h"
+#include "../include/PersistenceQueue.h"
+#include "../include/ReaderPool.h"
+#include "../include/RoutingTable.h"
+#include <QDateTime>
+#include <QTcpSocket>
+#include <QtEndian>
+#include <QTimer>
+#include <QPointer>
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+// history page size (the "limit" field)
+constexpr int kDefaultHistoryPage = 100;
+constexpr int kMaxHistoryPage = 500;
+
+// search page size; results end after the newest 1000 matches anyway
+constexpr int kDefaultSearchPage = 20;
+constexpr int kMaxSearchPage = 50;
+
+// Largest inbound WebSocket message a client may send; upload chunks may be
+// larger. Qt otherwise buffers messages of up to 2 GiB before handing them over.
+constexpr qint64 kMaxIncomingMessage = 1 << 20;
+
+const QStringList kMediaTypes = {QStringLiteral("photo"), QStringLiteral("video"),
+                                 QStringLiteral("voice"), QStringLiteral("file")};
+
+// Fixed-size binary value from its hex form; empty if malformed.
+QByteArray fromHex(const QString& hex, int bytes) {
+    const QByteArray raw = QByteArray::fromHex(hex.toLatin1());
+    return raw.size() == bytes && raw.toHex() == hex.toLatin1().toLower() ? raw : QByteArray();
+}
+
+// Offline backlog pushed after auth: messages per pending_messages frame and
+// the most sent per login (the rest stays queued; has_more tells the client).
+constexpr int kPendingFramePage = 200;
+constexpr int kMaxPendingOnAuth = 2000;
+
+// Contacts a session follows the presence of: the snapshot after auth and
+// first messages to new partners both stop adding at this many.
+constexpr int kMaxContacts = 1000;
+
+// Event-loop lag probe period.
+constexpr std::chrono::milliseconds kLagProbeInterval{100};
+
+// Heartbeat timing-wheel resolution: pings and reaps happen up to one tick late.
+constexpr std::chrono::milliseconds kHeartbeatTick{250};
+
+// Heartbeat durations in wheel ticks, rounded up.
+std::uint64_t heartbeatTicks(std::chrono::milliseconds duration) {
+    return static_cast<std::uint64_t>((duration.count() + kHeartbeatTick.count() - 1) / kHeartbeatTick.count());
+}
+
+// Payload size of an encoded frame; text is counted in UTF-16 units, close
+// enough to its UTF-8 size for accounting.
+qint64 frameSize(const Frame& frame) {
+    return frame.protocol == WireProtocol::Binary ? frame.binary.size() : frame.text.size();
+}
+
+// QWebSocket reports bytesWritten for the whole WebSocket frame, but the send
+// calls return the payload size: add the (unmasked, server-side) header.
+qint64 wireSize(qint64 payload) {
+    return payload + 2 + (payload > 0xFFFF ? 8 : payload > 125 ? 2 : 0);
+}
+
+ShardMetrics::RequestType requestMetric(Wire::Type type) {
+    switch (type) {
+    case Wire::Type::Auth: return ShardMetrics::Auth;
+    case Wire::Type::Message: return ShardMetrics::Message;
+    case Wire::Type::History: return ShardMetrics::History;
+    case Wire::Type::Search: return ShardMetrics::Search;
+    case Wire::Type::Ping: return ShardMetrics::Ping;
+    case Wire::Type::GroupMessage:
+    case Wire::Type::GroupJoin:
+    case Wire::Type::GroupLeave: return ShardMetrics::Group;
+    default: return ShardMetrics::Other;
+    }
+}
+
+// One HTTP/1.1 response; HEAD gets the same headers without the body.
+QByteArray makeResponse(const char* status, const QByteArray& headers, const QByteArray& body,
+                        bool keepAlive, bool headOnly = false) {
+    QByteArray response = QByteArray("HTTP/1.1 ") + status + "\r\n" +
+                          headers +
+                          "Content-Length: " + QByteArray::number(body.size()) + "\r\n" +
+                          (keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n") +
+                          "\r\n";
+    if (!headOnly) {
+        response += body;
+    }
+    return response;
+}
+
+// 200 with the best encoding the client accepts, or 304 if its cached copy is current.
+// no-cache makes browsers revalidate every load, which costs a 304 and no body.
+QByteArray assetResponse(const StaticAssetCache::Asset& asset, const HttpRequestParser& request,
+                         bool keepAlive, bool headOnly) {
+    const StaticAssetCache::Encoding encoding = asset.negotiate(request.header("accept-encoding"));
+    const StaticAssetCache::Variant& variant = asset.variant(encoding);
+
+    QByteArray headers = "ETag: " + variant.etag + "\r\n"
+                         "Cache-Control: no-cache\r\n"
+                         "Vary: Accept-Encoding\r\n";
+
+    const QByteArray ifNoneMatch = request.header("if-none-match");
+    if (!ifNoneMatch.isEmpty() && asset.matches(ifNoneMatch)) {
+        return "HTTP/1.1 304 Not Modified\r\n" + headers +
+               (keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n") + "\r\n";
+    }
+
+    headers += "Content-Type: " + asset.contentType + "\r\n";
+    if (encoding == StaticAssetCache::Encoding::Gzip) {
+        headers += "Content-Encoding: gzip\r\n";
+    } else if (encoding == StaticAssetCache::Encoding::Brotli) {
+        headers += "Content-Encoding: br\r\n";
+    }
+    return makeResponse("200 OK", headers, variant.body, keepAlive, headOnly);
+}
+
+} // namespace
+
+ConnectionShard::ConnectionShard(int index, PersistenceQueue& persistence, ReaderPool& readers, MediaStore& media,
+                                 RoutingTable& routing, GroupDirectory& groups, UserRateLimiter& userRates,
+                                 ClusterLink* cluster, PresenceHub& presence, const StaticAssetCache& assets,
+                                 const Options& options, QObject* parent)
+    : QObject(parent)
+    , m_index(index)
+    , m_persistence(persistence)
+    , m_readers(readers)
+    , m_media(media)
+    , m_routing(routing)
+    , m_groups(groups)
+    , m_userRates(userRates)
+    , m_cluster(cluster)
+    , m_presence(presence)
+    , m_assets(assets)
+    , m_options(options)
+    , m_wsServer(new QWebSocketServer("Connect Messenger", QWebSocketServer::NonSecureMode, this))
+{
+    // Never listens: handshakes arrive through handleConnection() from addConnection().
+#if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0)
+    m_wsServer->setSupportedSubprotocols({QString::fromLatin1(Wire::kBinarySubprotocol)});
+#endif
+    connect(m_wsServer, &QWebSocketServer::newConnection, this, &ConnectionShard::onNewConnection);
+    m_clock.start();
+    Metrics::instance().attach(&m_metrics);
+}
+
+ConnectionShard::~ConnectionShard() {
+    Metrics::instance().detach(&m_metrics);
+}
+
+void ConnectionShard::start() {
+    m_lagProbe = new QTimer(this);
+    m_lagProbe->setTimerType(Qt::PreciseTimer);
+    connect(m_lagProbe, &QTimer::timeout, this, &ConnectionShard::onLagProbe);
+    m_lagProbeDue = std::chrono::steady_clock::now() + kLagProbeInterval;
+    m_lagProbe->start(kLagProbeInterval);
+
+    if (m_options.heartbeatInterval.count() > 0) {
+        m_heartbeatTimer = new QTimer(this);
+        m_heartbeatTimer->setTimerType(Qt::CoarseTimer);
+        connect(m_heartbeatTimer, &QTimer::timeout, this, &ConnectionShard::onHeartbeatTick);
+        m_heartbeatTimer->start(kHeartbeatTick);
+    }
+}
+
+void ConnectionShard::onLagProbe() {
+    // A busy loop fires the timer late; the lateness is what queued frames wait too.
+    const auto now = std::chrono::steady_clock::now();
+    const auto lag = std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_lagProbeDue).count();
+    m_metrics.eventLoopLag.observe(lag > 0 ? static_cast<std::uint64_t>(lag) : 0);
+    m_lagProbeDue = now + kLagProbeInterval;
+}
+
+void ConnectionShard::shutdown() {
+    if (m_lagProbe) {
+        m_lagProbe->stop();
+    }
+    if (m_heartbeatTimer) {
+        m_heartbeatTimer->stop();
+    }
+    m_wsServer->close();
+    for (auto it = m_usersByName.cbegin(); it != m_usersByName.cend(); ++it) {
+        m_routing.unregisterUser(it.key(), this);
+    }
+    m_usersByName.clear();
+    m_watchers.clear();
+    for (auto& [client, session] : m_sessions) {
+        client->disconnect(this);
+    }
+    m_sessions.clear();
+    m_metrics.authenticatedUsers.store(0, std::memory_order_relaxed);
+    m_metrics.webSocketConnections.store(0, std::memory_order_relaxed);
+    m_metrics.outboundQueuedBytes.store(0, std::memory_order_relaxed);
+    m_metrics.congestedConnections.store(0, std::memory_order_relaxed);
+}
+
+void ConnectionShard::onNewConnection() {
+    QWebSocket* client = m_wsServer->nextPendingConnection();
+    
+    auto session = std::make_unique<Session>();
+    session->socket = client;
+#if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0)
+    if (client->subprotocol() == QLatin1String(Wire::kBinarySubprotocol)) {
+        session->protocol = WireProtocol::Binary;
+    }
+#endif
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    // Inbound memory per connection is one bounded message.
+    const quint64 maxMessage = static_cast<quint64>(
+        std::max<qint64>(kMaxIncomingMessage, m_media.options().chunkBytes + Wire::kUploadChunkHeaderBytes));
+    client->setMaxAllowedIncomingMessageSize(maxMessage);
+    client->setMaxAllowedIncomingFrameSize(maxMessage);
+#endif
+    Session* state = session.get();
+    m_sessions.emplace(client, std::move(session));
+    m_metrics.webSocketConnections.fetch_add(1, std::memory_order_relaxed);
+    
+    // Handlers capture the session, so a frame never needs a socket -> user lookup.
+    connect(client, &QWebSocket::textMessageReceived, this, [this, state](const QString& message) {
+        onTextFrame(*state, message);
+    });
+    connect(client, &QWebSocket::binaryMessageReceived, this, [this, state](const QByteArray& message) {
+        onBinaryFrame(*state, message);
+    });
+    connect(client, &QWebSocket::disconnected, this, [this, state]() {
+        onDisconnected(state);
+    });
+    connect(client, &QWebSocket::bytesWritten, this, [this, state](qint64 bytes) {
+        onBytesWritten(*state, bytes);
+    });
+    
+    // Liveness: first check one interval from now, then re-armed lazily.
+    if (m_heartbeatTimer) {
+        connect(client, &QWebSocket::pong, this, [this, state](quint64, const QByteArray&) {
+            touch(*state);
+        });
+        state->heartbeat.owner = state;
+        state->lastActivity = m_heartbeats.now();
+        m_heartbeats.schedule(state->heartbeat, state->lastActivity + heartbeatTicks(m_options.heartbeatInterval));
+    }
+    
+    std::cout << "New WebSocket connection established" << std::endl;
+}
+
+void ConnectionShard::addConnection(qintptr socketDescriptor) {
+    // The socket is created in this shard's thread so it, and the QWebSocket
+    // built on top of it, belong to this event loop.
+    QTcpSocket* socket = new QTcpSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        std::cerr << "Failed to adopt socket: " << socket->errorString().toStdString() << std::endl;
+        delete socket;
+        return;
+    }
+    m_metrics.connectionsAccepted.fetch_add(1, std::memory_order_relaxed);
+    m_metrics.tcpConnections.fetch_add(1, std::memory_order_relaxed);
+    // Also fires for sockets handed to QWebSocketServer, when their QWebSocket goes.
+    connect(socket, &QObject::destroyed, this, [this]() {
+        m_metrics.tcpConnections.fetch_sub(1, std::memory_order_relaxed);
+    });
+
+    // Plain HTTP and WebSocket upgrades share the port. The parser only peeks,
+    // so an upgrade request is still unread when QWebSocketServer gets the socket.
+    auto parser = std::make_shared<HttpRequestParser>(m_options.maxHeaderBytes);
+
+    // Slowloris guard: headers must arrive within headerTimeout, and an idle
+    // keep-alive connection is closed after keepAliveTimeout.
+    QTimer* timer = new QTimer(socket);
+    timer->setSingleShot(true);
+    connect(timer, &QTimer::timeout, socket, &QTcpSocket::abort);
+    timer->start(m_options.headerTimeout);
+
+    connect(socket, &QTcpSocket::readyRead, this, [this, socket, parser, timer]() {
+        onHttpData(socket, *parser, timer);
+    });
+    connect(socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater);
+}
+
+void ConnectionShard::onHttpData(QTcpSocket* socket, HttpRequestParser& parser, QTimer* timer) {
+    // Loops for pipelined keep-alive requests already in the buffer.
+    while (socket->bytesAvailable() > 0) {
+        if (!parser.started()) {
+            timer->start(m_options.headerTimeout);
+        }
+
+        switch (parser.parse(socket->peek(parser.maxHeaderBytes() + 1))) {
+        case HttpRequestParser::Status::NeedMore:
+            return;
+        case HttpRequestParser::Status::TooLarge:
+            socket->write(makeResponse("431 Request Header Fields Too Large", QByteArray(), QByteArray(), false));
+            socket->disconnectFromHost();
+            return;
+        case HttpRequestParser::Status::Malformed:
+            socket->write(makeResponse("400 Bad Request", QByteArray(), QByteArray(), false));
+            socket->disconnectFromHost();
+            return;
+        case HttpRequestParser::Status::Complete:
+            break;
+        }
+
+        // A body would be read as WebSocket frames after the handshake.
+        if (parser.isWebSocketUpgrade() && parser.hasBody()) {
+            socket->write(makeResponse("400 Bad Request", QByteArray(), QByteArray(), false));
+            socket->disconnectFromHost();
+            return;
+        }
+        if (parser.isWebSocketUpgrade()) {
+            delete timer;
+            // Drops this handler (and the parser it owns) and the self-delete
+            // before handing over; the destroyed hook stays for the gauge.
+            disconnect(socket, &QTcpSocket::readyRead, this, nullptr);
+            disconnect(socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater);
+            m_wsServer->handleConnection(socket);  // QWebSocketServer takes ownership.
+            return;
+        }
+
+        socket->skip(parser.headerLength());
+
+        // No route takes a body: answer and close instead of skipping it, or
+        // the body would be parsed as the next pipelined request.
+        const bool keepAlive = parser.keepAlive() && !parser.hasBody();
+        socket->write(httpResponse(parser, keepAlive));
+        if (!keepAlive) {
+            timer->stop();
+            socket->disconnectFromHost();
+            return;
+        }
+
+        parser.reset();
+        timer->start(m_options.keepAliveTimeout);
+    }
+}
+
+QByteArray ConnectionShard::httpResponse(const HttpRequestParser& request, bool keepAlive) const {
+    const bool head = request.method() == "HEAD";
+    if (request.method() != "GET" && !head) {
+        return makeResponse("405 Method Not Allowed", "Allow: GET, HEAD\r\nContent-Type: text/plain\r\n",
+                            "Method Not Allowed", keepAlive);
+    }
+
+    const QByteArray& path = request.path();
+
+    // Health-check endpoint.
+    if (path == "/health") {
+        const QByteArray body = QStringLiteral("{\"status\":\"healthy\",\"online_users\":%1}").arg(m_routing.size()).toUtf8();
+        return makeResponse("200 OK", "Content-Type: application/json\r\n", body, keepAlive, head);
+    }
+
+    // Prometheus scrape endpoint
+    if (path == "/metrics") {
+        return makeResponse("200 OK", "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n",
+                            QByteArray::fromStdString(Metrics::instance().render()), keepAlive, head);
+    }
+
+    // Web client, served from memory (no disk I/O per request)
+    if (auto asset = m_assets.find(QString::fromLatin1(path))) {
+        return assetResponse(*asset, request, keepAlive, head);
+    }
+
+    // web_client.html is missing: keep a minimal page on the old routes.
+    if (path == "/client") {
+        return makeResponse("200 OK", "Content-Type: text/html\r\n",
+                            "<html><body><h1>Web Client Not Found</h1></body></html>", keepAlive, head);
+    }
+    if (path == "/" || path == "/index.html") {
+        return makeResponse("200 OK", "Content-Type: text/html\r\n",
+                            R"(<html><body><h1>Connect Messenger Server</h1><p>Server is running</p><p><a href="/client">Web Client</a></p></body></html>)",
+                            keepAlive, head);
+    }
+
+    return makeResponse("404 Not Found", "Content-Type: text/plain\r\n", "Not Found", keepAlive, head);
+}
+
+void ConnectionShard::onDisconnected(Session* session) {
+    QWebSocket* client = session->socket;
+    
+    // Remove user from online list (unless a newer connection already took the name over)
+    const QString username = session->username;
+    if (!username.isEmpty() && m_usersByName.value(username) == session) {
+        m_usersByName.remove(username);
+        m_routing.unregisterUser(username, this);
+        m_metrics.authenticatedUsers.store(m_usersByName.size(), std::memory_order_relaxed);
+        std::cout << "User " << username.toStdString() << " disconnected" << std::endl;
+    }
+    unwatchContacts(*session);
+    
+    // Whatever was still queued for this client is gone with the socket.
+    m_metrics.outboundQueuedBytes.fetch_sub(session->queuedBytes(), std::memory_order_relaxed);
+    if (session->congested) {
+        m_metrics.congestedConnections.fetch_sub(1, std::memory_order_relaxed);
+    }
+    if (session->graceTimer) {
+        session->graceTimer->stop();
+    }
+    m_heartbeats.cancel(session->heartbeat);
+    
+    client->disconnect(this);
+    client->deleteLater();
+    m_sessions.erase(client);
+    m_metrics.webSocketConnections.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ConnectionShard::onTextFrame(Session& session, const QString& message) {
+    touch(session);
+    if (!admitFrame(session)) {
+        return;
+    }
+    Request request;
+    if (!decodeRequest(message, request)) {
+        m_metrics.invalidFrames.fetch_add(1, std::memory_order_relaxed);
+        sendFrame(session, Frames::errorInvalidFrame(session.protocol));
+        return;
+    }
+    if (admitRequest(session, request.type)) {
+        handleMessage(session, request);
+    }
+}
+
+void ConnectionShard::onBinaryFrame(Session& session, const QByteArray& message) {
+    touch(session);
+    // Upload chunks are data, not requests, in either protocol. They are
+    // paced by the upload window rather than the frame bucket.
+    if (message.startsWith(Wire::kUploadChunkMarker)) {
+        handleUploadChunk(session, message);
+        return;
+    }
+    // Without subprotocol negotiation (Qt < 6.4) a client opts in by sending
+    // binary before auth; after auth the route already carries the protocol.
+    if (!session.isAuthenticated()) {
+        session.protocol = WireProtocol::Binary;
+    }
+    if (!admitFrame(session)) {
+        return;
+    }
+
+    Request request;
+    if (!decodeRequest(message, request)) {
+        m_metrics.invalidFrames.fetch_add(1, std::memory_order_relaxed);
+        sendFrame(session, Frames::errorInvalidFrame(session.protocol));
+        return;
+    }
+    if (admitRequest(session, request.type)) {
+        handleMessage(session, request);
+    }
+}
+
+void ConnectionShard::touch(Session& session) {
+    // Only a tick stamp: the wheel entry is not moved on every frame, the
+    // check finds the newer stamp when it fires and re-arms from there.
+    session.lastActivity = m_heartbeats.now();
+    session.pingSent = false;
+}
+
+void ConnectionShard::onHeartbeatTick() {
+    const std::uint64_t now = static_cast<std::uint64_t>(m_clock.elapsed()) / kHeartbeatTick.count();
+    TimingWheel::List due;
+    m_heartbeats.advance(now, due);
+    while (TimingWheel::Node* node = due.popFront()) {
+        checkHeartbeat(*static_cast<Session*>(node->owner));
+    }
+}
+
+void ConnectionShard::checkHeartbeat(Session& session) {
+    if (session.closing) {
+        return;
+    }
+    const std::uint64_t interval = heartbeatTicks(m_options.heartbeatInterval);
+    const std::uint64_t timeout = heartbeatTicks(m_options.heartbeatTimeout);
+    const std::uint64_t now = m_heartbeats.now();
+
+    // Heard from since the last check: next check one interval after that.
+    if (now < session.lastActivity + interval) {
+        m_heartbeats.schedule(session.heartbeat, session.lastActivity + interval);
+        return;
+    }
+    if (!session.pingSent) {
+        // Control frame, answered by the client's WebSocket stack itself.
+        session.pingSent = true;
+        const qint64 sent = wireSize(0);
+        session.bufferedBytes += sent;
+        m_metrics.outboundQueuedBytes.fetch_add(sent, std::memory_order_relaxed);
+        m_metrics.heartbeatPings.fetch_add(1, std::memory_order_relaxed);
+        session.socket->ping();
+        m_heartbeats.schedule(session.heartbeat, now + timeout);
+        return;
+    }
+
+    // Half-open or hung: the abort ends in onDisconnected like any other close.
+    session.closing = true;
+    m_metrics.idleDisconnects.fetch_add(1, std::memory_order_relaxed);
+    std::cout << "Closing unresponsive connection "
+              << (session.isAuthenticated() ? session.username.toStdString() : std::string("(not authenticated)"))
+              << std::endl;
+    QWebSocket* client = session.socket;
+    QMetaObject::invokeMethod(client, [client]() {
+        client->abort();
+    }, Qt::QueuedConnection);
+}
+
+bool ConnectionShard::admitFrame(Session& session) {
+    // Before decoding: a flood costs one bucket check per frame, not a parse.
+    quint32 retryAfterMs = 0;
+    if (session.frameBucket.take(m_options.rateLimits.connection, static_cast<quint32>(m_clock.elapsed()), retryAfterMs)) {
+        return true;
+    }
+    m_metrics.rateLimitedConnection.fetch_add(1, std::memory_order_relaxed);
+    sendRateLimited(session, retryAfterMs);
+    return false;
+}
+
+bool ConnectionShard::admitRequest(Session& session, Wire::Type type) {
+    const RateLimits& limits = m_options.rateLimits;
+    TokenBucket* bucket = nullptr;
+    const RateLimit* limit = nullptr;
+    bool perUser = false;
+    bool history = false;
+    switch (type) {
+    case Wire::Type::Message:
+    case Wire::Type::GroupMessage:
+        bucket = &session.messageBucket;
+        limit = &limits.message;
+        perUser = true;
+        break;
+    case Wire::Type::History:
+    case Wire::Type::Search:
+        bucket = &session.historyBucket;
+        limit = &limits.history;
+        perUser = true;
+        history = true;
+        break;
+    case Wire::Type::Auth:
+    case Wire::Type::GroupJoin:
+    case Wire::Type::GroupLeave:
+    case Wire::Type::UploadBegin:
+        bucket = &session.controlBucket;
+        limit = &limits.control;
+        break;
+    default:
+        return true; // ping and unknown types: the frame bucket only
+    }
+
+    const quint32 now = static_cast<quint32>(m_clock.elapsed());
+    quint32 retryAfterMs = 0;
+    if (!bucket->take(*limit, now, retryAfterMs)) {
+        m_metrics.rateLimitedConnection.fetch_add(1, std::memory_order_relaxed);
+        sendRateLimited(session, retryAfterMs);
+        return false;
+    }
+    // Shared by the user's sessions on every shard, so extra connections
+    // do not multiply what one account may send.
+    if (perUser && session.isAuthenticated()) {
+        if (!m_userRates.take(session.username, history, retryAfterMs)) {
+            m_metrics.rateLimitedUser.fetch_add(1, std::memory_order_relaxed);
+            sendRateLimited(session, retryAfterMs);
+            return false;
+        }
+    }
+    return true;
+}
+
+void ConnectionShard::sendRateLimited(Session& session, quint32 retryAfterMs) {
+    // Ephemeral: a flooding client that does not read gets no reply queue.
+    sendFrame(session, FrameWriter(m_frameBuffer, session.protocol)
+        .field(Wire::Key::Type, Wire::Type::Error)
+        .field(Wire::Key::Status, QLatin1String("rate_limited"))
+        .field(Wire::Key::Message, QLatin1String("Rate limit exceeded"))
+        .field(Wire::Key::RetryAfterMs, static_cast<qint64>(retryAfterMs))
+        .finish(), Delivery::Ephemeral);
+}
+
+void ConnectionShard::handleMessage(Session& session, const Request& request) {
+    // Event-loop time only: history reads and commits are timed by the database metrics.
+    ScopedTimer timer(m_metrics.requests[requestMetric(request.type)]);
+    QWebSocket* client = session.socket;
+    const WireProtocol protocol = session.protocol;
+    
+    if (request.type == Wire::Type::Auth) {
+        // Authentication
+        const QString& username = request.username;
+        
+        // Register user in database (INSERT OR IGNORE on the writer thread).
+        // Its commit also covers every message queued before this auth, so the
+        // offline backlog read afterwards cannot miss one still in flight.
+        QPointer<QWebSocket> guard(client);
+        m_persistence.enqueueUser(username.toStdString(), [this, guard, protocol, username](bool) {
+            m_readers.submit([this, guard, protocol, username](Database& db) {
+                loadPendingMessages(db, guard, protocol, username);
+            });
+        });
+        // Contacts and their presence snapshot; conversations are read as
+        // committed, so this does not wait for the user row.
+        m_readers.submit([this, guard, username](Database& db) {
+            loadContacts(db, guard, username);
+        });
+        
+        // Re-auth under another name drops the old index entry.
+        if (session.isAuthenticated() && session.username != username
+            && m_usersByName.value(session.username) == &session) {
+            m_usersByName.remove(session.username);
+            m_routing.unregisterUser(session.username, this);
+        }
+        unwatchContacts(session);
+        session.username = username;
+        session.deflateRequested = request.deflate && m_options.deflate.enabled;
+        m_usersByName.insert(username, &session);
+        m_routing.registerUser(username, this, protocol);
+        m_metrics.authenticatedUsers.store(m_usersByName.size(), std::memory_order_relaxed);
+        
+        sendFrame(session, Frames::authSuccess(protocol));
+        
+        std::cout << "User " << username.toStdString() << " authenticated" << std::endl;
+    }
+    else if (request.type == Wire::Type::Message) {
+        // Send message
+        const QString& to = request.to;
+        const QString& text = request.text;
+        
+        const QString& sender = session.username;
+        if (sender.isEmpty()) {
+            sendFrame(session, Frames::errorNotAuthenticated(protocol));
+            return;
+        }
+        
+        // Recipient's shard and protocol, if online (possibly on another shard),
+        // else the cluster node holding them.
+        const RoutingTable::Route target = m_routing.routeFor(to);
+        ClusterLink::RemoteRoute remote;
+        const bool onOtherNode = !target.shard && m_cluster && m_cluster->remoteRoute(to, remote);
+        
+        // Queue for the persistence writer; the event loop never waits on disk.
+        // Stored undelivered even for an online recipient: the recipient's
+        // shard marks it once the frame is written to their socket. Anything
+        // that never gets there is pushed after their next auth.
+        // Stored and sent with the same time, so history matches what was shown
+        // and the delivered row can be found by it.
+        const long long timestamp = Database::currentTimestamp();
+        Message stored;
+        stored.sender = sender.toStdString();
+        stored.receiver = to.toStdString();
+        stored.text = text.toStdString();
+        stored.messageType = "text";
+        stored.timestamp = timestamp;
+        stored.delivered = false;
+        
+        if (onOtherNode) {
+            // The other node marks the row delivered after its socket write,
+            // so it is forwarded once the row is committed and can be found.
+            // A dropped forward (no broker, node gone) leaves it undelivered.
+            const Frame frame = FrameWriter(m_frameBuffer, remote.protocol)
+                .field(Wire::Key::Type, Wire::Type::Message)
+                .field(Wire::Key::From, sender)
+                .field(Wire::Key::Text, text)
+                .field(Wire::Key::Timestamp, static_cast<qint64>(timestamp / 1000000))
+                .finish();
+            m_persistence.enqueue(std::move(stored),
+                [cluster = m_cluster, node = remote.node, to, frame, sender, timestamp,
+                 ack = ackOnCommit(client, protocol)](bool committed) {
+                    if (ack) {
+                        ack(committed);
+                    }
+                    if (committed) {
+                        cluster->forward(node, to, frame, sender, timestamp);
+                    }
+                });
+        } else {
+            m_persistence.enqueue(std::move(stored), ackOnCommit(client, protocol));
+        }
+        
+        // Send to recipient if online here; encoded once, in the recipient's protocol.
+        if (target.shard) {
+            const Frame& frame = FrameWriter(m_frameBuffer, target.protocol)
+                .field(Wire::Key::Type, Wire::Type::Message)
+                .field(Wire::Key::From, sender)
+                .field(Wire::Key::Text, text)
+                .field(Wire::Key::Timestamp, static_cast<qint64>(timestamp / 1000000))
+                .finish();
+            route(target, to, frame, sender, timestamp);
+        }
+        
+        // A new conversation partner becomes a contact: the sender follows
+        // their presence from now on.
+        if (to != sender && !session.contacts.contains(to)) {
+            watchContacts(session, QStringList{to}, false);
+        }
+        
+        // Acknowledgment to sender (ack-after-commit mode replies from onCommitted)
+        if (m_persistence.ackMode() == PersistenceQueue::AckMode::AfterEnqueue) {
+            sendFrame(session, Frames::messageAck(protocol));
+        }
+    }
+    else if (request.type == Wire::Type::GroupMessage) {
+        const QString& group = request.group;
+        const QString& sender = session.username;
+        if (sender.isEmpty()) {
+            sendFrame(session, Frames::errorNotAuthenticated(protocol));
+            return;
+        }
+        
+        // The in-memory snapshot is both the membership check and the
+        // fan-out list; the database is never read on this path.
+        const std::shared_ptr<const GroupDirectory::Members> members = m_groups.members(group);
+        if (!members || !members->contains(sender)) {
+            sendFrame(session, Frames::errorNotGroupMember(protocol));
+            return;
+        }
+        
+        // Stored once for the whole group, not once per member; stored and
+        // sent with the same time, so history matches what was shown.
+        const long long timestamp = Database::currentTimestamp();
+        Message stored;
+        stored.sender = sender.toStdString();
+        stored.receiver = group.toStdString();
+        stored.text = request.text.toStdString();
+        stored.messageType = "text";
+        stored.timestamp = timestamp;
+        m_persistence.enqueueGroupMessage(std::move(stored), ackOnCommit(client, protocol));
+        
+        fanOut(group, sender, request.text, timestamp, *members);
+        
+        if (m_persistence.ackMode() == PersistenceQueue::AckMode::AfterEnqueue) {
+            sendFrame(session, Frames::messageAck(protocol));
+        }
+    }
+    else if (request.type == Wire::Type::GroupJoin || request.type == Wire::Type::GroupLeave) {
+        handleGroupMembership(session, request);
+    }
+    else if (request.type == Wire::Type::History) {
+        // Request message history (of a conversation, or of a group with "group")
+        const QString& with = request.with;
+        const QString& group = request.group;
+        const QString& currentUser = session.username;
+        
+        if (currentUser.isEmpty()) {
+            sendFrame(session, Frames::errorNotAuthenticated(protocol));
+            return;
+        }
+        if (!group.isEmpty() && !m_groups.isMember(group, currentUser)) {
+            sendFrame(session, Frames::errorNotGroupMember(protocol));
+            return;
+        }
+        
+        // Keyset pagination: before_id pages back, after_id pages forward, neither = newest page.
+        const long long beforeId = request.beforeId;
+        const long long afterId = request.afterId;
+        const int limit = std::clamp(request.limit > 0 ? request.limit : kDefaultHistoryPage, 1, kMaxHistoryPage);
+        
+        // Query on a reader thread, then hop back to this shard's thread to send.
+        QPointer<QWebSocket> guard(client);
+        m_readers.submit([this, guard, protocol, with, group, beforeId, afterId, limit,
+                           user = currentUser.toStdString()](Database& db) {
+            // One extra row tells whether another page exists.
+            // Group history pages backwards only.
+            std::vector<Message> messages;
+            if (!group.isEmpty()) {
+                messages = db.getGroupMessages(group.toStdString(), beforeId, limit + 1);
+            } else if (afterId > 0) {
+                messages = db.getMessagesAfter(user, with.toStdString(), afterId, limit + 1);
+            } else if (beforeId > 0) {
+                messages = db.getMessagesBefore(user, with.toStdString(), beforeId, limit + 1);
+            } else {
+                messages = db.getMessages(user, with.toStdString(), limit + 1);
+            }
+            
+            // Pages are newest-first: the extra row is the newest one when paging
+            // forward and the oldest one otherwise.
+            const bool hasMore = messages.size() > static_cast<std::size_t>(limit);
+            if (hasMore) {
+                if (afterId > 0 && group.isEmpty()) {
+                    messages.erase(messages.begin());
+                } else {
+                    messages.pop_back();
+                }
+            }
+            
+            // Encoded here too, so the shard only writes bytes.
+            Frame frame;
+            FrameWriter writer(frame, protocol);
+            writer.field(Wire::Key::Type, Wire::Type::History);
+            if (!group.isEmpty()) {
+                writer.field(Wire::Key::Group, group);
+            } else {
+                writer.field(Wire::Key::With, with);
+            }
+            writer.field(Wire::Key::HasMore, hasMore);
+            if (hasMore) {
+                const bool forward = afterId > 0 && group.isEmpty();
+                writer.field(Wire::Key::NextCursor, static_cast<qint64>(forward ? messages.front().id : messages.back().id));
+            } else {
+                writer.field(Wire::Key::NextCursor, nullptr);
+            }
+            
+            writer.beginArray(Wire::Key::Messages);
+            for (const auto& msg : messages) {
+                writer.beginObject()
+                    .field(Wire::Key::Id, static_cast<qint64>(msg.id))
+                    .field(Wire::Key::Seq, static_cast<qint64>(msg.seq))
+                    .field(Wire::Key::Sender, QString::fromStdString(msg.sender))
+                    .field(Wire::Key::Text, QString::fromStdString(msg.text))
+                    .field(Wire::Key::Timestamp, static_cast<qint64>(msg.timestamp / 1000000))
+                    .endObject();
+            }
+            writer.endArray().finish();
+            
+            // A client that is not reading gets its pages once it catches up.
+            QMetaObject::invokeMethod(this, [this, guard, frame]() {
+                if (Session* session = findSession(guard)) {
+                    sendFrame(*session, frame, Delivery::Bulk);
+                }
+            }, Qt::QueuedConnection);
+        });
+    }
+    else if (request.type == Wire::Type::Search) {
+        handleSearch(session, request);
+    }
+    else if (request.type == Wire::Type::UploadBegin) {
+        handleUploadBegin(session, request);
+    }
+    else if (request.type == Wire::Type::Ping) {
+        // Pong for connection check
+        sendFrame(session, FrameWriter(m_frameBuffer, protocol)
+            .field(Wire::Key::Type, Wire::Type::Pong)
+            .field(Wire::Key::Timestamp, QDateTime::currentSecsSinceEpoch())
+            .finish(), Delivery::Ephemeral);
+    }
+    else {
+        sendFrame(session, Frames::errorUnknownType(protocol));
+    }
+}
+
+void ConnectionShard::handleSearch(Session& session, const Request& request) {
+    const WireProtocol protocol = session.protocol;
+    if (session.username.isEmpty()) {
+        sendFrame(session, Frames::errorNotAuthenticated(protocol));
+        return;
+    }
+    const QString query = request.text.trimmed();
+    if (query.isEmpty()) {
+        sendFrame(session, Frames::errorSearchQueryRequired(protocol));
+        return;
+    }
+
+    // Offset pagination: results are ordered by rank, which has no key to resume from.
+    const QString& with = request.with;
+    const int offset = request.offset;
+    const int limit = std::clamp(request.limit > 0 ? request.limit : kDefaultSearchPage, 1, kMaxSearchPage);
+
+    // Same path as history: query and encode on a reader, send from this thread.
+    QPointer<QWebSocket> guard(session.socket);
+    m_readers.submit([this, guard, protocol, query, with, offset, limit,
+                       user = session.username.toStdString()](Database& db) {
+        std::vector<Message> messages = db.searchMessages(user, query.toStdString(), with.toStdString(),
+                                                          offset, limit + 1);
+        const bool hasMore = messages.size() > static_cast<std::size_t>(limit);
+        if (hasMore) {
+            messages.pop_back();
+        }
+
+        Frame frame;
+        FrameWriter writer(frame, protocol);
+        writer.field(Wire::Key::Type, Wire::Type::Search);
+        writer.field(Wire::Key::Text, query);
+        if (!with.isEmpty()) {
+            writer.field(Wire::Key::With, with);
+        }
+        writer.field(Wire::Key::HasMore, hasMore);
+        if (hasMore) {
+            writer.field(Wire::Key::NextCursor, static_cast<qint64>(offset + limit));
+        } else {
+            writer.field(Wire::Key::NextCursor, nullptr);
+        }
+
+        // "with" of each hit is the other side of its conversation.
+        writer.beginArray(Wire::Key::Messages);
+        for (const auto& msg : messages) {
+            writer.beginObject()
+                .field(Wire::Key::Id, static_cast<qint64>(msg.id))
+                .field(Wire::Key::Seq, static_cast<qint64>(msg.seq))
+                .field(Wire::Key::Sender, QString::fromStdString(msg.sender))
+                .field(Wire::Key::With, QString::fromStdString(msg.sender == user ? msg.receiver : msg.sender))
+                .field(Wire::Key::Snippet, QString::fromStdString(msg.text))
+                .field(Wire::Key::Timestamp, static_cast<qint64>(msg.timestamp / 1000000))
+                .endObject();
+        }
+        writer.endArray().finish();
+
+        QMetaObject::invokeMethod(this, [this, guard, frame]() {
+            if (Session* session = findSession(guard)) {
+                sendFrame(*session, frame, Delivery::Bulk);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ConnectionShard::handleUploadBegin(Session& session, const Request& request) {
+    const WireProtocol protocol = session.protocol;
+    if (session.username.isEmpty()) {
+        sendFrame(session, Frames::errorNotAuthenticated(protocol));
+        return;
+    }
+
+    // A resume needs only upload_id: the rest was stored with the upload.
+    MediaStore::Begin begin;
+    begin.owner = session.username;
+    begin.receiver = request.to;
+    begin.mediaType = request.mediaType;
+    begin.size = request.size;
+    begin.sha256 = fromHex(request.sha256, 32);
+    begin.uploadId = fromHex(request.uploadId, Wire::kUploadIdBytes);
+    const bool resume = !request.uploadId.isEmpty();
+    if ((resume && begin.uploadId.isEmpty())
+        || (!request.sha256.isEmpty() && begin.sha256.isEmpty())
+        || (!resume && (begin.receiver.isEmpty() || !kMediaTypes.contains(begin.mediaType) || begin.size <= 0))) {
+        sendFrame(session, Frames::errorInvalidUpload(protocol));
+        return;
+    }
+    if (begin.size > m_media.options().maxUploadBytes) {
+        sendFrame(session, Frames::errorUploadTooLarge(protocol));
+        return;
+    }
+
+    QPointer<QWebSocket> guard(session.socket);
+    m_media.begin(std::move(begin), [this, guard](const MediaStore::Result& result) {
+        QMetaObject::invokeMethod(this, [this, guard, result]() {
+            if (Session* session = findSession(guard)) {
+                onUploadResult(*session, result);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ConnectionShard::handleUploadChunk(Session& session, const QByteArray& frame) {
+    // Rejected chunks cost the frame bucket, so they cannot be used to flood.
+    const WireProtocol protocol = session.protocol;
+    if (session.username.isEmpty()) {
+        if (admitFrame(session)) {
+            sendFrame(session, Frames::errorNotAuthenticated(protocol));
+        }
+        return;
+    }
+    const MediaStore::Options& media = m_media.options();
+    const qint64 length = frame.size() - Wire::kUploadChunkHeaderBytes;
+    if (length <= 0 || length > media.chunkBytes) {
+        m_metrics.invalidFrames.fetch_add(1, std::memory_order_relaxed);
+        if (admitFrame(session)) {
+            sendFrame(session, Frames::errorInvalidFrame(protocol));
+        }
+        return;
+    }
+    const QByteArray uploadId = frame.mid(1, Wire::kUploadIdBytes);
+    // Chunks beyond the window are refused rather than queued, so a client
+    // that does not wait for upload_progress cannot pile up memory here.
+    if (session.uploadBytesInFlight + length > static_cast<qint64>(media.chunkBytes) * media.window) {
+        if (!admitFrame(session)) {
+            return;
+        }
+        sendFrame(session, FrameWriter(m_frameBuffer, protocol)
+            .field(Wire::Key::Type, Wire::Type::Error)
+            .field(Wire::Key::Status, QLatin1String("upload_window"))
+            .field(Wire::Key::UploadId, QString::fromLatin1(uploadId.toHex()))
+            .field(Wire::Key::Message, QLatin1String("Upload window exceeded"))
+            .finish());
+        return;
+    }
+
+    const qint64 offset = qFromBigEndian<qint64>(frame.constData() + 1 + Wire::kUploadIdBytes);
+    session.uploadBytesInFlight += length;
+    m_metrics.uploadBytes.fetch_add(static_cast<std::uint64_t>(length), std::memory_order_relaxed);
+
+    // The frame is shared with the store, not copied; it is freed once written.
+    QPointer<QWebSocket> guard(session.socket);
+    m_media.write(uploadId, session.username, offset, frame, [this, guard, length](const MediaStore::Result& result) {
+        QMetaObject::invokeMethod(this, [this, guard, length, result]() {
+            if (Session* session = findSession(guard)) {
+                session->uploadBytesInFlight -= length;
+                onUploadResult(*session, result);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ConnectionShard::onUploadResult(Session& session, const MediaStore::Result& result) {
+    const QString uploadId = QString::fromLatin1(result.uploadId.toHex());
+    switch (result.status) {
+    case MediaStore::Result::Status::Ready:
+        sendFrame(session, FrameWriter(m_frameBuffer, session.protocol)
+            .field(Wire::Key::Type, Wire::Type::UploadBegin)
+            .field(Wire::Key::UploadId, uploadId)
+            .field(Wire::Key::Offset, result.offset)
+            .field(Wire::Key::ChunkSize, static_cast<qint64>(m_media.options().chunkBytes))
+            .field(Wire::Key::Window, static_cast<qint64>(m_media.options().window))
+            .finish());
+        return;
+    case MediaStore::Result::Status::Progress:
+        sendFrame(session, FrameWriter(m_frameBuffer, session.protocol)
+            .field(Wire::Key::Type, Wire::Type::UploadProgress)
+            .field(Wire::Key::UploadId, uploadId)
+            .field(Wire::Key::Offset, result.offset)
+            .finish());
+        return;
+    case MediaStore::Result::Status::Error:
+        sendFrame(session, FrameWriter(m_frameBuffer, session.protocol)
+            .field(Wire::Key::Type, Wire::Type::Error)
+            .field(Wire::Key::UploadId, uploadId)
+            .field(Wire::Key::Message, QLatin1String(result.error))
+            .finish());
+        return;
+    case MediaStore::Result::Status::Complete:
+        break;
+    }
+
+    (result.deduplicated ? m_metrics.uploadsDeduplicated : m_metrics.uploadsStored)
+        .fetch_add(1, std::memory_order_relaxed);
+
+    // Every upload gets its media row; the file itself may be shared.
+    Media media;
+    media.sender = result.owner.toStdString();
+    media.receiver = result.receiver.toStdString();
+    media.path = result.path.toStdString();
+    media.type = result.mediaType.toStdString();
+
+    QPointer<QWebSocket> guard(session.socket);
+    m_persistence.enqueueMedia(std::move(media), [this, guard, uploadId, result](bool committed) {
+        QMetaObject::invokeMethod(this, [this, guard, uploadId, result, committed]() {
+            Session* session = findSession(guard);
+            if (!session) {
+                return;
+            }
+            if (!committed) {
+                sendFrame(*session, Frames::errorStoreFailed(session->protocol));
+                return;
+            }
+            sendFrame(*session, FrameWriter(m_frameBuffer, session->protocol)
+                .field(Wire::Key::Type, Wire::Type::UploadComplete)
+                .field(Wire::Key::UploadId, uploadId)
+                // Whether someone else had the content is not the client's business.
+                .field(Wire::Key::Status, QLatin1String(result.reused ? "reused" : "stored"))
+                .field(Wire::Key::Path, result.path)
+                .field(Wire::Key::Sha256, QString::fromLatin1(result.sha256.toHex()))
+                .field(Wire::Key::Size, result.offset)
+                .finish());
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ConnectionShard::handleGroupMembership(Session& session, const Request& request) {
+    const WireProtocol protocol = session.protocol;
+    const QString& username = session.username;
+    const QString& group = request.group;
+    if (username.isEmpty()) {
+        sendFrame(session, Frames::errorNotAuthenticated(protocol));
+        return;
+    }
+    if (group.isEmpty()) {
+        sendFrame(session, Frames::errorGroupRequired(protocol));
+        return;
+    }
+
+    // Applied in memory at once, so the next group_message sees it; the
+    // writer stores it ahead of anything this member sends afterwards.
+    const bool join = request.type == Wire::Type::GroupJoin;
+    const bool changed = join ? m_groups.join(group, username) : m_groups.leave(group, username);
+    if (changed) {
+        m_persistence.enqueueGroupMembership(group.toStdString(), username.toStdString(), join);
+        if (m_cluster) {
+            m_cluster->announceMembership(group, username, join);
+        }
+    }
+
+    const char* status = changed ? "success" : join ? "already_member" : "not_member";
+    sendFrame(session, FrameWriter(m_frameBuffer, protocol)
+        .field(Wire::Key::Type, request.type)
+        .field(Wire::Key::Group, group)
+        .field(Wire::Key::Status, QLatin1String(status))
+        .finish());
+}
+
+std::function<void(bool)> ConnectionShard::ackOnCommit(QWebSocket* client, WireProtocol protocol) {
+    if (m_persistence.ackMode() != PersistenceQueue::AckMode::AfterCommit) {
+        return nullptr;
+    }
+    // Called on the writer thread: hop back to this shard's thread before touching the socket.
+    QPointer<QWebSocket> guard(client);
+    return [this, guard, protocol](bool committed) {
+        QMetaObject::invokeMethod(this, [this, guard, protocol, committed]() {
+            if (Session* session = findSession(guard)) {
+                sendFrame(*session, committed ? Frames::messageAck(protocol) : Frames::errorStoreFailed(protocol));
+            }
+        }, Qt::QueuedConnection);
+    };
+}
+
+void ConnectionShard::fanOut(const QString& group, const QString& sender, const QString& text,
+                             long long timestamp, const GroupDirectory::Members& members) {
+    // One routing-table lock for the whole group; only online members come back.
+    const auto routes = m_routing.onlineRoutes(members);
+
+    QHash<ConnectionShard*, QStringList> byShard;
+    auto frame = std::make_shared<FanoutFrame>();
+    std::uint64_t recipients = 0;
+    for (const auto& [username, route] : routes) {
+        if (username != sender) {
+            byShard[route.shard].append(username);
+            frame->encoded[static_cast<int>(route.protocol)] = true;
+            ++recipients;
+        }
+    }
+    // Members on other cluster nodes: one bus record per node, whatever its size.
+    // A member with sessions here and on another node is served here only.
+    QHash<QString, QStringList> byNode;
+    if (m_cluster) {
+        QSet<QString> local;
+        local.reserve(static_cast<int>(routes.size()));
+        for (const auto& route : routes) {
+            local.insert(route.first);
+        }
+        for (const auto& [username, route] : m_cluster->remoteRoutes(members)) {
+            if (username != sender && !local.contains(username)) {
+                byNode[route.node].append(username);
+                frame->encoded[static_cast<int>(route.protocol)] = true;
+                ++recipients;
+            }
+        }
+    }
+    if (recipients == 0) {
+        return;
+    }
+
+    // Serialized once per protocol in use. Frame buffers are implicitly
+    // shared, so every recipient on every shard writes the same bytes.
+    for (WireProtocol protocol : {WireProtocol::Json, WireProtocol::Binary}) {
+        const int i = static_cast<int>(protocol);
+        if (frame->encoded[i]) {
+            FrameWriter(frame->frames[i], protocol)
+                .field(Wire::Key::Type, Wire::Type::GroupMessage)
+                .field(Wire::Key::Group, group)
+                .field(Wire::Key::From, sender)
+                .field(Wire::Key::Text, text)
+                .field(Wire::Key::Timestamp, static_cast<qint64>(timestamp / 1000000))
+                .finish();
+        }
+    }
+    m_metrics.groupFanoutRecipients.observe(recipients);
+
+    std::shared_ptr<const FanoutFrame> shared = std::move(frame);
+    for (auto it = byNode.cbegin(); it != byNode.cend(); ++it) {
+        m_cluster->forward(it.key(), it.value(), *shared);
+    }
+    for (auto it = byShard.cbegin(); it != byShard.cend(); ++it) {
+        ConnectionShard* shard = it.key();
+        if (shard == this) {
+            deliverGroup(it.value(), *shared);
+        } else {
+            QMetaObject::invokeMethod(shard, [shard, usernames = it.value(), shared]() {
+                shard->deliverGroup(usernames, *shared);
+            }, Qt::QueuedConnection);
+        }
+    }
+}
+
+void ConnectionShard::loadPendingMessages(Database& db, QPointer<QWebSocket> client, WireProtocol protocol,
+                                          const QString& username) {
+    const std::string user = username.toStdString();
+    // Each frame with the id of its last message: only what was written is marked.
+    std::vector<std::pair<Frame, long long>> frames;
+    long long lastId = 0;
+
+    // Oldest first, one frame per page. One extra row tells whether more
+    // remain after each frame.
+    for (int sent = 0; sent < kMaxPendingOnAuth; sent += kPendingFramePage) {
+        std::vector<Message> messages = db.getUndelivered(user, lastId, kPendingFramePage + 1);
+        if (messages.empty()) {
+            break;
+        }
+        const bool hasMore = messages.size() > static_cast<std::size_t>(kPendingFramePage);
+        if (hasMore) {
+            messages.pop_back();
+        }
+        lastId = messages.back().id;
+
+        Frame frame;
+        FrameWriter writer(frame, protocol);
+        writer.field(Wire::Key::Type, Wire::Type::PendingMessages)
+            .field(Wire::Key::HasMore, hasMore);
+        writer.beginArray(Wire::Key::Messages);
+        for (const auto& msg : messages) {
+            writer.beginObject()
+                .field(Wire::Key::Id, static_cast<qint64>(msg.id))
+                .field(Wire::Key::Seq, static_cast<qint64>(msg.seq))
+                .field(Wire::Key::Sender, QString::fromStdString(msg.sender))
+                .field(Wire::Key::Text, QString::fromStdString(msg.text))
+                .field(Wire::Key::Timestamp, static_cast<qint64>(msg.timestamp / 1000000))
+                .endObject();
+        }
+        writer.endArray().finish();
+        frames.emplace_back(std::move(frame), lastId);
+
+        if (!hasMore) {
+            break;
+        }
+    }
+
+    if (frames.empty()) {
+        return;
+    }
+
+    QMetaObject::invokeMethod(this, [this, client, username, frames = std::move(frames)]() {
+        // Only marked once written to this user's socket; a login that went
+        // away (or re-authed as someone else) leaves the backlog queued.
+        // Sent as reliable: the backlog is bounded per login, and deferring it
+        // would mark messages delivered that never reached the socket. A
+        // backlog that trips the slow-consumer limit stops at the frame that
+        // did, and only the frames before it are marked.
+        Session* session = findSession(client);
+        if (!session || session->username != username) {
+            return;
+        }
+        long long writtenId = 0;
+        for (const auto& [frame, upToId] : frames) {
+            if (!sendFrame(*session, frame)) {
+                break;
+            }
+            writtenId = upToId;
+        }
+        if (writtenId > 0) {
+            m_persistence.enqueueMarkDelivered(username.toStdString(), writtenId);
+        }
+    }, Qt::QueuedConnection);
+}
+
+void ConnectionShard::loadContacts(Database& db, QPointer<QWebSocket> client, const QString& username) {
+    const std::vector<std::string> rows = db.getContacts(username.toStdString(), kMaxContacts);
+    QStringList contacts;
+    contacts.reserve(static_cast<int>(rows.size()));
+    for (const auto& row : rows) {
+        contacts.append(QString::fromStdString(row));
+    }
+
+    QMetaObject::invokeMethod(this, [this, client, username, contacts]() {
+        Session* session = findSession(client);
+        if (!session || session->username != username) {
+            return;
+        }
+        watchContacts(*session, contacts, true);
+    }, Qt::QueuedConnection);
+}
+
+void ConnectionShard::watchContacts(Session& session, const QStringList& contacts, bool snapshot) {
+    QSet<QString> added;
+    added.reserve(contacts.size());
+    for (const QString& contact : contacts) {
+        if (session.contacts.size() + added.size() >= kMaxContacts) {
+            break;
+        }
+        if (contact != session.username && !session.contacts.contains(contact)) {
+            added.insert(contact);
+        }
+    }
+
+    // One routing-table lock for the whole list. The state is read after the
+    // watch is in place, so a change racing with it still reaches the client
+    // with the next batch if this read missed it.
+    for (const QString& contact : added) {
+        m_watchers[contact].insert(&session);
+    }
+    const QSet<QString> online = m_presence.onlineAmong(added);
+
+    QStringList onlineList;
+    QStringList offlineList;
+    for (const QString& contact : added) {
+        const bool isOnline = online.contains(contact);
+        session.contacts.insert(contact, isOnline);
+        (isOnline ? onlineList : offlineList).append(contact);
+    }
+    // The snapshot goes out even when empty: it tells the client the list is complete.
+    if (snapshot) {
+        for (auto it = session.contacts.cbegin(); it != session.contacts.cend(); ++it) {
+            if (!added.contains(it.key())) {
+                (it.value() ? onlineList : offlineList).append(it.key());
+            }
+        }
+    }
+    if (snapshot || !onlineList.isEmpty() || !offlineList.isEmpty()) {
+        sendPresence(session, onlineList, offlineList, snapshot);
+    }
+}
+
+void ConnectionShard::unwatchContacts(Session& session) {
+    for (auto it = session.contacts.cbegin(); it != session.contacts.cend(); ++it) {
+        auto watchers = m_watchers.find(it.key());
+        if (watchers == m_watchers.end()) {
+            continue;
+        }
+        watchers->remove(&session);
+        if (watchers->isEmpty()) {
+            m_watchers.erase(watchers);
+        }
+    }
+    session.contacts.clear();
+}
+
+void ConnectionShard::applyPresence(const PresenceHub::Changes& changes) {
+    // Per watcher, only what differs from what it last saw: one frame per
+    // session per batch, however many of its contacts changed.
+    QHash<Session*, std::pair<QStringList, QStringList>> updates;
+    for (auto change = changes.cbegin(); change != changes.cend(); ++change) {
+        auto watchers = m_watchers.constFind(change.key());
+        if (watchers == m_watchers.cend()) {
+            continue;
+        }
+        for (Session* session : *watchers) {
+            auto seen = session->contacts.find(change.key());
+            if (seen == session->contacts.end() || seen.value() == change.value()) {
+                continue;
+            }
+            seen.value() = change.value();
+            auto& lists = updates[session];
+            (change.value() ? lists.first : lists.second).append(change.key());
+        }
+    }
+    for (auto it = updates.cbegin(); it != updates.cend(); ++it) {
+        sendPresence(*it.key(), it.value().first, it.value().second, false);
+    }
+}
+
+void ConnectionShard::sendPresence(Session& session, const QStringList& online, const QStringList& offline,
+                                   bool snapshot) {
+    FrameWriter writer(m_frameBuffer, session.protocol);
+    writer.field(Wire::Key::Type, Wire::Type::Presence);
+    if (snapshot) {
+        writer.field(Wire::Key::Snapshot, true);
+    }
+    writer.beginArray(Wire::Key::Online);
+    for (const QString& username : online) {
+        writer.element(username);
+    }
+    writer.endArray().beginArray(Wire::Key::Offline);
+    for (const QString& username : offline) {
+        writer.element(username);
+    }
+    writer.endArray();
+    // Presence is a convenience: a congested client gets it once it catches up.
+    sendFrame(session, writer.finish(), Delivery::Bulk);
+    m_metrics.presenceFrames.fetch_add(1, std::memory_order_relaxed);
+}
+
+Session* ConnectionShard::findSession(QWebSocket* client) const {
+    auto it = m_sessions.find(client);
+    return it != m_sessions.end() ? it->second.get() : nullptr;
+}
+
+bool ConnectionShard::sendFrame(Session& session, const Frame& frame, Delivery delivery) {
+    if (session.closing) {
+        return false;
+    }
+
+    // Over the high watermark the client is not keeping up: a pong would only
+    // queue behind everything else, and history pages wait for the low
+    // watermark. Messages, acks and errors always go to the socket.
+    if (delivery == Delivery::Ephemeral && session.congested && m_options.dropEphemeralWhenCongested) {
+        m_metrics.droppedFrames.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (delivery == Delivery::Bulk && m_options.pauseHistoryWhenCongested
+        && (session.congested || !session.deferred.empty())) {
+        const qint64 size = frameSize(frame);
+        session.deferred.push_back(frame);
+        session.deferredBytes += size;
+        m_metrics.outboundQueuedBytes.fetch_add(size, std::memory_order_relaxed);
+        if (session.queuedBytes() > m_options.outboundHardLimit) {
+            disconnectSlowConsumer(session);
+        }
+        return false;
+    }
+
+    return writeFrame(session, frame);
+}
+
+bool ConnectionShard::writeFrame(Session& session, const Frame& frame) {
+    QWebSocket* client = session.socket;
+
+    // Text frames are sized in UTF-16 units; close enough to bytes for the histogram.
+    // Small frames (acks, pongs) are not worth the CPU.
+    const int size = static_cast<int>(frameSize(frame));
+    m_metrics.outboundFrameBytes.observe(static_cast<std::uint64_t>(size));
+    qint64 sent = -1;
+    if (m_options.deflate.enabled && size >= m_options.deflate.threshold && session.deflateRequested) {
+        if (!session.deflater) {
+            session.deflater = std::make_unique<MessageDeflater>(m_options.deflate);
+        }
+        const QByteArray payload = frame.protocol == WireProtocol::Binary ? frame.binary : frame.text.toUtf8();
+        if (session.deflater->compress(payload.constData(), payload.size(), m_deflateBuffer)) {
+            sent = client->sendBinaryMessage(m_deflateBuffer);
+        } else {
+            // A failed stream stays failed: send uncompressed from now on.
+            session.deflateRequested = false;
+        }
+    }
+    if (sent < 0) {
+        sent = frame.protocol == WireProtocol::Binary ? client->sendBinaryMessage(frame.binary)
+                                                      : client->sendTextMessage(frame.text);
+    }
+    if (sent <= 0) {
+        return false;
+    }
+    m_metrics.outboundWireBytes.fetch_add(static_cast<std::uint64_t>(sent), std::memory_order_relaxed);
+
+    // QWebSocket buffers without limit; what it holds is tracked here and
+    // drained by bytesWritten.
+    const qint64 buffered = wireSize(sent);
+    session.bufferedBytes += buffered;
+    m_metrics.outboundQueuedBytes.fetch_add(buffered, std::memory_order_relaxed);
+
+    if (session.queuedBytes() > m_options.outboundHardLimit) {
+        // Aborted with everything it holds: not delivered.
+        disconnectSlowConsumer(session);
+        return false;
+    }
+    if (!session.congested && session.bufferedBytes >= m_options.outboundHighWatermark) {
+        session.congested = true;
+        m_metrics.congestedConnections.fetch_add(1, std::memory_order_relaxed);
+        if (m_options.slowConsumerGrace.count() > 0) {
+            if (!session.graceTimer) {
+                // Owned by the socket; looks the session up again, so it never
+                // outlives it.
+                session.graceTimer = new QTimer(client);
+                session.graceTimer->setSingleShot(true);
+                connect(session.graceTimer, &QTimer::timeout, this, [this, client]() {
+                    if (Session* congested = findSession(client)) {
+                        disconnectSlowConsumer(*congested);
+                    }
+                });
+            }
+            session.graceTimer->start(m_options.slowConsumerGrace);
+        }
+    }
+    return true;
+}
+
+void ConnectionShard::onBytesWritten(Session& session, qint64 bytes) {
+    const qint64 drained = std::min(bytes, session.bufferedBytes);
+    session.bufferedBytes -= drained;
+    m_metrics.outboundQueuedBytes.fetch_sub(drained, std::memory_order_relaxed);
+    if (!session.congested || session.bufferedBytes > m_options.outboundLowWatermark) {
+        return;
+    }
+
+    session.congested = false;
+    m_metrics.congestedConnections.fetch_sub(1, std::memory_order_relaxed);
+    if (session.graceTimer) {
+        session.graceTimer->stop();
+    }
+
+    // Resume paused history pages, in order, until the socket fills up again.
+    while (!session.deferred.empty() && !session.congested && !session.closing) {
+        const Frame frame = std::move(session.deferred.front());
+        session.deferred.pop_front();
+        const qint64 size = frameSize(frame);
+        session.deferredBytes -= size;
+        m_metrics.outboundQueuedBytes.fetch_sub(size, std::memory_order_relaxed);
+        writeFrame(session, frame);
+    }
+}
+
+void ConnectionShard::disconnectSlowConsumer(Session& session) {
+    if (session.closing) {
+        return;
+    }
+    session.closing = true;
+    m_metrics.slowConsumerDisconnects.fetch_add(1, std::memory_order_relaxed);
+    std::cout << "Disconnecting slow consumer "
+              << (session.isAuthenticated() ? session.username.toStdString() : std::string("(not authenticated)"))
+              << ": " << session.queuedBytes() << " bytes queued" << std::endl;
+
+    m_metrics.outboundQueuedBytes.fetch_sub(session.deferredBytes, std::memory_order_relaxed);
+    session.deferred.clear();
+    session.deferredBytes = 0;
+
+    // Callers may still hold the session; the abort, and onDisconnected with
+    // it, runs from the event loop. A close handshake would only queue behind
+    // the data the client is not reading.
+    QWebSocket* client = session.socket;
+    QMetaObject::invokeMethod(client, [client]() {
+        client->abort();
+    }, Qt::QueuedConnection);
+}
+
+void ConnectionShard::route(const RoutingTable::Route& target, const QString& username, const Frame& frame,
+                            const QString& sender, qint64 timestamp) {
+    if (target.shard == this) {
+        deliver(username, frame, sender, timestamp);
+    } else {
+        ConnectionShard* shard = target.shard;
+        QMetaObject::invokeMethod(shard, [shard, username, frame, sender, timestamp]() {
+            shard->deliver(username, frame, sender, timestamp);
+        }, Qt::QueuedConnection);
+    }
+}
+
+void ConnectionShard::deliverGroup(const QStringList& usernames, const FanoutFrame& frame) {
+    // A member who reconnected with the other protocol in the meantime may
+    // find no encoding for it; the message is in the group history either way.
+    for (const QString& username : usernames) {
+        Session* session = m_usersByName.value(username, nullptr);
+        if (!session) {
+            continue;
+        }
+        if (const Frame* encoded = frame.get(session->protocol)) {
+            sendFrame(*session, *encoded);
+        }
+    }
+}
+
+void ConnectionShard::deliver(const QString& username, const Frame& frame, const QString& sender,
+                              qint64 timestamp) {
+    // Marked delivered only once written to this user's socket, as the offline
+    // backlog is. A user who disconnected while a cross-shard delivery was
+    // queued, reconnected with the other protocol or is being dropped as a
+    // slow consumer keeps it undelivered and gets it pushed after next auth.
+    Session* session = m_usersByName.value(username, nullptr);
+    if (session && session->protocol == frame.protocol && sendFrame(*session, frame)) {
+        m_persistence.enqueueMarkMessageDelivered(username.toStdString(), sender.toStdString(), timestamp);
+    }
+}
@@ -1,12 +1,454 @@
 #include "../include/Database.h"
+#include "../include/Metrics.h"
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <filesystem>
 #include <sqlite3.h>
 
-Database::Database(const std::string& dbPath) : m_dbPath(dbPath), m_db(nullptr) {
+namespace {
+
+// Bumps the per-conversation sequence (creating the conversation on first use)
+// and returns the conversation id with the sequence number for the new message.
+const char* kNextSeqSql = R"(
+    INSERT INTO conversations (user_a, user_b) VALUES (?, ?)
+    ON CONFLICT (user_a, user_b) DO UPDATE SET last_seq = last_seq + 1
+    RETURNING id, last_seq;
+)";
+
+// Inserts run inside BEGIN IMMEDIATE, which holds the file's write lock
+// (across processes too, for cluster nodes sharing one database), so
+// MAX(id) + 1 (a lookup on the unique index) cannot race.
+const char* kInsertMessageSql = R"(
+    INSERT INTO messages (conversation_id, seq, id, sender_id, receiver_id, text, message_type,
+                          media_path, created_at, delivered)
+    VALUES (?, ?, (SELECT IFNULL(MAX(id), 0) + 1 FROM messages), ?, ?, ?, ?, ?, ?, ?);
+)";
+
+// A single range scan over the (conversation_id, seq) primary key.
+const char* kSelectMessagesSql = R"(
+    SELECT m.id, m.sender_id, m.receiver_id, m.text, m.created_at, m.message_type, m.media_path,
+           m.conversation_id, m.seq
+    FROM conversations c
+    JOIN messages m ON m.conversation_id = c.id
+    WHERE c.user_a = ? AND c.user_b = ?
+    ORDER BY m.seq DESC
+    LIMIT ?;
+)";
+
+// Keyset pages: the cursor message id is resolved to its seq through the
+// unique id index, then the primary key is range-scanned from there, so a
+// deep page costs the same as the first one.
+const char* kSelectMessagesBeforeSql = R"(
+    SELECT m.id, m.sender_id, m.receiver_id, m.text, m.created_at, m.message_type, m.media_path,
+           m.conversation_id, m.seq
+    FROM conversations c
+    JOIN messages m ON m.conversation_id = c.id
+    WHERE c.user_a = ? AND c.user_b = ?
+      AND m.seq < (SELECT p.seq FROM messages p WHERE p.id = ? AND p.conversation_id = c.id)
+    ORDER BY m.seq DESC
+    LIMIT ?;
+)";
+
+const char* kSelectMessagesAfterSql = R"(
+    SELECT m.id, m.sender_id, m.receiver_id, m.text, m.created_at, m.message_type, m.media_path,
+           m.conversation_id, m.seq
+    FROM conversations c
+    JOIN messages m ON m.conversation_id = c.id
+    WHERE c.user_a = ? AND c.user_b = ?
+      AND m.seq > (SELECT p.seq FROM messages p WHERE p.id = ? AND p.conversation_id = c.id)
+    ORDER BY m.seq ASC
+    LIMIT ?;
+)";
+
+// Served entirely from the partial idx_messages_undelivered index.
+const char* kSelectUndeliveredSql = R"(
+    SELECT m.id, m.sender_id, m.receiver_id, m.text, m.created_at, m.message_type, m.media_path,
+           m.conversation_id, m.seq
+    FROM messages m
+    WHERE m.receiver_id = ? AND m.delivered = 0 AND m.id > ?
+    ORDER BY m.id
+    LIMIT ?;
+)";
+
+const char* kMarkDeliveredSql = R"(
+    UPDATE messages SET delivered = 1
+    WHERE receiver_id = ? AND delivered = 0 AND id <= ?;
+)";
+
+// One live message, found among the receiver's undelivered rows (the
+// partial index); the row id is not known to the shard that delivered it.
+const char* kMarkMessageDeliveredSql = R"(
+    UPDATE messages SET delivered = 1
+    WHERE receiver_id = ? AND delivered = 0 AND sender_id = ? AND created_at = ?;
+)";
+
+// Same pattern as kNextSeqSql, per group; the group row is created by the
+// first join.
+const char* kNextGroupSeqSql = R"(
+    UPDATE chat_groups SET last_seq = last_seq + 1
+    WHERE name = ?
+    RETURNING id, last_seq;
+)";
+
+const char* kInsertGroupMessageSql = R"(
+    INSERT INTO group_messages (group_id, seq, id, sender_id, text, message_type, media_path, created_at)
+    VALUES (?, ?, (SELECT IFNULL(MAX(id), 0) + 1 FROM group_messages), ?, ?, ?, ?, ?);
+)";
+
+const char* kInsertGroupSql = "INSERT OR IGNORE INTO chat_groups (name) VALUES (?);";
+
+const char* kInsertGroupMemberSql = R"(
+    INSERT OR IGNORE INTO group_members (group_id, username)
+    SELECT id, ? FROM chat_groups WHERE name = ?;
+)";
+
+const char* kDeleteGroupMemberSql = R"(
+    DELETE FROM group_members
+    WHERE group_id = (SELECT id FROM chat_groups WHERE name = ?) AND username = ?;
+)";
+
+// kSelectMessages* column layout; the receiver (the group) is filled in by
+// the caller. A NULL cursor stands for "newest page", so one statement serves
+// every page; a cursor not in this group yields NULL and an empty page, as in
+// kSelectMessagesBeforeSql.
+const char* kSelectGroupMessagesSql = R"(
+    SELECT m.id, m.sender_id, NULL, m.text, m.created_at, m.message_type, m.media_path,
+           m.group_id, m.seq
+    FROM chat_groups g
+    JOIN group_messages m ON m.group_id = g.id
+    WHERE g.name = ?1
+      AND m.seq < CASE WHEN ?2 IS NULL THEN 9223372036854775807
+                       ELSE (SELECT p.seq FROM group_messages p WHERE p.id = ?2 AND p.group_id = g.id) END
+    ORDER BY m.seq DESC
+    LIMIT ?3;
+)";
+
+const char* kSelectGroupMembersSql = R"(
+    SELECT g.name, gm.username
+    FROM group_members gm
+    JOIN chat_groups g ON g.id = gm.group_id;
+)";
+
+// Conversation partners: user_a via the UNIQUE (user_a, user_b) index,
+// user_b via idx_conversations_user_b. Both are covering, no table lookups.
+const char* kSelectContactsSql = R"(
+    SELECT user_b FROM conversations WHERE user_a = ?1
+    UNION ALL
+    SELECT user_a FROM conversations WHERE user_b = ?1
+    LIMIT ?2;
+)";
+
+const char* kInsertMediaSql = R"(
+    INSERT INTO media (sender_id, receiver_id, path, type, created_at)
+    VALUES (?, ?, ?, ?, ?);
+)";
+
+const char* kSelectMediaSql = R"(
+    SELECT id, sender_id, receiver_id, path, type, created_at
+    FROM media 
+    WHERE (sender_id = ?1 AND receiver_id = ?2) OR (sender_id = ?2 AND receiver_id = ?1)
+    ORDER BY created_at DESC;
+)";
+
+// kSelectMessages* column layout with the snippet in place of the text.
+// Only the newest kSearchWindow matches are ranked: the subquery finds the
+// lowest id among them from the end of the posting lists, and bm25 runs on
+// the rows from there on instead of on every match of a common word. FTS5
+// returns rows already in rank order, so snippets are only built for the
+// page, and the join fetches just those rows through the id index.
+const char* kSearchMessagesSql = R"(
+    SELECT m.id, m.sender_id, m.receiver_id,
+           snippet(messages_fts, 0, char(2), char(3), '…', 16), m.created_at, m.message_type,
+           m.media_path, m.conversation_id, m.seq
+    FROM messages_fts
+    JOIN messages m ON m.id = messages_fts.rowid
+    WHERE messages_fts MATCH ?1
+      AND messages_fts.rowid >= IFNULL((SELECT rowid FROM messages_fts WHERE messages_fts MATCH ?1
+                                        ORDER BY rowid DESC LIMIT 1 OFFSET ?2), 0)
+    ORDER BY rank
+    LIMIT ?3 OFFSET ?4;
+)";
+
+const char* kUserExistsSql = "SELECT COUNT(*) FROM users WHERE username = ?;";
+
+const char* kCreateUserSql = "INSERT INTO users (username) VALUES (?);";
+
+const char* kSelectUserIdSql = "SELECT id FROM users WHERE username = ?;";
+
+const char* kSelectUsernameSql = "SELECT username FROM users WHERE id = ?;";
+
+const char* kInsertUserIdSql = "INSERT INTO users (username) VALUES (?) RETURNING id;";
+
+const char* kBeginSql = "BEGIN IMMEDIATE;";
+const char* kCommitSql = "COMMIT;";
+const char* kRollbackSql = "ROLLBACK;";
+// One write inside a batch, undone alone if it fails.
+const char* kSavepointSql = "SAVEPOINT entry;";
+const char* kReleaseSavepointSql = "RELEASE entry;";
+const char* kRollbackToSavepointSql = "ROLLBACK TO entry;";
+
+// Schema versions (PRAGMA user_version):
+//   0 - legacy flat messages table (sender/receiver/timestamp, no index)
+//   2 - conversations + messages clustered by (conversation_id, seq)
+//   3 - messages.delivered + partial index of undelivered messages
+//   4 - chat_groups, group_members, group_messages
+//   5 - conversations indexed by user_b (contacts for presence)
+//   6 - users.id instead of usernames, created_at in epoch microseconds
+//   7 - messages_fts full-text index of messages
+const int kSchemaVersion = 7;
+
+// Messages and group messages are copied to the v6 layout this many rows
+// per transaction, so the write lock is released between batches.
+const int kMigrationBatch = 20000;
+
+// Terms of a search query beyond this are ignored.
+const size_t kMaxSearchTerms = 8;
+
+// Search ranks this many of the newest matches; pages end there.
+const int kSearchWindow = 1000;
+
+// Users are few compared to the rows that reference them; the cache is
+// dropped wholesale when it grows past this.
+const size_t kMaxCachedUsers = 100000;
+
+// v6 tables. Created under their own names on a fresh file, under a _v6
+// suffix by the migration, which renames them in place at the switch.
+std::string conversationsTableSql(const std::string& name) {
+    return "CREATE TABLE IF NOT EXISTS " + name + R"( (
+            id INTEGER PRIMARY KEY,
+            user_a INTEGER NOT NULL,
+            user_b INTEGER NOT NULL,
+            last_seq INTEGER NOT NULL DEFAULT 1,
+            UNIQUE (user_a, user_b)
+        );)";
+}
+
+// Clustered by conversation: a conversation's history is contiguous on disk.
+// id stays globally unique for clients that reference messages by id.
+std::string messagesTableSql(const std::string& name) {
+    return "CREATE TABLE IF NOT EXISTS " + name + R"( (
+            conversation_id INTEGER NOT NULL,
+            seq INTEGER NOT NULL,
+            id INTEGER NOT NULL UNIQUE,
+            sender_id INTEGER NOT NULL,
+            receiver_id INTEGER NOT NULL,
+            text TEXT NOT NULL,
+            message_type TEXT DEFAULT 'text',
+            media_path TEXT,
+            created_at INTEGER NOT NULL,
+            delivered INTEGER NOT NULL DEFAULT 1,
+            PRIMARY KEY (conversation_id, seq)
+        ) WITHOUT ROWID;)";
+}
+
+// One row per message however many members the group has; clustered by
+// group like messages are by conversation.
+std::string groupMessagesTableSql(const std::string& name) {
+    return "CREATE TABLE IF NOT EXISTS " + name + R"( (
+            group_id INTEGER NOT NULL,
+            seq INTEGER NOT NULL,
+            id INTEGER NOT NULL UNIQUE,
+            sender_id INTEGER NOT NULL,
+            text TEXT NOT NULL,
+            message_type TEXT DEFAULT 'text',
+            media_path TEXT,
+            created_at INTEGER NOT NULL,
+            PRIMARY KEY (group_id, seq)
+        ) WITHOUT ROWID;)";
+}
+
+std::string mediaTableSql(const std::string& name) {
+    return "CREATE TABLE IF NOT EXISTS " + name + R"( (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            sender_id INTEGER NOT NULL,
+            receiver_id INTEGER NOT NULL,
+            path TEXT NOT NULL,
+            type TEXT NOT NULL,
+            created_at INTEGER NOT NULL
+        );)";
+}
+
+// Only undelivered rows are indexed, so the index stays as small as the
+// offline backlog and marking a row delivered removes it from the index.
+const char* kUndeliveredIndexSql = R"(
+    CREATE INDEX IF NOT EXISTS idx_messages_undelivered
+    ON messages (receiver_id, id) WHERE delivered = 0;
+)";
+
+// The UNIQUE constraint covers lookups by user_a; contacts also need user_b.
+const char* kConversationsUserBIndexSql = R"(
+    CREATE INDEX IF NOT EXISTS idx_conversations_user_b
+    ON conversations (user_b, user_a);
+)";
+
+// GROUPS is an SQL keyword (window frames), hence chat_groups. Members stay
+// keyed by name: the table is loaded whole at startup and is not per-message.
+const char* kGroupsTableSql = R"(
+    CREATE TABLE IF NOT EXISTS chat_groups (
+        id INTEGER PRIMARY KEY,
+        name TEXT NOT NULL UNIQUE,
+        last_seq INTEGER NOT NULL DEFAULT 0,
+        created_at DATETIME DEFAULT CURRENT_TIMESTAMP
+    );
+)";
+
+const char* kGroupMembersTableSql = R"(
+    CREATE TABLE IF NOT EXISTS group_members (
+        group_id INTEGER NOT NULL,
+        username TEXT NOT NULL,
+        joined_at DATETIME DEFAULT CURRENT_TIMESTAMP,
+        PRIMARY KEY (group_id, username)
+    ) WITHOUT ROWID;
+)";
+
+// External-content FTS5 index: only the inverted index is stored, the text
+// stays in messages. The view adds an "owners" column of u<sender_id>
+// u<receiver_id> tokens, so a query limited to one user's conversations is
+// an intersection of posting lists inside the index.
+//
+// New rows are added by indexMessages() behind the writes, from the id in
+// messages_fts_state on, many per statement. An AFTER INSERT trigger would
+// run inside each insert's statement savepoint, and FTS5 writes its pending
+// data out as a new segment on every savepoint: one segment per message,
+// plus merging them back, tripled the cost of saveMessage. Edits and
+// deletes (only ever done by hand) are left to triggers, for rows the index
+// already holds.
+const char* kSearchIndexSql = R"(
+    CREATE VIEW IF NOT EXISTS messages_search (id, text, owners) AS
+    SELECT id, text, 'u' || sender_id || ' u' || receiver_id FROM messages;
+
+    CREATE VIRTUAL TABLE IF NOT EXISTS messages_fts USING fts5(
+        text, owners,
+        content = 'messages_search', content_rowid = 'id',
+        tokenize = 'unicode61 remove_diacritics 2'
+    );
+
+    -- "rank" orders by relevance of the text alone: every hit matches the
+    -- owners tokens, which would only add noise.
+    INSERT INTO messages_fts (messages_fts, rank) VALUES ('rank', 'bm25(1.0, 0.0)');
+
+    CREATE TABLE IF NOT EXISTS messages_fts_state (indexed_id INTEGER NOT NULL);
+    INSERT INTO messages_fts_state SELECT 0 WHERE NOT EXISTS (SELECT 1 FROM messages_fts_state);
+
+    CREATE TRIGGER IF NOT EXISTS messages_fts_delete AFTER DELETE ON messages
+    WHEN old.id <= (SELECT indexed_id FROM messages_fts_state) BEGIN
+        INSERT INTO messages_fts (messages_fts, rowid, text, owners)
+        VALUES ('delete', old.id, old.text, 'u' || old.sender_id || ' u' || old.receiver_id);
+    END;
+
+    CREATE TRIGGER IF NOT EXISTS messages_fts_update AFTER UPDATE OF text ON messages
+    WHEN old.id <= (SELECT indexed_id FROM messages_fts_state) BEGIN
+        INSERT INTO messages_fts (messages_fts, rowid, text, owners)
+        VALUES ('delete', old.id, old.text, 'u' || old.sender_id || ' u' || old.receiver_id);
+        INSERT INTO messages_fts (rowid, text, owners)
+        VALUES (new.id, new.text, 'u' || new.sender_id || ' u' || new.receiver_id);
+    END;
+)";
+
+// Ids are allocated as MAX(id) + 1 under the write lock, so they commit in
+// order and everything above indexed_id is exactly what is left to index.
+const char* kSelectIndexedIdSql = "SELECT indexed_id FROM messages_fts_state;";
+
+const char* kIndexMessagesSql = R"(
+    INSERT INTO messages_fts (rowid, text, owners)
+    SELECT id, text, owners FROM messages_search
+    WHERE id > ?1
+    ORDER BY id
+    LIMIT ?2;
+)";
+
+const char* kAdvanceIndexedIdSql = R"(
+    UPDATE messages_fts_state SET indexed_id = IFNULL(
+        (SELECT MAX(id) FROM (SELECT id FROM messages WHERE id > ?1 ORDER BY id LIMIT ?2)), ?1);
+)";
+
+// FTS5 query for the words of a user's search, restricted to the rows the
+// owner ids are on. Every word is quoted, so query syntax typed by the user
+// is matched as text; a trailing * keeps its prefix meaning. Empty when the
+// search has no words.
+std::string searchExpression(const std::string& query, long long owner, long long partner) {
+    std::string terms;
+    size_t count = 0;
+    size_t pos = 0;
+    while (count < kMaxSearchTerms) {
+        pos = query.find_first_not_of(" \t\r\n", pos);
+        if (pos == std::string::npos) {
+            break;
+        }
+        const size_t end = std::min(query.find_first_of(" \t\r\n", pos), query.size());
+        std::string word = query.substr(pos, end - pos);
+        pos = end;
+
+        const bool prefix = word.size() > 1 && word.back() == '*';
+        if (prefix) {
+            word.pop_back();
+        }
+        if (word.find_first_not_of('*') == std::string::npos) {
+            continue;
+        }
+        terms += terms.empty() ? "\"" : " \"";
+        for (char c : word) {
+            terms += c;
+            if (c == '"') {
+                terms += '"';
+            }
+        }
+        terms += prefix ? "\"*" : "\"";
+        ++count;
+    }
+    if (terms.empty()) {
+        return terms;
+    }
+
+    std::string owners = "u" + std::to_string(owner);
+    if (partner != 0) {
+        owners += " u" + std::to_string(partner);
+    }
+    return "owners : (" + owners + ") AND text : (" + terms + ")";
+}
+
+// Resets a cached statement when leaving scope so it can be reused and
+// does not keep a read transaction open between calls.
+class StatementReset {
+public:
+    explicit StatementReset(sqlite3_stmt* stmt) : m_stmt(stmt) {}
+    ~StatementReset() {
+        if (m_stmt) {
+            sqlite3_reset(m_stmt);
+            sqlite3_clear_bindings(m_stmt);
+        }
+    }
+
+    StatementReset(const StatementReset&) = delete;
+    StatementReset& operator=(const StatementReset&) = delete;
+
+private:
+    sqlite3_stmt* m_stmt;
+};
+
+// Conversations are keyed by the ordered (user_a, user_b) id pair so both
+// directions of a chat map to the same row.
+std::pair<long long, long long> canonicalPair(long long user1, long long user2) {
+    if (user2 < user1) {
+        return {user2, user1};
+    }
+    return {user1, user2};
+}
+
+std::string columnText(sqlite3_stmt* stmt, int column) {
+    const unsigned char* text = sqlite3_column_text(stmt, column);
+    return text ? reinterpret_cast<const char*>(text) : std::string();
+}
+
+} // namespace
+
+Database::Database(const std::string& dbPath, OpenMode mode)
+    : m_dbPath(dbPath), m_mode(mode), m_db(nullptr) {
 }
 
 Database::~Database() {
+    finalizeStatements();
     if (m_db) {
         sqlite3_close(m_db);
     }
@@ -14,6 +456,25 @@ Database::~Database() {
 
 bool Database::initialize() {
     try {
+        if (m_mode == OpenMode::ReadOnly) {
+            // Readers attach to a file the writer has already created and switched to WAL.
+            int rc = sqlite3_open_v2(m_dbPath.c_str(), &m_db, SQLITE_OPEN_READONLY, nullptr);
+            if (rc != SQLITE_OK) {
+                std::cerr << "Can't open database (read-only): " << sqlite3_errmsg(m_db) << std::endl;
+                return false;
+            }
+            sqlite3_busy_timeout(m_db, 5000);
+
+            for (const char* sql : {kSelectMessagesSql, kSelectMessagesBeforeSql, kSelectMessagesAfterSql,
+                                    kSelectUndeliveredSql, kSelectGroupMessagesSql, kSelectMediaSql,
+                                    kUserExistsSql, kSelectUserIdSql, kSelectUsernameSql}) {
+                if (!statement(sql)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
         // Create data directory if it doesn't exist
         std::filesystem::path dbDir = std::filesystem::path(m_dbPath).parent_path();
         if (!dbDir.empty() && !std::filesystem::exists(dbDir)) {
@@ -27,7 +488,28 @@ bool Database::initialize() {
             return false;
         }
 
+        sqlite3_busy_timeout(m_db, 5000);
+
+        // WAL lets the reader connections run history queries while the writer commits.
+        if (!execute("PRAGMA journal_mode=WAL;")) {
+            std::cerr << "Failed to enable WAL: " << sqlite3_errmsg(m_db) << std::endl;
+        }
+
         createTables();
+        m_searchIndex = tableExists("messages_fts");
+
+        // Prepare the hot-path statements up front so the first message
+        // does not pay for it.
+        for (const char* sql : {kNextSeqSql, kInsertMessageSql, kSelectMessagesSql, kMarkDeliveredSql,
+                                kMarkMessageDeliveredSql, kNextGroupSeqSql, kInsertGroupMessageSql, kInsertMediaSql,
+                                kSelectMediaSql, kUserExistsSql, kCreateUserSql, kSelectUserIdSql,
+                                kSelectUsernameSql, kInsertUserIdSql, kBeginSql, kCommitSql, kRollbackSql,
+                                kSavepointSql, kReleaseSavepointSql, kRollbackToSavepointSql}) {
+            if (!statement(sql)) {
+                return false;
+            }
+        }
+
         std::cout << "Database initialized: " << m_dbPath << std::endl;
         return true;
     } catch (const std::exception& e) {
@@ -36,6 +518,11 @@ bool Database::initialize() {
     }
 }
 
+long long Database::currentTimestamp() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+}
+
 void Database::createTables() {
     const char* sql_users = R"(
         CREATE TABLE IF NOT EXISTS users (
@@ -45,16 +532,154 @@ void Database::createTables() {
         );
     )";
 
+    char* errMsg = 0;
+    
+    if (sqlite3_exec(m_db, sql_users, 0, 0, &errMsg) != SQLITE_OK) {
+        std::cerr << "SQL error creating users table: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+    }
+
+    migrateSchema();
+}
+
+int Database::schemaVersion() {
+    int version = 0;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(m_db, "PRAGMA user_version;", -1, &stmt, NULL) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW) {
+        version = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return version;
+}
+
+bool Database::tableExists(const char* table) {
+    sqlite3_stmt* stmt = nullptr;
+    bool exists = false;
+    if (sqlite3_prepare_v2(m_db, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?;",
+                           -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+        exists = sqlite3_step(stmt) == SQLITE_ROW;
+    }
+    sqlite3_finalize(stmt);
+    return exists;
+}
+
+void Database::migrateSchema() {
+    const int version = schemaVersion();
+
+    // A new file gets the current table layout directly; the search index
+    // is added below like on any v6 file.
+    if (version == 0 && !tableExists("messages") && !tableExists("media")) {
+        createSchema();
+    } else if (version < 6) {
+        if (version < 5 && !migrateToV5(version)) {
+            return;
+        }
+        if (!migrateToV6()) {
+            return;
+        }
+    }
+    // Also picks up a cleanup interrupted between the v6 switch and its end.
+    if (tableExists("messages_v5")) {
+        finishMigrationV6();
+    }
+
+    if (schemaVersion() < 7) {
+        migrateToV7();
+    }
+}
+
+void Database::createSchema() {
+    char* errMsg = 0;
+    auto run = [this, &errMsg](const std::string& sql, const char* what) {
+        if (sqlite3_exec(m_db, sql.c_str(), 0, 0, &errMsg) != SQLITE_OK) {
+            std::cerr << "SQL error " << what << ": " << errMsg << std::endl;
+            sqlite3_free(errMsg);
+            errMsg = 0;
+            return false;
+        }
+        return true;
+    };
+
+    const bool ok = run("BEGIN IMMEDIATE;", "starting schema creation")
+                 && run(conversationsTableSql("conversations"), "creating conversations table")
+                 && run(kConversationsUserBIndexSql, "creating conversations index")
+                 && run(messagesTableSql("messages"), "creating messages table")
+                 && run(kUndeliveredIndexSql, "creating undelivered index")
+                 && run(kGroupsTableSql, "creating groups table")
+                 && run(kGroupMembersTableSql, "creating group members table")
+                 && run(groupMessagesTableSql("group_messages"), "creating group messages table")
+                 && run(mediaTableSql("media"), "creating media table")
+                 && run("PRAGMA user_version = 6;", "updating schema version");
+    if (!ok || !run("COMMIT;", "committing schema")) {
+        sqlite3_exec(m_db, "ROLLBACK;", 0, 0, 0);
+    }
+}
+
+// Upgrades any older layout to v5 in one transaction; v6 is migrated from there.
+bool Database::migrateToV5(int version) {
+    // A version 0 file with a messages table was created by the old flat schema.
+    const bool legacyMessages = version < 2 && tableExists("messages");
+    // Version 2 already has the clustered table; it only gains the delivery state.
+    const bool addDelivered = version == 2;
+    if (legacyMessages) {
+        std::cout << "Migrating messages to conversation layout..." << std::endl;
+    }
+
+    const char* sql_rename_legacy = "ALTER TABLE messages RENAME TO messages_legacy;";
+
+    const char* sql_conversations = R"(
+        CREATE TABLE IF NOT EXISTS conversations (
+            id INTEGER PRIMARY KEY,
+            user_a TEXT NOT NULL,
+            user_b TEXT NOT NULL,
+            last_seq INTEGER NOT NULL DEFAULT 1,
+            UNIQUE (user_a, user_b)
+        );
+    )";
+
     const char* sql_messages = R"(
         CREATE TABLE IF NOT EXISTS messages (
-            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            conversation_id INTEGER NOT NULL,
+            seq INTEGER NOT NULL,
+            id INTEGER NOT NULL UNIQUE,
             sender TEXT NOT NULL,
             receiver TEXT NOT NULL,
             text TEXT NOT NULL,
             message_type TEXT DEFAULT 'text',
             media_path TEXT,
-            timestamp DATETIME DEFAULT CURRENT_TIMESTAMP
-        );
+            timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,
+            delivered INTEGER NOT NULL DEFAULT 1,
+            PRIMARY KEY (conversation_id, seq)
+        ) WITHOUT ROWID;
+    )";
+
+    // Existing messages count as delivered: clients already saw them or can page history.
+    const char* sql_add_delivered = "ALTER TABLE messages ADD COLUMN delivered INTEGER NOT NULL DEFAULT 1;";
+
+    const char* sql_undelivered_index = R"(
+        CREATE INDEX IF NOT EXISTS idx_messages_undelivered
+        ON messages (receiver, id) WHERE delivered = 0;
+    )";
+
+    const char* sql_conversations_user_b_index = R"(
+        CREATE INDEX IF NOT EXISTS idx_conversations_user_b
+        ON conversations (user_b, user_a);
+    )";
+
+    const char* sql_group_messages = R"(
+        CREATE TABLE IF NOT EXISTS group_messages (
+            group_id INTEGER NOT NULL,
+            seq INTEGER NOT NULL,
+            id INTEGER NOT NULL UNIQUE,
+            sender TEXT NOT NULL,
+            text TEXT NOT NULL,
+            message_type TEXT DEFAULT 'text',
+            media_path TEXT,
+            timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,
+            PRIMARY KEY (group_id, seq)
+        ) WITHOUT ROWID;
     )";
 
     const char* sql_media = R"(
@@ -68,48 +693,627 @@ void Database::createTables() {
         );
     )";
 
+    const char* sql_copy_conversations = R"(
+        INSERT INTO conversations (user_a, user_b, last_seq)
+        SELECT MIN(sender, receiver), MAX(sender, receiver), COUNT(*)
+        FROM messages_legacy
+        GROUP BY MIN(sender, receiver), MAX(sender, receiver);
+    )";
+
+    // Legacy ids are kept; seq follows the old timestamp order.
+    const char* sql_copy_messages = R"(
+        INSERT INTO messages (conversation_id, seq, id, sender, receiver, text,
+                              message_type, media_path, timestamp)
+        SELECT c.id,
+               ROW_NUMBER() OVER (PARTITION BY c.id ORDER BY l.timestamp, l.id),
+               l.id, l.sender, l.receiver, l.text, l.message_type, l.media_path, l.timestamp
+        FROM messages_legacy l
+        JOIN conversations c
+          ON c.user_a = MIN(l.sender, l.receiver) AND c.user_b = MAX(l.sender, l.receiver);
+    )";
+
+    const char* sql_drop_legacy = "DROP TABLE messages_legacy;";
+
     char* errMsg = 0;
-    
-    if (sqlite3_exec(m_db, sql_users, 0, 0, &errMsg) != SQLITE_OK) {
-        std::cerr << "SQL error creating users table: " << errMsg << std::endl;
-        sqlite3_free(errMsg);
+    auto run = [this, &errMsg](const char* sql, const char* what) {
+        if (sqlite3_exec(m_db, sql, 0, 0, &errMsg) != SQLITE_OK) {
+            std::cerr << "SQL error " << what << ": " << errMsg << std::endl;
+            sqlite3_free(errMsg);
+            errMsg = 0;
+            return false;
+        }
+        return true;
+    };
+
+    bool ok = run("BEGIN IMMEDIATE;", "starting migration");
+    if (ok && legacyMessages) {
+        ok = run(sql_rename_legacy, "renaming legacy messages table");
     }
-    
-    if (sqlite3_exec(m_db, sql_messages, 0, 0, &errMsg) != SQLITE_OK) {
-        std::cerr << "SQL error creating messages table: " << errMsg << std::endl;
-        sqlite3_free(errMsg);
+    ok = ok && run(sql_conversations, "creating conversations table")
+            && run(sql_messages, "creating messages table");
+    if (ok && legacyMessages) {
+        ok = run(sql_copy_conversations, "migrating conversations")
+          && run(sql_copy_messages, "migrating messages")
+          && run(sql_drop_legacy, "dropping legacy messages table");
     }
-    
-    if (sqlite3_exec(m_db, sql_media, 0, 0, &errMsg) != SQLITE_OK) {
-        std::cerr << "SQL error creating media table: " << errMsg << std::endl;
-        sqlite3_free(errMsg);
+    if (ok && addDelivered) {
+        ok = run(sql_add_delivered, "adding delivery state");
+    }
+    ok = ok && run(sql_undelivered_index, "creating undelivered index")
+            && run(kGroupsTableSql, "creating groups table")
+            && run(kGroupMembersTableSql, "creating group members table")
+            && run(sql_group_messages, "creating group messages table")
+            && run(sql_conversations_user_b_index, "creating conversations index")
+            && run(sql_media, "creating media table")
+            && run("PRAGMA user_version = 5;", "updating schema version");
+
+    if (ok && run("COMMIT;", "committing migration")) {
+        if (legacyMessages) {
+            std::cout << "Migration to conversation layout complete" << std::endl;
+        }
+        return true;
     }
+    sqlite3_exec(m_db, "ROLLBACK;", 0, 0, 0);
+    return false;
 }
 
-bool Database::saveMessage(const std::string& sender, const std::string& receiver, 
-                          const std::string& text, const std::string& messageType,
-                          const std::string& mediaPath) {
-    const char* sql = R"(
-        INSERT INTO messages (sender, receiver, text, message_type, media_path)
-        VALUES (?, ?, ?, ?, ?);
+// v5 -> v6 while other cluster nodes are still on v5: rows are copied into
+// *_v6 tables in short transactions in primary key order, so those nodes
+// keep reading and writing the old tables between batches. The switch then
+// copies what they wrote meanwhile (ids above the bound recorded at the
+// start, plus delivery flags) and swaps the tables in one transaction; v5
+// nodes must be restarted after it. An interrupted copy resumes from the
+// last copied key on the next start. The old tables are only renamed by the
+// switch; finishMigrationV6() drops them afterwards.
+bool Database::migrateToV6() {
+    char* errMsg = 0;
+    auto run = [this, &errMsg](const std::string& sql, const char* what) {
+        if (sqlite3_exec(m_db, sql.c_str(), 0, 0, &errMsg) != SQLITE_OK) {
+            std::cerr << "SQL error " << what << ": " << errMsg << std::endl;
+            sqlite3_free(errMsg);
+            errMsg = 0;
+            return false;
+        }
+        return true;
+    };
+
+    const char* sql_state = R"(
+        CREATE TABLE IF NOT EXISTS migration_v6 (
+            source TEXT PRIMARY KEY,
+            upto_id INTEGER NOT NULL
+        );
+        INSERT OR IGNORE INTO migration_v6 SELECT 'messages', IFNULL(MAX(id), 0) FROM messages;
+        INSERT OR IGNORE INTO migration_v6 SELECT 'group_messages', IFNULL(MAX(id), 0) FROM group_messages;
     )";
-    
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(m_db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+
+    // Keeps the delivery sync at the switch off a full scan; replaced by
+    // idx_messages_undelivered once the old table no longer holds the name.
+    const char* sql_undelivered_index = R"(
+        CREATE INDEX IF NOT EXISTS idx_messages_v6_undelivered
+        ON messages_v6 (receiver_id, id) WHERE delivered = 0;
+    )";
+
+    bool ok = run("BEGIN IMMEDIATE;", "starting migration")
+           && run(sql_state, "recording migration bounds")
+           && run(messagesTableSql("messages_v6"), "creating messages_v6 table")
+           && run(sql_undelivered_index, "creating messages_v6 index")
+           && run(groupMessagesTableSql("group_messages_v6"), "creating group_messages_v6 table")
+           && run("COMMIT;", "starting migration");
+    if (!ok) {
+        sqlite3_exec(m_db, "ROLLBACK;", 0, 0, 0);
+        return false;
+    }
+    std::cout << "Migrating messages to schema v6..." << std::endl;
+
+    // The batch is the next kMigrationBatch source rows after the last key
+    // already in the target (?1, ?2); its users are interned first. Only
+    // missing names are inserted: with AUTOINCREMENT even an ignored insert
+    // uses up an id, and small ids keep the rows short.
+    const char* sql_message_mark = R"(
+        SELECT conversation_id, seq FROM messages_v6 ORDER BY conversation_id DESC, seq DESC LIMIT 1;
+    )";
+    const char* sql_message_users = R"(
+        WITH batch AS (
+            SELECT sender, receiver FROM messages
+            WHERE (conversation_id, seq) > (?1, ?2)
+              AND id <= (SELECT upto_id FROM migration_v6 WHERE source = 'messages')
+            ORDER BY conversation_id, seq
+            LIMIT ?3
+        ),
+        names(name) AS (SELECT sender FROM batch UNION SELECT receiver FROM batch)
+        INSERT INTO users (username)
+        SELECT name FROM names WHERE NOT EXISTS (SELECT 1 FROM users WHERE username = name);
+    )";
+    const char* sql_message_copy = R"(
+        INSERT INTO messages_v6 (conversation_id, seq, id, sender_id, receiver_id, text, message_type,
+                                 media_path, created_at, delivered)
+        SELECT m.conversation_id, m.seq, m.id, s.id, r.id, m.text, m.message_type, m.media_path,
+               IFNULL(CAST(strftime('%s', m.timestamp) AS INTEGER), 0) * 1000000, m.delivered
+        FROM (SELECT * FROM messages
+              WHERE (conversation_id, seq) > (?1, ?2)
+                AND id <= (SELECT upto_id FROM migration_v6 WHERE source = 'messages')
+              ORDER BY conversation_id, seq
+              LIMIT ?3) m
+        JOIN users s ON s.username = m.sender
+        JOIN users r ON r.username = m.receiver;
+    )";
+    const char* sql_group_mark = R"(
+        SELECT group_id, seq FROM group_messages_v6 ORDER BY group_id DESC, seq DESC LIMIT 1;
+    )";
+    const char* sql_group_users = R"(
+        WITH batch AS (
+            SELECT sender FROM group_messages
+            WHERE (group_id, seq) > (?1, ?2)
+              AND id <= (SELECT upto_id FROM migration_v6 WHERE source = 'group_messages')
+            ORDER BY group_id, seq
+            LIMIT ?3
+        ),
+        names(name) AS (SELECT DISTINCT sender FROM batch)
+        INSERT INTO users (username)
+        SELECT name FROM names WHERE NOT EXISTS (SELECT 1 FROM users WHERE username = name);
+    )";
+    const char* sql_group_copy = R"(
+        INSERT INTO group_messages_v6 (group_id, seq, id, sender_id, text, message_type, media_path,
+                                       created_at)
+        SELECT m.group_id, m.seq, m.id, s.id, m.text, m.message_type, m.media_path,
+               IFNULL(CAST(strftime('%s', m.timestamp) AS INTEGER), 0) * 1000000
+        FROM (SELECT * FROM group_messages
+              WHERE (group_id, seq) > (?1, ?2)
+                AND id <= (SELECT upto_id FROM migration_v6 WHERE source = 'group_messages')
+              ORDER BY group_id, seq
+              LIMIT ?3) m
+        JOIN users s ON s.username = m.sender;
+    )";
+
+    auto copyInBatches = [this](const char* markSql, const char* usersSql, const char* copySql,
+                                const char* what) {
+        sqlite3_stmt* mark = statement(markSql);
+        sqlite3_stmt* users = statement(usersSql);
+        sqlite3_stmt* copy = statement(copySql);
+        if (!mark || !users || !copy) {
+            return false;
+        }
+
+        long long copied = 0;
+        for (;;) {
+            if (!beginTransaction()) {
+                return false;
+            }
+            sqlite3_int64 key = 0;
+            sqlite3_int64 seq = 0;
+            {
+                StatementReset reset(mark);
+                if (sqlite3_step(mark) == SQLITE_ROW) {
+                    key = sqlite3_column_int64(mark, 0);
+                    seq = sqlite3_column_int64(mark, 1);
+                }
+            }
+
+            int rows = -1;
+            for (sqlite3_stmt* stmt : {users, copy}) {
+                StatementReset reset(stmt);
+                sqlite3_bind_int64(stmt, 1, key);
+                sqlite3_bind_int64(stmt, 2, seq);
+                sqlite3_bind_int(stmt, 3, kMigrationBatch);
+                if (sqlite3_step(stmt) != SQLITE_DONE) {
+                    std::cerr << "Failed to copy " << what << ": " << sqlite3_errmsg(m_db) << std::endl;
+                    rows = -1;
+                    break;
+                }
+                rows = sqlite3_changes(m_db);
+            }
+            if (rows < 0 || !commitTransaction()) {
+                rollbackTransaction();
+                return false;
+            }
+
+            copied += rows;
+            if (rows < kMigrationBatch) {
+                std::cout << "Copied " << copied << " " << what << std::endl;
+                return true;
+            }
+            if (copied % (kMigrationBatch * 50) == 0) {
+                std::cout << "Copied " << copied << " " << what << "..." << std::endl;
+            }
+        }
+    };
+
+    ok = copyInBatches(sql_message_mark, sql_message_users, sql_message_copy, "messages")
+      && copyInBatches(sql_group_mark, sql_group_users, sql_group_copy, "group messages");
+    // The copy statements reference tables the switch renames.
+    finalizeStatements();
+    if (!ok) {
+        return false;
+    }
+
+    // Everything v5 nodes wrote since the bounds were recorded: new rows,
+    // delivery flags of copied rows, conversations and media (small tables,
+    // copied whole).
+    const char* sql_tail_users = R"(
+        WITH names(name) AS (
+            SELECT sender FROM messages WHERE id > (SELECT upto_id FROM migration_v6 WHERE source = 'messages')
+            UNION SELECT receiver FROM messages
+                  WHERE id > (SELECT upto_id FROM migration_v6 WHERE source = 'messages')
+            UNION SELECT sender FROM group_messages
+                  WHERE id > (SELECT upto_id FROM migration_v6 WHERE source = 'group_messages')
+            UNION SELECT user_a FROM conversations
+            UNION SELECT user_b FROM conversations
+            UNION SELECT sender FROM media
+            UNION SELECT receiver FROM media
+        )
+        INSERT INTO users (username)
+        SELECT name FROM names WHERE NOT EXISTS (SELECT 1 FROM users WHERE username = name);
+    )";
+    const char* sql_tail_messages = R"(
+        INSERT INTO messages_v6 (conversation_id, seq, id, sender_id, receiver_id, text, message_type,
+                                 media_path, created_at, delivered)
+        SELECT m.conversation_id, m.seq, m.id, s.id, r.id, m.text, m.message_type, m.media_path,
+               IFNULL(CAST(strftime('%s', m.timestamp) AS INTEGER), 0) * 1000000, m.delivered
+        FROM messages m
+        JOIN users s ON s.username = m.sender
+        JOIN users r ON r.username = m.receiver
+        WHERE m.id > (SELECT upto_id FROM migration_v6 WHERE source = 'messages');
+
+        UPDATE messages_v6 INDEXED BY idx_messages_v6_undelivered SET delivered = 1
+        WHERE delivered = 0 AND id NOT IN (SELECT id FROM messages WHERE delivered = 0);
+
+        INSERT INTO group_messages_v6 (group_id, seq, id, sender_id, text, message_type, media_path,
+                                       created_at)
+        SELECT m.group_id, m.seq, m.id, s.id, m.text, m.message_type, m.media_path,
+               IFNULL(CAST(strftime('%s', m.timestamp) AS INTEGER), 0) * 1000000
+        FROM group_messages m
+        JOIN users s ON s.username = m.sender
+        WHERE m.id > (SELECT upto_id FROM migration_v6 WHERE source = 'group_messages');
+    )";
+    // Conversation ids are kept, so messages still point at their rows;
+    // only the (user_a, user_b) order changes to the id order.
+    const char* sql_copy_conversations = R"(
+        INSERT INTO conversations_v6 (id, user_a, user_b, last_seq)
+        SELECT c.id, MIN(a.id, b.id), MAX(a.id, b.id), c.last_seq
+        FROM conversations c
+        JOIN users a ON a.username = c.user_a
+        JOIN users b ON b.username = c.user_b;
+    )";
+    const char* sql_copy_media = R"(
+        INSERT INTO media_v6 (id, sender_id, receiver_id, path, type, created_at)
+        SELECT md.id, s.id, r.id, md.path, md.type,
+               IFNULL(CAST(strftime('%s', md.timestamp) AS INTEGER), 0) * 1000000
+        FROM media md
+        JOIN users s ON s.username = md.sender
+        JOIN users r ON r.username = md.receiver;
+    )";
+    // Dropping the large tables frees every page and would hold the lock
+    // for seconds: they are renamed out of the way instead.
+    const char* sql_swap = R"(
+        DROP INDEX idx_messages_undelivered;
+        ALTER TABLE messages RENAME TO messages_v5;
+        ALTER TABLE messages_v6 RENAME TO messages;
+        ALTER TABLE group_messages RENAME TO group_messages_v5;
+        ALTER TABLE group_messages_v6 RENAME TO group_messages;
+        DROP TABLE conversations;
+        ALTER TABLE conversations_v6 RENAME TO conversations;
+        DROP TABLE media;
+        ALTER TABLE media_v6 RENAME TO media;
+        DROP TABLE migration_v6;
+    )";
+
+    ok = run("BEGIN IMMEDIATE;", "starting schema switch")
+      && run(sql_tail_users, "interning users")
+      && run(sql_tail_messages, "copying new messages")
+      && run(conversationsTableSql("conversations_v6"), "creating conversations_v6 table")
+      && run(sql_copy_conversations, "copying conversations")
+      && run(mediaTableSql("media_v6"), "creating media_v6 table")
+      && run(sql_copy_media, "copying media")
+      && run(sql_swap, "switching tables")
+      && run(kConversationsUserBIndexSql, "creating conversations index")
+      && run("PRAGMA user_version = 6;", "updating schema version");
+    if (!ok || !run("COMMIT;", "committing schema switch")) {
+        sqlite3_exec(m_db, "ROLLBACK;", 0, 0, 0);
+        return false;
+    }
+    std::cout << "Migration to schema v6 complete" << std::endl;
+    return true;
+}
+
+// After the switch nothing reads the v5 tables (v5 nodes fail on the new
+// schema), so each step may hold the lock for as long as it takes. Until the
+// final index exists, the migration's own partial index serves undelivered
+// lookups. Every step is idempotent.
+void Database::finishMigrationV6() {
+    char* errMsg = 0;
+    auto run = [this, &errMsg](const char* sql, const char* what) {
+        if (sqlite3_exec(m_db, sql, 0, 0, &errMsg) != SQLITE_OK) {
+            std::cerr << "SQL error " << what << ": " << errMsg << std::endl;
+            sqlite3_free(errMsg);
+            errMsg = 0;
+            return false;
+        }
+        return true;
+    };
+
+    // The v5 tables go last: their presence is what marks the job unfinished.
+    const bool ok = run("BEGIN IMMEDIATE;", "starting v5 cleanup")
+                 && run(kUndeliveredIndexSql, "creating undelivered index")
+                 && run("DROP INDEX IF EXISTS idx_messages_v6_undelivered;", "dropping migration index")
+                 && run("COMMIT;", "committing undelivered index");
+    if (!ok) {
+        sqlite3_exec(m_db, "ROLLBACK;", 0, 0, 0);
+        return;
+    }
+    run("DROP TABLE IF EXISTS group_messages_v5;", "dropping group_messages_v5")
+        && run("DROP TABLE IF EXISTS messages_v5;", "dropping messages_v5");
+}
+
+// v6 -> v7 adds the search index and nothing else: one short transaction,
+// after which the writer indexes the existing rows in the background (see
+// indexMessages()), so a large file does not hold up startup. v6 nodes of a
+// cluster keep working on the file; their messages are indexed by the v7
+// ones. Without FTS5 in the SQLite build the file stays on v6 and search
+// finds nothing.
+bool Database::migrateToV7() {
+    char* errMsg = 0;
+    auto run = [this, &errMsg](const char* sql, const char* what) {
+        if (sqlite3_exec(m_db, sql, 0, 0, &errMsg) != SQLITE_OK) {
+            std::cerr << "SQL error " << what << ": " << errMsg << std::endl;
+            sqlite3_free(errMsg);
+            errMsg = 0;
+            return false;
+        }
+        return true;
+    };
+
+    const bool ok = run("BEGIN IMMEDIATE;", "starting search index creation")
+                 && run(kSearchIndexSql, "creating search index")
+                 && run("PRAGMA user_version = 7;", "updating schema version");
+    if (!ok || !run("COMMIT;", "committing search index")) {
+        sqlite3_exec(m_db, "ROLLBACK;", 0, 0, 0);
+        std::cerr << "Message search is unavailable (SQLite built without FTS5?)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+sqlite3_stmt* Database::statement(const char* sql) {
+    auto it = m_statements.find(sql);
+    if (it != m_statements.end()) {
+        return it->second;
+    }
+
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v3(m_db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL) != SQLITE_OK) {
         std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(m_db) << std::endl;
+        return nullptr;
+    }
+
+    m_statements.emplace(sql, stmt);
+    return stmt;
+}
+
+bool Database::execute(const char* sql) {
+    sqlite3_stmt* stmt = statement(sql);
+    if (!stmt) {
         return false;
     }
-    
-    sqlite3_bind_text(stmt, 1, sender.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, receiver.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, text.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 4, messageType.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 5, mediaPath.c_str(), -1, SQLITE_STATIC);
-    
+    StatementReset reset(stmt);
+
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE || rc == SQLITE_ROW;
+}
+
+bool Database::beginTransaction() {
+    if (!execute(kBeginSql)) {
+        std::cerr << "Failed to begin transaction: " << sqlite3_errmsg(m_db) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Database::commitTransaction() {
+    if (!execute(kCommitSql)) {
+        std::cerr << "Failed to commit transaction: " << sqlite3_errmsg(m_db) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Database::rollbackTransaction() {
+    execute(kRollbackSql);
+    // A rolled-back insert's id goes back to AUTOINCREMENT's pool only if no
+    // later row took it, but the cache cannot tell: start over.
+    m_userIds.clear();
+    m_usernames.clear();
+}
+
+bool Database::savepoint() {
+    if (!execute(kSavepointSql)) {
+        std::cerr << "Failed to open savepoint: " << sqlite3_errmsg(m_db) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Database::releaseSavepoint() {
+    if (!execute(kReleaseSavepointSql)) {
+        std::cerr << "Failed to release savepoint: " << sqlite3_errmsg(m_db) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Database::rollbackToSavepoint() {
+    // ROLLBACK TO keeps the savepoint open; RELEASE closes it, keeping nothing.
+    execute(kRollbackToSavepointSql);
+    execute(kReleaseSavepointSql);
+    // Same reason as rollbackTransaction: the undone write may have created users.
+    m_userIds.clear();
+    m_usernames.clear();
+}
+
+void Database::finalizeStatements() {
+    for (auto& [sql, stmt] : m_statements) {
+        sqlite3_finalize(stmt);
+    }
+    m_statements.clear();
+}
+
+void Database::cacheUser(const std::string& username, long long id) {
+    if (m_userIds.size() >= kMaxCachedUsers) {
+        m_userIds.clear();
+        m_usernames.clear();
+    }
+    m_userIds.emplace(username, id);
+    m_usernames.emplace(id, username);
+}
+
+long long Database::userId(const std::string& username, bool create) {
+    auto it = m_userIds.find(username);
+    if (it != m_userIds.end()) {
+        return it->second;
+    }
+
+    sqlite3_stmt* stmt = statement(kSelectUserIdSql);
+    if (!stmt) {
+        return 0;
+    }
+    long long id = 0;
+    {
+        StatementReset reset(stmt);
+        sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            id = sqlite3_column_int64(stmt, 0);
+        }
+    }
+
+    // Unknown names are not cached: another connection may create them.
+    if (id == 0 && create) {
+        sqlite3_stmt* insert = statement(kInsertUserIdSql);
+        if (!insert) {
+            return 0;
+        }
+        StatementReset reset(insert);
+        sqlite3_bind_text(insert, 1, username.c_str(), -1, SQLITE_STATIC);
+        if (sqlite3_step(insert) != SQLITE_ROW) {
+            std::cerr << "Failed to register user: " << sqlite3_errmsg(m_db) << std::endl;
+            return 0;
+        }
+        id = sqlite3_column_int64(insert, 0);
+    }
+    if (id != 0) {
+        cacheUser(username, id);
+    }
+    return id;
+}
+
+const std::string& Database::usernameOf(long long id) {
+    static const std::string kUnknown;
+    if (id == 0) {
+        return kUnknown;
+    }
+    auto it = m_usernames.find(id);
+    if (it != m_usernames.end()) {
+        return it->second;
+    }
+
+    sqlite3_stmt* stmt = statement(kSelectUsernameSql);
+    if (!stmt) {
+        return kUnknown;
+    }
+    StatementReset reset(stmt);
+    sqlite3_bind_int64(stmt, 1, id);
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        return kUnknown;
+    }
+    cacheUser(columnText(stmt, 0), id);
+    return m_usernames[id];
+}
+
+// Reads rows of the kSelectMessages* column layout.
+std::vector<Message> Database::readMessages(sqlite3_stmt* stmt) {
+    std::vector<Message> messages;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        Message msg;
+        msg.id = sqlite3_column_int64(stmt, 0);
+        msg.sender = usernameOf(sqlite3_column_int64(stmt, 1));
+        msg.receiver = usernameOf(sqlite3_column_int64(stmt, 2));
+        msg.text = columnText(stmt, 3);
+        msg.timestamp = sqlite3_column_int64(stmt, 4);
+        msg.messageType = columnText(stmt, 5);
+        msg.mediaPath = columnText(stmt, 6);
+        msg.conversationId = sqlite3_column_int64(stmt, 7);
+        msg.seq = sqlite3_column_int64(stmt, 8);
+        messages.push_back(std::move(msg));
+    }
+    return messages;
+}
+
+bool Database::saveMessage(const std::string& sender, const std::string& receiver, 
+                          const std::string& text, const std::string& messageType,
+                          const std::string& mediaPath, bool delivered, long long timestamp) {
+    ScopedTimer timer(Metrics::instance().dbSaveMessage);
+
+    // Sequence bump and insert must land together; the writer normally
+    // calls this inside its batch transaction already.
+    const bool ownTransaction = sqlite3_get_autocommit(m_db) != 0;
+    if (ownTransaction && !beginTransaction()) {
+        return false;
+    }
+
+    bool ok = insertMessage(sender, receiver, text, messageType, mediaPath, delivered, timestamp);
+
+    if (ownTransaction) {
+        if (ok) {
+            ok = commitTransaction();
+        }
+        if (!ok) {
+            rollbackTransaction();
+        }
+    }
+    return ok;
+}
+
+bool Database::insertMessage(const std::string& sender, const std::string& receiver,
+                             const std::string& text, const std::string& messageType,
+                             const std::string& mediaPath, bool delivered, long long timestamp) {
+    sqlite3_stmt* seqStmt = statement(kNextSeqSql);
+    sqlite3_stmt* stmt = statement(kInsertMessageSql);
+    if (!seqStmt || !stmt) {
+        return false;
+    }
+
+    const long long senderId = userId(sender, true);
+    const long long receiverId = userId(receiver, true);
+    if (senderId == 0 || receiverId == 0) {
+        return false;
+    }
+    const auto [userA, userB] = canonicalPair(senderId, receiverId);
+
+    sqlite3_int64 conversationId = 0;
+    sqlite3_int64 seq = 0;
+    {
+        StatementReset reset(seqStmt);
+        sqlite3_bind_int64(seqStmt, 1, userA);
+        sqlite3_bind_int64(seqStmt, 2, userB);
+        if (sqlite3_step(seqStmt) != SQLITE_ROW) {
+            std::cerr << "Failed to allocate message sequence: " << sqlite3_errmsg(m_db) << std::endl;
+            return false;
+        }
+        conversationId = sqlite3_column_int64(seqStmt, 0);
+        seq = sqlite3_column_int64(seqStmt, 1);
+    }
+
+    StatementReset reset(stmt);
     
-    if (rc != SQLITE_DONE) {
+    sqlite3_bind_int64(stmt, 1, conversationId);
+    sqlite3_bind_int64(stmt, 2, seq);
+    sqlite3_bind_int64(stmt, 3, senderId);
+    sqlite3_bind_int64(stmt, 4, receiverId);
+    sqlite3_bind_text(stmt, 5, text.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 6, messageType.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 7, mediaPath.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 8, timestamp != 0 ? timestamp : currentTimestamp());
+    sqlite3_bind_int(stmt, 9, delivered ? 1 : 0);
+    
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
         std::cerr << "Failed to insert message: " << sqlite3_errmsg(m_db) << std::endl;
         return false;
     }
@@ -118,66 +1322,383 @@ bool Database::saveMessage(const std::string& sender, const std::string& receive
 }
 
 std::vector<Message> Database::getMessages(const std::string& user1, const std::string& user2, int limit) {
-    std::vector<Message> messages;
-    
-    const char* sql = R"(
-        SELECT id, sender, receiver, text, timestamp, message_type, media_path
-        FROM messages 
-        WHERE (sender = ? AND receiver = ?) OR (sender = ? AND receiver = ?)
-        ORDER BY timestamp DESC 
-        LIMIT ?;
-    )";
-    
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(m_db, sql, -1, &stmt, NULL) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(m_db) << std::endl;
-        return messages;
+    ScopedTimer timer(Metrics::instance().dbGetMessages);
+    sqlite3_stmt* stmt = statement(kSelectMessagesSql);
+    if (!stmt) {
+        return {};
+    }
+    // Users without an id have no messages.
+    const long long id1 = userId(user1);
+    const long long id2 = userId(user2);
+    if (id1 == 0 || id2 == 0) {
+        return {};
     }
+    StatementReset reset(stmt);
     
-    sqlite3_bind_text(stmt, 1, user1.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, user2.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, user2.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 4, user1.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 5, limit);
+    const auto [userA, userB] = canonicalPair(id1, id2);
+    sqlite3_bind_int64(stmt, 1, userA);
+    sqlite3_bind_int64(stmt, 2, userB);
+    sqlite3_bind_int(stmt, 3, limit);
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        Message msg;
-        msg.id = sqlite3_column_int(stmt, 0);
-        msg.sender = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-        msg.receiver = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-        msg.text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-        msg.timestamp = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
-        msg.messageType = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-        msg.mediaPath = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 6));
-        messages.push_back(msg);
+    return readMessages(stmt);
+}
+
+std::vector<Message> Database::getMessagesBefore(const std::string& user1, const std::string& user2,
+                                                 long long beforeId, int limit) {
+    ScopedTimer timer(Metrics::instance().dbGetMessages);
+    sqlite3_stmt* stmt = statement(kSelectMessagesBeforeSql);
+    if (!stmt) {
+        return {};
+    }
+    const long long id1 = userId(user1);
+    const long long id2 = userId(user2);
+    if (id1 == 0 || id2 == 0) {
+        return {};
+    }
+    StatementReset reset(stmt);
+
+    const auto [userA, userB] = canonicalPair(id1, id2);
+    sqlite3_bind_int64(stmt, 1, userA);
+    sqlite3_bind_int64(stmt, 2, userB);
+    sqlite3_bind_int64(stmt, 3, beforeId);
+    sqlite3_bind_int(stmt, 4, limit);
+
+    return readMessages(stmt);
+}
+
+std::vector<Message> Database::getMessagesAfter(const std::string& user1, const std::string& user2,
+                                                long long afterId, int limit) {
+    ScopedTimer timer(Metrics::instance().dbGetMessages);
+    sqlite3_stmt* stmt = statement(kSelectMessagesAfterSql);
+    if (!stmt) {
+        return {};
+    }
+    const long long id1 = userId(user1);
+    const long long id2 = userId(user2);
+    if (id1 == 0 || id2 == 0) {
+        return {};
+    }
+    StatementReset reset(stmt);
+
+    const auto [userA, userB] = canonicalPair(id1, id2);
+    sqlite3_bind_int64(stmt, 1, userA);
+    sqlite3_bind_int64(stmt, 2, userB);
+    sqlite3_bind_int64(stmt, 3, afterId);
+    sqlite3_bind_int(stmt, 4, limit);
+
+    // Scanned oldest-first from the cursor; returned newest-first like every page.
+    auto messages = readMessages(stmt);
+    std::reverse(messages.begin(), messages.end());
+    return messages;
+}
+
+std::vector<Message> Database::getUndelivered(const std::string& receiver, long long afterId, int limit) {
+    sqlite3_stmt* stmt = statement(kSelectUndeliveredSql);
+    if (!stmt) {
+        return {};
+    }
+    const long long receiverId = userId(receiver);
+    if (receiverId == 0) {
+        return {};
+    }
+    StatementReset reset(stmt);
+
+    sqlite3_bind_int64(stmt, 1, receiverId);
+    sqlite3_bind_int64(stmt, 2, afterId);
+    sqlite3_bind_int(stmt, 3, limit);
+
+    auto messages = readMessages(stmt);
+    for (auto& msg : messages) {
+        msg.delivered = false;
+    }
+    return messages;
+}
+
+bool Database::markDelivered(const std::string& receiver, long long upToId) {
+    sqlite3_stmt* stmt = statement(kMarkDeliveredSql);
+    if (!stmt) {
+        return false;
+    }
+    const long long receiverId = userId(receiver);
+    if (receiverId == 0) {
+        return true; // no messages to mark
+    }
+    StatementReset reset(stmt);
+
+    sqlite3_bind_int64(stmt, 1, receiverId);
+    sqlite3_bind_int64(stmt, 2, upToId);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        std::cerr << "Failed to mark messages delivered: " << sqlite3_errmsg(m_db) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Database::markMessageDelivered(const std::string& receiver, const std::string& sender, long long timestamp) {
+    sqlite3_stmt* stmt = statement(kMarkMessageDeliveredSql);
+    if (!stmt) {
+        return false;
+    }
+    const long long receiverId = userId(receiver);
+    const long long senderId = userId(sender);
+    if (receiverId == 0 || senderId == 0) {
+        return true; // the message was never stored
+    }
+    StatementReset reset(stmt);
+
+    sqlite3_bind_int64(stmt, 1, receiverId);
+    sqlite3_bind_int64(stmt, 2, senderId);
+    sqlite3_bind_int64(stmt, 3, timestamp);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        std::cerr << "Failed to mark message delivered: " << sqlite3_errmsg(m_db) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::vector<Message> Database::searchMessages(const std::string& username, const std::string& query,
+                                              const std::string& with, int offset, int limit) {
+    ScopedTimer timer(Metrics::instance().dbSearchMessages);
+    const long long owner = userId(username);
+    const long long partner = with.empty() ? 0 : userId(with);
+    if (owner == 0 || (!with.empty() && partner == 0)) {
+        return {};
+    }
+    const std::string expression = searchExpression(query, owner, partner);
+    if (expression.empty() || offset >= kSearchWindow) {
+        return {};
+    }
+    // Prepared on first use: without FTS5 this fails and search finds nothing.
+    sqlite3_stmt* stmt = statement(kSearchMessagesSql);
+    if (!stmt) {
+        return {};
+    }
+    StatementReset reset(stmt);
+
+    sqlite3_bind_text(stmt, 1, expression.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, kSearchWindow - 1);
+    sqlite3_bind_int(stmt, 3, std::min(limit, kSearchWindow - offset));
+    sqlite3_bind_int(stmt, 4, offset);
+
+    return readMessages(stmt);
+}
+
+int Database::indexMessages(int limit) {
+    if (!m_searchIndex) {
+        return 0;
+    }
+    sqlite3_stmt* mark = statement(kSelectIndexedIdSql);
+    sqlite3_stmt* index = statement(kIndexMessagesSql);
+    sqlite3_stmt* advance = statement(kAdvanceIndexedIdSql);
+    if (!mark || !index || !advance || !beginTransaction()) {
+        return -1;
+    }
+
+    // Read inside the write transaction: another node's writer may have
+    // indexed meanwhile.
+    sqlite3_int64 indexedId = 0;
+    {
+        StatementReset reset(mark);
+        if (sqlite3_step(mark) == SQLITE_ROW) {
+            indexedId = sqlite3_column_int64(mark, 0);
+        }
+    }
+
+    int rows = -1;
+    for (sqlite3_stmt* stmt : {index, advance}) {
+        StatementReset reset(stmt);
+        sqlite3_bind_int64(stmt, 1, indexedId);
+        sqlite3_bind_int(stmt, 2, limit);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            std::cerr << "Failed to index messages: " << sqlite3_errmsg(m_db) << std::endl;
+            rows = -1;
+            break;
+        }
+        if (stmt == index) {
+            rows = sqlite3_changes(m_db);
+        }
+    }
+    if (rows < 0 || !commitTransaction()) {
+        rollbackTransaction();
+        return -1;
+    }
+    return rows;
+}
+
+bool Database::saveGroupMessage(const std::string& group, const std::string& sender, const std::string& text,
+                                const std::string& messageType, const std::string& mediaPath,
+                                long long timestamp) {
+    ScopedTimer timer(Metrics::instance().dbSaveMessage);
+    sqlite3_stmt* seqStmt = statement(kNextGroupSeqSql);
+    sqlite3_stmt* stmt = statement(kInsertGroupMessageSql);
+    if (!seqStmt || !stmt) {
+        return false;
+    }
+
+    // Sequence bump and insert must land together, as in saveMessage.
+    const bool ownTransaction = sqlite3_get_autocommit(m_db) != 0;
+    if (ownTransaction && !beginTransaction()) {
+        return false;
+    }
+
+    bool ok = false;
+    const long long senderId = userId(sender, true);
+    if (senderId != 0) {
+        StatementReset reset(seqStmt);
+        sqlite3_bind_text(seqStmt, 1, group.c_str(), -1, SQLITE_STATIC);
+        if (sqlite3_step(seqStmt) == SQLITE_ROW) {
+            const sqlite3_int64 groupId = sqlite3_column_int64(seqStmt, 0);
+            const sqlite3_int64 seq = sqlite3_column_int64(seqStmt, 1);
+
+            StatementReset resetInsert(stmt);
+            sqlite3_bind_int64(stmt, 1, groupId);
+            sqlite3_bind_int64(stmt, 2, seq);
+            sqlite3_bind_int64(stmt, 3, senderId);
+            sqlite3_bind_text(stmt, 4, text.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 5, messageType.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 6, mediaPath.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 7, timestamp != 0 ? timestamp : currentTimestamp());
+            ok = sqlite3_step(stmt) == SQLITE_DONE;
+            if (!ok) {
+                std::cerr << "Failed to insert group message: " << sqlite3_errmsg(m_db) << std::endl;
+            }
+        } else {
+            std::cerr << "Failed to allocate group message sequence for " << group << std::endl;
+        }
+    }
+
+    if (ownTransaction) {
+        if (ok) {
+            ok = commitTransaction();
+        }
+        if (!ok) {
+            rollbackTransaction();
+        }
+    }
+    return ok;
+}
+
+bool Database::addGroupMember(const std::string& group, const std::string& username) {
+    sqlite3_stmt* groupStmt = statement(kInsertGroupSql);
+    sqlite3_stmt* stmt = statement(kInsertGroupMemberSql);
+    if (!groupStmt || !stmt) {
+        return false;
+    }
+
+    {
+        StatementReset reset(groupStmt);
+        sqlite3_bind_text(groupStmt, 1, group.c_str(), -1, SQLITE_STATIC);
+        if (sqlite3_step(groupStmt) != SQLITE_DONE) {
+            std::cerr << "Failed to create group: " << sqlite3_errmsg(m_db) << std::endl;
+            return false;
+        }
+    }
+
+    StatementReset reset(stmt);
+    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, group.c_str(), -1, SQLITE_STATIC);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        std::cerr << "Failed to add group member: " << sqlite3_errmsg(m_db) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Database::removeGroupMember(const std::string& group, const std::string& username) {
+    sqlite3_stmt* stmt = statement(kDeleteGroupMemberSql);
+    if (!stmt) {
+        return false;
+    }
+    StatementReset reset(stmt);
+
+    sqlite3_bind_text(stmt, 1, group.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, username.c_str(), -1, SQLITE_STATIC);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        std::cerr << "Failed to remove group member: " << sqlite3_errmsg(m_db) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::vector<Message> Database::getGroupMessages(const std::string& group, long long beforeId, int limit) {
+    ScopedTimer timer(Metrics::instance().dbGetMessages);
+    sqlite3_stmt* stmt = statement(kSelectGroupMessagesSql);
+    if (!stmt) {
+        return {};
+    }
+    StatementReset reset(stmt);
+
+    sqlite3_bind_text(stmt, 1, group.c_str(), -1, SQLITE_STATIC);
+    if (beforeId > 0) {
+        sqlite3_bind_int64(stmt, 2, beforeId);
+    } else {
+        sqlite3_bind_null(stmt, 2); // newest page
+    }
+    sqlite3_bind_int(stmt, 3, limit);
+
+    auto messages = readMessages(stmt);
+    for (auto& msg : messages) {
+        msg.receiver = group;
     }
-    
-    sqlite3_finalize(stmt);
     return messages;
 }
 
+std::vector<std::pair<std::string, std::string>> Database::getGroupMembers() {
+    std::vector<std::pair<std::string, std::string>> members;
+    sqlite3_stmt* stmt = statement(kSelectGroupMembersSql);
+    if (!stmt) {
+        return members;
+    }
+    StatementReset reset(stmt);
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        members.emplace_back(columnText(stmt, 0), columnText(stmt, 1));
+    }
+    return members;
+}
+
+std::vector<std::string> Database::getContacts(const std::string& username, int limit) {
+    std::vector<std::string> contacts;
+    sqlite3_stmt* stmt = statement(kSelectContactsSql);
+    if (!stmt) {
+        return contacts;
+    }
+    const long long id = userId(username);
+    if (id == 0) {
+        return contacts;
+    }
+    StatementReset reset(stmt);
+
+    sqlite3_bind_int64(stmt, 1, id);
+    sqlite3_bind_int(stmt, 2, limit);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        contacts.push_back(usernameOf(sqlite3_column_int64(stmt, 0)));
+    }
+    return contacts;
+}
+
 bool Database::saveMedia(const std::string& sender, const std::string& receiver,
                         const std::string& path, const std::string& type) {
-    const char* sql = R"(
-        INSERT INTO media (sender, receiver, path, type)
-        VALUES (?, ?, ?, ?);
-    )";
-    
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(m_db, sql, -1, &stmt, NULL) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(m_db) << std::endl;
+    sqlite3_stmt* stmt = statement(kInsertMediaSql);
+    if (!stmt) {
+        return false;
+    }
+    const long long senderId = userId(sender, true);
+    const long long receiverId = userId(receiver, true);
+    if (senderId == 0 || receiverId == 0) {
         return false;
     }
+    StatementReset reset(stmt);
     
-    sqlite3_bind_text(stmt, 1, sender.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, receiver.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 1, senderId);
+    sqlite3_bind_int64(stmt, 2, receiverId);
     sqlite3_bind_text(stmt, 3, path.c_str(), -1, SQLITE_STATIC);
     sqlite3_bind_text(stmt, 4, type.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 5, currentTimestamp());
     
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
-    if (rc != SQLITE_DONE) {
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
         std::cerr << "Failed to insert media: " << sqlite3_errmsg(m_db) << std::endl;
         return false;
     }
@@ -188,47 +1709,44 @@ bool Database::saveMedia(const std::string& sender, const std::string& receiver,
 std::vector<Media> Database::getMedia(const std::string& user1, const std::string& user2) {
     std::vector<Media> media;
     
-    const char* sql = R"(
-        SELECT id, sender, receiver, path, type, timestamp
-        FROM media 
-        WHERE (sender = ? AND receiver = ?) OR (sender = ? AND receiver = ?)
-        ORDER BY timestamp DESC;
-    )";
-    
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(m_db, sql, -1, &stmt, NULL) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(m_db) << std::endl;
+    sqlite3_stmt* stmt = statement(kSelectMediaSql);
+    if (!stmt) {
+        return media;
+    }
+    const long long id1 = userId(user1);
+    const long long id2 = userId(user2);
+    if (id1 == 0 || id2 == 0) {
         return media;
     }
+    StatementReset reset(stmt);
     
-    sqlite3_bind_text(stmt, 1, user1.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, user2.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, user2.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 4, user1.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 1, id1);
+    sqlite3_bind_int64(stmt, 2, id2);
     
     while (sqlite3_step(stmt) == SQLITE_ROW) {
         Media m;
         m.id = sqlite3_column_int(stmt, 0);
-        m.sender = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-        m.receiver = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-        m.path = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-        m.type = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
-        m.timestamp = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-        media.push_back(m);
+        m.sender = usernameOf(sqlite3_column_int64(stmt, 1));
+        m.receiver = usernameOf(sqlite3_column_int64(stmt, 2));
+        m.path = columnText(stmt, 3);
+        m.type = columnText(stmt, 4);
+        m.timestamp = sqlite3_column_int64(stmt, 5);
+        media.push_back(std::move(m));
     }
     
-    sqlite3_finalize(stmt);
     return media;
 }
 
 bool Database::userExists(const std::string& username) {
-    const char* sql = "SELECT COUNT(*) FROM users WHERE username = ?;";
-    
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(m_db, sql, -1, &stmt, NULL) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(m_db) << std::endl;
+    ScopedTimer timer(Metrics::instance().dbUserExists);
+    if (m_userIds.count(username) != 0) {
+        return true;
+    }
+    sqlite3_stmt* stmt = statement(kUserExistsSql);
+    if (!stmt) {
         return false;
     }
+    StatementReset reset(stmt);
     
     sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
     
@@ -237,28 +1755,27 @@ bool Database::userExists(const std::string& username) {
         exists = sqlite3_column_int(stmt, 0) > 0;
     }
     
-    sqlite3_finalize(stmt);
     return exists;
 }
 
 bool Database::createUser(const std::string& username) {
-    const char* sql = "INSERT INTO users (username) VALUES (?);";
-    
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(m_db, sql, -1, &stmt, NULL) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(m_db) << std::endl;
+    sqlite3_stmt* stmt = statement(kCreateUserSql);
+    if (!stmt) {
         return false;
     }
+    StatementReset reset(stmt);
     
     sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
     
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
-    if (rc != SQLITE_DONE) {
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
         std::cerr << "Failed to create user: " << sqlite3_errmsg(m_db) << std::endl;
         return false;
     }
     
     return true;
-} 
\ No newline at end of file
+}
+
+bool Database::ensureUser(const std::string& username) {
+    // Also warms the cache for the user's first messages.
+    return userId(username, true) != 0;
+}
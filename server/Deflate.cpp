@@ -0,0 +1,120 @@
+#include "../include/Deflate.h"
+#include <zlib.h>
+#include <algorithm>
+
+namespace {
+
+// RFC 7692 7.2.1: the empty stored block that Z_SYNC_FLUSH ends with is not sent.
+constexpr char kSyncFlushTail[] = {'\x00', '\x00', '\xff', '\xff'};
+constexpr int kSyncFlushTailSize = 4;
+
+} // namespace
+
+MessageDeflater::MessageDeflater(const DeflateOptions& options)
+    : m_stream(std::make_unique<z_stream_s>())
+    , m_contextTakeover(options.contextTakeover)
+{
+    // Raw deflate (negative window bits); zlib does not support 8 in raw mode.
+    const int windowBits = std::clamp(options.windowBits, 9, 15);
+    m_valid = deflateInit2(m_stream.get(), std::clamp(options.level, 0, 9), Z_DEFLATED,
+                           -windowBits, std::clamp(options.memLevel, 1, 9), Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+MessageDeflater::~MessageDeflater() {
+    if (m_valid) {
+        deflateEnd(m_stream.get());
+    }
+}
+
+bool MessageDeflater::compress(const char* data, int size, QByteArray& out) {
+    if (!m_valid) {
+        return false;
+    }
+
+    z_stream_s& zs = *m_stream;
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    zs.avail_in = static_cast<uInt>(size);
+
+    // Marker byte, then enough room for incompressible input plus the flush block.
+    out.resize(1 + static_cast<int>(deflateBound(&zs, static_cast<uLong>(size))) + 16);
+    out[0] = kCompressedFrameMarker;
+    int written = 1;
+    while (true) {
+        zs.next_out = reinterpret_cast<Bytef*>(out.data() + written);
+        zs.avail_out = static_cast<uInt>(out.size() - written);
+        const int rc = deflate(&zs, Z_SYNC_FLUSH);
+        if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            m_valid = false;
+            return false;
+        }
+        written = out.size() - static_cast<int>(zs.avail_out);
+        if (zs.avail_out != 0) {
+            break;
+        }
+        out.resize(out.size() * 2);
+    }
+
+    if (written >= 1 + kSyncFlushTailSize
+        && std::equal(kSyncFlushTail, kSyncFlushTail + kSyncFlushTailSize, out.constData() + written - kSyncFlushTailSize)) {
+        written -= kSyncFlushTailSize;
+    }
+    out.resize(written);
+
+    if (!m_contextTakeover) {
+        deflateReset(&zs);
+    }
+    return true;
+}
+
+MessageInflater::MessageInflater()
+    : m_stream(std::make_unique<z_stream_s>())
+{
+    // Always the largest window: the peer may use any size up to it.
+    m_valid = inflateInit2(m_stream.get(), -15) == Z_OK;
+}
+
+MessageInflater::~MessageInflater() {
+    if (m_valid) {
+        inflateEnd(m_stream.get());
+    }
+}
+
+bool MessageInflater::decompress(const char* data, int size, QByteArray& out) {
+    if (!m_valid) {
+        return false;
+    }
+
+    QByteArray input;
+    input.reserve(size + kSyncFlushTailSize);
+    input.append(data, size);
+    input.append(kSyncFlushTail, kSyncFlushTailSize);
+
+    z_stream_s& zs = *m_stream;
+    zs.next_in = reinterpret_cast<Bytef*>(input.data());
+    zs.avail_in = static_cast<uInt>(input.size());
+
+    out.resize(std::max(4096, size * 4));
+    int written = 0;
+    while (true) {
+        zs.next_out = reinterpret_cast<Bytef*>(out.data() + written);
+        zs.avail_out = static_cast<uInt>(out.size() - written);
+        const int rc = inflate(&zs, Z_SYNC_FLUSH);
+        if (rc != Z_OK && rc != Z_BUF_ERROR && rc != Z_STREAM_END) {
+            m_valid = false;
+            return false;
+        }
+        written = out.size() - static_cast<int>(zs.avail_out);
+        if (zs.avail_in == 0 && zs.avail_out != 0) {
+            break;
+        }
+        if (rc == Z_BUF_ERROR && zs.avail_out != 0) {
+            // No progress with input left: truncated or corrupt frame.
+            m_valid = false;
+            return false;
+        }
+        out.resize(out.size() * 2);
+    }
+
+    out.resize(written);
+    return true;
+}
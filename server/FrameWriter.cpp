@@ -0,0 +1,307 @@
+#include "../include/FrameWriter.h"
+
+FrameWriter::FrameWriter(Frame& frame, WireProtocol protocol) : m_frame(frame) {
+    m_frame.protocol = protocol;
+    if (protocol == WireProtocol::Binary) {
+        m_frame.binary.resize(0);
+        m_cbor.emplace(&m_frame.binary);
+        m_cbor->startMap();
+    } else {
+        m_frame.text.resize(0);
+        m_frame.text.append(QLatin1Char('{'));
+    }
+}
+
+FrameWriter& FrameWriter::field(Wire::Key name, Wire::Type value) {
+    key(name);
+    if (m_cbor) {
+        m_cbor->append(static_cast<quint64>(value));
+    } else {
+        m_frame.text.append(QLatin1Char('"'));
+        m_frame.text.append(Wire::typeName(value));
+        m_frame.text.append(QLatin1Char('"'));
+    }
+    return *this;
+}
+
+FrameWriter& FrameWriter::field(Wire::Key name, QLatin1String value) {
+    key(name);
+    if (m_cbor) {
+        m_cbor->append(value);
+    } else {
+        m_frame.text.append(QLatin1Char('"'));
+        m_frame.text.append(value);
+        m_frame.text.append(QLatin1Char('"'));
+    }
+    return *this;
+}
+
+FrameWriter& FrameWriter::field(Wire::Key name, const QString& value) {
+    key(name);
+    if (m_cbor) {
+        m_cbor->append(value);
+    } else {
+        m_frame.text.append(QLatin1Char('"'));
+        appendEscaped(value);
+        m_frame.text.append(QLatin1Char('"'));
+    }
+    return *this;
+}
+
+FrameWriter& FrameWriter::field(Wire::Key name, qint64 value) {
+    key(name);
+    if (m_cbor) {
+        m_cbor->append(value);
+    } else {
+        m_frame.text.append(QString::number(value));
+    }
+    return *this;
+}
+
+FrameWriter& FrameWriter::field(Wire::Key name, bool value) {
+    key(name);
+    if (m_cbor) {
+        m_cbor->append(value);
+    } else {
+        m_frame.text.append(value ? QLatin1String("true") : QLatin1String("false"));
+    }
+    return *this;
+}
+
+FrameWriter& FrameWriter::field(Wire::Key name, std::nullptr_t) {
+    key(name);
+    if (m_cbor) {
+        m_cbor->append(nullptr);
+    } else {
+        m_frame.text.append(QLatin1String("null"));
+    }
+    return *this;
+}
+
+FrameWriter& FrameWriter::beginArray(Wire::Key name) {
+    key(name);
+    if (m_cbor) {
+        m_cbor->startArray();
+    } else {
+        m_frame.text.append(QLatin1Char('['));
+    }
+    m_first = true;
+    return *this;
+}
+
+FrameWriter& FrameWriter::endArray() {
+    if (m_cbor) {
+        m_cbor->endArray();
+    } else {
+        m_frame.text.append(QLatin1Char(']'));
+    }
+    m_first = false;
+    return *this;
+}
+
+FrameWriter& FrameWriter::element(const QString& value) {
+    if (m_cbor) {
+        m_cbor->append(value);
+    } else {
+        separator();
+        m_frame.text.append(QLatin1Char('"'));
+        appendEscaped(value);
+        m_frame.text.append(QLatin1Char('"'));
+    }
+    return *this;
+}
+
+FrameWriter& FrameWriter::beginObject() {
+    if (m_cbor) {
+        m_cbor->startMap();
+    } else {
+        separator();
+        m_frame.text.append(QLatin1Char('{'));
+    }
+    m_first = true;
+    return *this;
+}
+
+FrameWriter& FrameWriter::endObject() {
+    if (m_cbor) {
+        m_cbor->endMap();
+    } else {
+        m_frame.text.append(QLatin1Char('}'));
+    }
+    m_first = false;
+    return *this;
+}
+
+const Frame& FrameWriter::finish() {
+    if (m_cbor) {
+        m_cbor->endMap();
+    } else {
+        m_frame.text.append(QLatin1Char('}'));
+    }
+    return m_frame;
+}
+
+void FrameWriter::key(Wire::Key name) {
+    if (m_cbor) {
+        m_cbor->append(static_cast<quint64>(name));
+        return;
+    }
+    separator();
+    m_frame.text.append(QLatin1Char('"'));
+    m_frame.text.append(Wire::keyName(name));
+    m_frame.text.append(QLatin1String("\":"));
+}
+
+void FrameWriter::separator() {
+    if (!m_first) {
+        m_frame.text.append(QLatin1Char(','));
+    }
+    m_first = false;
+}
+
+void FrameWriter::appendEscaped(const QString& value) {
+    static const char hex[] = "0123456789abcdef";
+
+    for (QChar c : value) {
+        const ushort u = c.unicode();
+        switch (u) {
+        case '"':  m_frame.text.append(QLatin1String("\\\"")); break;
+        case '\\': m_frame.text.append(QLatin1String("\\\\")); break;
+        case '\b': m_frame.text.append(QLatin1String("\\b")); break;
+        case '\f': m_frame.text.append(QLatin1String("\\f")); break;
+        case '\n': m_frame.text.append(QLatin1String("\\n")); break;
+        case '\r': m_frame.text.append(QLatin1String("\\r")); break;
+        case '\t': m_frame.text.append(QLatin1String("\\t")); break;
+        default:
+            if (u < 0x20) {
+                m_frame.text.append(QLatin1String("\\u00"));
+                m_frame.text.append(QLatin1Char(hex[u >> 4]));
+                m_frame.text.append(QLatin1Char(hex[u & 0xF]));
+            } else {
+                m_frame.text.append(c);
+            }
+        }
+    }
+}
+
+namespace Frames {
+
+namespace {
+
+using Wire::Key;
+using Wire::Type;
+
+// One pre-encoded copy per protocol.
+struct CachedFrame {
+    Frame json;
+    Frame binary;
+
+    const Frame& get(WireProtocol protocol) const {
+        return protocol == WireProtocol::Binary ? binary : json;
+    }
+};
+
+CachedFrame encodeBoth(Frame (*build)(WireProtocol)) {
+    return {build(WireProtocol::Json), build(WireProtocol::Binary)};
+}
+
+Frame errorFrame(WireProtocol protocol, const char* message) {
+    Frame frame;
+    FrameWriter(frame, protocol)
+        .field(Key::Type, Type::Error)
+        .field(Key::Message, QLatin1String(message))
+        .finish();
+    return frame;
+}
+
+} // namespace
+
+const Frame& authSuccess(WireProtocol protocol) {
+    static const CachedFrame frame = encodeBoth([](WireProtocol p) {
+        Frame encoded;
+        FrameWriter(encoded, p)
+            .field(Key::Type, Type::AuthResponse)
+            .field(Key::Status, QLatin1String("success"))
+            .field(Key::Message, QLatin1String("Authenticated successfully"))
+            .finish();
+        return encoded;
+    });
+    return frame.get(protocol);
+}
+
+const Frame& messageAck(WireProtocol protocol) {
+    static const CachedFrame frame = encodeBoth([](WireProtocol p) {
+        Frame encoded;
+        FrameWriter(encoded, p)
+            .field(Key::Type, Type::MessageAck)
+            .field(Key::Status, QLatin1String("sent"))
+            .finish();
+        return encoded;
+    });
+    return frame.get(protocol);
+}
+
+const Frame& errorInvalidFrame(WireProtocol protocol) {
+    static const CachedFrame frame = encodeBoth([](WireProtocol p) {
+        return errorFrame(p, p == WireProtocol::Binary ? "Invalid binary frame" : "Invalid JSON format");
+    });
+    return frame.get(protocol);
+}
+
+const Frame& errorNotAuthenticated(WireProtocol protocol) {
+    static const CachedFrame frame = encodeBoth([](WireProtocol p) {
+        return errorFrame(p, "Not authenticated");
+    });
+    return frame.get(protocol);
+}
+
+const Frame& errorUnknownType(WireProtocol protocol) {
+    static const CachedFrame frame = encodeBoth([](WireProtocol p) {
+        return errorFrame(p, "Unknown message type");
+    });
+    return frame.get(protocol);
+}
+
+const Frame& errorStoreFailed(WireProtocol protocol) {
+    static const CachedFrame frame = encodeBoth([](WireProtocol p) {
+        return errorFrame(p, "Failed to store message");
+    });
+    return frame.get(protocol);
+}
+
+const Frame& errorGroupRequired(WireProtocol protocol) {
+    static const CachedFrame frame = encodeBoth([](WireProtocol p) {
+        return errorFrame(p, "Group name required");
+    });
+    return frame.get(protocol);
+}
+
+const Frame& errorNotGroupMember(WireProtocol protocol) {
+    static const CachedFrame frame = encodeBoth([](WireProtocol p) {
+        return errorFrame(p, "Not a member of this group");
+    });
+    return frame.get(protocol);
+}
+
+const Frame& errorSearchQueryRequired(WireProtocol protocol) {
+    static const CachedFrame frame = encodeBoth([](WireProtocol p) {
+        return errorFrame(p, "Search query required");
+    });
+    return frame.get(protocol);
+}
+
+const Frame& errorInvalidUpload(WireProtocol protocol) {
+    static const CachedFrame frame = encodeBoth([](WireProtocol p) {
+        return errorFrame(p, "Invalid upload request");
+    });
+    return frame.get(protocol);
+}
+
+const Frame& errorUploadTooLarge(WireProtocol protocol) {
+    static const CachedFrame frame = encodeBoth([](WireProtocol p) {
+        return errorFrame(p, "Upload too large");
+    });
+    return frame.get(protocol);
+}
+
+} // namespace Frames
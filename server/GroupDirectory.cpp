@@ -0,0 +1,52 @@
+#include "../include/GroupDirectory.h"
+#include <QReadLocker>
+#include <QWriteLocker>
+
+void GroupDirectory::load(const std::vector<std::pair<std::string, std::string>>& members) {
+    QHash<QString, Members> groups;
+    for (const auto& [group, username] : members) {
+        groups[QString::fromStdString(group)].insert(QString::fromStdString(username));
+    }
+
+    QWriteLocker locker(&m_lock);
+    m_groups.clear();
+    for (auto it = groups.begin(); it != groups.end(); ++it) {
+        m_groups.insert(it.key(), std::make_shared<const Members>(std::move(it.value())));
+    }
+}
+
+std::shared_ptr<const GroupDirectory::Members> GroupDirectory::members(const QString& group) const {
+    QReadLocker locker(&m_lock);
+    return m_groups.value(group);
+}
+
+bool GroupDirectory::isMember(const QString& group, const QString& username) const {
+    QReadLocker locker(&m_lock);
+    const auto members = m_groups.value(group);
+    return members && members->contains(username);
+}
+
+bool GroupDirectory::join(const QString& group, const QString& username) {
+    QWriteLocker locker(&m_lock);
+    auto& members = m_groups[group];
+    if (members && members->contains(username)) {
+        return false;
+    }
+    // Copy-on-write: fan-outs still holding the old snapshot are unaffected.
+    auto updated = members ? std::make_shared<Members>(*members) : std::make_shared<Members>();
+    updated->insert(username);
+    members = std::move(updated);
+    return true;
+}
+
+bool GroupDirectory::leave(const QString& group, const QString& username) {
+    QWriteLocker locker(&m_lock);
+    auto it = m_groups.find(group);
+    if (it == m_groups.end() || !it.value()->contains(username)) {
+        return false;
+    }
+    auto updated = std::make_shared<Members>(*it.value());
+    updated->remove(username);
+    it.value() = std::move(updated);
+    return true;
+}
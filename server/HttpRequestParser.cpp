@@ -0,0 +1,122 @@
+#include "../include/HttpRequestParser.h"
+
+namespace {
+
+// Comma-separated header value contains the token (case-insensitive).
+bool hasToken(const QByteArray& value, const char* token) {
+    for (const QByteArray& item : value.split(',')) {
+        if (item.trimmed().compare(token, Qt::CaseInsensitive) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+HttpRequestParser::HttpRequestParser(int maxHeaderBytes)
+    : m_maxHeaderBytes(maxHeaderBytes)
+{
+}
+
+void HttpRequestParser::reset() {
+    m_scanned = 0;
+    m_headerLength = 0;
+    m_method.clear();
+    m_path.clear();
+    m_headers.clear();
+    m_contentLength = 0;
+    m_chunked = false;
+    m_keepAlive = false;
+    m_upgrade = false;
+}
+
+HttpRequestParser::Status HttpRequestParser::parse(const QByteArray& buffered) {
+    if (m_headerLength > 0) {
+        return Status::Complete;
+    }
+
+    // Resume a few bytes back in case the terminator straddles two segments.
+    const int from = qMax(0, m_scanned - 3);
+    const int end = buffered.indexOf("\r\n\r\n", from);
+    if (end < 0) {
+        m_scanned = buffered.size();
+        return m_scanned > m_maxHeaderBytes ? Status::TooLarge : Status::NeedMore;
+    }
+
+    m_scanned = end + 4;
+    if (m_scanned > m_maxHeaderBytes) {
+        return Status::TooLarge;
+    }
+    if (!parseHeaders(buffered.left(end))) {
+        return Status::Malformed;
+    }
+    m_headerLength = m_scanned;
+    return Status::Complete;
+}
+
+QByteArray HttpRequestParser::header(const QByteArray& lowerName) const {
+    for (const auto& header : m_headers) {
+        if (header.first == lowerName) {
+            return header.second;
+        }
+    }
+    return QByteArray();
+}
+
+bool HttpRequestParser::parseHeaders(const QByteArray& head) {
+    const QList<QByteArray> lines = head.split('\n');
+
+    // Request line: METHOD SP request-target SP HTTP/1.x
+    const QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+    if (requestLine.size() != 3 || requestLine[0].isEmpty() || !requestLine[1].startsWith('/')
+        || !requestLine[2].startsWith("HTTP/1.")) {
+        return false;
+    }
+    m_method = requestLine[0];
+    const int query = requestLine[1].indexOf('?');
+    m_path = query >= 0 ? requestLine[1].left(query) : requestLine[1];
+    const bool http11 = requestLine[2] != "HTTP/1.0";
+
+    for (int i = 1; i < lines.size(); ++i) {
+        const QByteArray& line = lines[i];
+        // Obsolete line folding is rejected (RFC 7230 3.2.4).
+        if (line.startsWith(' ') || line.startsWith('\t')) {
+            return false;
+        }
+        const int colon = line.indexOf(':');
+        if (colon <= 0) {
+            return false;
+        }
+        const QByteArray name = line.left(colon);
+        if (name.contains(' ') || name.contains('\t')) {
+            return false;
+        }
+        m_headers.append({name.toLower(), line.mid(colon + 1).trimmed()});
+    }
+
+    // Framing the body two ways (or two lengths) is how requests are
+    // smuggled past a proxy that reads it the other way (RFC 7230 3.3.3).
+    bool hasContentLength = false;
+    for (const auto& [name, value] : m_headers) {
+        if (name == "transfer-encoding") {
+            m_chunked = true;
+        } else if (name == "content-length") {
+            bool ok = false;
+            const qint64 length = value.toLongLong(&ok);
+            if (!ok || length < 0 || (hasContentLength && length != m_contentLength)) {
+                return false;
+            }
+            hasContentLength = true;
+            m_contentLength = length;
+        }
+    }
+    if (m_chunked && hasContentLength) {
+        return false;
+    }
+
+    const QByteArray connection = header("connection");
+    m_keepAlive = http11 ? !hasToken(connection, "close") : hasToken(connection, "keep-alive");
+    m_upgrade = hasToken(header("upgrade"), "websocket");
+    return true;
+}
@@ -0,0 +1,446 @@
+#include "../include/MediaStore.h"
+#include "../include/WireProtocol.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <algorithm>
+#include <iostream>
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr std::chrono::minutes kSweepInterval{1};
+// Read size when re-hashing a partial file that was not open here
+constexpr qint64 kRehashBlock = 1 << 20;
+
+std::string hexKey(const QByteArray& uploadId) {
+    return uploadId.toHex().toStdString();
+}
+
+// One owner per line, hex-encoded so no username can forge a line.
+QByteArray ownerLine(const QString& owner) {
+    return owner.toUtf8().toHex() + '\n';
+}
+
+} // namespace
+
+struct MediaStore::Upload {
+    QString owner;
+    QString receiver;
+    QString mediaType;
+    qint64 size = 0;
+    QByteArray sha256; // declared by the client, may be empty
+    QFile file;
+    QCryptographicHash hash{QCryptographicHash::Sha256};
+    qint64 offset = 0; // bytes on disk and in the hash
+    std::chrono::steady_clock::time_point lastUsed;
+};
+
+MediaStore::MediaStore(const Options& options)
+    : m_options(options)
+{
+    m_options.chunkBytes = std::max(m_options.chunkBytes, 1);
+    m_options.window = std::max(m_options.window, 1);
+}
+
+MediaStore::~MediaStore() {
+    stop();
+}
+
+bool MediaStore::start() {
+    if (m_thread.joinable()) {
+        return true;
+    }
+
+    if (!QDir().mkpath(m_options.root + QStringLiteral("/partial"))) {
+        std::cerr << "Failed to create media directory " << m_options.root.toStdString() << std::endl;
+        return false;
+    }
+
+    m_stopping = false;
+    m_thread = std::thread(&MediaStore::run, this);
+    std::cout << "Media store at " << m_options.root.toStdString() << std::endl;
+    return true;
+}
+
+void MediaStore::stop() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_tasks.clear();
+    }
+    m_wakeup.notify_one();
+    m_thread.join();
+}
+
+void MediaStore::begin(Begin request, Callback done) {
+    post([this, request = std::move(request), done = std::move(done)]() {
+        doBegin(request, done);
+    });
+}
+
+void MediaStore::write(QByteArray uploadId, QString owner, qint64 offset, QByteArray frame, Callback done) {
+    post([this, uploadId = std::move(uploadId), owner = std::move(owner), offset,
+          frame = std::move(frame), done = std::move(done)]() {
+        doWrite(uploadId, owner, offset, frame, done);
+    });
+}
+
+void MediaStore::post(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping || !m_thread.joinable()) {
+            return;
+        }
+        m_tasks.push_back(std::move(task));
+    }
+    m_wakeup.notify_one();
+}
+
+void MediaStore::run() {
+    // The first pass removes partial files that expired while the server was down.
+    auto nextSweep = std::chrono::steady_clock::now();
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait_until(lock, nextSweep, [this] { return m_stopping || !m_tasks.empty(); });
+            if (m_stopping) {
+                break;
+            }
+            if (!m_tasks.empty()) {
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+        }
+
+        if (task) {
+            task();
+        }
+        if (std::chrono::steady_clock::now() >= nextSweep) {
+            sweep();
+            nextSweep = std::chrono::steady_clock::now() + kSweepInterval;
+        }
+    }
+
+    // Closes the files; the partial uploads stay on disk to be resumed.
+    m_uploads.clear();
+}
+
+void MediaStore::doBegin(const Begin& request, const Callback& done) {
+    Result result;
+    result.uploadId = request.uploadId;
+
+    // The owner's own file is not transferred again. Anyone else's hash is
+    // only a claim: the data is required, and dedup happens in finish().
+    if (!request.sha256.isEmpty() && isOwner(request.sha256, request.owner)) {
+        const QFileInfo blob(m_options.root + QLatin1Char('/') + blobPath(request.sha256));
+        if (blob.exists() && blob.size() == request.size) {
+            // A new upload gets an id all the same, to match the reply.
+            if (result.uploadId.isEmpty()) {
+                result.uploadId = newUploadId();
+            }
+            result.status = Result::Status::Complete;
+            result.offset = request.size;
+            result.owner = request.owner;
+            result.receiver = request.receiver;
+            result.mediaType = request.mediaType;
+            result.path = blobPath(request.sha256);
+            result.sha256 = request.sha256;
+            result.deduplicated = true;
+            result.reused = true;
+            done(result);
+            return;
+        }
+    }
+
+    if (!request.uploadId.isEmpty()) {
+        Upload* upload = find(request.uploadId);
+        if (!upload || upload->owner != request.owner) {
+            result.error = "Unknown upload";
+        } else if (upload->offset == upload->size) {
+            // Everything arrived before the last attempt to store it failed.
+            result = finish(request.uploadId, *upload);
+        } else {
+            result.status = Result::Status::Ready;
+            result.offset = upload->offset;
+        }
+        done(result);
+        return;
+    }
+
+    const QByteArray uploadId = newUploadId();
+    auto upload = std::make_unique<Upload>();
+    upload->owner = request.owner;
+    upload->receiver = request.receiver;
+    upload->mediaType = request.mediaType;
+    upload->size = request.size;
+    upload->sha256 = request.sha256;
+    upload->lastUsed = std::chrono::steady_clock::now();
+
+    // What a resume on another node (or after a restart) needs to know.
+    const QJsonObject description{
+        {QStringLiteral("owner"), request.owner},
+        {QStringLiteral("receiver"), request.receiver},
+        {QStringLiteral("media_type"), request.mediaType},
+        {QStringLiteral("size"), request.size},
+        {QStringLiteral("sha256"), QString::fromLatin1(request.sha256.toHex())},
+    };
+    QFile meta(partialPath(uploadId, ".meta"));
+    upload->file.setFileName(partialPath(uploadId, ".part"));
+    if (!meta.open(QIODevice::WriteOnly)
+        || meta.write(QJsonDocument(description).toJson(QJsonDocument::Compact)) < 0
+        || !upload->file.open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
+        std::cerr << "Failed to create upload in " << m_options.root.toStdString() << std::endl;
+        meta.close();
+        QFile::remove(meta.fileName());
+        result.error = "Failed to store upload";
+        done(result);
+        return;
+    }
+
+    m_uploads.emplace(hexKey(uploadId), std::move(upload));
+    result.status = Result::Status::Ready;
+    result.uploadId = uploadId;
+    done(result);
+}
+
+void MediaStore::doWrite(const QByteArray& uploadId, const QString& owner, qint64 offset,
+                         const QByteArray& frame, const Callback& done) {
+    Result result;
+    result.uploadId = uploadId;
+
+    Upload* upload = find(uploadId);
+    if (!upload || upload->owner != owner) {
+        result.error = "Unknown upload";
+        done(result);
+        return;
+    }
+
+    // A repeated chunk, or one sent after a lost one: tell where to continue.
+    if (offset != upload->offset) {
+        result.status = Result::Status::Progress;
+        result.offset = upload->offset;
+        done(result);
+        return;
+    }
+
+    const char* data = frame.constData() + Wire::kUploadChunkHeaderBytes;
+    const qint64 length = frame.size() - Wire::kUploadChunkHeaderBytes;
+    if (length > upload->size - upload->offset) {
+        discard(uploadId);
+        result.error = "Upload exceeds declared size";
+        done(result);
+        return;
+    }
+
+    // Unbuffered: the chunk goes to the file and is dropped with the frame.
+    if (upload->file.write(data, length) != length) {
+        std::cerr << "Failed to write upload: " << upload->file.errorString().toStdString() << std::endl;
+        discard(uploadId);
+        result.error = "Failed to store upload";
+        done(result);
+        return;
+    }
+    upload->hash.addData(QByteArray::fromRawData(data, static_cast<int>(length)));
+    upload->offset += length;
+
+    if (upload->offset < upload->size) {
+        result.status = Result::Status::Progress;
+        result.offset = upload->offset;
+        done(result);
+        return;
+    }
+    done(finish(uploadId, *upload));
+}
+
+MediaStore::Upload* MediaStore::find(const QByteArray& uploadId) {
+    if (uploadId.size() != Wire::kUploadIdBytes) {
+        return nullptr;
+    }
+    const auto it = m_uploads.find(hexKey(uploadId));
+    if (it != m_uploads.end()) {
+        it->second->lastUsed = std::chrono::steady_clock::now();
+        return it->second.get();
+    }
+
+    // Not open here: started before a restart, closed while idle, or begun
+    // on another node sharing the directory.
+    QFile meta(partialPath(uploadId, ".meta"));
+    if (!meta.open(QIODevice::ReadOnly)) {
+        return nullptr;
+    }
+    const QJsonObject description = QJsonDocument::fromJson(meta.readAll()).object();
+
+    auto upload = std::make_unique<Upload>();
+    upload->owner = description.value(QStringLiteral("owner")).toString();
+    upload->receiver = description.value(QStringLiteral("receiver")).toString();
+    upload->mediaType = description.value(QStringLiteral("media_type")).toString();
+    upload->size = description.value(QStringLiteral("size")).toVariant().toLongLong();
+    upload->sha256 = QByteArray::fromHex(description.value(QStringLiteral("sha256")).toString().toLatin1());
+    upload->file.setFileName(partialPath(uploadId, ".part"));
+    if (upload->owner.isEmpty() || upload->size <= 0
+        || !upload->file.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        return nullptr;
+    }
+
+    // The hash state is not saved with the file: hash what is on disk again,
+    // a block at a time. A tail past the declared size is cut off.
+    const qint64 available = std::min(upload->file.size(), upload->size);
+    while (upload->offset < available) {
+        const QByteArray block = upload->file.read(std::min(kRehashBlock, available - upload->offset));
+        if (block.isEmpty()) {
+            return nullptr;
+        }
+        upload->hash.addData(block);
+        upload->offset += block.size();
+    }
+    if (upload->file.size() > available) {
+        upload->file.resize(available);
+    }
+    upload->file.seek(available);
+    upload->lastUsed = std::chrono::steady_clock::now();
+
+    Upload* found = upload.get();
+    m_uploads.emplace(hexKey(uploadId), std::move(upload));
+    return found;
+}
+
+MediaStore::Result MediaStore::finish(const QByteArray& uploadId, Upload& upload) {
+    Result result;
+    result.uploadId = uploadId;
+
+    const QByteArray sha256 = upload.hash.result();
+    if (!upload.sha256.isEmpty() && upload.sha256 != sha256) {
+        discard(uploadId);
+        result.error = "Upload hash mismatch";
+        return result;
+    }
+
+#ifdef Q_OS_UNIX
+    // On disk before the media row that points at it is committed.
+    ::fsync(upload.file.handle());
+#endif
+    upload.file.close();
+
+    // Stored under its hash: the same content from any sender is kept once.
+    const QString path = blobPath(sha256);
+    const QString target = m_options.root + QLatin1Char('/') + path;
+    const QString partial = partialPath(uploadId, ".part");
+    bool deduplicated = QFileInfo::exists(target);
+    if (!deduplicated) {
+        QDir().mkpath(QFileInfo(target).path());
+        if (!QFile::rename(partial, target)) {
+            // Another node may have stored the same content meanwhile.
+            if (!QFileInfo::exists(target)) {
+                std::cerr << "Failed to store upload as " << target.toStdString() << std::endl;
+                discard(uploadId);
+                result.error = "Failed to store upload";
+                return result;
+            }
+            deduplicated = true;
+        }
+    }
+
+    addOwner(sha256, upload.owner);
+
+    result.status = Result::Status::Complete;
+    result.offset = upload.size;
+    result.owner = upload.owner;
+    result.receiver = upload.receiver;
+    result.mediaType = upload.mediaType;
+    result.path = path;
+    result.sha256 = sha256;
+    result.deduplicated = deduplicated;
+
+    discard(uploadId); // the partial is gone unless the content was already stored
+    return result;
+}
+
+void MediaStore::discard(const QByteArray& uploadId) {
+    m_uploads.erase(hexKey(uploadId));
+    QFile::remove(partialPath(uploadId, ".part"));
+    QFile::remove(partialPath(uploadId, ".meta"));
+}
+
+bool MediaStore::isOwner(const QByteArray& sha256, const QString& owner) const {
+    QFile owners(m_options.root + QLatin1Char('/') + blobPath(sha256) + QStringLiteral(".owners"));
+    if (!owners.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QByteArray line = ownerLine(owner);
+    while (!owners.atEnd()) {
+        if (owners.readLine() == line) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void MediaStore::addOwner(const QByteArray& sha256, const QString& owner) {
+    if (isOwner(sha256, owner)) {
+        return;
+    }
+    // Appends are whole lines, so nodes sharing the directory can add concurrently.
+    QFile owners(m_options.root + QLatin1Char('/') + blobPath(sha256) + QStringLiteral(".owners"));
+    if (!owners.open(QIODevice::Append | QIODevice::Unbuffered) || owners.write(ownerLine(owner)) < 0) {
+        std::cerr << "Failed to record owner of " << owners.fileName().toStdString() << std::endl;
+    }
+}
+
+QByteArray MediaStore::newUploadId() {
+    QByteArray uploadId(Wire::kUploadIdBytes, Qt::Uninitialized);
+    QRandomGenerator::system()->fillRange(reinterpret_cast<quint32*>(uploadId.data()),
+                                          Wire::kUploadIdBytes / sizeof(quint32));
+    return uploadId;
+}
+
+void MediaStore::sweep() {
+    // Idle uploads release their file; a later chunk reopens it from disk.
+    const auto now = std::chrono::steady_clock::now();
+    for (auto it = m_uploads.begin(); it != m_uploads.end();) {
+        if (now - it->second->lastUsed >= m_options.idleClose) {
+            it = m_uploads.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Uploads nobody has written to for partialTtl are abandoned.
+    const QDateTime expired = QDateTime::currentDateTimeUtc().addSecs(
+        -std::chrono::duration_cast<std::chrono::seconds>(m_options.partialTtl).count());
+    const QDir partials(m_options.root + QStringLiteral("/partial"));
+    const QFileInfoList files = partials.entryInfoList({QStringLiteral("*.part"), QStringLiteral("*.meta")},
+                                                       QDir::Files);
+    for (const QFileInfo& file : files) {
+        // A description is as old as its upload; the data file's age is what counts.
+        if (file.suffix() == QLatin1String("meta")
+            && QFileInfo::exists(partials.filePath(file.completeBaseName() + QStringLiteral(".part")))) {
+            continue;
+        }
+        if (file.lastModified() < expired) {
+            discard(QByteArray::fromHex(file.completeBaseName().toLatin1()));
+        }
+    }
+}
+
+QString MediaStore::blobPath(const QByteArray& sha256) const {
+    const QString hex = QString::fromLatin1(sha256.toHex());
+    return hex.left(2) + QLatin1Char('/') + hex;
+}
+
+QString MediaStore::partialPath(const QByteArray& uploadId, const char* suffix) const {
+    return m_options.root + QStringLiteral("/partial/") + QString::fromLatin1(uploadId.toHex())
+        + QLatin1String(suffix);
+}
@@ -0,0 +1,344 @@
+#include "../include/Metrics.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+constexpr const char* kRequestTypeNames[] = {"auth", "message", "history", "search", "ping", "group", "other"};
+
+constexpr double kNanosecondsToSeconds = 1e-9;
+
+void appendNumber(std::string& out, double value) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+    out += buffer;
+}
+
+void appendHeader(std::string& out, const char* name, const char* type, const char* help) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+void appendSample(std::string& out, const char* name, const std::string& labels, double value) {
+    out += name;
+    if (!labels.empty()) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+    appendNumber(out, value);
+    out += '\n';
+}
+
+// Cumulative _bucket lines plus _sum and _count; scale converts recorded units
+// (nanoseconds) to the exposed ones (seconds).
+void appendHistogram(std::string& out, const char* name, const std::string& labels,
+                     const std::vector<std::uint64_t>& bounds, const Histogram::Snapshot& snapshot,
+                     double scale) {
+    const std::string bucketName = std::string(name) + "_bucket";
+    const std::string prefix = labels.empty() ? std::string() : labels + ",";
+    std::uint64_t cumulative = 0;
+    for (std::size_t i = 0; i < snapshot.buckets.size(); ++i) {
+        cumulative += snapshot.buckets[i];
+        std::string le;
+        if (i < bounds.size()) {
+            appendNumber(le, static_cast<double>(bounds[i]) * scale);
+        } else {
+            le = "+Inf";
+        }
+        appendSample(out, bucketName.c_str(), prefix + "le=\"" + le + "\"", static_cast<double>(cumulative));
+    }
+    appendSample(out, (std::string(name) + "_sum").c_str(), labels, static_cast<double>(snapshot.sum) * scale);
+    appendSample(out, (std::string(name) + "_count").c_str(), labels, static_cast<double>(snapshot.count));
+}
+
+Histogram::Snapshot emptySnapshot(const Histogram& histogram) {
+    Histogram::Snapshot snapshot;
+    snapshot.buckets.assign(histogram.bounds().size() + 1, 0);
+    return snapshot;
+}
+
+} // namespace
+
+Histogram::Histogram(std::vector<std::uint64_t> bounds)
+    : m_bounds(std::move(bounds))
+    , m_buckets(std::make_unique<std::atomic<std::uint64_t>[]>(m_bounds.size() + 1))
+{
+}
+
+void Histogram::observe(std::uint64_t value) {
+    const auto bucket = std::lower_bound(m_bounds.begin(), m_bounds.end(), value) - m_bounds.begin();
+    m_buckets[static_cast<std::size_t>(bucket)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+void Histogram::addTo(Snapshot& snapshot) const {
+    snapshot.buckets.resize(m_bounds.size() + 1, 0);
+    for (std::size_t i = 0; i <= m_bounds.size(); ++i) {
+        snapshot.buckets[i] += m_buckets[i].load(std::memory_order_relaxed);
+    }
+    snapshot.count += m_count.load(std::memory_order_relaxed);
+    snapshot.sum += m_sum.load(std::memory_order_relaxed);
+}
+
+std::vector<std::uint64_t> Histogram::latencyBounds() {
+    constexpr std::uint64_t us = 1000;
+    constexpr std::uint64_t ms = 1000 * us;
+    return {10 * us, 25 * us, 50 * us, 100 * us, 250 * us, 500 * us,
+            1 * ms, 2500 * us, 5 * ms, 10 * ms, 25 * ms, 50 * ms, 100 * ms, 250 * ms, 500 * ms,
+            1000 * ms, 2500 * ms};
+}
+
+std::vector<std::uint64_t> Histogram::sizeBounds() {
+    return {64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536, 131072, 262144, 1048576};
+}
+
+std::vector<std::uint64_t> Histogram::fanoutBounds() {
+    return {1, 2, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000};
+}
+
+ShardMetrics::ShardMetrics()
+    : requests{Histogram(Histogram::latencyBounds()), Histogram(Histogram::latencyBounds()),
+               Histogram(Histogram::latencyBounds()), Histogram(Histogram::latencyBounds()),
+               Histogram(Histogram::latencyBounds()), Histogram(Histogram::latencyBounds()),
+               Histogram(Histogram::latencyBounds())}
+    , outboundFrameBytes(Histogram::sizeBounds())
+    , eventLoopLag(Histogram::latencyBounds())
+    , groupFanoutRecipients(Histogram::fanoutBounds())
+{
+}
+
+Metrics& Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::Metrics()
+    : dbSaveMessage(Histogram::latencyBounds())
+    , dbGetMessages(Histogram::latencyBounds())
+    , dbUserExists(Histogram::latencyBounds())
+    , dbSearchMessages(Histogram::latencyBounds())
+    , presenceBatchChanges(Histogram::fanoutBounds())
+    , clusterBatchRecords(Histogram::fanoutBounds())
+{
+}
+
+void Metrics::attach(const ShardMetrics* shard) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_shards.push_back(shard);
+}
+
+void Metrics::detach(const ShardMetrics* shard) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_shards.erase(std::remove(m_shards.begin(), m_shards.end(), shard), m_shards.end());
+}
+
+std::string Metrics::render() const {
+    std::string out;
+    out.reserve(16384);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Requests by type, summed over shards.
+    appendHeader(out, "connect_request_duration_seconds", "histogram",
+                 "Time spent in handleMessage per request type.");
+    const std::vector<std::uint64_t> latencyBounds = Histogram::latencyBounds();
+    for (int type = 0; type < ShardMetrics::RequestTypeCount; ++type) {
+        Histogram::Snapshot snapshot;
+        snapshot.buckets.assign(latencyBounds.size() + 1, 0);
+        for (const ShardMetrics* shard : m_shards) {
+            shard->requests[type].addTo(snapshot);
+        }
+        appendHistogram(out, "connect_request_duration_seconds",
+                        std::string("type=\"") + kRequestTypeNames[type] + "\"", latencyBounds, snapshot,
+                        kNanosecondsToSeconds);
+    }
+
+    // Database operations.
+    appendHeader(out, "connect_db_operation_duration_seconds", "histogram",
+                 "SQLite operation latency.");
+    const std::pair<const char*, const Histogram*> dbOperations[] = {
+        {"saveMessage", &dbSaveMessage},
+        {"getMessages", &dbGetMessages},
+        {"userExists", &dbUserExists},
+        {"searchMessages", &dbSearchMessages},
+    };
+    for (const auto& [operation, histogram] : dbOperations) {
+        Histogram::Snapshot snapshot = emptySnapshot(*histogram);
+        histogram->addTo(snapshot);
+        appendHistogram(out, "connect_db_operation_duration_seconds",
+                        std::string("operation=\"") + operation + "\"", histogram->bounds(), snapshot,
+                        kNanosecondsToSeconds);
+    }
+
+    // Outbound traffic and connections, summed over shards.
+    const std::vector<std::uint64_t> sizeBounds = Histogram::sizeBounds();
+    Histogram::Snapshot frameBytes;
+    Histogram::Snapshot lag;
+    Histogram::Snapshot fanout;
+    const std::vector<std::uint64_t> fanoutBounds = Histogram::fanoutBounds();
+    frameBytes.buckets.assign(sizeBounds.size() + 1, 0);
+    lag.buckets.assign(latencyBounds.size() + 1, 0);
+    fanout.buckets.assign(fanoutBounds.size() + 1, 0);
+    std::uint64_t wireBytes = 0;
+    std::uint64_t invalidFrames = 0;
+    std::uint64_t accepted = 0;
+    std::int64_t tcp = 0;
+    std::int64_t webSockets = 0;
+    std::int64_t users = 0;
+    std::int64_t queuedBytes = 0;
+    std::int64_t congested = 0;
+    std::uint64_t dropped = 0;
+    std::uint64_t slowConsumers = 0;
+    std::uint64_t presenceFrames = 0;
+    std::uint64_t rateLimitedConnection = 0;
+    std::uint64_t rateLimitedUser = 0;
+    std::uint64_t heartbeatPings = 0;
+    std::uint64_t idleDisconnects = 0;
+    std::uint64_t uploadBytes = 0;
+    std::uint64_t uploadsStored = 0;
+    std::uint64_t uploadsDeduplicated = 0;
+    for (const ShardMetrics* shard : m_shards) {
+        shard->outboundFrameBytes.addTo(frameBytes);
+        shard->eventLoopLag.addTo(lag);
+        shard->groupFanoutRecipients.addTo(fanout);
+        wireBytes += shard->outboundWireBytes.load(std::memory_order_relaxed);
+        invalidFrames += shard->invalidFrames.load(std::memory_order_relaxed);
+        accepted += shard->connectionsAccepted.load(std::memory_order_relaxed);
+        tcp += shard->tcpConnections.load(std::memory_order_relaxed);
+        webSockets += shard->webSocketConnections.load(std::memory_order_relaxed);
+        users += shard->authenticatedUsers.load(std::memory_order_relaxed);
+        queuedBytes += shard->outboundQueuedBytes.load(std::memory_order_relaxed);
+        congested += shard->congestedConnections.load(std::memory_order_relaxed);
+        dropped += shard->droppedFrames.load(std::memory_order_relaxed);
+        slowConsumers += shard->slowConsumerDisconnects.load(std::memory_order_relaxed);
+        presenceFrames += shard->presenceFrames.load(std::memory_order_relaxed);
+        rateLimitedConnection += shard->rateLimitedConnection.load(std::memory_order_relaxed);
+        rateLimitedUser += shard->rateLimitedUser.load(std::memory_order_relaxed);
+        heartbeatPings += shard->heartbeatPings.load(std::memory_order_relaxed);
+        idleDisconnects += shard->idleDisconnects.load(std::memory_order_relaxed);
+        uploadBytes += shard->uploadBytes.load(std::memory_order_relaxed);
+        uploadsStored += shard->uploadsStored.load(std::memory_order_relaxed);
+        uploadsDeduplicated += shard->uploadsDeduplicated.load(std::memory_order_relaxed);
+    }
+
+    appendHeader(out, "connect_outbound_frame_bytes", "histogram",
+                 "Size of outbound WebSocket frames before compression.");
+    appendHistogram(out, "connect_outbound_frame_bytes", std::string(), sizeBounds, frameBytes, 1.0);
+
+    appendHeader(out, "connect_outbound_wire_bytes_total", "counter",
+                 "Outbound WebSocket payload bytes after compression.");
+    appendSample(out, "connect_outbound_wire_bytes_total", std::string(), static_cast<double>(wireBytes));
+
+    appendHeader(out, "connect_invalid_frames_total", "counter", "Inbound frames that failed to decode.");
+    appendSample(out, "connect_invalid_frames_total", std::string(), static_cast<double>(invalidFrames));
+
+    appendHeader(out, "connect_connections_accepted_total", "counter", "TCP connections accepted.");
+    appendSample(out, "connect_connections_accepted_total", std::string(), static_cast<double>(accepted));
+
+    appendHeader(out, "connect_tcp_connections", "gauge", "Open TCP connections (HTTP and WebSocket).");
+    appendSample(out, "connect_tcp_connections", std::string(), static_cast<double>(tcp));
+
+    appendHeader(out, "connect_websocket_connections", "gauge", "Open WebSocket connections.");
+    appendSample(out, "connect_websocket_connections", std::string(), static_cast<double>(webSockets));
+
+    appendHeader(out, "connect_authenticated_users", "gauge", "Authenticated WebSocket sessions.");
+    appendSample(out, "connect_authenticated_users", std::string(), static_cast<double>(users));
+
+    appendHeader(out, "connect_outbound_queued_bytes", "gauge",
+                 "Outbound bytes not yet written to the network, including paused history pages.");
+    appendSample(out, "connect_outbound_queued_bytes", std::string(), static_cast<double>(queuedBytes));
+
+    appendHeader(out, "connect_congested_connections", "gauge",
+                 "Connections above the outbound high watermark.");
+    appendSample(out, "connect_congested_connections", std::string(), static_cast<double>(congested));
+
+    appendHeader(out, "connect_outbound_dropped_frames_total", "counter",
+                 "Ephemeral frames dropped for congested connections.");
+    appendSample(out, "connect_outbound_dropped_frames_total", std::string(), static_cast<double>(dropped));
+
+    appendHeader(out, "connect_slow_consumer_disconnects_total", "counter",
+                 "Connections closed for not reading their outbound queue.");
+    appendSample(out, "connect_slow_consumer_disconnects_total", std::string(), static_cast<double>(slowConsumers));
+
+    appendHeader(out, "connect_rate_limited_total", "counter",
+                 "Inbound frames rejected by a token bucket, by scope.");
+    appendSample(out, "connect_rate_limited_total", "scope=\"connection\"", static_cast<double>(rateLimitedConnection));
+    appendSample(out, "connect_rate_limited_total", "scope=\"user\"", static_cast<double>(rateLimitedUser));
+
+    appendHeader(out, "connect_heartbeat_pings_total", "counter",
+                 "WebSocket pings sent to connections that went quiet.");
+    appendSample(out, "connect_heartbeat_pings_total", std::string(), static_cast<double>(heartbeatPings));
+
+    appendHeader(out, "connect_idle_disconnects_total", "counter",
+                 "Connections closed for not answering a heartbeat ping.");
+    appendSample(out, "connect_idle_disconnects_total", std::string(), static_cast<double>(idleDisconnects));
+
+    appendHeader(out, "connect_upload_bytes_total", "counter",
+                 "Media upload chunk bytes handed to the store for writing.");
+    appendSample(out, "connect_upload_bytes_total", std::string(), static_cast<double>(uploadBytes));
+
+    appendHeader(out, "connect_uploads_total", "counter",
+                 "Completed media uploads, by whether the content was already stored.");
+    appendSample(out, "connect_uploads_total", "result=\"stored\"", static_cast<double>(uploadsStored));
+    appendSample(out, "connect_uploads_total", "result=\"deduplicated\"", static_cast<double>(uploadsDeduplicated));
+
+    appendHeader(out, "connect_event_loop_lag_seconds", "histogram",
+                 "How late the per-shard probe timer fires.");
+    appendHistogram(out, "connect_event_loop_lag_seconds", std::string(), latencyBounds, lag,
+                    kNanosecondsToSeconds);
+
+    appendHeader(out, "connect_group_fanout_recipients", "histogram",
+                 "Online members a group message is delivered to.");
+    appendHistogram(out, "connect_group_fanout_recipients", std::string(), fanoutBounds, fanout, 1.0);
+
+    appendHeader(out, "connect_presence_frames_total", "counter", "Presence snapshots and diffs sent to clients.");
+    appendSample(out, "connect_presence_frames_total", std::string(), static_cast<double>(presenceFrames));
+
+    appendHeader(out, "connect_presence_batch_changes", "histogram",
+                 "Users whose presence changed within one coalescing window.");
+    {
+        Histogram::Snapshot batch = emptySnapshot(presenceBatchChanges);
+        presenceBatchChanges.addTo(batch);
+        appendHistogram(out, "connect_presence_batch_changes", std::string(), presenceBatchChanges.bounds(), batch, 1.0);
+    }
+
+    // Cluster bus (zero when the server runs standalone).
+    appendHeader(out, "connect_cluster_broker_connected", "gauge", "1 while the cluster broker link is up.");
+    appendSample(out, "connect_cluster_broker_connected", std::string(),
+                 static_cast<double>(clusterBrokerConnected.load(std::memory_order_relaxed)));
+
+    appendHeader(out, "connect_cluster_remote_users", "gauge", "Users online on other cluster nodes.");
+    appendSample(out, "connect_cluster_remote_users", std::string(),
+                 static_cast<double>(clusterRemoteUsers.load(std::memory_order_relaxed)));
+
+    appendHeader(out, "connect_cluster_forwarded_total", "counter",
+                 "Frames forwarded over the bus, by direction.");
+    appendSample(out, "connect_cluster_forwarded_total", "direction=\"out\"",
+                 static_cast<double>(clusterForwarded.load(std::memory_order_relaxed)));
+    appendSample(out, "connect_cluster_forwarded_total", "direction=\"in\"",
+                 static_cast<double>(clusterReceived.load(std::memory_order_relaxed)));
+
+    appendHeader(out, "connect_cluster_dropped_total", "counter",
+                 "Bus records dropped while the broker link was down.");
+    appendSample(out, "connect_cluster_dropped_total", std::string(),
+                 static_cast<double>(clusterDropped.load(std::memory_order_relaxed)));
+
+    appendHeader(out, "connect_cluster_batch_records", "histogram", "Bus records coalesced into one write.");
+    {
+        Histogram::Snapshot batch = emptySnapshot(clusterBatchRecords);
+        clusterBatchRecords.addTo(batch);
+        appendHistogram(out, "connect_cluster_batch_records", std::string(), clusterBatchRecords.bounds(), batch, 1.0);
+    }
+
+    return out;
+}
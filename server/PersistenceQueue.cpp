@@ -0,0 +1,287 @@
+#include "../include/PersistenceQueue.h"
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+
+PersistenceQueue::PersistenceQueue(const std::string& dbPath, const Options& options)
+    : m_options(options)
+    , m_database(std::make_unique<Database>(dbPath))
+{
+    m_options.maxBatchSize = std::max<std::size_t>(m_options.maxBatchSize, 1);
+    m_options.searchIndexBatch = std::max(m_options.searchIndexBatch, 1);
+    m_options.maxAttempts = std::max(m_options.maxAttempts, 1);
+}
+
+PersistenceQueue::~PersistenceQueue() {
+    stop();
+}
+
+bool PersistenceQueue::start() {
+    if (m_thread.joinable()) {
+        return true;
+    }
+
+    // The writer thread owns the only read-write connection; the event loop never touches it.
+    if (!m_database->initialize()) {
+        std::cerr << "Failed to initialize persistence writer database" << std::endl;
+        return false;
+    }
+
+    m_stopping = false;
+    m_thread = std::thread(&PersistenceQueue::run, this);
+    return true;
+}
+
+void PersistenceQueue::stop() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wakeup.notify_one();
+    m_thread.join();
+}
+
+void PersistenceQueue::enqueue(Message message, CommitCallback onCommitted) {
+    Entry entry;
+    entry.kind = Entry::Kind::SaveMessage;
+    entry.message = std::move(message);
+    entry.onCommitted = std::move(onCommitted);
+    push(std::move(entry));
+}
+
+void PersistenceQueue::enqueueUser(std::string username, CommitCallback onCommitted) {
+    Entry entry;
+    entry.kind = Entry::Kind::EnsureUser;
+    entry.username = std::move(username);
+    entry.onCommitted = std::move(onCommitted);
+    push(std::move(entry));
+}
+
+void PersistenceQueue::enqueueMarkDelivered(std::string receiver, long long upToId) {
+    Entry entry;
+    entry.kind = Entry::Kind::MarkDelivered;
+    entry.username = std::move(receiver);
+    entry.upToId = upToId;
+    push(std::move(entry));
+}
+
+void PersistenceQueue::enqueueMarkMessageDelivered(std::string receiver, std::string sender, long long timestamp) {
+    Entry entry;
+    entry.kind = Entry::Kind::MarkMessageDelivered;
+    entry.message.receiver = std::move(receiver);
+    entry.message.sender = std::move(sender);
+    entry.message.timestamp = timestamp;
+    push(std::move(entry));
+}
+
+void PersistenceQueue::enqueueGroupMessage(Message message, CommitCallback onCommitted) {
+    Entry entry;
+    entry.kind = Entry::Kind::SaveGroupMessage;
+    entry.message = std::move(message);
+    entry.onCommitted = std::move(onCommitted);
+    push(std::move(entry));
+}
+
+void PersistenceQueue::enqueueGroupMembership(std::string group, std::string username, bool join) {
+    Entry entry;
+    entry.kind = join ? Entry::Kind::JoinGroup : Entry::Kind::LeaveGroup;
+    entry.group = std::move(group);
+    entry.username = std::move(username);
+    push(std::move(entry));
+}
+
+void PersistenceQueue::enqueueMedia(Media media, CommitCallback onCommitted) {
+    Entry entry;
+    entry.kind = Entry::Kind::SaveMedia;
+    entry.media = std::move(media);
+    entry.onCommitted = std::move(onCommitted);
+    push(std::move(entry));
+}
+
+void PersistenceQueue::push(Entry entry) {
+    std::size_t pending = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_thread.joinable() || m_stopping) {
+            std::cerr << "Persistence queue is not running, write dropped" << std::endl;
+            if (entry.onCommitted) {
+                entry.onCommitted(false);
+            }
+            return;
+        }
+        m_pending.push_back(std::move(entry));
+        pending = m_pending.size();
+    }
+
+    // Wake the writer for the first entry of a batch and once a batch is full.
+    if (pending == 1 || pending >= m_options.maxBatchSize) {
+        m_wakeup.notify_one();
+    }
+}
+
+void PersistenceQueue::run() {
+    std::vector<Entry> batch;
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_wakeup.wait(lock, [this] { return m_stopping || !m_pending.empty() || m_indexBacklog; });
+        if (m_pending.empty()) {
+            if (m_stopping) {
+                return; // what is left is indexed after the next start
+            }
+            // Idle: catch up with the search index one slice at a time,
+            // checking for new writes in between.
+            lock.unlock();
+            indexMessages();
+            lock.lock();
+            continue;
+        }
+
+        // Give other senders a few milliseconds to join the same transaction.
+        const auto deadline = std::chrono::steady_clock::now() + m_options.maxBatchDelay;
+        m_wakeup.wait_until(lock, deadline, [this] {
+            return m_stopping || m_pending.size() >= m_options.maxBatchSize;
+        });
+
+        if (m_pending.size() <= m_options.maxBatchSize) {
+            batch.swap(m_pending);
+        } else {
+            auto last = m_pending.begin() + static_cast<std::ptrdiff_t>(m_options.maxBatchSize);
+            batch.assign(std::make_move_iterator(m_pending.begin()), std::make_move_iterator(last));
+            m_pending.erase(m_pending.begin(), last);
+        }
+
+        lock.unlock();
+        flush(batch);
+        batch.clear();
+        // Under sustained load the queue never drains: index once enough
+        // has piled up, so search does not fall behind without bound.
+        if (m_unindexed >= m_options.searchIndexBatch) {
+            indexMessages();
+        }
+        lock.lock();
+    }
+}
+
+void PersistenceQueue::indexMessages() {
+    // Acks went out with the flush, so this never delays a sender.
+    const int indexed = m_database->indexMessages(m_options.searchIndexBatch);
+    m_indexBacklog = indexed == m_options.searchIndexBatch;
+    m_unindexed = indexed < 0 ? 0 : std::max(0, m_unindexed - indexed);
+}
+
+void PersistenceQueue::flush(std::vector<Entry>& batch) {
+    // The fast path is one plain transaction. A failed entry costs a second
+    // pass with a savepoint per entry, so it alone is left out; a busy or
+    // failed BEGIN/COMMIT is retried with backoff rather than dropped.
+    std::vector<char> ok(batch.size(), 1);
+    bool isolated = false;
+    auto backoff = m_options.retryBackoff;
+    Outcome outcome = Outcome::TransactionFailed;
+    for (int attempt = 1;; ) {
+        outcome = write(batch, ok, isolated);
+        if (outcome == Outcome::Committed) {
+            break;
+        }
+        if (outcome == Outcome::EntryFailed) {
+            isolated = true;
+            continue;
+        }
+        if (attempt++ >= m_options.maxAttempts) {
+            break;
+        }
+        std::cerr << "Retrying batch of " << batch.size() << " writes in " << backoff.count() << " ms" << std::endl;
+        std::this_thread::sleep_for(backoff);
+        backoff *= 2;
+    }
+
+    const bool committed = outcome == Outcome::Committed;
+    if (!committed) {
+        std::cerr << "Failed to persist batch of " << batch.size() << " writes" << std::endl;
+    }
+
+    int saved = 0;
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        const bool written = committed && ok[i];
+        if (written && batch[i].kind == Entry::Kind::SaveMessage) {
+            ++saved;
+        }
+        if (batch[i].onCommitted) {
+            batch[i].onCommitted(written);
+        }
+    }
+    if (saved > 0) {
+        m_unindexed += saved;
+        m_indexBacklog = true;
+    }
+}
+
+PersistenceQueue::Outcome PersistenceQueue::write(const std::vector<Entry>& batch, std::vector<char>& ok,
+                                                  bool isolated) {
+    if (!m_database->beginTransaction()) {
+        return Outcome::TransactionFailed;
+    }
+
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        if (!ok[i]) {
+            continue;
+        }
+        if (!isolated) {
+            if (!apply(batch[i])) {
+                ok[i] = 0;
+                m_database->rollbackTransaction();
+                return Outcome::EntryFailed;
+            }
+            continue;
+        }
+        if (!m_database->savepoint()) {
+            m_database->rollbackTransaction();
+            return Outcome::TransactionFailed;
+        }
+        if (apply(batch[i])) {
+            if (!m_database->releaseSavepoint()) {
+                m_database->rollbackTransaction();
+                return Outcome::TransactionFailed;
+            }
+        } else {
+            ok[i] = 0;
+            m_database->rollbackToSavepoint();
+        }
+    }
+
+    if (!m_database->commitTransaction()) {
+        m_database->rollbackTransaction();
+        return Outcome::TransactionFailed;
+    }
+    return Outcome::Committed;
+}
+
+bool PersistenceQueue::apply(const Entry& entry) {
+    const auto& msg = entry.message;
+    switch (entry.kind) {
+    case Entry::Kind::SaveMessage:
+        return m_database->saveMessage(msg.sender, msg.receiver, msg.text, msg.messageType,
+                                       msg.mediaPath, msg.delivered, msg.timestamp);
+    case Entry::Kind::EnsureUser:
+        return m_database->ensureUser(entry.username);
+    case Entry::Kind::MarkDelivered:
+        return m_database->markDelivered(entry.username, entry.upToId);
+    case Entry::Kind::MarkMessageDelivered:
+        return m_database->markMessageDelivered(msg.receiver, msg.sender, msg.timestamp);
+    case Entry::Kind::SaveGroupMessage:
+        return m_database->saveGroupMessage(msg.receiver, msg.sender, msg.text, msg.messageType,
+                                            msg.mediaPath, msg.timestamp);
+    case Entry::Kind::JoinGroup:
+        return m_database->addGroupMember(entry.group, entry.username);
+    case Entry::Kind::LeaveGroup:
+        return m_database->removeGroupMember(entry.group, entry.username);
+    case Entry::Kind::SaveMedia:
+        return m_database->saveMedia(entry.media.sender, entry.media.receiver, entry.media.path,
+                                     entry.media.type);
+    }
+    return false;
+}
@@ -0,0 +1,87 @@
+#include "../include/PresenceHub.h"
+#include "../include/ClusterLink.h"
+#include "../include/ConnectionShard.h"
+#include "../include/Metrics.h"
+#include <QMutexLocker>
+#include <QTimer>
+#include <memory>
+
+PresenceHub::PresenceHub(RoutingTable& routing, std::chrono::milliseconds window, QObject* parent)
+    : QObject(parent)
+    , m_routing(routing)
+    , m_window(window)
+{
+}
+
+void PresenceHub::start(const QVector<ConnectionShard*>& shards) {
+    m_shards = shards;
+}
+
+void PresenceHub::stop() {
+    m_shards.clear();
+    QMutexLocker locker(&m_mutex);
+    m_dirty.clear();
+}
+
+void PresenceHub::markChanged(const QString& username) {
+    QMutexLocker locker(&m_mutex);
+    m_dirty.insert(username);
+    // The first change opens the window; everything until it closes goes
+    // out in the same batch.
+    if (!m_scheduled) {
+        m_scheduled = true;
+        QMetaObject::invokeMethod(this, [this]() {
+            QTimer::singleShot(m_window, this, [this]() { flush(); });
+        }, Qt::QueuedConnection);
+    }
+}
+
+bool PresenceHub::isOnline(const QString& username) const {
+    if (m_routing.routeFor(username).shard) {
+        return true;
+    }
+    ClusterLink::RemoteRoute remote;
+    return m_cluster && m_cluster->remoteRoute(username, remote);
+}
+
+QSet<QString> PresenceHub::onlineAmong(const QSet<QString>& users) const {
+    QSet<QString> online;
+    for (const auto& route : m_routing.onlineRoutes(users)) {
+        online.insert(route.first);
+    }
+    if (m_cluster) {
+        for (const auto& route : m_cluster->remoteRoutes(users)) {
+            online.insert(route.first);
+        }
+    }
+    return online;
+}
+
+void PresenceHub::flush() {
+    QSet<QString> dirty;
+    {
+        QMutexLocker locker(&m_mutex);
+        dirty.swap(m_dirty);
+        m_scheduled = false;
+    }
+    if (dirty.isEmpty() || m_shards.isEmpty()) {
+        return;
+    }
+
+    // The state at flush time, not the events: a user who dropped and came
+    // back within the window is simply online, and shards then send nothing
+    // to watchers who already saw them online.
+    auto changes = std::make_shared<Changes>();
+    changes->reserve(dirty.size());
+    for (const QString& username : dirty) {
+        changes->insert(username, isOnline(username));
+    }
+    Metrics::instance().presenceBatchChanges.observe(static_cast<std::uint64_t>(changes->size()));
+
+    std::shared_ptr<const Changes> shared = std::move(changes);
+    for (ConnectionShard* shard : m_shards) {
+        QMetaObject::invokeMethod(shard, [shard, shared]() {
+            shard->applyPresence(*shared);
+        }, Qt::QueuedConnection);
+    }
+}
@@ -0,0 +1,84 @@
+#include "../include/ReaderPool.h"
+#include <algorithm>
+#include <iostream>
+
+ReaderPool::ReaderPool(const std::string& dbPath, std::size_t size)
+    : m_dbPath(dbPath)
+    , m_size(std::max<std::size_t>(size, 1))
+{
+}
+
+ReaderPool::~ReaderPool() {
+    stop();
+}
+
+bool ReaderPool::start() {
+    if (!m_threads.empty()) {
+        return true;
+    }
+
+    for (std::size_t i = 0; i < m_size; ++i) {
+        auto db = std::make_unique<Database>(m_dbPath, Database::OpenMode::ReadOnly);
+        if (!db->initialize()) {
+            std::cerr << "Failed to open reader connection " << i << std::endl;
+            m_connections.clear();
+            return false;
+        }
+        m_connections.push_back(std::move(db));
+    }
+
+    m_stopping = false;
+    for (auto& db : m_connections) {
+        m_threads.emplace_back(&ReaderPool::run, this, std::ref(*db));
+    }
+
+    std::cout << "Reader pool started with " << m_size << " connections" << std::endl;
+    return true;
+}
+
+void ReaderPool::stop() {
+    if (m_threads.empty()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_tasks.clear();
+    }
+    m_wakeup.notify_all();
+
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+    m_threads.clear();
+    m_connections.clear();
+}
+
+void ReaderPool::submit(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping || m_threads.empty()) {
+            return;
+        }
+        m_tasks.push_back(std::move(task));
+    }
+    m_wakeup.notify_one();
+}
+
+void ReaderPool::run(Database& db) {
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+            if (m_stopping) {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+
+        task(db);
+    }
+}
@@ -0,0 +1,66 @@
+#include "../include/RoutingTable.h"
+#include <QReadLocker>
+#include <QWriteLocker>
+
+void RoutingTable::setListener(Listener listener) {
+    QWriteLocker locker(&m_lock);
+    m_listener = std::move(listener);
+}
+
+void RoutingTable::registerUser(const QString& username, ConnectionShard* shard, WireProtocol protocol) {
+    QWriteLocker locker(&m_lock);
+    m_users.insert(username, Route{shard, protocol});
+    if (m_listener) {
+        m_listener(username, true, protocol);
+    }
+}
+
+void RoutingTable::unregisterUser(const QString& username, ConnectionShard* shard) {
+    QWriteLocker locker(&m_lock);
+    auto it = m_users.find(username);
+    if (it != m_users.end() && it.value().shard == shard) {
+        const WireProtocol protocol = it.value().protocol;
+        m_users.erase(it);
+        if (m_listener) {
+            m_listener(username, false, protocol);
+        }
+    }
+}
+
+RoutingTable::Route RoutingTable::routeFor(const QString& username) const {
+    QReadLocker locker(&m_lock);
+    return m_users.value(username);
+}
+
+std::vector<std::pair<QString, RoutingTable::Route>> RoutingTable::onlineRoutes(const QSet<QString>& users) const {
+    std::vector<std::pair<QString, Route>> routes;
+    QReadLocker locker(&m_lock);
+    // Iterate the smaller side: a large group with few users online, or the reverse.
+    if (users.size() <= m_users.size()) {
+        for (const QString& username : users) {
+            auto it = m_users.constFind(username);
+            if (it != m_users.cend()) {
+                routes.emplace_back(username, it.value());
+            }
+        }
+    } else {
+        for (auto it = m_users.cbegin(); it != m_users.cend(); ++it) {
+            if (users.contains(it.key())) {
+                routes.emplace_back(it.key(), it.value());
+            }
+        }
+    }
+    return routes;
+}
+
+int RoutingTable::size() const {
+    QReadLocker locker(&m_lock);
+    return m_users.size();
+}
+
+void RoutingTable::forEach(const std::function<void(const QString&, const Route&)>& visit) const {
+    QReadLocker locker(&m_lock);
+    for (auto it = m_users.cbegin(); it != m_users.cend(); ++it) {
+        visit(it.key(), it.value());
+    }
+}
@@ -0,0 +1,197 @@
+#include "../include/StaticAssetCache.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#include <iostream>
+
+namespace {
+
+QByteArray gzipCompress(const QByteArray& data) {
+    z_stream zs{};
+    // windowBits + 16 = gzip header and trailer instead of zlib's.
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return QByteArray();
+    }
+
+    QByteArray out;
+    out.resize(static_cast<int>(deflateBound(&zs, static_cast<uLong>(data.size()))) + 32);
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    zs.avail_in = static_cast<uInt>(data.size());
+    zs.next_out = reinterpret_cast<Bytef*>(out.data());
+    zs.avail_out = static_cast<uInt>(out.size());
+
+    const int rc = deflate(&zs, Z_FINISH);
+    out.resize(static_cast<int>(zs.total_out));
+    deflateEnd(&zs);
+    return rc == Z_STREAM_END ? out : QByteArray();
+}
+
+QByteArray brotliCompress(const QByteArray& data) {
+#ifdef HAVE_BROTLI
+    QByteArray out;
+    std::size_t size = BrotliEncoderMaxCompressedSize(static_cast<std::size_t>(data.size()));
+    out.resize(static_cast<int>(size));
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                               static_cast<std::size_t>(data.size()),
+                               reinterpret_cast<const uint8_t*>(data.constData()),
+                               &size, reinterpret_cast<uint8_t*>(out.data()))) {
+        return QByteArray();
+    }
+    out.resize(static_cast<int>(size));
+    return out;
+#else
+    Q_UNUSED(data)
+    return QByteArray();
+#endif
+}
+
+// Compressed variants are only kept when they actually save bytes.
+StaticAssetCache::Variant makeVariant(QByteArray body, const QByteArray& identity, const QByteArray& etag) {
+    StaticAssetCache::Variant variant;
+    if (!body.isEmpty() && body.size() < identity.size()) {
+        variant.body = std::move(body);
+        variant.etag = etag;
+    }
+    return variant;
+}
+
+// Accept-Encoding token with q=0 means "not acceptable".
+bool accepts(const QByteArray& acceptEncoding, const QByteArray& coding) {
+    for (const QByteArray& item : acceptEncoding.split(',')) {
+        const QList<QByteArray> parts = item.split(';');
+        if (parts.first().trimmed().toLower() != coding) {
+            continue;
+        }
+        for (int i = 1; i < parts.size(); ++i) {
+            const QByteArray param = parts[i].trimmed();
+            if (param.startsWith("q=") && param.mid(2).toDouble() <= 0.0) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+StaticAssetCache::Encoding StaticAssetCache::Asset::negotiate(const QByteArray& acceptEncoding) const {
+    if (!variant(Encoding::Brotli).body.isEmpty() && accepts(acceptEncoding, "br")) {
+        return Encoding::Brotli;
+    }
+    if (!variant(Encoding::Gzip).body.isEmpty() && accepts(acceptEncoding, "gzip")) {
+        return Encoding::Gzip;
+    }
+    return Encoding::Identity;
+}
+
+bool StaticAssetCache::Asset::matches(const QByteArray& ifNoneMatch) const {
+    for (QByteArray tag : ifNoneMatch.split(',')) {
+        tag = tag.trimmed();
+        if (tag == "*") {
+            return true;
+        }
+        // If-None-Match uses weak comparison.
+        if (tag.startsWith("W/")) {
+            tag = tag.mid(2);
+        }
+        for (const Variant& v : variants) {
+            if (!v.etag.isEmpty() && v.etag == tag) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+StaticAssetCache::StaticAssetCache(QObject* parent)
+    : QObject(parent)
+{
+    connect(&m_watcher, &QFileSystemWatcher::fileChanged, this, &StaticAssetCache::onFileChanged);
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, &StaticAssetCache::onDirectoryChanged);
+}
+
+void StaticAssetCache::addFile(const QString& filePath, const QStringList& urlPaths, const QByteArray& contentType) {
+    const QFileInfo info(filePath);
+    const QString path = info.absoluteFilePath();
+    m_contentTypes.insert(path, contentType);
+
+    {
+        QWriteLocker locker(&m_lock);
+        for (const QString& url : urlPaths) {
+            m_filesByUrl.insert(url, path);
+        }
+    }
+
+    // The directory is watched too: editors and deploys replace the file,
+    // which drops it from the file watch.
+    m_watcher.addPath(info.absolutePath());
+    if (info.exists()) {
+        m_watcher.addPath(path);
+    }
+    load(path);
+}
+
+std::shared_ptr<const StaticAssetCache::Asset> StaticAssetCache::find(const QString& urlPath) const {
+    QReadLocker locker(&m_lock);
+    const auto file = m_filesByUrl.constFind(urlPath);
+    if (file == m_filesByUrl.cend()) {
+        return nullptr;
+    }
+    return m_assets.value(file.value());
+}
+
+void StaticAssetCache::onFileChanged(const QString& path) {
+    if (QFileInfo::exists(path) && !m_watcher.files().contains(path)) {
+        m_watcher.addPath(path);
+    }
+    load(path);
+}
+
+void StaticAssetCache::onDirectoryChanged(const QString& path) {
+    for (auto it = m_contentTypes.cbegin(); it != m_contentTypes.cend(); ++it) {
+        const QFileInfo info(it.key());
+        if (info.absolutePath() != path) {
+            continue;
+        }
+        const qint64 modified = info.exists() ? info.lastModified().toMSecsSinceEpoch() : -1;
+        if (modified != m_modified.value(it.key(), -1)) {
+            onFileChanged(it.key());
+        }
+    }
+}
+
+void StaticAssetCache::load(const QString& filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        m_modified.remove(filePath);
+        QWriteLocker locker(&m_lock);
+        m_assets.remove(filePath);
+        return;
+    }
+
+    auto asset = std::make_shared<Asset>();
+    asset->contentType = m_contentTypes.value(filePath);
+    const QByteArray identity = file.readAll();
+    m_modified.insert(filePath, QFileInfo(file).lastModified().toMSecsSinceEpoch());
+
+    // One strong tag per representation: "<hash>", "<hash>-gz", "<hash>-br".
+    const QByteArray hash = QCryptographicHash::hash(identity, QCryptographicHash::Sha1).toHex().left(20);
+    asset->variants[static_cast<int>(Encoding::Gzip)] = makeVariant(gzipCompress(identity), identity, '"' + hash + "-gz\"");
+    asset->variants[static_cast<int>(Encoding::Brotli)] = makeVariant(brotliCompress(identity), identity, '"' + hash + "-br\"");
+    asset->variants[static_cast<int>(Encoding::Identity)] = Variant{identity, '"' + hash + '"'};
+
+    std::cout << "Loaded static asset " << filePath.toStdString() << " (" << identity.size() << " bytes, gzip "
+              << asset->variant(Encoding::Gzip).body.size() << ", br "
+              << asset->variant(Encoding::Brotli).body.size() << ")" << std::endl;
+
+    QWriteLocker locker(&m_lock);
+    m_assets.insert(filePath, std::move(asset));
+}
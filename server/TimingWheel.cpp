@@ -0,0 +1,116 @@
+#include "../include/TimingWheel.h"
+
+void TimingWheel::Node::unlink() {
+    if (!next) {
+        return;
+    }
+    prev->next = next;
+    next->prev = prev;
+    prev = nullptr;
+    next = nullptr;
+}
+
+TimingWheel::List::List() {
+    m_head.prev = &m_head;
+    m_head.next = &m_head;
+}
+
+TimingWheel::List::~List() {
+    // Nodes outlive the list (they belong to their owners): just detach them.
+    while (popFront()) {
+    }
+    m_head.prev = nullptr;
+    m_head.next = nullptr;
+}
+
+TimingWheel::Node* TimingWheel::List::popFront() {
+    if (empty()) {
+        return nullptr;
+    }
+    Node* node = m_head.next;
+    node->unlink();
+    return node;
+}
+
+void TimingWheel::List::append(Node& node) {
+    node.prev = m_head.prev;
+    node.next = &m_head;
+    m_head.prev->next = &node;
+    m_head.prev = &node;
+}
+
+void TimingWheel::List::splice(List& other) {
+    if (other.empty()) {
+        return;
+    }
+    Node* first = other.m_head.next;
+    Node* last = other.m_head.prev;
+    first->prev = m_head.prev;
+    m_head.prev->next = first;
+    last->next = &m_head;
+    m_head.prev = last;
+    other.m_head.prev = &other.m_head;
+    other.m_head.next = &other.m_head;
+}
+
+TimingWheel::TimingWheel(std::uint64_t now)
+    : m_next(now)
+{
+}
+
+void TimingWheel::schedule(Node& node, std::uint64_t expires) {
+    node.unlink();
+    node.expires = expires;
+    insert(node);
+}
+
+void TimingWheel::insert(Node& node) {
+    // The level is picked by distance from the next tick, the slot by the
+    // expiry's own bits, so a node always lands in a slot that is reached
+    // (directly or by cascading) exactly when it is due.
+    std::uint64_t expires = node.expires;
+    if (expires < m_next) {
+        expires = m_next;
+    }
+    std::uint64_t delta = expires - m_next;
+    // Further than the top level reaches: parked at its far end and
+    // re-placed when that slot cascades.
+    constexpr std::uint64_t kRange = std::uint64_t(1) << (kBits * kLevels);
+    if (delta >= kRange) {
+        delta = kRange - 1;
+        expires = m_next + delta;
+    }
+
+    int level = 0;
+    while (level < kLevels - 1 && delta >= (std::uint64_t(1) << (kBits * (level + 1)))) {
+        ++level;
+    }
+    m_slots[level][(expires >> (kBits * level)) & kMask].append(node);
+}
+
+void TimingWheel::cascade(int level, std::uint64_t index) {
+    List pending;
+    pending.splice(m_slots[level][index]);
+    while (Node* node = pending.popFront()) {
+        insert(*node);
+    }
+}
+
+void TimingWheel::advance(std::uint64_t now, List& expired) {
+    while (m_next <= now) {
+        // Entering a new lap of a level pulls the matching slot of the level
+        // above down; only every 64^k-th tick touches level k.
+        const std::uint64_t index = m_next & kMask;
+        if (index == 0) {
+            for (int level = 1; level < kLevels; ++level) {
+                const std::uint64_t upper = (m_next >> (kBits * level)) & kMask;
+                cascade(level, upper);
+                if (upper != 0) {
+                    break;
+                }
+            }
+        }
+        expired.splice(m_slots[0][index]);
+        ++m_next;
+    }
+}
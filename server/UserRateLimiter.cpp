@@ -0,0 +1,46 @@
+#include "../include/UserRateLimiter.h"
+#include <QMutexLocker>
+#include <algorithm>
+
+namespace {
+constexpr int kMinSweepSize = 1024;
+}
+
+UserRateLimiter::UserRateLimiter(const RateLimits& limits)
+    : m_message(limits.userMessage)
+    , m_history(limits.userHistory)
+{
+    m_clock.start();
+    for (Stripe& stripe : m_stripes) {
+        stripe.sweepAt = kMinSweepSize;
+    }
+}
+
+bool UserRateLimiter::take(const QString& username, bool history, quint32& retryAfterMs) {
+    const RateLimit& limit = history ? m_history : m_message;
+    if (!limit.enabled()) {
+        return true;
+    }
+    Stripe& stripe = m_stripes[qHash(username) % m_stripes.size()];
+    QMutexLocker locker(&stripe.mutex);
+    const quint32 now = static_cast<quint32>(m_clock.elapsed());
+    if (stripe.users.size() >= stripe.sweepAt) {
+        sweep(stripe, now);
+    }
+    Buckets& buckets = stripe.users[username];
+    return (history ? buckets.history : buckets.message).take(limit, now, retryAfterMs);
+}
+
+void UserRateLimiter::sweep(Stripe& stripe, quint32 nowMs) {
+    // A full bucket is indistinguishable from a new one, so dropping it
+    // hands nobody extra tokens; drained ones stay until they refill.
+    for (auto it = stripe.users.begin(); it != stripe.users.end();) {
+        if (it->message.full(m_message, nowMs) && it->history.full(m_history, nowMs)) {
+            it = stripe.users.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // Amortised: the next sweep waits until the stripe doubles again.
+    stripe.sweepAt = std::max(kMinSweepSize, static_cast<int>(stripe.users.size()) * 2);
+}
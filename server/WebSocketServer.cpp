@@ -1,23 +1,45 @@
 #include "../include/WebSocketServer.h"
+#include "../include/ConnectionShard.h"
 #include "../include/Database.h"
-#include "../include/Encryption.h"
-#include <QJsonDocument>
-#include <QJsonObject>
-#include <QJsonArray>
-#include <QDateTime>
-#include <QTcpSocket>
-#include <QTcpServer>
 #include <QHostAddress>
-#include <QFile>
+#include <QSysInfo>
+#include <algorithm>
+#include <functional>
 #include <iostream>
 
-WebSocketServer::WebSocketServer(QObject* parent)
+namespace {
+
+// Hands accepted descriptors to a shard instead of creating the QTcpSocket
+// here, so each socket is born in the thread that will serve it.
+class ShardingTcpServer : public QTcpServer {
+public:
+    ShardingTcpServer(std::function<void(qintptr)> dispatch, QObject* parent)
+        : QTcpServer(parent), m_dispatch(std::move(dispatch)) {}
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override {
+        m_dispatch(socketDescriptor);
+    }
+
+private:
+    std::function<void(qintptr)> m_dispatch;
+};
+
+} // namespace
+
+WebSocketServer::WebSocketServer(const ServerConfig& config, QObject* parent)
     : QObject(parent)
-    , m_server(new QWebSocketServer("Connect Messenger", QWebSocketServer::NonSecureMode, this))
-    , m_httpServer(new QTcpServer(this))
+    , m_config(config)
+    , m_httpServer(new ShardingTcpServer([this](qintptr descriptor) { dispatchConnection(descriptor); }, this))
+    , m_persistence(std::make_unique<PersistenceQueue>(config.dbPath.toStdString(), config.persistence))
+    , m_readers(std::make_unique<ReaderPool>(config.dbPath.toStdString(), config.readerThreads))
+    , m_media(std::make_unique<MediaStore>(config.media))
+    , m_presence(m_routing, config.presenceWindow)
+    , m_userRates(config.connections.rateLimits)
 {
-    connect(m_server.get(), &QWebSocketServer::newConnection, this, &WebSocketServer::onNewConnection);
-    connect(m_httpServer.get(), &QTcpServer::newConnection, this, &WebSocketServer::onTcpConnection);
+    m_assets.addFile(config.webClientPath,
+                     {QStringLiteral("/"), QStringLiteral("/index.html"), QStringLiteral("/client")},
+                     "text/html; charset=utf-8");
 }
 
 WebSocketServer::~WebSocketServer() {
@@ -25,284 +47,163 @@ WebSocketServer::~WebSocketServer() {
 }
 
 bool WebSocketServer::start(int port) {
+    // All writes go through the write-behind queue; it owns the only read-write
+    // connection and creates the schema / switches the file to WAL.
+    if (!m_persistence->start()) {
+        std::cerr << "Failed to initialize database" << std::endl;
+        return false;
+    }
+
+    // History and media reads run on read-only connections off the event loop.
+    if (!m_readers->start()) {
+        m_persistence->stop();
+        return false;
+    }
+
+    // Uploads are written and hashed on the media store's thread.
+    if (!m_media->start()) {
+        m_readers->stop();
+        m_persistence->stop();
+        return false;
+    }
+
+    // Group membership lives in memory for the server's lifetime; fan-out
+    // never reads it from the database.
+    {
+        Database database(m_config.dbPath.toStdString(), Database::OpenMode::ReadOnly);
+        if (!database.initialize()) {
+            m_media->stop();
+            m_readers->stop();
+            m_persistence->stop();
+            return false;
+        }
+        m_groups.load(database.getGroupMembers());
+    }
+
     // Start a single TCP server that will handle both WebSocket upgrades and HTTP requests.
+    // Connections are only dispatched once the event loop runs, after the shards exist.
     if (!m_httpServer->listen(QHostAddress::Any, port)) {
         std::cerr << "Failed to start TCP listener: " << m_httpServer->errorString().toStdString() << std::endl;
+        m_media->stop();
+        m_readers->stop();
+        m_persistence->stop();
         return false;
     }
 
+    // Cluster mode: the link announces local users to the broker and forwards
+    // frames for users held by other nodes. Its own thread keeps bus traffic
+    // from queueing behind a busy shard.
+    if (m_config.cluster.broker.valid) {
+        ClusterLink::Options options = m_config.cluster;
+        if (options.nodeId.isEmpty()) {
+            options.nodeId = QStringLiteral("%1:%2").arg(QSysInfo::machineHostName()).arg(port);
+        }
+        m_clusterThread = new QThread(this);
+        m_clusterThread->setObjectName(QStringLiteral("cluster"));
+        m_cluster = new ClusterLink(options, m_routing, m_groups);
+        m_cluster->moveToThread(m_clusterThread);
+        connect(m_clusterThread, &QThread::finished, m_cluster, &QObject::deleteLater);
+
+        // Users of other nodes count as online for presence too.
+        PresenceHub* presence = &m_presence;
+        presence->setCluster(m_cluster);
+        m_cluster->setPresenceListener([presence](const QString& username) {
+            presence->markChanged(username);
+        });
+        m_clusterThread->start();
+        QMetaObject::invokeMethod(m_cluster, [cluster = m_cluster]() { cluster->start(); }, Qt::QueuedConnection);
+        std::cout << "Cluster node " << options.nodeId.toStdString() << ", broker "
+                  << options.broker.toString().toStdString() << std::endl;
+    }
+
+    // Every login and logout feeds the presence batch (and, clustered, the broker).
+    PresenceHub* presence = &m_presence;
+    ClusterLink* cluster = m_cluster;
+    m_routing.setListener([presence, cluster](const QString& username, bool online, WireProtocol protocol) {
+        presence->markChanged(username);
+        if (cluster) {
+            cluster->announcePresence(username, online, protocol);
+        }
+    });
+
+    // One event loop per shard; sockets never migrate between them.
+    const int shardCount = m_config.eventLoopThreads > 0
+        ? m_config.eventLoopThreads
+        : std::max(1, QThread::idealThreadCount());
+    for (int i = 0; i < shardCount; ++i) {
+        QThread* thread = new QThread(this);
+        thread->setObjectName(QStringLiteral("shard-%1").arg(i));
+
+        ConnectionShard* shard = new ConnectionShard(i, *m_persistence, *m_readers, *m_media, m_routing, m_groups,
+                                                      m_userRates, m_cluster, m_presence, m_assets,
+                                                      m_config.connections);
+        shard->moveToThread(thread);
+        connect(thread, &QThread::finished, shard, &QObject::deleteLater);
+
+        thread->start();
+        QMetaObject::invokeMethod(shard, [shard]() { shard->start(); }, Qt::QueuedConnection);
+        m_threads.append(thread);
+        m_shards.append(shard);
+    }
+    m_presence.start(m_shards);
+
     m_running = true;
-    std::cout << "Server listening (WebSocket+HTTP) on port " << port << std::endl;
+    std::cout << "Server listening (WebSocket+HTTP) on port " << port
+              << " with " << shardCount << " event loop threads" << std::endl;
     return true;
 }
 
 void WebSocketServer::stop() {
     if (m_running) {
-        m_server->close();
         m_httpServer->close();
-        m_running = false;
-        std::cout << "Servers stopped" << std::endl;
-    }
-}
-
-bool WebSocketServer::isRunning() const {
-    return m_running;
-}
-
-void WebSocketServer::onNewConnection() {
-    QWebSocket* client = m_server->nextPendingConnection();
-    
-    connect(client, &QWebSocket::textMessageReceived, this, &WebSocketServer::onTextMessageReceived);
-    connect(client, &QWebSocket::disconnected, this, &WebSocketServer::onDisconnected);
-    
-    std::cout << "New WebSocket connection established" << std::endl;
-}
-
-void WebSocketServer::onTcpConnection() {
-    QTcpSocket* socket = m_httpServer->nextPendingConnection();
-
-    // Handle the very first data chunk to decide if this is a plain HTTP request or a WebSocket upgrade.
-    connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
-        if (!socket->bytesAvailable()) {
-            return;
-        }
-
-        // Peek so we do not consume bytes in case we hand over the socket to the WebSocket server.
-        QByteArray data = socket->peek(2048);
-        QString requestStr = QString::fromUtf8(data);
 
-        // Health-check endpoint.
-        if (requestStr.startsWith("GET /health")) {
-            // Consume the request.
-            socket->readAll();
-            QString body = QStringLiteral("{\"status\":\"healthy\",\"online_users\":%1}").arg(m_onlineUsers.size());
-            QByteArray response = "HTTP/1.1 200 OK\r\n"
-                                   "Content-Type: application/json\r\n" +
-                                   QByteArray("Content-Length: ") + QByteArray::number(body.toUtf8().size()) + "\r\n\r\n" +
-                                   body.toUtf8();
-            socket->write(response);
-            socket->disconnectFromHost();
-            return;
+        for (ConnectionShard* shard : m_shards) {
+            QMetaObject::invokeMethod(shard, [shard]() { shard->shutdown(); }, Qt::BlockingQueuedConnection);
         }
 
-        // Serve web client
-        if (requestStr.startsWith("GET / ") || requestStr.startsWith("GET /index.html")) {
-            socket->readAll();
-            
-            // Read web_client.html file
-            QFile file("web_client.html");
-            QByteArray html;
-            if (file.open(QIODevice::ReadOnly)) {
-                html = file.readAll();
-            } else {
-                // Fallback HTML if file not found
-                html = R"(<html><body><h1>Connect Messenger Server</h1><p>Server is running</p><p><a href="/client">Web Client</a></p></body></html>)";
-            }
-            
-            QByteArray response = "HTTP/1.1 200 OK\r\n"
-                                   "Content-Type: text/html\r\n" +
-                                   QByteArray("Content-Length: ") + QByteArray::number(html.size()) + "\r\n\r\n" +
-                                   html;
-            socket->write(response);
-            socket->disconnectFromHost();
-            return;
-        }
-        
-        // Serve web client at /client endpoint
-        if (requestStr.startsWith("GET /client")) {
-            socket->readAll();
-            
-            QFile file("web_client.html");
-            QByteArray html;
-            if (file.open(QIODevice::ReadOnly)) {
-                html = file.readAll();
-            } else {
-                html = "<html><body><h1>Web Client Not Found</h1></body></html>";
-            }
-            
-            QByteArray response = "HTTP/1.1 200 OK\r\n"
-                                   "Content-Type: text/html\r\n" +
-                                   QByteArray("Content-Length: ") + QByteArray::number(html.size()) + "\r\n\r\n" +
-                                   html;
-            socket->write(response);
-            socket->disconnectFromHost();
-            return;
+        // Nobody is left to tell; batches still queued here are dropped.
+        m_presence.stop();
+
+        // Workers post results to the shards, so they stop while the shards still exist.
+        m_media->stop();
+        m_readers->stop();
+        m_persistence->stop();
+
+        // The shards' final unregistrations, and messages forwarded from the
+        // writer's last commits, go out before the link closes.
+        if (m_cluster) {
+            ClusterLink* cluster = m_cluster;
+            QMetaObject::invokeMethod(cluster, [cluster]() { cluster->stop(); }, Qt::BlockingQueuedConnection);
+            m_clusterThread->quit();
+            m_clusterThread->wait();
+            delete m_clusterThread;
+            m_clusterThread = nullptr;
+            m_cluster = nullptr;
         }
+        m_routing.setListener(nullptr);
 
-        // If it contains an Upgrade header assume it is a WebSocket handshake, delegate.
-        if (requestStr.contains("Upgrade: websocket", Qt::CaseInsensitive)) {
-            // Disconnect the lambda to avoid re-entry after handing over.
-            socket->disconnect();
-            m_server->handleConnection(socket);  // QWebSocketServer takes ownership.
-            return;
+        for (QThread* thread : m_threads) {
+            thread->quit();
+            thread->wait();
+            delete thread;
         }
+        m_shards.clear();
+        m_threads.clear();
 
-        // Any other HTTP request -> 404
-        socket->readAll();
-        const QByteArray notFound = "Not Found";
-        QByteArray response = "HTTP/1.1 404 Not Found\r\n"
-                               "Content-Type: text/plain\r\n" +
-                               QByteArray("Content-Length: ") + QByteArray::number(notFound.size()) + "\r\n\r\n" +
-                               notFound;
-        socket->write(response);
-        socket->disconnectFromHost();
-    });
-
-    connect(socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater);
-}
-
-void WebSocketServer::onTextMessageReceived(const QString& message) {
-    QWebSocket* client = qobject_cast<QWebSocket*>(sender());
-    if (client) {
-        handleMessage(client, message);
+        m_running = false;
+        std::cout << "Servers stopped" << std::endl;
     }
 }
 
-void WebSocketServer::onDisconnected() {
-    QWebSocket* client = qobject_cast<QWebSocket*>(sender());
-    if (client) {
-        // Remove user from online list
-        QString username = m_onlineUsers.key(client);
-        if (!username.isEmpty()) {
-            m_onlineUsers.remove(username);
-            std::cout << "User " << username.toStdString() << " disconnected" << std::endl;
-        }
-        client->deleteLater();
-    }
+bool WebSocketServer::isRunning() const {
+    return m_running;
 }
 
-void WebSocketServer::handleMessage(QWebSocket* client, const QString& message) {
-    QJsonDocument doc = QJsonDocument::fromJson(message.toUtf8());
-    if (!doc.isObject()) {
-        QJsonObject error = {
-            {"type", "error"},
-            {"message", "Invalid JSON format"}
-        };
-        sendJsonMessage(client, error);
-        return;
-    }
-    
-    QJsonObject j = doc.object();
-    QString type = j["type"].toString();
-    
-    if (type == "auth") {
-        // Authentication
-        QString username = j["username"].toString();
-        
-        // Save user to database
-        Database db;
-        if (db.initialize()) {
-            if (!db.userExists(username.toStdString())) {
-                db.createUser(username.toStdString());
-            }
-        }
-        
-        m_onlineUsers[username] = client;
-        
-        QJsonObject response = {
-            {"type", "auth_response"},
-            {"status", "success"},
-            {"message", "Authenticated successfully"}
-        };
-        sendJsonMessage(client, response);
-        
-        std::cout << "User " << username.toStdString() << " authenticated" << std::endl;
-    }
-    else if (type == "message") {
-        // Send message
-        QString to = j["to"].toString();
-        QString text = j["text"].toString();
-        
-        // Find sender
-        QString sender = m_onlineUsers.key(client);
-        if (sender.isEmpty()) {
-            QJsonObject error = {
-                {"type", "error"},
-                {"message", "Not authenticated"}
-            };
-            sendJsonMessage(client, error);
-            return;
-        }
-        
-        // Save to database
-        Database db;
-        if (db.initialize()) {
-            db.saveMessage(sender.toStdString(), to.toStdString(), text.toStdString());
-        }
-        
-        // Send to recipient if online
-        if (m_onlineUsers.contains(to)) {
-            QJsonObject messageJson = {
-                {"type", "message"},
-                {"from", sender},
-                {"text", text},
-                {"timestamp", QDateTime::currentSecsSinceEpoch()}
-            };
-            sendJsonMessage(m_onlineUsers[to], messageJson);
-        }
-        
-        // Acknowledgment to sender
-        QJsonObject ack = {
-            {"type", "message_ack"},
-            {"status", "sent"}
-        };
-        sendJsonMessage(client, ack);
-    }
-    else if (type == "history") {
-        // Request message history
-        QString with = j["with"].toString();
-        QString currentUser = m_onlineUsers.key(client);
-        
-        if (currentUser.isEmpty()) {
-            QJsonObject error = {
-                {"type", "error"},
-                {"message", "Not authenticated"}
-            };
-            sendJsonMessage(client, error);
-            return;
-        }
-        
-        Database db;
-        if (db.initialize()) {
-            auto messages = db.getMessages(currentUser.toStdString(), with.toStdString());
-            QJsonObject history = {
-                {"type", "history"},
-                {"with", with}
-            };
-            
-            QJsonArray messagesArray;
-            for (const auto& msg : messages) {
-                QJsonObject messageObj = {
-                    {"id", msg.id},
-                    {"sender", QString::fromStdString(msg.sender)},
-                    {"text", QString::fromStdString(msg.text)},
-                    {"timestamp", QString::fromStdString(msg.timestamp)}
-                };
-                messagesArray.append(messageObj);
-            }
-            history["messages"] = messagesArray;
-            
-            sendJsonMessage(client, history);
-        }
-    }
-    else if (type == "ping") {
-        // Pong for connection check
-        QJsonObject pong = {
-            {"type", "pong"},
-            {"timestamp", QDateTime::currentSecsSinceEpoch()}
-        };
-        sendJsonMessage(client, pong);
-    }
-    else {
-        QJsonObject error = {
-            {"type", "error"},
-            {"message", "Unknown message type"}
-        };
-        sendJsonMessage(client, error);
-    }
-}
+void WebSocketServer::dispatchConnection(qintptr socketDescriptor) {
+    ConnectionShard* shard = m_shards[m_nextShard];
+    m_nextShard = (m_nextShard + 1) % m_shards.size();
 
-void WebSocketServer::sendJsonMessage(QWebSocket* client, const QJsonObject& message) {
-    QJsonDocument doc(message);
-    client->sendTextMessage(doc.toJson());
+    QMetaObject::invokeMethod(shard, [shard, socketDescriptor]() {
+        shard->addConnection(socketDescriptor);
+    }, Qt::QueuedConnection);
 } 
\ No newline at end of file
@@ -0,0 +1,155 @@
+#include "../include/WireProtocol.h"
+#include <QCborStreamReader>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QVariant>
+#include <climits>
+
+namespace {
+
+QJsonValue jsonField(const QJsonObject& object, Wire::Key key) {
+    return object.value(Wire::keyName(key));
+}
+
+bool readString(QCborStreamReader& reader, QString& out) {
+    if (!reader.isString()) {
+        return false;
+    }
+    out.clear();
+    auto chunk = reader.readString();
+    while (chunk.status == QCborStreamReader::Ok) {
+        out += chunk.data;
+        chunk = reader.readString();
+    }
+    return chunk.status == QCborStreamReader::EndOfString;
+}
+
+bool isDeflate(const QString& compression) {
+    return compression == QLatin1String("deflate");
+}
+
+bool readInteger(QCborStreamReader& reader, qint64& out) {
+    if (!reader.isInteger()) {
+        return false;
+    }
+    out = reader.toInteger();
+    return reader.next();
+}
+
+} // namespace
+
+bool decodeRequest(const QString& json, Request& request) {
+    const QJsonDocument doc = QJsonDocument::fromJson(json.toUtf8());
+    if (!doc.isObject()) {
+        return false;
+    }
+
+    const QJsonObject j = doc.object();
+    request.type = Wire::typeFromName(jsonField(j, Wire::Key::Type).toString());
+    request.username = jsonField(j, Wire::Key::Username).toString();
+    request.to = jsonField(j, Wire::Key::To).toString();
+    request.text = jsonField(j, Wire::Key::Text).toString();
+    request.with = jsonField(j, Wire::Key::With).toString();
+    request.group = jsonField(j, Wire::Key::Group).toString();
+    request.beforeId = jsonField(j, Wire::Key::BeforeId).toVariant().toLongLong();
+    request.afterId = jsonField(j, Wire::Key::AfterId).toVariant().toLongLong();
+    request.limit = jsonField(j, Wire::Key::Limit).toInt(0);
+    request.offset = qMax(0, jsonField(j, Wire::Key::Offset).toInt(0));
+    request.deflate = isDeflate(jsonField(j, Wire::Key::Compression).toString());
+    request.uploadId = jsonField(j, Wire::Key::UploadId).toString();
+    request.sha256 = jsonField(j, Wire::Key::Sha256).toString();
+    request.mediaType = jsonField(j, Wire::Key::MediaType).toString();
+    request.size = jsonField(j, Wire::Key::Size).toVariant().toLongLong();
+    return true;
+}
+
+bool decodeRequest(const QByteArray& cbor, Request& request) {
+    QCborStreamReader reader(cbor);
+    if (!reader.isMap() || !reader.enterContainer()) {
+        return false;
+    }
+
+    while (reader.hasNext()) {
+        if (!reader.isUnsignedInteger()) {
+            return false;
+        }
+        const quint64 code = reader.toUnsignedInteger();
+        if (!reader.next()) {
+            return false;
+        }
+
+        // Unknown keys are skipped so newer clients can talk to this server.
+        Wire::Key key;
+        if (!Wire::keyFromCode(code, key)) {
+            if (!reader.next()) {
+                return false;
+            }
+            continue;
+        }
+
+        bool ok = true;
+        qint64 number = 0;
+        switch (key) {
+        case Wire::Key::Type:
+            ok = readInteger(reader, number);
+            request.type = Wire::typeFromCode(static_cast<quint64>(number));
+            break;
+        case Wire::Key::Username:
+            ok = readString(reader, request.username);
+            break;
+        case Wire::Key::To:
+            ok = readString(reader, request.to);
+            break;
+        case Wire::Key::Text:
+            ok = readString(reader, request.text);
+            break;
+        case Wire::Key::With:
+            ok = readString(reader, request.with);
+            break;
+        case Wire::Key::Group:
+            ok = readString(reader, request.group);
+            break;
+        case Wire::Key::BeforeId:
+            ok = readInteger(reader, request.beforeId);
+            break;
+        case Wire::Key::AfterId:
+            ok = readInteger(reader, request.afterId);
+            break;
+        case Wire::Key::Limit:
+            ok = readInteger(reader, number);
+            request.limit = static_cast<int>(qBound<qint64>(0, number, INT_MAX));
+            break;
+        case Wire::Key::Offset:
+            ok = readInteger(reader, number);
+            request.offset = static_cast<int>(qBound<qint64>(0, number, INT_MAX));
+            break;
+        case Wire::Key::UploadId:
+            ok = readString(reader, request.uploadId);
+            break;
+        case Wire::Key::Sha256:
+            ok = readString(reader, request.sha256);
+            break;
+        case Wire::Key::MediaType:
+            ok = readString(reader, request.mediaType);
+            break;
+        case Wire::Key::Size:
+            ok = readInteger(reader, request.size);
+            break;
+        case Wire::Key::Compression: {
+            QString compression;
+            ok = readString(reader, compression);
+            request.deflate = isDeflate(compression);
+            break;
+        }
+        default:
+            ok = reader.next();
+            break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return reader.lastError() == QCborError::NoError && reader.leaveContainer();
+}
@@ -41,24 +41,24 @@ void ContactListWidget::addContact(const QString& contact) {
     // Проверяем, есть ли уже такой контакт
     for (int i = 0; i < m_contactList->count(); ++i) {
         QListWidgetItem* item = m_contactList->item(i);
-        if (item->text() == contact) {
+        if (item->data(Qt::UserRole).toString() == contact) {
             return; // Контакт уже существует
         }
     }
     
+    // Текст элемента меняется вместе со статусом, имя хранится отдельно
     QListWidgetItem* item = new QListWidgetItem(contact);
+    item->setData(Qt::UserRole, contact);
     item->setIcon(QIcon(":/icons/user.png")); // Можно добавить иконку
     m_contactList->addItem(item);
     
-    // Устанавливаем статус онлайн по умолчанию
-    m_onlineStatus[contact] = true;
-    updateContactDisplay(contact, true);
+    // Статус приходит от сервера (presence); до него — без отметки
 }
 
 void ContactListWidget::removeContact(const QString& contact) {
     for (int i = 0; i < m_contactList->count(); ++i) {
         QListWidgetItem* item = m_contactList->item(i);
-        if (item->text() == contact) {
+        if (item->data(Qt::UserRole).toString() == contact) {
             delete m_contactList->takeItem(i);
             m_onlineStatus.remove(contact);
             break;
@@ -78,20 +78,20 @@ void ContactListWidget::setOnlineStatus(const QString& contact, bool online) {
 
 void ContactListWidget::onContactClicked(QListWidgetItem* item) {
     if (item) {
-        emit contactSelected(item->text());
+        emit contactSelected(item->data(Qt::UserRole).toString());
     }
 }
 
 void ContactListWidget::onContactDoubleClicked(QListWidgetItem* item) {
     if (item) {
-        emit contactDoubleClicked(item->text());
+        emit contactDoubleClicked(item->data(Qt::UserRole).toString());
     }
 }
 
 void ContactListWidget::onSearchTextChanged(const QString& text) {
     for (int i = 0; i < m_contactList->count(); ++i) {
         QListWidgetItem* item = m_contactList->item(i);
-        bool visible = item->text().contains(text, Qt::CaseInsensitive);
+        bool visible = item->data(Qt::UserRole).toString().contains(text, Qt::CaseInsensitive);
         item->setHidden(!visible);
     }
 }
@@ -99,7 +99,7 @@ void ContactListWidget::onSearchTextChanged(const QString& text) {
 void ContactListWidget::updateContactDisplay(const QString& contact, bool online) {
     for (int i = 0; i < m_contactList->count(); ++i) {
         QListWidgetItem* item = m_contactList->item(i);
-        if (item->text() == contact) {
+        if (item->data(Qt::UserRole).toString() == contact) {
             QString displayText = contact;
             if (online) {
                 displayText += " ●"; // Зеленая точка для онлайн
@@ -1,12 +1,19 @@
 #include "MessengerClient.h"
 #include "ChatWidget.h"
 #include "ContactListWidget.h"
+#include "../../include/Deflate.h"
 #include "../../include/Encryption.h"
+#include "../../include/WireProtocol.h"
 #include <QApplication>
 #include <QMessageBox>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <QCryptographicHash>
+#include <QtEndian>
 #include <QFileInfo>
 #include <QDir>
 #include <QStandardPaths>
@@ -20,6 +27,82 @@
 #include <QLabel>
 #include <QTimer>
 #include <QDateTime>
+#include <QRegularExpression>
+#if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0)
+#include <QWebSocketHandshakeOptions>
+#endif
+
+namespace {
+
+// Запрос клиента -> CBOR-карта с числовыми ключами (Wire::Key)
+QByteArray encodeBinary(const QJsonObject& message) {
+    QCborMap map;
+    for (auto it = message.constBegin(); it != message.constEnd(); ++it) {
+        Wire::Key key;
+        if (!Wire::keyFromName(it.key(), key)) {
+            continue;
+        }
+        if (key == Wire::Key::Type) {
+            map.insert(static_cast<qint64>(key), static_cast<qint64>(Wire::typeFromName(it.value().toString())));
+        } else {
+            map.insert(static_cast<qint64>(key), QCborValue::fromJsonValue(it.value()));
+        }
+    }
+    return map.toCborValue().toCbor();
+}
+
+QJsonValue fromBinary(const QCborValue& value);
+
+// Ответ сервера -> тот же QJsonObject, что и для текстового протокола
+QJsonObject fromBinaryMap(const QCborMap& map) {
+    QJsonObject object;
+    for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
+        Wire::Key key;
+        if (!it.key().isInteger() || !Wire::keyFromCode(static_cast<quint64>(it.key().toInteger()), key)) {
+            continue;
+        }
+        if (key == Wire::Key::Type) {
+            object.insert(Wire::keyName(key), Wire::typeName(Wire::typeFromCode(static_cast<quint64>(it.value().toInteger()))));
+        } else {
+            object.insert(Wire::keyName(key), fromBinary(it.value()));
+        }
+    }
+    return object;
+}
+
+// Тип медиа для upload_begin по расширению файла
+QString mediaTypeOf(const QString& path) {
+    const QString suffix = QFileInfo(path).suffix().toLower();
+    static const QStringList photo = {"jpg", "jpeg", "png", "gif", "webp", "heic"};
+    static const QStringList video = {"mp4", "mov", "webm", "mkv", "avi"};
+    static const QStringList voice = {"ogg", "opus", "m4a", "mp3", "wav", "aac"};
+    if (photo.contains(suffix)) {
+        return "photo";
+    }
+    if (video.contains(suffix)) {
+        return "video";
+    }
+    if (voice.contains(suffix)) {
+        return "voice";
+    }
+    return "file";
+}
+
+QJsonValue fromBinary(const QCborValue& value) {
+    if (value.isMap()) {
+        return fromBinaryMap(value.toMap());
+    }
+    if (value.isArray()) {
+        QJsonArray array;
+        for (const QCborValue& item : value.toArray()) {
+            array.append(fromBinary(item));
+        }
+        return array;
+    }
+    return value.toJsonValue();
+}
+
+} // namespace
 
 MessengerClient::MessengerClient(QWidget* parent)
     : QMainWindow(parent)
@@ -110,6 +193,7 @@ void MessengerClient::setupUI() {
     connect(m_loginButton, &QPushButton::clicked, this, &MessengerClient::login);
     connect(m_contactList, &ContactListWidget::contactSelected, this, &MessengerClient::onContactSelected);
     connect(m_chatWidget, &ChatWidget::messageSent, this, &MessengerClient::sendMessage);
+    connect(m_chatWidget, &ChatWidget::fileAttachRequested, this, &MessengerClient::onFileAttachClicked);
 }
 
 void MessengerClient::setupTrayIcon() {
@@ -139,6 +223,7 @@ void MessengerClient::setupWebSocket() {
     connect(m_webSocket, &QWebSocket::connected, this, &MessengerClient::onConnected);
     connect(m_webSocket, &QWebSocket::disconnected, this, &MessengerClient::onDisconnected);
     connect(m_webSocket, &QWebSocket::textMessageReceived, this, &MessengerClient::onMessageReceived);
+    connect(m_webSocket, &QWebSocket::binaryMessageReceived, this, &MessengerClient::onBinaryMessageReceived);
     connect(m_webSocket, QOverload<QAbstractSocket::SocketError>::of(&QWebSocket::error),
             this, &MessengerClient::onError);
 }
@@ -149,7 +234,17 @@ void MessengerClient::connectToServer() {
         serverUrl = "ws://" + serverUrl;
     }
     
+#if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0)
+    if (m_binaryRequested) {
+        QWebSocketHandshakeOptions options;
+        options.setSubprotocols({QString::fromLatin1(Wire::kBinarySubprotocol)});
+        m_webSocket->open(QUrl(serverUrl), options);
+    } else {
+        m_webSocket->open(QUrl(serverUrl));
+    }
+#else
     m_webSocket->open(QUrl(serverUrl));
+#endif
     m_connectButton->setEnabled(false);
     m_connectButton->setText("Connecting...");
 }
@@ -165,12 +260,23 @@ void MessengerClient::login() {
         {"type", "auth"},
         {"username", username}
     };
+    if (m_compressionRequested) {
+        authMessage["compression"] = "deflate";
+    }
     
     sendJsonMessage(authMessage);
 }
 
 void MessengerClient::onConnected() {
     m_connected = true;
+    m_inflater = std::make_unique<MessageInflater>();
+    // Binary only if the server accepted the subprotocol; without negotiation
+    // (Qt < 6.4) the server switches when the first frame is binary.
+#if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0)
+    m_binaryActive = m_webSocket->subprotocol() == QLatin1String(Wire::kBinarySubprotocol);
+#else
+    m_binaryActive = m_binaryRequested;
+#endif
     m_connectButton->setText("Connected");
     m_connectButton->setEnabled(false);
     m_loginButton->setEnabled(true);
@@ -180,7 +286,9 @@ void MessengerClient::onConnected() {
 
 void MessengerClient::onDisconnected() {
     m_connected = false;
+    m_binaryActive = false;
     m_authenticated = false;
+    m_upload.reset(); // resumable from upload_id, but the file is picked again
     m_connectButton->setText("Connect to Server");
     m_connectButton->setEnabled(true);
     m_loginButton->setEnabled(false);
@@ -188,13 +296,50 @@ void MessengerClient::onDisconnected() {
     m_trayIcon->showMessage("Connect Messenger", "Disconnected from server", QSystemTrayIcon::Warning, 2000);
 }
 
+void MessengerClient::setBinaryProtocol(bool enabled) {
+    m_binaryRequested = enabled;
+}
+
+void MessengerClient::setCompression(bool enabled) {
+    m_compressionRequested = enabled;
+}
+
 void MessengerClient::onMessageReceived(const QString& message) {
     QJsonDocument doc = QJsonDocument::fromJson(message.toUtf8());
     if (!doc.isObject()) {
         return;
     }
     
-    QJsonObject j = doc.object();
+    handleIncomingMessage(doc.object());
+}
+
+void MessengerClient::onBinaryMessageReceived(const QByteArray& message) {
+    // Compressed frames carry either protocol; everything else is CBOR.
+    if (message.startsWith(kCompressedFrameMarker)) {
+        QByteArray inflated;
+        if (!m_inflater || !m_inflater->decompress(message.constData() + 1, message.size() - 1, inflated)) {
+            return;
+        }
+        if (!m_binaryActive) {
+            onMessageReceived(QString::fromUtf8(inflated));
+            return;
+        }
+        const QCborValue value = QCborValue::fromCbor(inflated);
+        if (value.isMap()) {
+            handleIncomingMessage(fromBinaryMap(value.toMap()));
+        }
+        return;
+    }
+    
+    const QCborValue value = QCborValue::fromCbor(message);
+    if (!value.isMap()) {
+        return;
+    }
+    
+    handleIncomingMessage(fromBinaryMap(value.toMap()));
+}
+
+void MessengerClient::handleIncomingMessage(const QJsonObject& j) {
     QString type = j["type"].toString();
     
     if (type == "auth_response") {
@@ -203,11 +348,8 @@ void MessengerClient::onMessageReceived(const QString& message) {
             m_loginButton->setText("Logged In");
             m_loginButton->setEnabled(false);
             
-                    // Load contacts (for demo, add some dummy contacts)
-        m_contactList->addContact("Alice");
-        m_contactList->addContact("Bob");
-        m_contactList->addContact("Charlie");
-        
+            // Contacts arrive with the presence snapshot
+            
         // Load settings
         loadSettings();
             
@@ -240,11 +382,59 @@ void MessengerClient::onMessageReceived(const QString& message) {
             QJsonObject messageObj = msg.toObject();
             QString sender = messageObj["sender"].toString();
             QString text = messageObj["text"].toString();
-            qint64 timestamp = messageObj["timestamp"].toString().toLongLong();
+            qint64 timestamp = messageObj["timestamp"].toVariant().toLongLong();
             
             m_chatWidget->addMessage(sender, text, QDateTime::fromSecsSinceEpoch(timestamp));
         }
     }
+    else if (type == "group_message") {
+        // Groups are listed as "#name" next to the contacts
+        const QString contact = "#" + j["group"].toString();
+        QString from = j["from"].toString();
+        QString text = j["text"].toString();
+        m_contactList->addContact(contact);
+        if (m_currentContact == contact) {
+            m_chatWidget->addMessage(from, text, QDateTime::fromSecsSinceEpoch(j["timestamp"].toVariant().toLongLong()));
+        }
+        if (!isActiveWindow()) {
+            m_trayIcon->showMessage(contact + ": " + from, text, QSystemTrayIcon::Information, 3000);
+        }
+    }
+    else if (type == "group_join") {
+        const QString status = j["status"].toString();
+        if (status == "success" || status == "already_member") {
+            m_contactList->addContact("#" + j["group"].toString());
+        }
+    }
+    else if (type == "pending_messages") {
+        // Messages that arrived while we were offline, oldest first
+        QJsonArray messages = j["messages"].toArray();
+        for (const QJsonValue& msg : messages) {
+            QJsonObject messageObj = msg.toObject();
+            QString sender = messageObj["sender"].toString();
+            m_contactList->addContact(sender);
+            if (m_currentContact == sender) {
+                m_chatWidget->addMessage(sender, messageObj["text"].toString(),
+                                         QDateTime::fromSecsSinceEpoch(messageObj["timestamp"].toVariant().toLongLong()));
+            }
+        }
+        if (!messages.isEmpty() && !isActiveWindow()) {
+            m_trayIcon->showMessage("Connect Messenger",
+                                    QString("%1 new messages while offline").arg(messages.size()),
+                                    QSystemTrayIcon::Information, 3000);
+        }
+    }
+    else if (type == "presence") {
+        // Snapshot after auth, then only changes
+        for (const QJsonValue& contact : j["online"].toArray()) {
+            m_contactList->addContact(contact.toString());
+            m_contactList->setOnlineStatus(contact.toString(), true);
+        }
+        for (const QJsonValue& contact : j["offline"].toArray()) {
+            m_contactList->addContact(contact.toString());
+            m_contactList->setOnlineStatus(contact.toString(), false);
+        }
+    }
     else if (type == "message_ack") {
         // Message sent successfully
         // Add own message to chat
@@ -252,6 +442,46 @@ void MessengerClient::onMessageReceived(const QString& message) {
             m_chatWidget->addMessage(m_usernameInput->text(), m_lastSentText, QDateTime::currentDateTime(), true);
         }
     }
+    else if (type == "upload_begin" && m_upload) {
+        // Continue from whatever the server already has
+        m_upload->uploadId = QByteArray::fromHex(j["upload_id"].toString().toLatin1());
+        m_upload->chunkSize = j["chunk_size"].toInt();
+        m_upload->window = qMax(1, j["window"].toInt(1));
+        m_upload->sent = j["offset"].toVariant().toLongLong();
+        m_upload->inFlight = 0;
+        sendUploadChunks();
+    }
+    else if (type == "upload_progress" && m_upload
+             && QByteArray::fromHex(j["upload_id"].toString().toLatin1()) == m_upload->uploadId) {
+        // Once every sent chunk is answered, a lower offset means one was
+        // refused: rewind to it
+        m_upload->inFlight = qMax(0, m_upload->inFlight - 1);
+        const qint64 offset = j["offset"].toVariant().toLongLong();
+        if (m_upload->inFlight == 0 && offset < m_upload->sent) {
+            m_upload->sent = offset;
+        }
+        sendUploadChunks();
+    }
+    else if (type == "upload_complete" && m_upload) {
+        m_chatWidget->addMediaMessage(m_usernameInput->text(), j["path"].toString(), m_upload->type,
+                                      QDateTime::currentDateTime(), true);
+        m_upload.reset();
+    }
+    else if (type == "error" && m_upload && j["status"].toString() == "upload_window") {
+        // Chunk refused, not stored: handled like a lost one
+        m_upload->inFlight = qMax(0, m_upload->inFlight - 1);
+        sendUploadChunks();
+    }
+    else if (type == "error" && m_upload && j.contains("upload_id")) {
+        QMessageBox::warning(this, "Upload Failed", j["message"].toString());
+        m_upload.reset();
+    }
+    else if (type == "error" && j["status"].toString() == "rate_limited") {
+        // The request was dropped; no modal dialog per rejected frame
+        m_trayIcon->showMessage("Connect Messenger",
+                                QString("Sending too fast, retry in %1 ms").arg(j["retry_after_ms"].toVariant().toLongLong()),
+                                QSystemTrayIcon::Warning, 2000);
+    }
     else if (type == "error") {
         QMessageBox::warning(this, "Server Error", j["message"].toString());
     }
@@ -272,24 +502,39 @@ void MessengerClient::onContactSelected(const QString& contact) {
     
     // Request message history
     if (m_authenticated) {
-        QJsonObject historyRequest = {
-            {"type", "history"},
-            {"with", contact}
-        };
+        QJsonObject historyRequest = {{"type", "history"}};
+        if (contact.startsWith('#')) {
+            historyRequest["group"] = contact.mid(1);
+        } else {
+            historyRequest["with"] = contact;
+        }
         sendJsonMessage(historyRequest);
     }
 }
 
 void MessengerClient::sendMessage(const QString& text) {
-    if (!m_authenticated || m_currentContact.isEmpty()) {
+    if (!m_authenticated) {
         return;
     }
     
-    QJsonObject message = {
-        {"type", "message"},
-        {"to", m_currentContact},
-        {"text", text}
-    };
+    // "/join team" and "/leave team" manage group membership
+    static const QRegularExpression groupCommand("^/(join|leave)\\s+(\\S+)$");
+    const QRegularExpressionMatch command = groupCommand.match(text);
+    if (command.hasMatch()) {
+        sendJsonMessage({{"type", "group_" + command.captured(1)}, {"group", command.captured(2)}});
+        return;
+    }
+    
+    if (m_currentContact.isEmpty()) {
+        return;
+    }
+    
+    QJsonObject message;
+    if (m_currentContact.startsWith('#')) {
+        message = {{"type", "group_message"}, {"group", m_currentContact.mid(1)}, {"text", text}};
+    } else {
+        message = {{"type", "message"}, {"to", m_currentContact}, {"text", text}};
+    }
     
     sendJsonMessage(message);
     
@@ -297,8 +542,71 @@ void MessengerClient::sendMessage(const QString& text) {
     m_lastSentText = text;
 }
 
+void MessengerClient::onFileAttachClicked() {
+    if (!m_authenticated || m_upload || m_currentContact.isEmpty() || m_currentContact.startsWith('#')) {
+        return;
+    }
+    const QString path = QFileDialog::getOpenFileName(this, "Send file");
+    if (path.isEmpty()) {
+        return;
+    }
+
+    auto upload = std::make_unique<Upload>();
+    upload->file.setFileName(path);
+    if (!upload->file.open(QIODevice::ReadOnly)) {
+        QMessageBox::warning(this, "Error", "Cannot open " + path);
+        return;
+    }
+    // Hashed from disk before sending: a file the server already has is not
+    // transferred at all
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(&upload->file);
+    upload->file.seek(0);
+    upload->receiver = m_currentContact;
+    upload->type = mediaTypeOf(path);
+
+    sendJsonMessage({{"type", "upload_begin"},
+                     {"to", upload->receiver},
+                     {"media_type", upload->type},
+                     {"size", upload->file.size()},
+                     {"sha256", QString::fromLatin1(hash.result().toHex())}});
+    m_upload = std::move(upload);
+}
+
+void MessengerClient::sendUploadChunks() {
+    // Chunk frame: marker, upload_id, offset (big-endian), data
+    while (m_upload && m_upload->chunkSize > 0 && m_upload->inFlight < m_upload->window
+           && m_upload->sent < m_upload->file.size()) {
+        if (!m_upload->file.seek(m_upload->sent)) {
+            break;
+        }
+        const QByteArray data = m_upload->file.read(m_upload->chunkSize);
+        if (data.isEmpty()) {
+            break;
+        }
+        QByteArray frame;
+        frame.reserve(Wire::kUploadChunkHeaderBytes + data.size());
+        frame.append(Wire::kUploadChunkMarker);
+        frame.append(m_upload->uploadId);
+        char offset[8];
+        qToBigEndian<qint64>(m_upload->sent, offset);
+        frame.append(offset, sizeof(offset));
+        frame.append(data);
+        m_webSocket->sendBinaryMessage(frame);
+
+        m_upload->sent += data.size();
+        ++m_upload->inFlight;
+    }
+}
+
 void MessengerClient::sendJsonMessage(const QJsonObject& message) {
-    if (m_webSocket->state() == QAbstractSocket::ConnectedState) {
+    if (m_webSocket->state() != QAbstractSocket::ConnectedState) {
+        return;
+    }
+    
+    if (m_binaryActive) {
+        m_webSocket->sendBinaryMessage(encodeBinary(message));
+    } else {
         QJsonDocument doc(message);
         m_webSocket->sendTextMessage(doc.toJson());
     }
@@ -18,9 +18,11 @@
 #include <QAudioRecorder>
 #include <QTimer>
 #include <QSettings>
+#include <QFile>
 #include <memory>
 
 class ChatWidget;
+class MessageInflater;
 class ContactListWidget;
 
 class MessengerClient : public QMainWindow {
@@ -30,10 +32,16 @@ public:
     MessengerClient(QWidget* parent = nullptr);
     ~MessengerClient();
 
+    // Бинарный протокол (CBOR) вместо JSON; применяется при следующем подключении
+    void setBinaryProtocol(bool enabled);
+    // Просить сервер сжимать крупные кадры (история); применяется при следующем auth
+    void setCompression(bool enabled);
+
 private slots:
     void onConnected();
     void onDisconnected();
     void onTextMessageReceived(const QString& message);
+    void onBinaryMessageReceived(const QByteArray& message);
     void onSendMessage();
     void onConnectClicked();
     void onAuthClicked();
@@ -56,6 +64,8 @@ private:
     void showNotification(const QString& title, const QString& message);
     void loadChatHistory(const QString& contact);
     QString saveMediaFile(const QString& filePath, const QString& type);
+    // Следующие чанки загрузки, пока открыто окно
+    void sendUploadChunks();
 
     // UI компоненты
     QWidget* m_centralWidget;
@@ -73,12 +83,29 @@ private:
     QString m_currentContact;
     QString m_lastSentText;
     bool m_authenticated = false;
+    bool m_binaryRequested = false; // клиент хочет бинарный протокол
+    bool m_binaryActive = false;    // сервер его принял для текущего соединения
+    bool m_compressionRequested = false;
+    std::unique_ptr<MessageInflater> m_inflater; // словарь сжатия на время соединения
 
     // Медиа
     QMediaPlayer* m_mediaPlayer;
     QAudioRecorder* m_audioRecorder;
     QString m_recordingPath;
 
+    // Загрузка файла (одна за раз): читается с диска по чанку, не целиком
+    struct Upload {
+        QFile file;
+        QString receiver;
+        QString type;
+        QByteArray uploadId;  // от сервера (upload_begin)
+        qint64 sent = 0;      // отправлено байт
+        int inFlight = 0;     // чанков без ответа
+        int chunkSize = 0;
+        int window = 1;
+    };
+    std::unique_ptr<Upload> m_upload;
+
     // Системный трей
     QSystemTrayIcon* m_trayIcon;
     QMenu* m_trayMenu;
@@ -33,6 +33,10 @@ int main(int argc, char *argv[]) {
     
     // Create and show main window
     MessengerClient client;
+    // --binary: CBOR-кадры вместо JSON (для ботов с большим потоком сообщений)
+    client.setBinaryProtocol(app.arguments().contains(QStringLiteral("--binary")));
+    // --deflate: сжатие крупных кадров сервером
+    client.setCompression(app.arguments().contains(QStringLiteral("--deflate")));
     client.show();
     
     return app.exec();